@@ -29,4 +29,4 @@ THE SOFTWARE.
 #pragma once
 
 VOID
-ActiveMonitorWindowHandlerMain();
\ No newline at end of file
+ActiveMonitorWindowHandlerMain(HANDLE StopEvent);
\ No newline at end of file
@@ -21,7 +21,26 @@
  */
 #pragma once
 
+#include "SettingsCache.h"
+
+typedef struct _FLIP_GESTURE_COUNTERS
+{
+    // Flips which swapped the panel in a single screen posture
+    ULONG64 Swaps;
+    // Flips with both panels on, which only picked the favorite screen
+    ULONG64 Toggles;
+    // From reading the start of the gesture to the swapped panels
+    ULONG64 TotalLatencyMicroseconds;
+    ULONG64 MaxLatencyMicroseconds;
+} FLIP_GESTURE_COUNTERS, *PFLIP_GESTURE_COUNTERS;
+
 VOID
 OnPowerEvent(_In_ GUID SettingGuid, _In_ PVOID Value, _In_ ULONG ValueLength, _Inout_opt_ PVOID Context);
 VOID
-AutoRotateMain();
\ No newline at end of file
+OnSettingChanged(SettingId Id, DWORD Value);
+VOID
+AutoRotateMain(HANDLE StopEvent);
+HRESULT WINAPI
+WriteSensorTrace(CONST WCHAR *FileName);
+VOID WINAPI
+GetFlipGestureCounters(PFLIP_GESTURE_COUNTERS Counters);
\ No newline at end of file
@@ -0,0 +1,592 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// A small C++20 coroutine layer so that waits suspend instead of parking a thread. A Task is lazy:
+// it starts when awaited or spawned, and runs on the scheduler it was spawned on. Tasks it awaits
+// inherit that scheduler, and timers and WhenAll resume on it, so a coroutine stays on its thread
+// from one await to the next. Only standard C++ is used so that the scheduling and the cost per
+// await can be measured off-device.
+//
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <coroutine>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//
+// Where coroutines are resumed
+//
+class CoroutineScheduler
+{
+public:
+    virtual ~CoroutineScheduler() = default;
+
+    virtual void Post(std::coroutine_handle<> Handle) = 0;
+    virtual void PostAfter(std::coroutine_handle<> Handle, uint64_t DelayMicroseconds) = 0;
+};
+
+// Every promise of this layer knows the scheduler its coroutine is affine to
+struct CoroutinePromiseBase
+{
+    CoroutineScheduler *Scheduler = nullptr;
+};
+
+template <typename T = void> class Task;
+
+namespace CoroutineDetail
+{
+template <typename T> struct TaskResult
+{
+    std::optional<T> Value;
+
+    void return_value(T Result)
+    {
+        Value.emplace(std::move(Result));
+    }
+
+    T Take()
+    {
+        return std::move(*Value);
+    }
+};
+
+template <> struct TaskResult<void>
+{
+    void return_void()
+    {
+    }
+
+    void Take()
+    {
+    }
+};
+} // namespace CoroutineDetail
+
+template <typename T> struct TaskPromise : CoroutinePromiseBase, CoroutineDetail::TaskResult<T>
+{
+    std::coroutine_handle<> Continuation;
+    std::exception_ptr Exception;
+
+    Task<T> get_return_object() noexcept
+    {
+        return Task<T>{std::coroutine_handle<TaskPromise>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    auto final_suspend() noexcept
+    {
+        // Hands the thread straight to the awaiting coroutine, no trip through the scheduler
+        struct FinalAwaiter
+        {
+            bool await_ready() const noexcept
+            {
+                return false;
+            }
+
+            std::coroutine_handle<> await_suspend(std::coroutine_handle<TaskPromise> Handle) const noexcept
+            {
+                std::coroutine_handle<> continuation = Handle.promise().Continuation;
+                return continuation ? continuation : std::noop_coroutine();
+            }
+
+            void await_resume() const noexcept
+            {
+            }
+        };
+
+        return FinalAwaiter{};
+    }
+
+    void unhandled_exception() noexcept
+    {
+        Exception = std::current_exception();
+    }
+};
+
+template <typename T> class [[nodiscard]] Task
+{
+public:
+    using promise_type = TaskPromise<T>;
+
+    explicit Task(std::coroutine_handle<promise_type> Handle) noexcept : m_handle(Handle)
+    {
+    }
+
+    Task(Task &&Other) noexcept : m_handle(std::exchange(Other.m_handle, {}))
+    {
+    }
+
+    Task &operator=(Task &&Other) noexcept
+    {
+        if (this != &Other)
+        {
+            if (m_handle)
+            {
+                m_handle.destroy();
+            }
+
+            m_handle = std::exchange(Other.m_handle, {});
+        }
+
+        return *this;
+    }
+
+    Task(const Task &) = delete;
+    Task &operator=(const Task &) = delete;
+
+    ~Task()
+    {
+        if (m_handle)
+        {
+            m_handle.destroy();
+        }
+    }
+
+    struct Awaiter
+    {
+        std::coroutine_handle<promise_type> Handle;
+
+        bool await_ready() const noexcept
+        {
+            return false;
+        }
+
+        // Starts the task on the awaiting coroutine's scheduler and thread
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> Awaiting) const noexcept
+        {
+            Handle.promise().Scheduler = Awaiting.promise().Scheduler;
+            Handle.promise().Continuation = Awaiting;
+            return Handle;
+        }
+
+        T await_resume() const
+        {
+            if (Handle.promise().Exception)
+            {
+                std::rethrow_exception(Handle.promise().Exception);
+            }
+
+            return Handle.promise().Take();
+        }
+    };
+
+    Awaiter operator co_await() const noexcept
+    {
+        return Awaiter{m_handle};
+    }
+
+private:
+    std::coroutine_handle<promise_type> m_handle;
+};
+
+namespace CoroutineDetail
+{
+//
+// A coroutine nothing awaits, its frame frees itself when it finishes
+//
+struct DetachedPromise;
+
+struct Detached
+{
+    using promise_type = DetachedPromise;
+
+    std::coroutine_handle<DetachedPromise> Handle;
+};
+
+struct DetachedPromise : CoroutinePromiseBase
+{
+    Detached get_return_object() noexcept
+    {
+        return Detached{std::coroutine_handle<DetachedPromise>::from_promise(*this)};
+    }
+
+    std::suspend_always initial_suspend() noexcept
+    {
+        return {};
+    }
+
+    std::suspend_never final_suspend() noexcept
+    {
+        return {};
+    }
+
+    void return_void() noexcept
+    {
+    }
+
+    // Nobody is left to rethrow to
+    void unhandled_exception() noexcept
+    {
+    }
+};
+
+inline Detached
+RunDetached(Task<void> Spawned)
+{
+    co_await Spawned;
+}
+
+struct WhenAllState
+{
+    std::atomic<size_t> Remaining;
+    std::coroutine_handle<> Parent;
+    CoroutineScheduler *Scheduler;
+    std::mutex Lock;
+    std::exception_ptr Exception;
+};
+
+template <typename T> using WhenAllSlot = std::optional<std::conditional_t<std::is_void_v<T>, bool, T>>;
+
+template <typename T>
+Detached
+RunWhenAllChild(WhenAllState &State, Task<T> Child, WhenAllSlot<T> &Result)
+{
+    try
+    {
+        if constexpr (std::is_void_v<T>)
+        {
+            co_await Child;
+            Result.emplace(true);
+        }
+        else
+        {
+            Result.emplace(co_await Child);
+        }
+    }
+    catch (...)
+    {
+        std::lock_guard lock{State.Lock};
+
+        if (!State.Exception)
+        {
+            State.Exception = std::current_exception();
+        }
+    }
+
+    // The parent may free the state as soon as it is posted
+    CoroutineScheduler *scheduler = State.Scheduler;
+    std::coroutine_handle<> parent = State.Parent;
+
+    if (State.Remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+    {
+        scheduler->Post(parent);
+    }
+}
+
+template <typename T> struct WhenAllAwaiter
+{
+    WhenAllState &State;
+    std::vector<Task<T>> &Tasks;
+    std::vector<WhenAllSlot<T>> &Results;
+
+    bool await_ready() const noexcept
+    {
+        return Tasks.empty();
+    }
+
+    template <typename P> bool await_suspend(std::coroutine_handle<P> Parent)
+    {
+        State.Parent = Parent;
+        State.Scheduler = Parent.promise().Scheduler;
+
+        // One extra count keeps the children from resuming the parent before they are all posted
+        State.Remaining.store(Tasks.size() + 1, std::memory_order_relaxed);
+
+        for (size_t i = 0; i < Tasks.size(); i++)
+        {
+            Detached child = RunWhenAllChild<T>(State, std::move(Tasks[i]), Results[i]);
+            child.Handle.promise().Scheduler = State.Scheduler;
+            State.Scheduler->Post(child.Handle);
+        }
+
+        return State.Remaining.fetch_sub(1, std::memory_order_acq_rel) != 1;
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+};
+} // namespace CoroutineDetail
+
+//
+// Starts a task on the scheduler without waiting for it, exceptions it throws are dropped
+//
+inline void
+Spawn(CoroutineScheduler &Scheduler, Task<void> Spawned)
+{
+    CoroutineDetail::Detached detached = CoroutineDetail::RunDetached(std::move(Spawned));
+    detached.Handle.promise().Scheduler = &Scheduler;
+    Scheduler.Post(detached.Handle);
+}
+
+//
+// Runs the tasks concurrently on the awaiting coroutine's scheduler, the first exception is rethrown
+// once all of them finished
+//
+template <typename T>
+Task<std::vector<T>>
+WhenAll(std::vector<Task<T>> Tasks)
+{
+    CoroutineDetail::WhenAllState state{};
+    std::vector<CoroutineDetail::WhenAllSlot<T>> results(Tasks.size());
+    std::vector<T> values;
+
+    co_await CoroutineDetail::WhenAllAwaiter<T>{state, Tasks, results};
+
+    if (state.Exception)
+    {
+        std::rethrow_exception(state.Exception);
+    }
+
+    values.reserve(results.size());
+    for (CoroutineDetail::WhenAllSlot<T> &result : results)
+    {
+        values.push_back(std::move(*result));
+    }
+
+    co_return values;
+}
+
+inline Task<void>
+WhenAll(std::vector<Task<void>> Tasks)
+{
+    CoroutineDetail::WhenAllState state{};
+    std::vector<CoroutineDetail::WhenAllSlot<void>> results(Tasks.size());
+
+    co_await CoroutineDetail::WhenAllAwaiter<void>{state, Tasks, results};
+
+    if (state.Exception)
+    {
+        std::rethrow_exception(state.Exception);
+    }
+}
+
+//
+// Suspends the coroutine for a while, it resumes on its scheduler
+//
+struct ResumeAfter
+{
+    explicit ResumeAfter(std::chrono::microseconds Delay) : DelayMicroseconds((uint64_t)Delay.count())
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    template <typename P> void await_suspend(std::coroutine_handle<P> Handle) const
+    {
+        Handle.promise().Scheduler->PostAfter(Handle, DelayMicroseconds);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+
+    uint64_t DelayMicroseconds;
+};
+
+//
+// Moves the coroutine to another scheduler, it stays there for the following awaits
+//
+struct ResumeOn
+{
+    explicit ResumeOn(CoroutineScheduler &Target) : Target(&Target)
+    {
+    }
+
+    bool await_ready() const noexcept
+    {
+        return false;
+    }
+
+    template <typename P> void await_suspend(std::coroutine_handle<P> Handle) const
+    {
+        Handle.promise().Scheduler = Target;
+        Target->Post(Handle);
+    }
+
+    void await_resume() const noexcept
+    {
+    }
+
+    CoroutineScheduler *Target;
+};
+
+struct CoroutineLoopStats
+{
+    uint64_t Resumptions;
+    uint64_t TimersFired;
+};
+
+//
+// Resumes coroutines on whichever thread runs it. Coroutines still suspended when the loop is
+// destroyed are never resumed.
+//
+class CoroutineLoop final : public CoroutineScheduler
+{
+public:
+    // Microseconds on a monotonic clock
+    static uint64_t Now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    void Post(std::coroutine_handle<> Handle) override
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_ready.push_back(Handle);
+        }
+
+        m_wake.notify_one();
+    }
+
+    void PostAfter(std::coroutine_handle<> Handle, uint64_t DelayMicroseconds) override
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_timers.push(Timer{Now() + DelayMicroseconds, m_timerSequence++, Handle});
+        }
+
+        m_wake.notify_one();
+    }
+
+    // Resumes coroutines on the calling thread until Stop, or StopWhenIdle and the last of them finished
+    void Run()
+    {
+        RunWhile([this] { return !m_stop && (!m_stopWhenIdle || !m_ready.empty() || !m_timers.empty()); });
+    }
+
+    // Resumes coroutines on the calling thread until none is ready and no timer is pending
+    void RunUntilIdle()
+    {
+        RunWhile([this] { return !m_stop && (!m_ready.empty() || !m_timers.empty()); });
+    }
+
+    void Stop()
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_stop = true;
+        }
+
+        m_wake.notify_all();
+    }
+
+    // Lets Run finish the coroutines already started, it returns once none is ready and no timer is pending
+    void StopWhenIdle()
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_stopWhenIdle = true;
+        }
+
+        m_wake.notify_all();
+    }
+
+    CoroutineLoopStats GetStats()
+    {
+        std::lock_guard lock{m_lock};
+        return m_stats;
+    }
+
+private:
+    struct Timer
+    {
+        uint64_t Deadline;
+        // Keeps timers with the same deadline in the order they were set
+        uint64_t Sequence;
+        std::coroutine_handle<> Handle;
+
+        bool operator>(const Timer &Other) const
+        {
+            return Deadline != Other.Deadline ? Deadline > Other.Deadline : Sequence > Other.Sequence;
+        }
+    };
+
+    template <typename F> void RunWhile(F Running)
+    {
+        std::unique_lock lock{m_lock};
+
+        while (Running())
+        {
+            uint64_t now = Now();
+
+            while (!m_timers.empty() && m_timers.top().Deadline <= now)
+            {
+                m_ready.push_back(m_timers.top().Handle);
+                m_timers.pop();
+                m_stats.TimersFired++;
+            }
+
+            if (!m_ready.empty())
+            {
+                std::coroutine_handle<> handle = m_ready.front();
+                m_ready.pop_front();
+                m_stats.Resumptions++;
+
+                lock.unlock();
+                handle.resume();
+                lock.lock();
+                continue;
+            }
+
+            if (m_timers.empty())
+            {
+                m_wake.wait(lock, [this, &Running] { return !m_ready.empty() || !m_timers.empty() || !Running(); });
+            }
+            else
+            {
+                m_wake.wait_for(lock, std::chrono::microseconds(m_timers.top().Deadline - now));
+            }
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::deque<std::coroutine_handle<>> m_ready;
+    std::priority_queue<Timer, std::vector<Timer>, std::greater<Timer>> m_timers;
+    uint64_t m_timerSequence = 0;
+    bool m_stop = false;
+    bool m_stopWhenIdle = false;
+    CoroutineLoopStats m_stats{};
+};
\ No newline at end of file
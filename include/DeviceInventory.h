@@ -0,0 +1,107 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <functional>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+//
+// A device node as handed over by a device source. Sources only report devnodes
+// which carry a panel id, nothing else is of interest to the display code.
+//
+struct DeviceNodeRecord
+{
+    std::wstring InstanceId;
+    std::wstring DriverKey;
+    std::wstring PanelId;
+    std::vector<std::wstring> HardwareIds;
+};
+
+//
+// Provides the set of device nodes the inventory is built from
+//
+class DeviceSource
+{
+public:
+    virtual ~DeviceSource() = default;
+
+    virtual HRESULT EnumeratePanelDevices(const std::function<void(DeviceNodeRecord &&)> &callback) = 0;
+};
+
+//
+// Walks every devnode on the system once through SetupDi
+//
+class SetupDiDeviceSource final : public DeviceSource
+{
+public:
+    HRESULT EnumeratePanelDevices(const std::function<void(DeviceNodeRecord &&)> &callback) override;
+};
+
+//
+// Columnar table of all the devnodes bound to a panel, indexed by monitor device id
+// ("<hardware id>\<driver key>") and by hardware id.
+//
+class DeviceInventory
+{
+public:
+    static DeviceInventory &instance();
+
+    explicit DeviceInventory(DeviceSource &source);
+
+    HRESULT Refresh();
+    HRESULT EnsurePopulated();
+
+    size_t GetDeviceCount() const;
+
+    // Rows are only valid until the next refresh
+    std::optional<size_t> FindByMonitorDeviceId(CONST WCHAR *DeviceId) const;
+    std::optional<size_t> FindByInstanceId(CONST WCHAR *InstanceId) const;
+    std::vector<size_t> FindByHardwareId(CONST WCHAR *HardwareId) const;
+
+    std::wstring GetInstanceId(size_t row) const;
+    std::wstring GetPanelId(size_t row) const;
+
+    BOOLEAN IsDeviceBoundToPanelId(CONST WCHAR *DeviceId, CONST WCHAR *DevicePanelId) const;
+
+private:
+    static std::wstring NormalizeKey(const std::wstring &key);
+
+    DeviceSource &m_source;
+    mutable std::shared_mutex m_lock;
+    BOOLEAN m_populated{FALSE};
+
+    // Columns
+    std::vector<std::wstring> m_instanceIds;
+    std::vector<std::wstring> m_driverKeys;
+    std::vector<std::wstring> m_panelIds;
+    std::vector<std::wstring> m_hardwareIds;
+    std::vector<size_t> m_hardwareIdOffsets;
+
+    // Indexes
+    std::unordered_map<std::wstring, size_t> m_monitorDeviceIdIndex;
+    std::unordered_map<std::wstring, size_t> m_instanceIdIndex;
+    std::unordered_multimap<std::wstring, size_t> m_hardwareIdIndex;
+};
\ No newline at end of file
@@ -59,12 +59,30 @@ DEFINE_DEVPROPKEY2(
     9); // DEVPROP_TYPE_BINARY
 #endif
 
+//
+// Physical location of device buffer (_PLD), revision 2
+//
 typedef struct _ACPI_PLD_V2_BUFFER
 {
     UINT32 Revision : 7;
     UINT32 IgnoreColor : 1;
     UINT32 Color : 24;
+    USHORT Width;
+    USHORT Height;
+    UINT32 UserVisible : 1;
+    UINT32 Dock : 1;
+    UINT32 Lid : 1;
     UINT32 Panel : 3;
+    UINT32 VerticalPosition : 2;
+    UINT32 HorizontalPosition : 2;
+    UINT32 Shape : 4;
+    UINT32 GroupOrientation : 1;
+    UINT32 GroupToken : 8;
+    UINT32 GroupPosition : 8;
+    UINT32 Bay : 1;
+    UINT32 Ejectable : 1;
+    UINT32 EjectionRequired : 1;
+    UINT32 CabinetNumber : 8;
     UINT32 CardCageNumber : 8;
     UINT32 Reference : 1;
     UINT32 Rotation : 4;
@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <string>
+#include <vector>
+
+struct DeviceStateOperation
+{
+    std::wstring PanelId;
+    std::wstring HardwareId;
+    BOOLEAN Enable;
+};
+
+struct DeviceStateResult
+{
+    std::wstring InstanceId;
+    BOOLEAN Enable;
+    HRESULT Status;
+    ULONGLONG DurationMicroseconds;
+};
+
+//
+// Collects device enablement changes for devices bound to a panel and applies them together.
+// Targets are resolved through the device inventory hardware id index, so committing does not
+// enumerate the device tree.
+//
+class DeviceStateTransaction
+{
+public:
+    VOID Add(CONST WCHAR *PanelId, CONST WCHAR *HardwareId, BOOLEAN Enable);
+    BOOLEAN IsEmpty() const;
+
+    HRESULT Commit();
+
+    const std::vector<DeviceStateResult> &GetResults() const;
+
+private:
+    BOOLEAN ResolveTargets(std::vector<std::pair<std::wstring, BOOLEAN>> &Targets) const;
+
+    std::vector<DeviceStateOperation> m_operations;
+    std::vector<DeviceStateResult> m_results;
+};
\ No newline at end of file
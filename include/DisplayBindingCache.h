@@ -0,0 +1,73 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <mutex>
+#include <string>
+#include <vector>
+
+//
+// A panel id to display device binding as resolved by a full device scan
+//
+struct DisplayBinding
+{
+    std::wstring PanelId;
+    DWORD AdapterIndex;
+    std::wstring AdapterDeviceName;
+    std::wstring MonitorDeviceId;
+    BOOLEAN HasBestDisplayMode;
+    DEVMODE BestDisplayMode;
+};
+
+//
+// Persists resolved display bindings across service restarts so that the first topology
+// apply after logon does not need to scan the device tree. Entries are only hints: callers
+// must check them against the live display devices before use.
+//
+class DisplayBindingCache
+{
+public:
+    static DisplayBindingCache &instance();
+
+    HRESULT Load();
+    HRESULT Save();
+
+    BOOLEAN Lookup(CONST WCHAR *PanelId, DisplayBinding &Binding);
+    VOID Update(CONST WCHAR *PanelId, DWORD AdapterIndex, CONST DISPLAY_DEVICE &Adapter, CONST DISPLAY_DEVICE &Monitor);
+    VOID Remove(CONST WCHAR *PanelId);
+
+    BOOLEAN GetBestDisplayMode(CONST WCHAR *AdapterDeviceName, PDEVMODE DevMode);
+    VOID SetBestDisplayMode(CONST WCHAR *AdapterDeviceName, CONST DEVMODE &DevMode);
+
+private:
+    DisplayBindingCache() = default;
+
+    HRESULT LoadLocked();
+
+    std::vector<DisplayBinding>::iterator FindByPanelId(CONST WCHAR *PanelId);
+    std::vector<DisplayBinding>::iterator FindByAdapterDeviceName(CONST WCHAR *AdapterDeviceName);
+
+    std::mutex m_lock;
+    std::vector<DisplayBinding> m_bindings;
+    BOOLEAN m_loaded{FALSE};
+    BOOLEAN m_dirty{FALSE};
+};
\ No newline at end of file
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+
+//
+// Owns a hidden window on a dedicated thread and counts the display and device
+// change broadcasts it receives, so that cached display state can be invalidated.
+//
+class DisplayChangeNotifier
+{
+public:
+    static DisplayChangeNotifier &instance();
+
+    // Bumped on every WM_DISPLAYCHANGE
+    ULONG GetDisplayGeneration() const;
+
+    // Bumped on every DBT_DEVNODES_CHANGED
+    ULONG GetDeviceGeneration() const;
+
+    // Waits until the display generation moves past Generation, FALSE on timeout
+    BOOLEAN WaitForDisplayChange(ULONG Generation, DWORD TimeoutMs);
+
+private:
+    DisplayChangeNotifier();
+    ~DisplayChangeNotifier();
+
+    static LRESULT CALLBACK WindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam);
+    VOID MessageLoop();
+
+    std::atomic<ULONG> m_displayGeneration{0};
+    std::atomic<ULONG> m_deviceGeneration{0};
+    std::atomic<DWORD> m_threadId{0};
+    std::mutex m_waitLock;
+    std::condition_variable m_displayChanged;
+    std::thread m_thread;
+};
\ No newline at end of file
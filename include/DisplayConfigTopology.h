@@ -0,0 +1,63 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "DisplayLayoutPlanner.h"
+#include <array>
+#include <vector>
+
+//
+// Path and mode arrays as exchanged with QueryDisplayConfig and SetDisplayConfig
+//
+struct DisplayConfigTopology
+{
+    std::vector<DISPLAYCONFIG_PATH_INFO> Paths;
+    std::vector<DISPLAYCONFIG_MODE_INFO> Modes;
+};
+
+//
+// The display configuration source a panel is scanned out from
+//
+struct DisplayConfigPanelSource
+{
+    LUID AdapterId;
+    UINT32 SourceId;
+};
+
+HRESULT WINAPI
+QueryDisplayConfigTopology(DisplayConfigTopology &Topology);
+
+HRESULT WINAPI
+GetDisplayConfigPanelSource(
+    CONST DisplayConfigTopology &Topology,
+    CONST WCHAR *GdiDeviceName,
+    DisplayConfigPanelSource &Source);
+
+HRESULT WINAPI
+BuildDisplayConfigTopology(
+    CONST DisplayConfigTopology &Current,
+    CONST std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> &Panels,
+    CONST TopologyPlan &Plan,
+    DisplayConfigTopology &Target);
+
+HRESULT WINAPI
+ApplyDisplayConfigTopology(DisplayConfigTopology &Target);
\ No newline at end of file
@@ -0,0 +1,464 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Platform neutral planning of the two panel display layout. Given the current size and orientation
+// of each panel and the requested orientations and power states, PlanDisplayLayout computes where
+// every panel goes, which one is primary, and the ordered steps needed to apply it. The Win32 side
+// only executes the resulting plan.
+//
+
+#include <array>
+#include <cstdint>
+
+// Same values as DMDO_DEFAULT, DMDO_90, DMDO_180 and DMDO_270
+constexpr inline int32_t LAYOUT_ORIENTATION_DEFAULT = 0;
+constexpr inline int32_t LAYOUT_ORIENTATION_90 = 1;
+constexpr inline int32_t LAYOUT_ORIENTATION_180 = 2;
+constexpr inline int32_t LAYOUT_ORIENTATION_270 = 3;
+constexpr inline int32_t LAYOUT_ORIENTATION_COUNT = 4;
+
+constexpr inline uint32_t LAYOUT_PANEL_COUNT = 2;
+constexpr inline uint32_t LAYOUT_NO_PANEL = 0xFF;
+
+enum class LayoutPanelStates : uint8_t
+{
+    Both = 0,
+    FirstOnly = 1,
+    SecondOnly = 2,
+    Count = 3
+};
+
+//
+// Where the first panel sits next to the second one, clockwise so that rotating the desktop by one
+// orientation step moves to the next side
+//
+enum class LayoutPanelSide : uint8_t
+{
+    Left = 0,
+    Top = 1,
+    Right = 2,
+    Bottom = 3,
+    Count = 4
+};
+
+// ACPI _PLD panel surface values
+constexpr inline uint8_t LAYOUT_PLD_PANEL_TOP = 0;
+constexpr inline uint8_t LAYOUT_PLD_PANEL_BOTTOM = 1;
+constexpr inline uint8_t LAYOUT_PLD_PANEL_LEFT = 2;
+constexpr inline uint8_t LAYOUT_PLD_PANEL_RIGHT = 3;
+
+//
+// The physical location of a panel, as reported by its ACPI _PLD
+//
+struct LayoutPanelLocation
+{
+    uint8_t Panel;
+    uint16_t HorizontalOffset;
+    uint16_t VerticalOffset;
+};
+
+enum class LayoutAxis : uint8_t
+{
+    None,
+    X,
+    Y
+};
+
+//
+// How the panels are placed relative to each other: the offset panel is moved along the axis,
+// in the negative direction, by the extent of the other panel
+//
+struct LayoutRule
+{
+    uint8_t PrimaryPanel;
+    uint8_t OffsetPanel;
+    LayoutAxis Axis;
+};
+
+struct LayoutPanelInput
+{
+    int32_t Width;
+    int32_t Height;
+    int32_t CurrentOrientation;
+    bool Attached;
+};
+
+struct LayoutPanelPlan
+{
+    int32_t Width;
+    int32_t Height;
+    int32_t X;
+    int32_t Y;
+    int32_t Orientation;
+    bool Active;
+    bool Primary;
+};
+
+enum class LayoutStepKind : uint8_t
+{
+    // Apply the panel mode and make it the primary display
+    SetPrimaryMode,
+    // Apply the panel mode
+    SetMode,
+    // Detach the panel from the desktop
+    Detach,
+    // Only let the system rotation service know about the new orientation
+    NotifyRotation,
+    // Commit all the pending mode changes
+    Commit
+};
+
+struct LayoutStep
+{
+    LayoutStepKind Kind;
+    uint8_t Panel;
+};
+
+constexpr inline uint32_t LAYOUT_MAX_STEPS = 3;
+
+struct TopologyPlan
+{
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> Panels;
+    std::array<LayoutStep, LAYOUT_MAX_STEPS> Steps;
+    uint32_t StepCount;
+    int32_t NotifyOrientation;
+};
+
+constexpr inline uint32_t LAYOUT_RULE_COUNT =
+    LAYOUT_ORIENTATION_COUNT * LAYOUT_ORIENTATION_COUNT * (uint32_t)LayoutPanelStates::Count;
+
+using LayoutRuleTable = std::array<LayoutRule, LAYOUT_RULE_COUNT>;
+using LayoutRuleTables = std::array<LayoutRuleTable, (uint32_t)LayoutPanelSide::Count>;
+
+//
+// Subject: Tells on which side of the second panel the first one is, from their _PLD
+//
+// Parameters:
+//
+//             First, Second: The physical location of each panel
+//
+// Returns: The side, left when the locations do not tell as the panels were always laid out that way
+//
+constexpr LayoutPanelSide
+ComputeFirstPanelSide(const LayoutPanelLocation &First, const LayoutPanelLocation &Second)
+{
+    if (First.Panel == LAYOUT_PLD_PANEL_LEFT || Second.Panel == LAYOUT_PLD_PANEL_RIGHT)
+        return LayoutPanelSide::Left;
+    if (First.Panel == LAYOUT_PLD_PANEL_RIGHT || Second.Panel == LAYOUT_PLD_PANEL_LEFT)
+        return LayoutPanelSide::Right;
+    if (First.Panel == LAYOUT_PLD_PANEL_TOP || Second.Panel == LAYOUT_PLD_PANEL_BOTTOM)
+        return LayoutPanelSide::Top;
+    if (First.Panel == LAYOUT_PLD_PANEL_BOTTOM || Second.Panel == LAYOUT_PLD_PANEL_TOP)
+        return LayoutPanelSide::Bottom;
+
+    // Both on the same surface, the offsets from its origin tell them apart
+    if (First.HorizontalOffset != Second.HorizontalOffset)
+        return First.HorizontalOffset < Second.HorizontalOffset ? LayoutPanelSide::Left : LayoutPanelSide::Right;
+    if (First.VerticalOffset != Second.VerticalOffset)
+        return First.VerticalOffset < Second.VerticalOffset ? LayoutPanelSide::Top : LayoutPanelSide::Bottom;
+
+    return LayoutPanelSide::Left;
+}
+
+constexpr uint32_t
+LayoutRuleIndex(int32_t Orientation1, int32_t Orientation2, LayoutPanelStates States)
+{
+    return ((uint32_t)Orientation1 * LAYOUT_ORIENTATION_COUNT + (uint32_t)Orientation2) *
+               (uint32_t)LayoutPanelStates::Count +
+           (uint32_t)States;
+}
+
+constexpr LayoutRule
+ComputeLayoutRule(LayoutPanelSide FirstPanelSide, int32_t Orientation1, int32_t Orientation2, LayoutPanelStates States)
+{
+    (void)Orientation2;
+
+    switch (States)
+    {
+    case LayoutPanelStates::FirstOnly:
+        return LayoutRule{0, LAYOUT_NO_PANEL, LayoutAxis::None};
+    case LayoutPanelStates::SecondOnly:
+        return LayoutRule{1, LAYOUT_NO_PANEL, LayoutAxis::None};
+    default:
+        break;
+    }
+
+    // With both panels on, the first panel orientation rotates the physical side into the desktop side.
+    // The panel on the left or top side is placed at negative coordinates, the other one is primary.
+    switch ((LayoutPanelSide)(((uint32_t)FirstPanelSide + (uint32_t)Orientation1) % (uint32_t)LayoutPanelSide::Count))
+    {
+    case LayoutPanelSide::Left:
+        return LayoutRule{1, 0, LayoutAxis::X};
+    case LayoutPanelSide::Right:
+        return LayoutRule{0, 1, LayoutAxis::X};
+    case LayoutPanelSide::Top:
+        return LayoutRule{1, 0, LayoutAxis::Y};
+    case LayoutPanelSide::Bottom:
+    default:
+        return LayoutRule{0, 1, LayoutAxis::Y};
+    }
+}
+
+constexpr LayoutRuleTables
+BuildLayoutRules()
+{
+    LayoutRuleTables rules{};
+
+    for (uint32_t side = 0; side < (uint32_t)LayoutPanelSide::Count; side++)
+    {
+        for (int32_t orientation1 = 0; orientation1 < LAYOUT_ORIENTATION_COUNT; orientation1++)
+        {
+            for (int32_t orientation2 = 0; orientation2 < LAYOUT_ORIENTATION_COUNT; orientation2++)
+            {
+                for (uint32_t states = 0; states < (uint32_t)LayoutPanelStates::Count; states++)
+                {
+                    rules[side][LayoutRuleIndex(orientation1, orientation2, (LayoutPanelStates)states)] =
+                        ComputeLayoutRule(
+                            (LayoutPanelSide)side, orientation1, orientation2, (LayoutPanelStates)states);
+                }
+            }
+        }
+    }
+
+    return rules;
+}
+
+// One table per physical arrangement of the panels
+constexpr inline LayoutRuleTables LayoutRules = BuildLayoutRules();
+
+//
+// Subject: Plans the display layout for both panels
+//
+// Parameters:
+//
+//             Panels: The current mode size, orientation and attachment of each panel
+//
+//             Orientation1, Orientation2: The requested orientation of each panel
+//
+//             States: Which panels should be on
+//
+//             FirstPanelSide: Where the first panel physically sits next to the second one
+//
+// Returns: The plan to execute
+//
+constexpr TopologyPlan
+PlanDisplayLayout(
+    const std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> &Panels,
+    int32_t Orientation1,
+    int32_t Orientation2,
+    LayoutPanelStates States,
+    LayoutPanelSide FirstPanelSide = LayoutPanelSide::Left)
+{
+    TopologyPlan plan{};
+    const int32_t orientations[LAYOUT_PANEL_COUNT] = {Orientation1, Orientation2};
+    const LayoutRule rule =
+        LayoutRules[(uint32_t)FirstPanelSide][LayoutRuleIndex(Orientation1 & 3, Orientation2 & 3, States)];
+
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
+    {
+        LayoutPanelPlan &panel = plan.Panels[i];
+
+        panel.Width = Panels[i].Width;
+        panel.Height = Panels[i].Height;
+
+        // In order to switch from portrait to landscape and vice versa the resolution width and height are swapped
+        if ((Panels[i].CurrentOrientation + orientations[i]) % 2 == 1)
+        {
+            panel.Width = Panels[i].Height;
+            panel.Height = Panels[i].Width;
+        }
+
+        panel.Orientation = orientations[i];
+        panel.Active = States == LayoutPanelStates::Both || i == rule.PrimaryPanel;
+        panel.Primary = i == rule.PrimaryPanel;
+    }
+
+    if (rule.OffsetPanel != LAYOUT_NO_PANEL)
+    {
+        LayoutPanelPlan &offset = plan.Panels[rule.OffsetPanel];
+        const LayoutPanelPlan &other = plan.Panels[1 - rule.OffsetPanel];
+
+        if (rule.Axis == LayoutAxis::X)
+        {
+            offset.X = -1 * other.Width;
+        }
+        else
+        {
+            offset.Y = -1 * other.Height;
+        }
+    }
+
+    const uint8_t primary = rule.PrimaryPanel;
+    const uint8_t secondary = (uint8_t)(1 - primary);
+
+    if (States == LayoutPanelStates::Both)
+    {
+        plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::SetPrimaryMode, primary};
+        plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::SetMode, secondary};
+    }
+    else if (Panels[primary].Attached && !Panels[secondary].Attached)
+    {
+        // Same single panel stays on, the rotation service takes care of it
+        plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::NotifyRotation, primary};
+        plan.NotifyOrientation = Orientation2;
+    }
+    else
+    {
+        plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::SetPrimaryMode, primary};
+
+        if (Panels[secondary].Attached)
+        {
+            plan.Panels[secondary].Width = 0;
+            plan.Panels[secondary].Height = 0;
+            plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::Detach, secondary};
+        }
+    }
+
+    plan.Steps[plan.StepCount++] = LayoutStep{LayoutStepKind::Commit, LAYOUT_NO_PANEL};
+
+    return plan;
+}
+
+constexpr bool
+IsModeStep(LayoutStepKind Kind)
+{
+    return Kind == LayoutStepKind::SetPrimaryMode || Kind == LayoutStepKind::SetMode || Kind == LayoutStepKind::Detach;
+}
+
+constexpr uint32_t
+CountModeSteps(const TopologyPlan &Plan)
+{
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < Plan.StepCount; i++)
+    {
+        count += IsModeStep(Plan.Steps[i].Kind) ? 1 : 0;
+    }
+
+    return count;
+}
+
+constexpr bool
+IsSamePanelMode(const LayoutPanelPlan &Target, const LayoutPanelPlan &Current)
+{
+    return Current.Active && Target.Width == Current.Width && Target.Height == Current.Height &&
+           Target.X == Current.X && Target.Y == Current.Y && Target.Orientation == Current.Orientation;
+}
+
+//
+// Subject: Drops the steps of a plan which the live configuration already satisfies
+//
+// Parameters:
+//
+//             Target: The plan computed by PlanDisplayLayout
+//
+//             Current: The live layout of each panel
+//
+// Returns: The plan with only the steps that change something, no steps at all if nothing changes
+//
+constexpr TopologyPlan
+DiffTopologyPlan(const TopologyPlan &Target, const std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> &Current)
+{
+    TopologyPlan plan = Target;
+    plan.StepCount = 0;
+
+    for (uint32_t i = 0; i < Target.StepCount; i++)
+    {
+        const LayoutStep &step = Target.Steps[i];
+        bool satisfied = false;
+
+        switch (step.Kind)
+        {
+        case LayoutStepKind::SetPrimaryMode:
+            satisfied = IsSamePanelMode(Target.Panels[step.Panel], Current[step.Panel]) && Current[step.Panel].Primary;
+            break;
+        case LayoutStepKind::SetMode:
+            satisfied = IsSamePanelMode(Target.Panels[step.Panel], Current[step.Panel]) && !Current[step.Panel].Primary;
+            break;
+        case LayoutStepKind::Detach:
+            satisfied = !Current[step.Panel].Active;
+            break;
+        case LayoutStepKind::NotifyRotation:
+            satisfied = Current[step.Panel].Orientation == Target.NotifyOrientation;
+            break;
+        case LayoutStepKind::Commit:
+            satisfied = CountModeSteps(plan) == 0;
+            break;
+        }
+
+        if (!satisfied)
+        {
+            plan.Steps[plan.StepCount++] = step;
+        }
+    }
+
+    return plan;
+}
+
+//
+// The steps left once the mode sets and their commit were carried out some other way
+//
+constexpr TopologyPlan
+WithoutModeSteps(const TopologyPlan &Plan)
+{
+    TopologyPlan plan = Plan;
+    plan.StepCount = 0;
+
+    for (uint32_t i = 0; i < Plan.StepCount; i++)
+    {
+        if (!IsModeStep(Plan.Steps[i].Kind) && Plan.Steps[i].Kind != LayoutStepKind::Commit)
+        {
+            plan.Steps[plan.StepCount++] = Plan.Steps[i];
+        }
+    }
+
+    return plan;
+}
+
+static_assert(
+    LayoutRules[0][LayoutRuleIndex(LAYOUT_ORIENTATION_DEFAULT, 0, LayoutPanelStates::Both)].PrimaryPanel == 1);
+static_assert(LayoutRules[0][LayoutRuleIndex(LAYOUT_ORIENTATION_270, 0, LayoutPanelStates::Both)].PrimaryPanel == 0);
+static_assert(
+    LayoutRules[0][LayoutRuleIndex(LAYOUT_ORIENTATION_90, 2, LayoutPanelStates::SecondOnly)].PrimaryPanel == 1);
+static_assert(
+    LayoutRules[2][LayoutRuleIndex(LAYOUT_ORIENTATION_DEFAULT, 0, LayoutPanelStates::Both)].PrimaryPanel == 0);
+static_assert(
+    ComputeFirstPanelSide({LAYOUT_PLD_PANEL_RIGHT, 0, 0}, {LAYOUT_PLD_PANEL_LEFT, 0, 0}) == LayoutPanelSide::Right);
+static_assert(ComputeFirstPanelSide({4, 0, 0}, {4, 100, 0}) == LayoutPanelSide::Left);
+static_assert(
+    PlanDisplayLayout({{{1350, 1800, 0, true}, {1350, 1800, 0, true}}}, 0, 0, LayoutPanelStates::Both).Panels[0].X ==
+    -1350);
+static_assert(
+    PlanDisplayLayout({{{1350, 1800, 0, true}, {1350, 1800, 0, true}}}, 1, 1, LayoutPanelStates::Both).Panels[0].Y ==
+    -1350);
+static_assert(
+    DiffTopologyPlan(
+        PlanDisplayLayout({{{1350, 1800, 0, true}, {1350, 1800, 0, true}}}, 0, 0, LayoutPanelStates::Both),
+        {{{1350, 1800, -1350, 0, 0, true, false}, {1350, 1800, 0, 0, 0, true, true}}})
+        .StepCount == 0);
+static_assert(
+    DiffTopologyPlan(
+        PlanDisplayLayout({{{1350, 1800, 0, true}, {1350, 1800, 0, true}}}, 0, 0, LayoutPanelStates::Both),
+        {{{1350, 1800, 0, 0, 0, true, true}, {1350, 1800, 1350, 0, 0, true, false}}})
+        .StepCount == 3);
\ No newline at end of file
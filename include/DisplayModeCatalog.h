@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <vector>
+
+//
+// Sort key of a display mode. Modes compare by height first, matching the historical
+// "tallest mode wins" selection.
+//
+struct DisplayModeKey
+{
+    DWORD Height;
+    DWORD Width;
+    DWORD Frequency;
+    DWORD BitsPerPel;
+
+    bool operator<(const DisplayModeKey &other) const
+    {
+        if (Height != other.Height)
+            return Height < other.Height;
+        if (Width != other.Width)
+            return Width < other.Width;
+        if (Frequency != other.Frequency)
+            return Frequency < other.Frequency;
+        return BitsPerPel < other.BitsPerPel;
+    }
+
+    bool operator==(const DisplayModeKey &other) const
+    {
+        return Height == other.Height && Width == other.Width && Frequency == other.Frequency &&
+               BitsPerPel == other.BitsPerPel;
+    }
+};
+
+//
+// Provides the raw list of modes supported by a display device
+//
+class DisplayModeSource
+{
+public:
+    virtual ~DisplayModeSource() = default;
+
+    virtual BOOL EnumDisplayMode(CONST WCHAR *DeviceName, DWORD ModeIndex, PDEVMODE DevMode) = 0;
+};
+
+class EnumDisplaySettingsModeSource final : public DisplayModeSource
+{
+public:
+    BOOL EnumDisplayMode(CONST WCHAR *DeviceName, DWORD ModeIndex, PDEVMODE DevMode) override;
+};
+
+//
+// The modes of one display device, sorted by DisplayModeKey
+//
+class DisplayModeCatalog
+{
+public:
+    HRESULT Build(CONST WCHAR *DeviceName, DisplayModeSource &Source);
+
+    BOOLEAN IsEmpty() const;
+    size_t GetModeCount() const;
+    const DisplayModeKey &GetKey(size_t Index) const;
+    const DEVMODE &GetMode(size_t Index) const;
+
+    std::optional<size_t> Find(const DisplayModeKey &Key) const;
+    std::optional<size_t> FindBestForResolution(DWORD Width, DWORD Height) const;
+
+    static DisplayModeKey KeyFromDevMode(const DEVMODE &DevMode);
+
+private:
+    std::vector<DisplayModeKey> m_keys;
+    std::vector<DEVMODE> m_modes;
+};
+
+//
+// Chooses a mode out of a catalog
+//
+class DisplayModePolicy
+{
+public:
+    virtual ~DisplayModePolicy() = default;
+
+    virtual std::optional<size_t> Select(const DisplayModeCatalog &Catalog) const = 0;
+};
+
+class MaxResolutionDisplayModePolicy final : public DisplayModePolicy
+{
+public:
+    std::optional<size_t> Select(const DisplayModeCatalog &Catalog) const override;
+};
+
+class MaxRefreshDisplayModePolicy final : public DisplayModePolicy
+{
+public:
+    std::optional<size_t> Select(const DisplayModeCatalog &Catalog) const override;
+};
+
+//
+// Picks the mode matching another panel, either orientation, falling back to the maximum resolution
+//
+class MatchDisplayModePolicy final : public DisplayModePolicy
+{
+public:
+    explicit MatchDisplayModePolicy(const DEVMODE &Reference);
+
+    std::optional<size_t> Select(const DisplayModeCatalog &Catalog) const override;
+
+private:
+    DisplayModeKey m_reference;
+};
+
+//
+// Picks the highest or lowest refresh rate available at the resolution of a mode, either orientation
+//
+class RefreshRateDisplayModePolicy final : public DisplayModePolicy
+{
+public:
+    RefreshRateDisplayModePolicy(const DEVMODE &Reference, BOOLEAN Highest);
+
+    std::optional<size_t> Select(const DisplayModeCatalog &Catalog) const override;
+
+private:
+    DisplayModeKey m_reference;
+    BOOLEAN m_highest;
+};
+
+//
+// Per display device catalogs, rebuilt only after the device tree changed
+//
+class DisplayModeCatalogs
+{
+public:
+    static DisplayModeCatalogs &instance();
+
+    explicit DisplayModeCatalogs(DisplayModeSource &Source);
+
+    HRESULT SelectDisplayMode(CONST WCHAR *DeviceName, const DisplayModePolicy &Policy, PDEVMODE DevMode);
+    VOID Invalidate();
+
+private:
+    DisplayModeSource &m_source;
+    std::mutex m_lock;
+    ULONG m_deviceGeneration{0};
+    std::map<std::wstring, DisplayModeCatalog> m_catalogs;
+};
\ No newline at end of file
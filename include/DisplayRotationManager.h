@@ -21,6 +21,38 @@
  */
 #pragma once
 
+typedef struct _TOPOLOGY_APPLY_COUNTERS
+{
+    // Per panel mode changes actually issued
+    ULONG64 ExecutedModeSets;
+    // Per panel mode changes skipped because the panel already matched
+    ULONG64 ElidedModeSets;
+    // Transitions which did not need any change at all
+    ULONG64 SkippedTransitions;
+} TOPOLOGY_APPLY_COUNTERS, *PTOPOLOGY_APPLY_COUNTERS;
+
+typedef struct _PRESTAGE_COUNTERS
+{
+    // Transitions prepared ahead of time
+    ULONG64 Staged;
+    // Transitions which found their preparation staged
+    ULONG64 Hits;
+    // Transitions which found a stale or different preparation staged
+    ULONG64 Misses;
+    // Preparation time the hits did not have to spend
+    ULONG64 SavedMicroseconds;
+} PRESTAGE_COUNTERS, *PPRESTAGE_COUNTERS;
+
+// Where a transition prepared ahead of time is kept, so that expecting one does not drop the other
+enum class PrestageSlot : uint8_t
+{
+    // The layout the hinge is heading for
+    Hinge,
+    // The other panel on, for a flip in a single screen posture
+    Flip,
+    Count
+};
+
 HRESULT WINAPI
 SetExtendedDisplayConfiguration();
 HRESULT WINAPI
@@ -30,4 +62,19 @@ SetDisplayStates(
     INT DisplayOrientation1,
     INT DisplayOrientation2,
     BOOLEAN DisplayState1,
-    BOOLEAN DisplayState2);
\ No newline at end of file
+    BOOLEAN DisplayState2);
+HRESULT WINAPI
+PrestageDisplayStates(
+    PrestageSlot Slot,
+    CONST WCHAR *DisplayPanelId1,
+    CONST WCHAR *DisplayPanelId2,
+    INT DisplayOrientation1,
+    INT DisplayOrientation2,
+    BOOLEAN DisplayState1,
+    BOOLEAN DisplayState2);
+VOID WINAPI
+GetTopologyApplyCounters(PTOPOLOGY_APPLY_COUNTERS Counters);
+VOID WINAPI
+GetPrestageCounters(PPRESTAGE_COUNTERS Counters);
+HRESULT WINAPI
+SetPanelsRefreshRate(BOOLEAN Highest);
\ No newline at end of file
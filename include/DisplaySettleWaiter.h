@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "DisplayLayoutPlanner.h"
+#include <array>
+#include <mutex>
+
+// Upper bound of the wait, the old fixed delay was a second
+#define DISPLAY_SETTLE_TIMEOUT_MS 2000
+// Re-check interval in case a mode set completes without a WM_DISPLAYCHANGE broadcast
+#define DISPLAY_SETTLE_POLL_MS 50
+#define DISPLAY_SETTLE_BUCKET_COUNT 8
+
+//
+// What the desktop looks like for both panels
+//
+struct DisplayLiveState
+{
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> Panels;
+    ULONG MonitorCount;
+};
+
+//
+// Settle time distribution, bucket i counts waits of up to 16 << i ms, the last bucket everything longer
+//
+typedef struct _DISPLAY_SETTLE_STATS
+{
+    ULONG64 Settled;
+    ULONG64 TimedOut;
+    ULONG64 TotalMilliseconds;
+    ULONG64 MaxMilliseconds;
+    ULONG64 Buckets[DISPLAY_SETTLE_BUCKET_COUNT];
+} DISPLAY_SETTLE_STATS, *PDISPLAY_SETTLE_STATS;
+
+class DisplaySettleClock
+{
+public:
+    virtual ~DisplaySettleClock() = default;
+
+    virtual ULONGLONG GetMilliseconds() const = 0;
+};
+
+class TickCountDisplaySettleClock final : public DisplaySettleClock
+{
+public:
+    ULONGLONG GetMilliseconds() const override;
+};
+
+//
+// Reports display changes and the live state of the panels
+//
+class DisplaySettleSource
+{
+public:
+    virtual ~DisplaySettleSource() = default;
+
+    virtual ULONG GetGeneration() const = 0;
+    virtual BOOLEAN WaitForChange(ULONG Generation, DWORD TimeoutMs) = 0;
+    virtual HRESULT QueryLiveState(DisplayLiveState &State) = 0;
+};
+
+//
+// Reads the panels through EnumDisplayDevices and EnumDisplaySettings, woken up by DisplayChangeNotifier
+//
+class SystemDisplaySettleSource final : public DisplaySettleSource
+{
+public:
+    SystemDisplaySettleSource(CONST WCHAR *DeviceName1, CONST WCHAR *DeviceName2);
+
+    ULONG GetGeneration() const override;
+    BOOLEAN WaitForChange(ULONG Generation, DWORD TimeoutMs) override;
+    HRESULT QueryLiveState(DisplayLiveState &State) override;
+
+private:
+    std::array<CONST WCHAR *, LAYOUT_PANEL_COUNT> m_deviceNames;
+};
+
+class DisplaySettleStatistics
+{
+public:
+    static DisplaySettleStatistics &instance();
+
+    VOID Record(ULONGLONG Milliseconds, BOOLEAN Settled);
+    VOID GetStats(PDISPLAY_SETTLE_STATS Stats);
+
+private:
+    std::mutex m_lock;
+    DISPLAY_SETTLE_STATS m_stats{};
+};
+
+//
+// Waits for a new display layout to be observably live instead of sleeping for a fixed time
+//
+class DisplaySettleWaiter
+{
+public:
+    DisplaySettleWaiter(
+        const DisplaySettleClock &Clock,
+        DisplaySettleSource &Source,
+        DisplaySettleStatistics &Statistics,
+        DWORD TimeoutMs = DISPLAY_SETTLE_TIMEOUT_MS,
+        DWORD PollMs = DISPLAY_SETTLE_POLL_MS);
+
+    // Generation is the source generation from before the mode set was issued
+    HRESULT Wait(const DisplayLiveState &Target, ULONG Generation);
+
+    static BOOLEAN IsLayoutLive(const DisplayLiveState &Target, const DisplayLiveState &Live);
+
+private:
+    const DisplaySettleClock &m_clock;
+    DisplaySettleSource &m_source;
+    DisplaySettleStatistics &m_statistics;
+    DWORD m_timeoutMs;
+    DWORD m_pollMs;
+};
\ No newline at end of file
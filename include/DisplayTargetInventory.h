@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "DisplayConfigTopology.h"
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+//
+// A display target bound to a panel, as seen by the display configuration API
+//
+struct DisplayTargetRecord
+{
+    std::wstring PanelId;
+    std::wstring InstanceId;
+    std::wstring GdiDeviceName;
+    DisplayConfigPanelSource Source;
+    UINT32 TargetId;
+    BOOLEAN Active;
+    BOOLEAN Primary;
+};
+
+typedef struct _DISPLAY_TARGET_INVENTORY_STATS
+{
+    ULONG64 Refreshes;
+    ULONG64 Lookups;
+    // System calls made by the refreshes, QueryDisplayConfig and DisplayConfigGetDeviceInfo
+    ULONG64 QueryCalls;
+    ULONG64 DeviceInfoCalls;
+} DISPLAY_TARGET_INVENTORY_STATS, *PDISPLAY_TARGET_INVENTORY_STATS;
+
+//
+// Provides the display paths and the names of their sources and targets
+//
+class DisplayTargetSource
+{
+public:
+    virtual ~DisplayTargetSource() = default;
+
+    virtual HRESULT QueryPaths(DisplayConfigTopology &Topology) = 0;
+    virtual HRESULT GetSourceGdiDeviceName(LUID AdapterId, UINT32 SourceId, std::wstring &GdiDeviceName) = 0;
+    virtual HRESULT GetTargetDevicePath(LUID AdapterId, UINT32 TargetId, std::wstring &DevicePath) = 0;
+};
+
+class DisplayConfigTargetSource final : public DisplayTargetSource
+{
+public:
+    HRESULT QueryPaths(DisplayConfigTopology &Topology) override;
+    HRESULT GetSourceGdiDeviceName(LUID AdapterId, UINT32 SourceId, std::wstring &GdiDeviceName) override;
+    HRESULT GetTargetDevicePath(LUID AdapterId, UINT32 TargetId, std::wstring &DevicePath) override;
+};
+
+//
+// Maps panel ids to their display source and target. Built from a single QueryDisplayConfig call
+// and one name lookup per source and target, then served from memory until the next display or
+// device change, or until the service sets a mode itself.
+//
+class DisplayTargetInventory
+{
+public:
+    static DisplayTargetInventory &instance();
+
+    explicit DisplayTargetInventory(DisplayTargetSource &Source);
+
+    HRESULT Lookup(CONST WCHAR *PanelId, DisplayTargetRecord &Record);
+    HRESULT LookupByGdiDeviceName(CONST WCHAR *GdiDeviceName, DisplayTargetRecord &Record);
+    VOID Invalidate();
+
+    VOID GetStats(PDISPLAY_TARGET_INVENTORY_STATS Stats);
+
+    // Turns a monitor device path ("\\?\DISPLAY#...#{guid}") into the instance id of the monitor devnode
+    static std::wstring InstanceIdFromDevicePath(CONST std::wstring &DevicePath);
+
+private:
+    HRESULT EnsureCurrentLocked();
+    HRESULT RefreshLocked();
+
+    DisplayTargetSource &m_source;
+    std::mutex m_lock;
+    BOOLEAN m_populated{FALSE};
+    BOOLEAN m_invalidated{FALSE};
+    ULONG m_displayGeneration{0};
+    ULONG m_deviceGeneration{0};
+    std::vector<DisplayTargetRecord> m_records;
+    std::unordered_map<std::wstring, size_t> m_panelIdIndex;
+    std::unordered_map<std::wstring, size_t> m_gdiDeviceNameIndex;
+    DISPLAY_TARGET_INVENTORY_STATS m_stats{};
+};
\ No newline at end of file
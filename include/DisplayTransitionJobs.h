@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "on_thread_executor.h"
+#include <functional>
+#include <mutex>
+#include <set>
+#include <string>
+#include <vector>
+
+typedef struct _DISPLAY_TRANSITION_STATS
+{
+    ULONG64 Transitions;
+    // Time spent in the transition on the calling thread, which holds the rotation lock throughout
+    ULONG64 TotalHoldMicroseconds;
+    ULONG64 MaxHoldMicroseconds;
+    ULONG64 JobsExecuted;
+    ULONG64 JobsCancelled;
+} DISPLAY_TRANSITION_STATS, *PDISPLAY_TRANSITION_STATS;
+
+//
+// Runs the follow up work of display transitions (digitizer enablement, work area fixups) on a
+// background thread, in submission order. Jobs of a transition which got superseded by a newer
+// one are dropped, the newer transition carries whatever is still pending.
+//
+class DisplayTransitionJobs
+{
+public:
+    static DisplayTransitionJobs &instance();
+
+    // Starts a new transition, cancelling the jobs of the previous ones which did not run yet
+    ULONG BeginTransition();
+    VOID EndTransition(ULONGLONG HoldMicroseconds);
+    ULONG GetGeneration();
+
+    // Name must be a string literal, it names the job in the span trace
+    VOID Post(ULONG Generation, const char *Name, std::function<VOID()> Job);
+
+    // Disables the digitizers of the given panels, waiting for any job still touching them
+    HRESULT DisableDigitizers(const std::vector<std::wstring> &PanelIds, CONST WCHAR *HardwareId);
+
+    // Remembers that the digitizer of a panel is off and needs to be enabled once the panel is on
+    VOID MarkDigitizerDisabled(CONST WCHAR *PanelId);
+
+    // Queues enabling the disabled digitizers amongst the given panels
+    VOID PostEnableDigitizers(ULONG Generation, const std::vector<std::wstring> &PanelIds, CONST WCHAR *HardwareId);
+
+    VOID GetStats(PDISPLAY_TRANSITION_STATS Stats);
+
+private:
+    DisplayTransitionJobs() = default;
+
+    std::mutex m_lock;
+    ULONG m_generation{0};
+    std::set<std::wstring> m_disabledDigitizers;
+    DISPLAY_TRANSITION_STATS m_stats{};
+    OnThreadExecutor m_executor;
+};
\ No newline at end of file
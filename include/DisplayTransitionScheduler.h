@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <atomic>
+
+typedef struct _DISPLAY_SCHEDULER_STATS
+{
+    ULONG64 Requested;
+    // Dropped before starting, a newer request was still to come
+    ULONG64 Coalesced;
+    // Aborted between two phases by a newer request
+    ULONG64 Cancelled;
+    ULONG64 Completed;
+} DISPLAY_SCHEDULER_STATS, *PDISPLAY_SCHEDULER_STATS;
+
+//
+// Keeps only the newest requested display transition. Requests are numbered as they come in, before
+// waiting for the rotation lock. Once holding the lock a request is dropped if a newer one has yet to
+// start, since that one applies the latest state anyway, and a running transition gives up between
+// its phases as soon as such a newer request shows up.
+//
+class DisplayTransitionScheduler
+{
+public:
+    static DisplayTransitionScheduler &instance();
+
+    // Called before taking the rotation lock
+    ULONG64 Request();
+
+    // Called with the rotation lock held, FALSE if the request is superseded and must not run
+    BOOLEAN Begin(ULONG64 Ticket);
+    VOID End(HRESULT Status);
+
+    // Whether the running transition should give up, checked between its phases
+    BOOLEAN IsSuperseded() const;
+
+    VOID GetStats(PDISPLAY_SCHEDULER_STATS Stats) const;
+
+private:
+    DisplayTransitionScheduler() = default;
+
+    std::atomic<ULONG64> m_latest{0};
+    std::atomic<ULONG64> m_lastStarted{0};
+    std::atomic<BOOLEAN> m_running{FALSE};
+
+    std::atomic<ULONG64> m_coalesced{0};
+    std::atomic<ULONG64> m_cancelled{0};
+    std::atomic<ULONG64> m_completed{0};
+};
\ No newline at end of file
@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// What a flip gesture does to the panels. Only the start of a gesture counts. In a single screen
+// posture it swaps the panel which is on; with both panels on it only picks the panel the next
+// single screen posture uses, there is nothing to reconfigure.
+//
+
+#include "PostureFilter.h"
+
+enum class FlipGestureAction : uint8_t
+{
+    Ignore,
+    // Toggles the favorite screen without a display transition
+    ToggleOnly,
+    // Toggles the favorite screen and swaps the panels
+    Swap
+};
+
+constexpr bool
+IsSingleScreenPosture(HingePosition Position)
+{
+    bool firstOn = true;
+    bool secondOn = true;
+
+    GetPanelStatesForHingePosition(Position, true, firstOn, secondOn);
+    return firstOn != secondOn;
+}
+
+constexpr FlipGestureAction
+DecideFlipGesture(bool Started, HingePosition Position)
+{
+    if (!Started)
+    {
+        return FlipGestureAction::Ignore;
+    }
+
+    return IsSingleScreenPosture(Position) ? FlipGestureAction::Swap : FlipGestureAction::ToggleOnly;
+}
+
+static_assert(DecideFlipGesture(false, HingePosition::Full) == FlipGestureAction::Ignore);
+static_assert(DecideFlipGesture(true, HingePosition::Full) == FlipGestureAction::Swap);
+static_assert(DecideFlipGesture(true, HingePosition::Flat) == FlipGestureAction::ToggleOnly);
+static_assert(DecideFlipGesture(true, HingePosition::Unknown) == FlipGestureAction::ToggleOnly);
\ No newline at end of file
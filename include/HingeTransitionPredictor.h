@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Platform neutral prediction of the next hinge state which changes the display topology. The posture
+// reading carries no hinge angle, only the coarse hinge state, so the trend is taken from the order of
+// the states: opening up from flat towards convex is heading for the panels being folded back (full).
+//
+
+#include <cstdint>
+
+// Ordered from closed to fully folded back, unknown first
+enum class HingePosition : uint8_t
+{
+    Unknown,
+    Closed,
+    Concave,
+    Flat,
+    Convex,
+    Full
+};
+
+class HingeTransitionPredictor
+{
+public:
+    //
+    // Subject: Feeds a hinge state reading to the predictor
+    //
+    // Parameters:
+    //
+    //             Position: The hinge state of the reading
+    //
+    // Returns: The hinge state the next display transition is likely for, Unknown if none is expected soon
+    //
+    constexpr HingePosition Observe(HingePosition Position)
+    {
+        HingePosition previous = m_last;
+        m_last = Position;
+
+        // Unfolding always goes through convex, which turns the second panel back on
+        if (Position == HingePosition::Full)
+        {
+            return HingePosition::Convex;
+        }
+
+        // Opening past flat, folding back is next
+        if (Position == HingePosition::Convex && previous != HingePosition::Unknown && previous < Position)
+        {
+            return HingePosition::Full;
+        }
+
+        return HingePosition::Unknown;
+    }
+
+private:
+    HingePosition m_last{HingePosition::Unknown};
+};
+
+//
+// Subject: Replays a recorded sequence of hinge states and counts the predictions which came true
+//
+// Parameters:
+//
+//             Trace: The hinge states, in the order they were read
+//
+//             Count: The number of hinge states
+//
+// Returns: The number of predictions matching the following reading
+//
+constexpr uint32_t
+ReplayHingeTrace(const HingePosition *Trace, uint32_t Count)
+{
+    HingeTransitionPredictor predictor;
+    HingePosition predicted = HingePosition::Unknown;
+    uint32_t hits = 0;
+
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        hits += predicted != HingePosition::Unknown && predicted == Trace[i] ? 1 : 0;
+        predicted = predictor.Observe(Trace[i]);
+    }
+
+    return hits;
+}
+
+constexpr HingePosition HingeFoldBackTrace[] = {
+    HingePosition::Concave,
+    HingePosition::Flat,
+    HingePosition::Convex,
+    HingePosition::Full,
+    HingePosition::Convex,
+    HingePosition::Flat};
+
+static_assert(ReplayHingeTrace(HingeFoldBackTrace, 6) == 2);
\ No newline at end of file
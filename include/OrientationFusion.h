@@ -0,0 +1,349 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Platform neutral fusion of the panel orientations into the orientation to rotate to. Both panel
+// readings, the hinge position and how many readings in a row agreed are scored through a lookup table
+// built at compile time, and a rotation is only committed once its confidence reaches a threshold.
+// A panel reading face up or face down carries no orientation: the other panel is trusted while the
+// hinge is bent, much less while the device lies flat, where both panels tend to be equally unreliable.
+//
+
+#include "PostureFilter.h"
+#include <array>
+#include <cstdint>
+
+constexpr inline uint8_t ORIENTATION_FUSION_DEFAULT_THRESHOLD = 60;
+
+// Table value for keeping the committed orientation
+constexpr inline uint8_t ORIENTATION_FUSION_KEEP = 0xFF;
+
+// Four orientations and unknown
+constexpr inline uint32_t ORIENTATION_FUSION_READINGS = 5;
+constexpr inline uint32_t ORIENTATION_FUSION_HINGE_POSITIONS = (uint32_t)HingePosition::Full + 1;
+constexpr inline uint32_t ORIENTATION_FUSION_MAX_STREAK = 2;
+
+struct OrientationFusionEntry
+{
+    uint8_t Orientation1;
+    uint8_t Orientation2;
+    uint8_t Confidence;
+};
+
+using OrientationFusionTable = std::array<
+    OrientationFusionEntry,
+    ORIENTATION_FUSION_READINGS * ORIENTATION_FUSION_READINGS * ORIENTATION_FUSION_HINGE_POSITIONS *
+        (ORIENTATION_FUSION_MAX_STREAK + 1)>;
+
+constexpr uint32_t
+OrientationFusionReadingIndex(uint8_t Orientation)
+{
+    return Orientation < 4 ? Orientation : 4;
+}
+
+constexpr uint32_t
+OrientationFusionIndex(uint8_t Orientation1, uint8_t Orientation2, HingePosition Position, uint32_t Streak)
+{
+    uint32_t index = OrientationFusionReadingIndex(Orientation1);
+
+    index = index * ORIENTATION_FUSION_READINGS + OrientationFusionReadingIndex(Orientation2);
+    index = index * ORIENTATION_FUSION_HINGE_POSITIONS + (uint32_t)Position;
+    return index * (ORIENTATION_FUSION_MAX_STREAK + 1) + (Streak < ORIENTATION_FUSION_MAX_STREAK ? Streak : 2);
+}
+
+//
+// Subject: Scores one combination of readings
+//
+// Parameters:
+//
+//             Orientation1, Orientation2: The panel readings, POSTURE_ORIENTATION_UNKNOWN for face up or down
+//
+//             Position: The hinge position
+//
+//             Streak: How many readings in a row before this one led to the same orientations
+//
+// Returns: The orientations the readings point to and the confidence in them, out of 100
+//
+constexpr OrientationFusionEntry
+ScoreOrientationReadings(uint8_t Orientation1, uint8_t Orientation2, HingePosition Position, uint32_t Streak)
+{
+    bool known1 = Orientation1 != POSTURE_ORIENTATION_UNKNOWN;
+    bool known2 = Orientation2 != POSTURE_ORIENTATION_UNKNOWN;
+    bool backToBack = Position == HingePosition::Full || Position == HingePosition::Closed;
+    OrientationFusionEntry entry{Orientation1, Orientation2, 0};
+
+    if (!known1 && !known2)
+    {
+        return OrientationFusionEntry{ORIENTATION_FUSION_KEEP, ORIENTATION_FUSION_KEEP, 0};
+    }
+
+    if (known1 && known2)
+    {
+        // Panels share the hinge axis, they only disagree legitimately when folded onto each other
+        entry.Confidence = Orientation1 == Orientation2 ? 90 : backToBack ? 70 : 30;
+    }
+    else
+    {
+        entry.Orientation1 = known1 ? Orientation1 : Orientation2;
+        entry.Orientation2 = known2 ? Orientation2 : Orientation1;
+
+        switch (Position)
+        {
+        case HingePosition::Concave:
+        case HingePosition::Convex:
+            entry.Confidence = 70;
+            break;
+        case HingePosition::Closed:
+        case HingePosition::Full:
+            entry.Confidence = 60;
+            break;
+        case HingePosition::Flat:
+            entry.Confidence = 40;
+            break;
+        default:
+            entry.Confidence = 50;
+            break;
+        }
+    }
+
+    uint32_t confidence = entry.Confidence + 10 * (Streak < ORIENTATION_FUSION_MAX_STREAK ? Streak : 2);
+    entry.Confidence = (uint8_t)(confidence < 100 ? confidence : 100);
+
+    return entry;
+}
+
+constexpr OrientationFusionTable
+BuildOrientationFusionTable()
+{
+    OrientationFusionTable table{};
+
+    for (uint8_t o1 = 0; o1 < ORIENTATION_FUSION_READINGS; o1++)
+    {
+        for (uint8_t o2 = 0; o2 < ORIENTATION_FUSION_READINGS; o2++)
+        {
+            for (uint32_t position = 0; position < ORIENTATION_FUSION_HINGE_POSITIONS; position++)
+            {
+                for (uint32_t streak = 0; streak <= ORIENTATION_FUSION_MAX_STREAK; streak++)
+                {
+                    uint8_t reading1 = o1 < 4 ? o1 : POSTURE_ORIENTATION_UNKNOWN;
+                    uint8_t reading2 = o2 < 4 ? o2 : POSTURE_ORIENTATION_UNKNOWN;
+
+                    table[OrientationFusionIndex(o1, o2, (HingePosition)position, streak)] =
+                        ScoreOrientationReadings(reading1, reading2, (HingePosition)position, streak);
+                }
+            }
+        }
+    }
+
+    return table;
+}
+
+constexpr inline OrientationFusionTable OrientationFusionScores = BuildOrientationFusionTable();
+
+struct OrientationFusionStats
+{
+    uint32_t Readings;
+    uint32_t Commits;
+    // Readings pointing elsewhere which were not confident enough
+    uint32_t Held;
+};
+
+class OrientationFusion
+{
+public:
+    constexpr explicit OrientationFusion(uint8_t Threshold = ORIENTATION_FUSION_DEFAULT_THRESHOLD)
+        : m_threshold(Threshold)
+    {
+    }
+
+    //
+    // Subject: Fuses the orientations of a posture reading
+    //
+    // Parameters:
+    //
+    //             Sample: The raw reading
+    //
+    // Returns: The reading with both orientations replaced by the committed ones
+    //
+    constexpr PostureSample Fuse(const PostureSample &Sample)
+    {
+        PostureSample fused = Sample;
+        uint8_t reading1 = Sample.Orientation1;
+        uint8_t reading2 = Sample.Orientation2;
+        OrientationFusionEntry candidate =
+            OrientationFusionScores[OrientationFusionIndex(reading1, reading2, Sample.Position, 0)];
+
+        m_stats.Readings++;
+
+        if (candidate.Orientation1 != ORIENTATION_FUSION_KEEP)
+        {
+            bool same =
+                m_hasCandidate && candidate.Orientation1 == m_candidate1 && candidate.Orientation2 == m_candidate2;
+
+            m_streak = same ? m_streak + 1 : 0;
+            m_candidate1 = candidate.Orientation1;
+            m_candidate2 = candidate.Orientation2;
+            m_hasCandidate = true;
+
+            uint32_t scored = OrientationFusionIndex(reading1, reading2, Sample.Position, m_streak);
+            m_confidence = OrientationFusionScores[scored].Confidence;
+
+            bool change = !m_hasCommitted || m_candidate1 != m_committed1 || m_candidate2 != m_committed2;
+
+            // Nothing to compare the first orientation with, take it whatever the confidence
+            if (change && (!m_hasCommitted || m_confidence >= m_threshold))
+            {
+                m_committed1 = m_candidate1;
+                m_committed2 = m_candidate2;
+                m_hasCommitted = true;
+                m_stats.Commits++;
+            }
+            else if (change)
+            {
+                m_stats.Held++;
+            }
+        }
+        else
+        {
+            m_confidence = 0;
+        }
+
+        // Before anything was committed the posture filter resolves what is left
+        fused.Orientation1 = m_hasCommitted ? m_committed1 : POSTURE_ORIENTATION_UNKNOWN;
+        fused.Orientation2 = m_hasCommitted ? m_committed2 : POSTURE_ORIENTATION_UNKNOWN;
+
+        return fused;
+    }
+
+    // The confidence of the last reading in the orientations it points to
+    constexpr uint8_t GetConfidence() const
+    {
+        return m_confidence;
+    }
+
+    constexpr OrientationFusionStats GetStats() const
+    {
+        return m_stats;
+    }
+
+private:
+    uint8_t m_threshold;
+    uint8_t m_candidate1{0};
+    uint8_t m_candidate2{0};
+    uint8_t m_committed1{0};
+    uint8_t m_committed2{0};
+    bool m_hasCandidate{false};
+    bool m_hasCommitted{false};
+    uint32_t m_streak{0};
+    uint8_t m_confidence{0};
+    OrientationFusionStats m_stats{};
+};
+
+//
+// A reading along with the orientation the device was actually held in
+//
+struct LabeledPostureSample
+{
+    PostureSample Sample;
+    uint8_t Orientation;
+};
+
+struct OrientationFusionScore
+{
+    // Readings after which the first panel ended up in the labeled orientation
+    uint32_t Correct;
+    // Rotations to an orientation other than the labeled one, each an avoidable pair of mode sets
+    uint32_t WrongRotations;
+};
+
+//
+// Subject: Scores the fusion against a labeled trace
+//
+// Parameters:
+//
+//             Trace, Count: The labeled readings
+//
+//             Threshold: The confidence threshold to evaluate, 0 commits every reading like the historical
+//                        copy-the-other-panel fallback did
+//
+// Returns: How often the orientation was right, and how many rotations were wrong
+//
+constexpr OrientationFusionScore
+ScoreOrientationFusion(const LabeledPostureSample *Trace, uint32_t Count, uint8_t Threshold)
+{
+    OrientationFusion fusion(Threshold);
+    OrientationFusionScore score{};
+    uint8_t previous = POSTURE_ORIENTATION_UNKNOWN;
+
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        uint8_t orientation = fusion.Fuse(Trace[i].Sample).Orientation1;
+
+        score.Correct += orientation == Trace[i].Orientation ? 1 : 0;
+        score.WrongRotations += orientation != previous && previous != POSTURE_ORIENTATION_UNKNOWN &&
+                                        orientation != Trace[i].Orientation
+                                    ? 1
+                                    : 0;
+        previous = orientation;
+    }
+
+    return score;
+}
+
+//
+// Table driven checks of the scores
+//
+static_assert(OrientationFusionScores[OrientationFusionIndex(1, 1, HingePosition::Flat, 0)].Confidence == 90);
+static_assert(OrientationFusionScores[OrientationFusionIndex(1, POSTURE_ORIENTATION_UNKNOWN, HingePosition::Convex, 0)]
+                  .Orientation2 == 1);
+static_assert(
+    OrientationFusionScores[OrientationFusionIndex(1, POSTURE_ORIENTATION_UNKNOWN, HingePosition::Flat, 0)]
+        .Confidence < ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+static_assert(
+    OrientationFusionScores[OrientationFusionIndex(1, POSTURE_ORIENTATION_UNKNOWN, HingePosition::Flat, 2)]
+        .Confidence >= ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+static_assert(OrientationFusionScores[OrientationFusionIndex(1, 3, HingePosition::Flat, 0)].Confidence <
+              ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+static_assert(OrientationFusionScores[OrientationFusionIndex(1, 3, HingePosition::Full, 0)].Confidence >=
+              ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+static_assert(
+    OrientationFusionScores[OrientationFusionIndex(
+                                POSTURE_ORIENTATION_UNKNOWN, POSTURE_ORIENTATION_UNKNOWN, HingePosition::Flat, 0)]
+        .Orientation1 == ORIENTATION_FUSION_KEEP);
+
+//
+// Held upright, then laid flat on a table: the panel still tilted reports a stray landscape reading while
+// the other one reads face up, before both settle. Then a real turn to landscape with the hinge bent.
+//
+constexpr LabeledPostureSample LaidFlatTrace[] = {
+    {{HingePosition::Flat, 0, 0}, 0},
+    {{HingePosition::Flat, 1, POSTURE_ORIENTATION_UNKNOWN}, 0},
+    {{HingePosition::Flat, POSTURE_ORIENTATION_UNKNOWN, POSTURE_ORIENTATION_UNKNOWN}, 0},
+    {{HingePosition::Flat, 3, POSTURE_ORIENTATION_UNKNOWN}, 0},
+    {{HingePosition::Flat, POSTURE_ORIENTATION_UNKNOWN, POSTURE_ORIENTATION_UNKNOWN}, 0},
+    {{HingePosition::Convex, 1, POSTURE_ORIENTATION_UNKNOWN}, 1},
+    {{HingePosition::Convex, 1, 1}, 1}};
+
+static_assert(ScoreOrientationFusion(LaidFlatTrace, 7, ORIENTATION_FUSION_DEFAULT_THRESHOLD).WrongRotations == 0);
+static_assert(ScoreOrientationFusion(LaidFlatTrace, 7, ORIENTATION_FUSION_DEFAULT_THRESHOLD).Correct == 7);
+static_assert(ScoreOrientationFusion(LaidFlatTrace, 7, 0).WrongRotations == 2);
\ No newline at end of file
@@ -0,0 +1,300 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Platform neutral filter between the posture readings and the display code. A reading only becomes
+// the applied posture once it held for a dwell time, so transient face up/down orientations and hinge
+// states flickering around the full boundary never reach SetDisplayStates. Panel power changes, which
+// cost a lot more than a rotation, need to hold longer, and leaving full towards convex, the band the
+// hinge sensor flickers in, longer still. Time only moves through the Now arguments, in milliseconds.
+//
+
+#include "HingeTransitionPredictor.h"
+#include <cstdint>
+
+// Matches DMDO_DEFAULT, DMDO_90, DMDO_180 and DMDO_270
+constexpr inline uint8_t POSTURE_ORIENTATION_UNKNOWN = 0xFF;
+
+constexpr inline uint64_t POSTURE_FILTER_NO_DEADLINE = UINT64_MAX;
+
+struct PostureSample
+{
+    HingePosition Position;
+    // POSTURE_ORIENTATION_UNKNOWN for face up and face down
+    uint8_t Orientation1;
+    uint8_t Orientation2;
+
+    constexpr bool operator==(const PostureSample &Other) const
+    {
+        return Position == Other.Position && Orientation1 == Other.Orientation1 &&
+               Orientation2 == Other.Orientation2;
+    }
+
+    constexpr bool operator!=(const PostureSample &Other) const
+    {
+        return !(*this == Other);
+    }
+};
+
+struct PostureFilterSettings
+{
+    // A rotation, or a hinge change keeping the same panels on
+    uint64_t RotationConfirmMs;
+    // A hinge change turning a panel on or off
+    uint64_t PowerConfirmMs;
+    // Added to PowerConfirmMs when leaving full for convex
+    uint64_t FullHysteresisMs;
+};
+
+constexpr inline PostureFilterSettings DefaultPostureFilterSettings = {250, 400, 400};
+
+struct PostureFilterStats
+{
+    uint32_t Samples;
+    // Postures which made it through to the display code
+    uint32_t Applied;
+    // Pending postures abandoned because the readings went back or elsewhere before confirming
+    uint32_t Suppressed;
+};
+
+class PostureFilter
+{
+public:
+    constexpr explicit PostureFilter(PostureFilterSettings Settings) : m_settings(Settings)
+    {
+    }
+
+    //
+    // Subject: Feeds a posture reading to the filter
+    //
+    // Parameters:
+    //
+    //             Sample: The reading, unknown parts keep their last known value
+    //
+    //             Now: The time of the reading
+    //
+    // Returns: true if the applied posture changed and must be applied
+    //
+    constexpr bool Observe(const PostureSample &Sample, uint64_t Now)
+    {
+        m_stats.Samples++;
+
+        PostureSample candidate = Complete(Sample);
+
+        // The first posture has nothing to be compared with
+        if (!m_hasCurrent)
+        {
+            m_current = candidate;
+            m_hasCurrent = true;
+            m_stats.Applied++;
+            return true;
+        }
+
+        // A reading queued while the caller was busy may come in past the deadline of the pending posture,
+        // which held until then and must not be replaced without being applied
+        bool applied = Poll(Now);
+
+        if (m_pending && candidate != m_candidate)
+        {
+            m_pending = false;
+            m_stats.Suppressed++;
+        }
+
+        if (candidate == m_current)
+        {
+            return applied;
+        }
+
+        if (!m_pending)
+        {
+            m_candidate = candidate;
+            m_candidateSince = Now;
+            m_pending = true;
+        }
+
+        return Poll(Now) || applied;
+    }
+
+    // Confirms the pending posture once it held long enough, true if the applied posture changed
+    constexpr bool Poll(uint64_t Now)
+    {
+        if (!m_pending || Now < NextDeadline())
+        {
+            return false;
+        }
+
+        m_current = m_candidate;
+        m_pending = false;
+        m_stats.Applied++;
+        return true;
+    }
+
+    // The time at which Poll confirms the pending posture if no other reading comes in
+    constexpr uint64_t NextDeadline() const
+    {
+        return m_pending ? m_candidateSince + ConfirmTime(m_current, m_candidate) : POSTURE_FILTER_NO_DEADLINE;
+    }
+
+    constexpr const PostureSample &GetCurrent() const
+    {
+        return m_current;
+    }
+
+    constexpr PostureFilterStats GetStats() const
+    {
+        return m_stats;
+    }
+
+private:
+    static constexpr bool IsPowerChange(HingePosition From, HingePosition To)
+    {
+        return (From == HingePosition::Full) != (To == HingePosition::Full);
+    }
+
+    constexpr uint64_t ConfirmTime(const PostureSample &From, const PostureSample &To) const
+    {
+        if (!IsPowerChange(From.Position, To.Position))
+        {
+            return m_settings.RotationConfirmMs;
+        }
+
+        if (From.Position == HingePosition::Full && To.Position == HingePosition::Convex)
+        {
+            return m_settings.PowerConfirmMs + m_settings.FullHysteresisMs;
+        }
+
+        return m_settings.PowerConfirmMs;
+    }
+
+    // Fills the unknown parts of a reading, a panel lying flat takes the orientation of the other one
+    constexpr PostureSample Complete(const PostureSample &Sample) const
+    {
+        PostureSample complete = Sample;
+
+        if (complete.Orientation1 == POSTURE_ORIENTATION_UNKNOWN)
+        {
+            complete.Orientation1 = complete.Orientation2;
+        }
+
+        if (complete.Orientation2 == POSTURE_ORIENTATION_UNKNOWN)
+        {
+            complete.Orientation2 = complete.Orientation1;
+        }
+
+        if (complete.Orientation1 == POSTURE_ORIENTATION_UNKNOWN)
+        {
+            complete.Orientation1 = m_hasCurrent ? m_current.Orientation1 : 0;
+            complete.Orientation2 = m_hasCurrent ? m_current.Orientation2 : 0;
+        }
+
+        if (complete.Position == HingePosition::Unknown && m_hasCurrent)
+        {
+            complete.Position = m_current.Position;
+        }
+
+        return complete;
+    }
+
+    PostureFilterSettings m_settings;
+    PostureSample m_current{};
+    PostureSample m_candidate{};
+    uint64_t m_candidateSince{0};
+    bool m_hasCurrent{false};
+    bool m_pending{false};
+    PostureFilterStats m_stats{};
+};
+
+//
+// Subject: Tells which panels are on for a hinge position
+//
+// Parameters:
+//
+//             Position: The applied hinge position
+//
+//             FirstPanelFavorite: Whether the first panel stays on when folded back
+//
+//             FirstPanelOn, SecondPanelOn: Receive the panel states, never both off
+//
+constexpr void
+GetPanelStatesForHingePosition(HingePosition Position, bool FirstPanelFavorite, bool &FirstPanelOn, bool &SecondPanelOn)
+{
+    FirstPanelOn = Position != HingePosition::Full || FirstPanelFavorite;
+    SecondPanelOn = Position != HingePosition::Full || !FirstPanelFavorite;
+}
+
+struct TimedPostureSample
+{
+    uint64_t Time;
+    PostureSample Sample;
+};
+
+//
+// Subject: Replays a recorded posture trace through the filter, polling at every deadline in between
+//
+// Parameters:
+//
+//             Trace: The readings, in the order they were read
+//
+//             Count: The number of readings
+//
+// Returns: The number of postures applied, each costing a display reconfiguration
+//
+constexpr uint32_t
+ReplayPostureTrace(const TimedPostureSample *Trace, uint32_t Count)
+{
+    PostureFilter filter(DefaultPostureFilterSettings);
+
+    for (uint32_t i = 0; i < Count; i++)
+    {
+        if (filter.NextDeadline() <= Trace[i].Time)
+        {
+            filter.Poll(filter.NextDeadline());
+        }
+
+        filter.Observe(Trace[i].Sample, Trace[i].Time);
+    }
+
+    filter.Poll(POSTURE_FILTER_NO_DEADLINE - 1);
+
+    return filter.GetStats().Applied;
+}
+
+//
+// Folding back with the hinge sensor flickering between convex and full, a panel briefly reading face
+// up, then a real rotation. Unfiltered, each of the eight postures read reconfigured the displays.
+//
+constexpr TimedPostureSample JitteryFoldBackTrace[] = {
+    {0, {HingePosition::Flat, 0, 0}},
+    {1000, {HingePosition::Convex, 0, 0}},
+    {1100, {HingePosition::Full, 0, 0}},
+    {1150, {HingePosition::Convex, 0, 0}},
+    {1200, {HingePosition::Full, 0, 0}},
+    {1900, {HingePosition::Convex, 0, 0}},
+    {2000, {HingePosition::Full, 0, 0}},
+    {2500, {HingePosition::Full, POSTURE_ORIENTATION_UNKNOWN, 0}},
+    {2600, {HingePosition::Full, 0, 0}},
+    {3000, {HingePosition::Full, 1, 1}},
+    {4000, {HingePosition::Full, 1, 1}}};
+
+// Flat, full and the rotation, convex never held long enough
+static_assert(ReplayPostureTrace(JitteryFoldBackTrace, 11) == 3);
\ No newline at end of file
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "RefreshRateGovernor.h"
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+typedef struct _REFRESH_RATE_STATS
+{
+    // Switches to the high and low tier which the panels accepted
+    ULONG64 SwitchesUp;
+    ULONG64 SwitchesDown;
+    ULONG64 FailedSwitches;
+    // Input which had to wake the controller to go back up
+    ULONG64 InteractionWakeups;
+} REFRESH_RATE_STATS, *PREFRESH_RATE_STATS;
+
+//
+// Drives a RefreshRateGovernor off the tick count on a dedicated thread. The thread sleeps until
+// the governor's next deadline, or until input arrives while the panels run at the low tier, and
+// applies whatever tier the governor settles on.
+//
+class RefreshRateController
+{
+public:
+    static RefreshRateController &instance();
+
+    // Apply is called on the controller thread whenever the tier changes
+    VOID Start(std::function<HRESULT(RefreshRateTier)> Apply);
+
+    // Cheap enough to be called from a WinEvent hook for every event
+    VOID OnInteraction();
+    VOID OnPowerSourceChanged(BOOLEAN OnBattery);
+
+    VOID GetStats(PREFRESH_RATE_STATS Stats);
+
+private:
+    RefreshRateController() = default;
+    ~RefreshRateController();
+
+    VOID Run();
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::function<HRESULT(RefreshRateTier)> m_apply;
+    std::atomic<ULONGLONG> m_lastInteraction{0};
+    std::atomic<RefreshRateTier> m_appliedTier{RefreshRateTier::High};
+    BOOLEAN m_onBattery{FALSE};
+    BOOLEAN m_pending{FALSE};
+    BOOLEAN m_stop{FALSE};
+    REFRESH_RATE_STATS m_stats{};
+    std::thread m_thread;
+};
\ No newline at end of file
@@ -0,0 +1,153 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Platform neutral policy deciding which refresh rate the panels run at. Interaction asks for the
+// highest rate right away, the rate drops once the user has been idle for a while or the device runs
+// on battery. Dropping honors a minimum dwell time so that sporadic input does not flap the panels.
+// Time only moves through the Now arguments, so the policy can be driven by a simulated clock.
+//
+
+#include <cstdint>
+
+enum class RefreshRateTier : uint8_t
+{
+    High,
+    Low
+};
+
+struct RefreshRateGovernorSettings
+{
+    uint64_t IdleTimeoutMs;
+    uint64_t MinDwellMs;
+};
+
+constexpr inline RefreshRateGovernorSettings DefaultRefreshRateGovernorSettings = {30000, 5000};
+
+constexpr inline uint64_t REFRESH_RATE_NO_DEADLINE = UINT64_MAX;
+
+class RefreshRateGovernor
+{
+public:
+    constexpr RefreshRateGovernor(RefreshRateGovernorSettings Settings, uint64_t Now)
+        : m_settings(Settings), m_lastInteraction(Now), m_lastSwitch(Now)
+    {
+    }
+
+    constexpr void OnInteraction(uint64_t Now)
+    {
+        if (Now > m_lastInteraction)
+        {
+            m_lastInteraction = Now;
+        }
+    }
+
+    constexpr void OnPowerSource(bool OnBattery)
+    {
+        m_onBattery = OnBattery;
+    }
+
+    //
+    // Subject: Advances the policy to the given time
+    //
+    // Parameters:
+    //
+    //             Now: The current time in milliseconds
+    //
+    // Returns: The tier the panels should run at
+    //
+    constexpr RefreshRateTier Evaluate(uint64_t Now)
+    {
+        RefreshRateTier desired = Desired(Now);
+
+        if (desired != m_tier && (desired == RefreshRateTier::High || Now - m_lastSwitch >= m_settings.MinDwellMs))
+        {
+            m_tier = desired;
+            m_lastSwitch = Now;
+            m_switchCount++;
+        }
+
+        return m_tier;
+    }
+
+    // The time at which Evaluate may change its answer without any new input
+    constexpr uint64_t NextDeadline(uint64_t Now) const
+    {
+        if (Desired(Now) == m_tier)
+        {
+            return m_tier == RefreshRateTier::High ? m_lastInteraction + m_settings.IdleTimeoutMs
+                                                   : REFRESH_RATE_NO_DEADLINE;
+        }
+
+        // Waiting for the dwell time to run out
+        return m_lastSwitch + m_settings.MinDwellMs;
+    }
+
+    constexpr uint32_t GetSwitchCount() const
+    {
+        return m_switchCount;
+    }
+
+private:
+    constexpr RefreshRateTier Desired(uint64_t Now) const
+    {
+        return !m_onBattery && Now - m_lastInteraction < m_settings.IdleTimeoutMs ? RefreshRateTier::High
+                                                                                  : RefreshRateTier::Low;
+    }
+
+    RefreshRateGovernorSettings m_settings;
+    uint64_t m_lastInteraction;
+    uint64_t m_lastSwitch;
+    bool m_onBattery{false};
+    RefreshRateTier m_tier{RefreshRateTier::High};
+    uint32_t m_switchCount{0};
+};
+
+//
+// Subject: Models a short session: idle, interaction, battery, and counts the switches made
+//
+constexpr uint32_t
+SimulateRefreshRateSession()
+{
+    RefreshRateGovernor governor(DefaultRefreshRateGovernorSettings, 0);
+
+    // Idle long enough to drop
+    governor.Evaluate(10000);
+    governor.Evaluate(governor.NextDeadline(10000));
+
+    // Burst of input, back up at once and no flapping while it lasts
+    for (uint64_t now = 40000; now < 45000; now += 100)
+    {
+        governor.OnInteraction(now);
+        governor.Evaluate(now);
+    }
+
+    // Unplugged, the last switch is past the dwell time so the rate drops right away
+    governor.OnPowerSource(true);
+    governor.Evaluate(46000);
+    governor.Evaluate(governor.NextDeadline(46000));
+
+    return governor.GetSwitchCount();
+}
+
+static_assert(SimulateRefreshRateSession() == 3);
\ No newline at end of file
@@ -0,0 +1,211 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Hands sensor readings over from the sensor callbacks to a single worker. Callbacks only stamp
+// the reading and push it, they never wait on the worker. The queue is bounded: when it is full the
+// oldest coalescable reading is dropped, a newer one describes the device better anyway. Readings
+// which are not coalescable, such as a gesture, are never dropped once queued; a push finding no
+// room for them is rejected instead. Only standard C++ is used so that dispatch latency and
+// throughput can be measured off-device with synthetic readings.
+//
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+
+struct SensorDispatchStats
+{
+    uint64_t Pushed;
+    // Coalescable readings dropped for newer ones before the worker got to them
+    uint64_t Coalesced;
+    // Pushes turned down because every queued reading had to be kept
+    uint64_t Rejected;
+    uint64_t Dispatched;
+    // Time readings spent queued
+    uint64_t TotalLatencyMicroseconds;
+    uint64_t MaxLatencyMicroseconds;
+};
+
+enum class SensorDispatchWait
+{
+    Reading,
+    Timeout,
+    Closed
+};
+
+template <typename T, uint32_t Capacity> class SensorDispatchQueue
+{
+    static_assert(Capacity > 0, "The queue must hold at least one reading");
+
+public:
+    struct Entry
+    {
+        T Reading;
+        uint64_t EnqueuedMicroseconds;
+        bool Coalescable;
+    };
+
+    // Microseconds on a monotonic clock
+    static uint64_t Now()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    // Returns false if the queue is closed, or full of readings none of which may be dropped
+    bool Push(T Reading, bool Coalescable)
+    {
+        uint64_t now = Now();
+
+        {
+            std::lock_guard lock{m_lock};
+
+            if (m_closed)
+            {
+                return false;
+            }
+
+            if (m_count == Capacity && !DropOldestCoalescableLocked())
+            {
+                m_stats.Rejected++;
+                return false;
+            }
+
+            m_entries[(m_head + m_count) % Capacity].emplace(Entry{std::move(Reading), now, Coalescable});
+            m_count++;
+            m_stats.Pushed++;
+        }
+
+        m_available.notify_one();
+        return true;
+    }
+
+    // Waits for the next reading, returns false once the queue is closed and drained
+    bool Pop(Entry &Out)
+    {
+        std::unique_lock lock{m_lock};
+
+        m_available.wait(lock, [this] { return m_count != 0 || m_closed; });
+
+        if (m_count == 0)
+        {
+            return false;
+        }
+
+        TakeLocked(Out);
+        return true;
+    }
+
+    // Like Pop, giving up once TimeoutMicroseconds passed without a reading
+    SensorDispatchWait PopFor(Entry &Out, uint64_t TimeoutMicroseconds)
+    {
+        std::unique_lock lock{m_lock};
+
+        if (!m_available.wait_for(
+                lock, std::chrono::microseconds(TimeoutMicroseconds), [this] { return m_count != 0 || m_closed; }))
+        {
+            return SensorDispatchWait::Timeout;
+        }
+
+        if (m_count == 0)
+        {
+            return SensorDispatchWait::Closed;
+        }
+
+        TakeLocked(Out);
+        return SensorDispatchWait::Reading;
+    }
+
+    // Wakes the worker, readings already queued are still handed out
+    void Close()
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_closed = true;
+        }
+
+        m_available.notify_all();
+    }
+
+    SensorDispatchStats GetStats()
+    {
+        std::lock_guard lock{m_lock};
+        return m_stats;
+    }
+
+private:
+    // Closes the gap the dropped reading leaves, the queue only gets full when the worker falls behind
+    bool DropOldestCoalescableLocked()
+    {
+        uint32_t index = 0;
+
+        while (index < m_count && !m_entries[(m_head + index) % Capacity]->Coalescable)
+        {
+            index++;
+        }
+
+        if (index == m_count)
+        {
+            return false;
+        }
+
+        for (; index + 1 < m_count; index++)
+        {
+            m_entries[(m_head + index) % Capacity] = std::move(m_entries[(m_head + index + 1) % Capacity]);
+        }
+
+        m_entries[(m_head + index) % Capacity].reset();
+        m_count--;
+        m_stats.Coalesced++;
+        return true;
+    }
+
+    void TakeLocked(Entry &Out)
+    {
+        Out = std::move(*m_entries[m_head]);
+        m_entries[m_head].reset();
+        m_head = (m_head + 1) % Capacity;
+        m_count--;
+
+        uint64_t latency = Now() - Out.EnqueuedMicroseconds;
+        m_stats.Dispatched++;
+        m_stats.TotalLatencyMicroseconds += latency;
+        if (latency > m_stats.MaxLatencyMicroseconds)
+        {
+            m_stats.MaxLatencyMicroseconds = latency;
+        }
+    }
+
+    std::mutex m_lock;
+    std::condition_variable m_available;
+    std::array<std::optional<Entry>, Capacity> m_entries;
+    uint32_t m_head{0};
+    uint32_t m_count{0};
+    bool m_closed{false};
+    SensorDispatchStats m_stats{};
+};
\ No newline at end of file
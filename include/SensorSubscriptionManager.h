@@ -0,0 +1,257 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Owns the sensor event subscriptions and decides from the power state which of them to keep.
+// Suspend, resume, the display turning on, off or dimming and the service starting or stopping are
+// all fed into one state machine, which attaches and detaches the sensors to match. A sensor which
+// gets attached again is resynced, readings missed while detached are never replayed. The sensors
+// sit behind SensorHandle so that the state machine can run against fakes off-device.
+//
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+
+enum class SensorKind : uint8_t
+{
+    Posture,
+    Flip,
+    Count
+};
+
+enum class SensorDisplayState : uint8_t
+{
+    Off,
+    On,
+    Dimmed
+};
+
+enum class SensorSubscriptionMode : uint8_t
+{
+    // Nothing attached
+    Detached,
+    // Only the posture sensor, so that folding the device still lays out the panels
+    Reduced,
+    Full
+};
+
+constexpr SensorSubscriptionMode
+SelectSensorSubscriptionMode(bool Started, bool Suspended, SensorDisplayState Display)
+{
+    if (!Started || Suspended || Display == SensorDisplayState::Off)
+    {
+        return SensorSubscriptionMode::Detached;
+    }
+
+    // Nobody flips the device in hand while the screen has dimmed from idling, and any input un-dims it
+    return Display == SensorDisplayState::Dimmed ? SensorSubscriptionMode::Reduced : SensorSubscriptionMode::Full;
+}
+
+constexpr bool
+IsSensorAttachedInMode(SensorSubscriptionMode Mode, SensorKind Kind)
+{
+    return Mode == SensorSubscriptionMode::Full ||
+           (Mode == SensorSubscriptionMode::Reduced && Kind == SensorKind::Posture);
+}
+
+static_assert(SelectSensorSubscriptionMode(false, false, SensorDisplayState::On) == SensorSubscriptionMode::Detached);
+static_assert(SelectSensorSubscriptionMode(true, true, SensorDisplayState::On) == SensorSubscriptionMode::Detached);
+static_assert(SelectSensorSubscriptionMode(true, false, SensorDisplayState::Off) == SensorSubscriptionMode::Detached);
+static_assert(SelectSensorSubscriptionMode(true, false, SensorDisplayState::Dimmed) == SensorSubscriptionMode::Reduced);
+static_assert(SelectSensorSubscriptionMode(true, false, SensorDisplayState::On) == SensorSubscriptionMode::Full);
+static_assert(!IsSensorAttachedInMode(SensorSubscriptionMode::Reduced, SensorKind::Flip));
+
+//
+// A sensor whose events can be subscribed to
+//
+class SensorHandle
+{
+public:
+    virtual ~SensorHandle() = default;
+
+    // Returns false if the subscription failed, it is tried again on the next state change
+    virtual bool Attach() = 0;
+    virtual void Detach() = 0;
+
+    // Brings the service up to date with the sensor after it was detached
+    virtual void Resync() = 0;
+};
+
+struct SensorSubscriptionStats
+{
+    uint64_t Transitions;
+    uint64_t Attaches;
+    uint64_t Detaches;
+    uint64_t Resyncs;
+    std::array<uint64_t, (uint32_t)SensorKind::Count> Events;
+    std::array<uint64_t, (uint32_t)SensorKind::Count> AttachedMilliseconds;
+    std::array<uint64_t, (uint32_t)SensorKind::Count> DetachedMilliseconds;
+    // Events the sensors would have delivered while detached, at the rate they delivered them while attached
+    uint64_t EstimatedWakeupsSaved;
+};
+
+class SensorSubscriptionManager
+{
+public:
+    SensorSubscriptionManager(SensorHandle &Posture, SensorHandle &Flip) : m_handles{&Posture, &Flip}
+    {
+    }
+
+    SensorSubscriptionManager(const SensorSubscriptionManager &) = delete;
+    SensorSubscriptionManager &operator=(const SensorSubscriptionManager &) = delete;
+
+    void Start(uint64_t NowMilliseconds)
+    {
+        std::lock_guard lock{m_lock};
+        m_started = true;
+        ApplyLocked(NowMilliseconds);
+    }
+
+    void Stop(uint64_t NowMilliseconds)
+    {
+        std::lock_guard lock{m_lock};
+        m_started = false;
+        ApplyLocked(NowMilliseconds);
+    }
+
+    void OnSuspend(bool Suspended, uint64_t NowMilliseconds)
+    {
+        std::lock_guard lock{m_lock};
+        m_suspended = Suspended;
+        ApplyLocked(NowMilliseconds);
+    }
+
+    void OnDisplayState(SensorDisplayState Display, uint64_t NowMilliseconds)
+    {
+        std::lock_guard lock{m_lock};
+        m_display = Display;
+        ApplyLocked(NowMilliseconds);
+    }
+
+    // Called from the sensor callbacks
+    void OnEvent(SensorKind Kind) noexcept
+    {
+        m_events[(uint32_t)Kind].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    SensorSubscriptionMode GetMode()
+    {
+        std::lock_guard lock{m_lock};
+        return m_mode;
+    }
+
+    SensorSubscriptionStats GetStats(uint64_t NowMilliseconds)
+    {
+        std::lock_guard lock{m_lock};
+        AccountLocked(NowMilliseconds);
+
+        SensorSubscriptionStats stats = m_stats;
+        stats.EstimatedWakeupsSaved = 0;
+
+        for (uint32_t i = 0; i < (uint32_t)SensorKind::Count; i++)
+        {
+            stats.Events[i] = m_events[i].load(std::memory_order_relaxed);
+
+            if (stats.AttachedMilliseconds[i] != 0)
+            {
+                stats.EstimatedWakeupsSaved +=
+                    stats.Events[i] * stats.DetachedMilliseconds[i] / stats.AttachedMilliseconds[i];
+            }
+        }
+
+        return stats;
+    }
+
+private:
+    void AccountLocked(uint64_t NowMilliseconds)
+    {
+        uint64_t elapsed = NowMilliseconds > m_accountedMilliseconds ? NowMilliseconds - m_accountedMilliseconds : 0;
+        m_accountedMilliseconds = NowMilliseconds;
+
+        // Time before the first start is neither
+        if (!m_everStarted)
+        {
+            return;
+        }
+
+        for (uint32_t i = 0; i < (uint32_t)SensorKind::Count; i++)
+        {
+            (m_attached[i] ? m_stats.AttachedMilliseconds[i] : m_stats.DetachedMilliseconds[i]) += elapsed;
+        }
+    }
+
+    void ApplyLocked(uint64_t NowMilliseconds)
+    {
+        AccountLocked(NowMilliseconds);
+        m_everStarted |= m_started;
+
+        SensorSubscriptionMode mode = SelectSensorSubscriptionMode(m_started, m_suspended, m_display);
+        if (mode != m_mode)
+        {
+            m_mode = mode;
+            m_stats.Transitions++;
+        }
+
+        // Also retries attaches which failed on an earlier change
+        for (uint32_t i = 0; i < (uint32_t)SensorKind::Count; i++)
+        {
+            bool attach = IsSensorAttachedInMode(mode, (SensorKind)i);
+
+            if (attach && !m_attached[i])
+            {
+                if (!m_handles[i]->Attach())
+                {
+                    continue;
+                }
+
+                m_attached[i] = true;
+                m_stats.Attaches++;
+
+                m_handles[i]->Resync();
+                m_stats.Resyncs++;
+            }
+            else if (!attach && m_attached[i])
+            {
+                m_handles[i]->Detach();
+                m_attached[i] = false;
+                m_stats.Detaches++;
+            }
+        }
+    }
+
+    std::mutex m_lock;
+    std::array<SensorHandle *, (uint32_t)SensorKind::Count> m_handles;
+    std::array<bool, (uint32_t)SensorKind::Count> m_attached{};
+    std::array<std::atomic<uint64_t>, (uint32_t)SensorKind::Count> m_events{};
+
+    bool m_started = false;
+    bool m_everStarted = false;
+    bool m_suspended = false;
+    SensorDisplayState m_display = SensorDisplayState::On;
+    SensorSubscriptionMode m_mode = SensorSubscriptionMode::Detached;
+
+    uint64_t m_accountedMilliseconds = 0;
+    SensorSubscriptionStats m_stats{};
+};
\ No newline at end of file
@@ -0,0 +1,280 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Compact binary traces of the posture and flip sensor events, so that the rotation logic can be tuned
+// and checked off-device. After a "DSTR" magic and a version, each event is:
+//
+//     varint   time since the previous event, in microseconds
+//     byte     kind
+//     posture: panel 1 id, panel 2 id, varint hinge position, varint orientation 1, varint orientation 2
+//     flip:    varint gesture state
+//
+// Panel ids are interned: a reference is a varint, 0 introduces a new id (varint length then UTF-16 code
+// units as varints) which takes the next index, n refers to the id with index n - 1. Only standard C++
+// is used so that traces recorded on the device can be replayed anywhere.
+//
+
+#include "PostureFilter.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+constexpr inline uint8_t SENSOR_TRACE_MAGIC[4] = {'D', 'S', 'T', 'R'};
+constexpr inline uint32_t SENSOR_TRACE_VERSION = 1;
+
+enum class SensorTraceEventKind : uint8_t
+{
+    Posture,
+    Flip
+};
+
+// Mirrors the GestureState values of the flip sensor
+constexpr inline uint8_t SENSOR_TRACE_GESTURE_STARTED = 0;
+
+struct SensorTraceEvent
+{
+    uint64_t TimeMicroseconds;
+    SensorTraceEventKind Kind;
+    // Posture events, panel ids are indices into the interned ids
+    PostureSample Posture;
+    uint32_t Panel1;
+    uint32_t Panel2;
+    // Flip events
+    uint8_t GestureState;
+};
+
+class SensorTraceWriter
+{
+public:
+    SensorTraceWriter()
+    {
+        m_buffer.assign(SENSOR_TRACE_MAGIC, SENSOR_TRACE_MAGIC + sizeof(SENSOR_TRACE_MAGIC));
+        WriteVarint(SENSOR_TRACE_VERSION);
+    }
+
+    void AppendPosture(
+        uint64_t TimeMicroseconds,
+        const std::u16string &Panel1Id,
+        const std::u16string &Panel2Id,
+        const PostureSample &Posture)
+    {
+        WriteHeader(TimeMicroseconds, SensorTraceEventKind::Posture);
+        WritePanelId(Panel1Id);
+        WritePanelId(Panel2Id);
+        WriteVarint((uint64_t)Posture.Position);
+        WriteVarint(Posture.Orientation1);
+        WriteVarint(Posture.Orientation2);
+    }
+
+    void AppendFlip(uint64_t TimeMicroseconds, uint8_t GestureState)
+    {
+        WriteHeader(TimeMicroseconds, SensorTraceEventKind::Flip);
+        WriteVarint(GestureState);
+    }
+
+    const std::vector<uint8_t> &GetBuffer() const
+    {
+        return m_buffer;
+    }
+
+private:
+    void WriteVarint(uint64_t Value)
+    {
+        while (Value >= 0x80)
+        {
+            m_buffer.push_back((uint8_t)(Value | 0x80));
+            Value >>= 7;
+        }
+
+        m_buffer.push_back((uint8_t)Value);
+    }
+
+    void WriteHeader(uint64_t TimeMicroseconds, SensorTraceEventKind Kind)
+    {
+        // Readings are stamped on several threads, keep the deltas non negative
+        uint64_t time = TimeMicroseconds > m_lastTime ? TimeMicroseconds : m_lastTime;
+
+        WriteVarint(time - m_lastTime);
+        m_buffer.push_back((uint8_t)Kind);
+        m_lastTime = time;
+    }
+
+    void WritePanelId(const std::u16string &PanelId)
+    {
+        for (uint32_t i = 0; i < m_panelIds.size(); i++)
+        {
+            if (m_panelIds[i] == PanelId)
+            {
+                WriteVarint(i + 1);
+                return;
+            }
+        }
+
+        WriteVarint(0);
+        WriteVarint(PanelId.size());
+        for (char16_t unit : PanelId)
+        {
+            WriteVarint(unit);
+        }
+
+        m_panelIds.push_back(PanelId);
+    }
+
+    std::vector<uint8_t> m_buffer;
+    std::vector<std::u16string> m_panelIds;
+    uint64_t m_lastTime{0};
+};
+
+class SensorTraceReader
+{
+public:
+    SensorTraceReader(const uint8_t *Data, size_t Size) : m_data(Data), m_size(Size)
+    {
+        uint64_t version = 0;
+
+        m_valid = Size >= sizeof(SENSOR_TRACE_MAGIC) && std::equal(Data, Data + 4, SENSOR_TRACE_MAGIC);
+        m_offset = sizeof(SENSOR_TRACE_MAGIC);
+        m_valid = m_valid && ReadVarint(version) && version == SENSOR_TRACE_VERSION;
+    }
+
+    // false at the end of the trace, or if it is truncated or corrupt
+    bool Next(SensorTraceEvent &Event)
+    {
+        uint64_t delta = 0;
+        uint64_t values[3] = {};
+
+        if (!m_valid || m_offset == m_size)
+        {
+            return false;
+        }
+
+        Event = SensorTraceEvent{};
+
+        m_valid = ReadVarint(delta) && m_offset < m_size;
+        if (!m_valid)
+        {
+            return false;
+        }
+
+        m_time += delta;
+        Event.TimeMicroseconds = m_time;
+        Event.Kind = (SensorTraceEventKind)m_data[m_offset++];
+
+        switch (Event.Kind)
+        {
+        case SensorTraceEventKind::Posture:
+            m_valid = ReadPanelId(Event.Panel1) && ReadPanelId(Event.Panel2) && ReadVarint(values[0]) &&
+                      ReadVarint(values[1]) && ReadVarint(values[2]) && values[0] <= (uint64_t)HingePosition::Full;
+            Event.Posture = PostureSample{(HingePosition)values[0], (uint8_t)values[1], (uint8_t)values[2]};
+            break;
+        case SensorTraceEventKind::Flip:
+            m_valid = ReadVarint(values[0]);
+            Event.GestureState = (uint8_t)values[0];
+            break;
+        default:
+            m_valid = false;
+            break;
+        }
+
+        return m_valid;
+    }
+
+    bool IsValid() const
+    {
+        return m_valid;
+    }
+
+    const std::vector<std::u16string> &GetPanelIds() const
+    {
+        return m_panelIds;
+    }
+
+private:
+    bool ReadVarint(uint64_t &Value)
+    {
+        Value = 0;
+
+        for (uint32_t shift = 0; shift < 64 && m_offset < m_size; shift += 7)
+        {
+            uint8_t byte = m_data[m_offset++];
+
+            Value |= (uint64_t)(byte & 0x7F) << shift;
+            if ((byte & 0x80) == 0)
+            {
+                return true;
+            }
+        }
+
+        return false;
+    }
+
+    bool ReadPanelId(uint32_t &Index)
+    {
+        uint64_t reference = 0;
+        uint64_t length = 0;
+
+        if (!ReadVarint(reference))
+        {
+            return false;
+        }
+
+        if (reference != 0)
+        {
+            Index = (uint32_t)(reference - 1);
+            return reference <= m_panelIds.size();
+        }
+
+        // Every code unit takes at least a byte
+        if (!ReadVarint(length) || length > m_size - m_offset)
+        {
+            return false;
+        }
+
+        std::u16string panelId;
+        for (uint64_t i = 0; i < length; i++)
+        {
+            uint64_t unit = 0;
+
+            if (!ReadVarint(unit))
+            {
+                return false;
+            }
+
+            panelId.push_back((char16_t)unit);
+        }
+
+        Index = (uint32_t)m_panelIds.size();
+        m_panelIds.push_back(std::move(panelId));
+        return true;
+    }
+
+    const uint8_t *m_data;
+    size_t m_size;
+    size_t m_offset{0};
+    uint64_t m_time{0};
+    bool m_valid{false};
+    std::vector<std::u16string> m_panelIds;
+};
\ No newline at end of file
@@ -0,0 +1,268 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Replays a sensor trace through the posture decision logic, the orientation fusion, the posture filter,
+// the favorite screen toggle, the prestaging and the layout planner, against a fake display backend and in
+// the virtual time of the trace. Only standard C++ is used, so that rotation path regressions can be caught
+// without the device.
+//
+
+#include "DisplayLayoutPlanner.h"
+#include "FlipGesture.h"
+#include "HingeTransitionPredictor.h"
+#include "OrientationFusion.h"
+#include "SensorTrace.h"
+#include <array>
+#include <optional>
+#include <vector>
+
+//
+// Two panels with the same native mode, tracking the layout the planned steps leave them in
+//
+class ReplayDisplayBackend
+{
+public:
+    ReplayDisplayBackend(int32_t Width, int32_t Height, LayoutPanelSide FirstPanelSide)
+        : m_width(Width), m_height(Height), m_firstPanelSide(FirstPanelSide)
+    {
+        for (LayoutPanelPlan &panel : m_layout)
+        {
+            panel = LayoutPanelPlan{Width, Height, 0, 0, LAYOUT_ORIENTATION_DEFAULT, true, false};
+        }
+
+        Apply(LAYOUT_ORIENTATION_DEFAULT, LAYOUT_ORIENTATION_DEFAULT, LayoutPanelStates::Both);
+        m_modeSets = 0;
+    }
+
+    // Returns the number of mode sets the transition took
+    uint32_t Apply(int32_t Orientation1, int32_t Orientation2, LayoutPanelStates States)
+    {
+        std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> inputs{};
+
+        // Detached panels come back in their native mode
+        for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
+        {
+            inputs[i] = m_layout[i].Active
+                            ? LayoutPanelInput{m_layout[i].Width, m_layout[i].Height, m_layout[i].Orientation, true}
+                            : LayoutPanelInput{m_width, m_height, LAYOUT_ORIENTATION_DEFAULT, false};
+        }
+
+        TopologyPlan target = PlanDisplayLayout(inputs, Orientation1, Orientation2, States, m_firstPanelSide);
+        uint32_t modeSets = CountModeSteps(DiffTopologyPlan(target, m_layout));
+
+        m_layout = target.Panels;
+        m_modeSets += modeSets;
+
+        return modeSets;
+    }
+
+    const std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> &GetLayout() const
+    {
+        return m_layout;
+    }
+
+    uint32_t GetModeSets() const
+    {
+        return m_modeSets;
+    }
+
+private:
+    int32_t m_width;
+    int32_t m_height;
+    LayoutPanelSide m_firstPanelSide;
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> m_layout{};
+    uint32_t m_modeSets{0};
+};
+
+struct ReplayStagedTransition
+{
+    int32_t Orientation1;
+    int32_t Orientation2;
+    LayoutPanelStates States;
+
+    bool operator==(const ReplayStagedTransition &Other) const
+    {
+        return Orientation1 == Other.Orientation1 && Orientation2 == Other.Orientation2 && States == Other.States;
+    }
+};
+
+struct SensorReplayDecision
+{
+    // The event which started the posture change
+    uint32_t EventIndex;
+    // Virtual time from that event until the display transition
+    uint64_t LatencyMicroseconds;
+    uint32_t ModeSets;
+    // The transition was staged after the one before, by the hinge prediction or for a flip
+    bool Prestaged;
+};
+
+struct SensorReplayResult
+{
+    bool Valid;
+    uint32_t Events;
+    uint32_t ModeSets;
+    // Flips which swapped the panels, the others only picked the favorite screen
+    uint32_t FlipSwaps;
+    uint32_t PrestageHits;
+    std::vector<SensorReplayDecision> Decisions;
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> FinalLayout;
+};
+
+//
+// Subject: Replays a recorded sensor trace
+//
+// Parameters:
+//
+//             Trace, Size: The trace written by SensorTraceWriter
+//
+//             Width, Height: The native mode of the panels
+//
+//             FirstPanelSide: Where the first panel physically sits next to the second one
+//
+// Returns: The display transitions the trace led to, Valid is false if the trace is corrupt
+//
+inline SensorReplayResult
+ReplaySensorTrace(
+    const uint8_t *Trace,
+    size_t Size,
+    int32_t Width,
+    int32_t Height,
+    LayoutPanelSide FirstPanelSide = LayoutPanelSide::Left)
+{
+    SensorTraceReader reader(Trace, Size);
+    SensorTraceEvent event{};
+    OrientationFusion fusion;
+    PostureFilter filter(DefaultPostureFilterSettings);
+    ReplayDisplayBackend display(Width, Height, FirstPanelSide);
+    SensorReplayResult result{};
+    std::vector<uint64_t> times;
+    bool firstPanelFavorite = false;
+    uint32_t candidateIndex = 0;
+
+    // What the service keeps prepared, one slot for the hinge prediction and one for a flip
+    std::array<std::optional<ReplayStagedTransition>, 2> staged;
+    HingeTransitionPredictor predictor;
+
+    auto statesFor = [](HingePosition Position, bool FirstPanelFavorite) {
+        bool firstOn = true;
+        bool secondOn = true;
+
+        GetPanelStatesForHingePosition(Position, FirstPanelFavorite, firstOn, secondOn);
+
+        return firstOn && secondOn ? LayoutPanelStates::Both
+               : firstOn           ? LayoutPanelStates::FirstOnly
+                                   : LayoutPanelStates::SecondOnly;
+    };
+
+    auto transition = [&](uint32_t Index, uint64_t Now) {
+        const PostureSample &posture = filter.GetCurrent();
+        ReplayStagedTransition target{
+            posture.Orientation1, posture.Orientation2, statesFor(posture.Position, firstPanelFavorite)};
+        bool prestaged = staged[0] == target || staged[1] == target;
+
+        result.PrestageHits += prestaged ? 1 : 0;
+        result.Decisions.push_back(SensorReplayDecision{
+            Index,
+            Now - times[Index],
+            display.Apply(target.Orientation1, target.Orientation2, target.States),
+            prestaged});
+
+        // Staged like SetPanelsOrientationState does once the transition is done
+        HingePosition predicted = predictor.Observe(posture.Position);
+
+        staged = {};
+
+        if (predicted != HingePosition::Unknown)
+        {
+            staged[0] = ReplayStagedTransition{
+                posture.Orientation1, posture.Orientation2, statesFor(predicted, firstPanelFavorite)};
+        }
+
+        if (IsSingleScreenPosture(posture.Position))
+        {
+            staged[1] = ReplayStagedTransition{
+                posture.Orientation1, posture.Orientation2, statesFor(posture.Position, !firstPanelFavorite)};
+        }
+    };
+
+    // The filter counts in milliseconds, the trace in microseconds
+    auto poll = [&](uint64_t Now) {
+        uint64_t deadline = filter.NextDeadline();
+
+        if (deadline != POSTURE_FILTER_NO_DEADLINE && deadline * 1000 <= Now && filter.Poll(deadline))
+        {
+            transition(candidateIndex, deadline * 1000);
+        }
+    };
+
+    while (reader.Next(event))
+    {
+        uint32_t index = (uint32_t)times.size();
+
+        times.push_back(event.TimeMicroseconds);
+        poll(event.TimeMicroseconds);
+
+        if (event.Kind == SensorTraceEventKind::Flip)
+        {
+            // Flips bypass the filter, like on the device
+            FlipGestureAction action =
+                DecideFlipGesture(event.GestureState == SENSOR_TRACE_GESTURE_STARTED, filter.GetCurrent().Position);
+
+            if (action != FlipGestureAction::Ignore)
+            {
+                firstPanelFavorite = !firstPanelFavorite;
+            }
+
+            if (action == FlipGestureAction::Swap)
+            {
+                result.FlipSwaps++;
+                transition(index, event.TimeMicroseconds);
+            }
+
+            continue;
+        }
+
+        uint64_t previousDeadline = filter.NextDeadline();
+
+        if (filter.Observe(fusion.Fuse(event.Posture), event.TimeMicroseconds / 1000))
+        {
+            transition(index, event.TimeMicroseconds);
+        }
+        else if (filter.NextDeadline() != previousDeadline)
+        {
+            candidateIndex = index;
+        }
+    }
+
+    // Whatever is still pending holds until the end
+    poll(UINT64_MAX);
+
+    result.Valid = reader.IsValid();
+    result.Events = (uint32_t)times.size();
+    result.ModeSets = display.GetModeSets();
+    result.FinalLayout = display.GetLayout();
+
+    return result;
+}
\ No newline at end of file
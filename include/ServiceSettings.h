@@ -0,0 +1,69 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include "SettingsCache.h"
+#include <thread>
+
+class RegistrySettingsStore final : public SettingsStore
+{
+public:
+    bool ReadDword(const SettingsKeyDescriptor &Key, const wchar_t *ValueName, uint32_t &Value) override;
+};
+
+//
+// The service wide settings cache. The values are read once when first used and from then on only
+// when the registry reports a change: a single thread waits on a change notification for every key
+// in SETTINGS_KEYS at once and re-reads the values under the key which fired. A key missing at start is
+// watched through its nearest existing ancestor until it gets created.
+//
+class ServiceSettings
+{
+public:
+    static ServiceSettings &instance();
+
+    // Changed is called on the watcher thread for every value which changed
+    VOID Start(SettingsCache::ChangedCallback Changed);
+
+    // Ends the watcher thread, the values cached so far can still be read
+    VOID Stop();
+
+    // Never touches the registry, safe on any hot path
+    DWORD Get(SettingId Id) const noexcept;
+
+    // Records a value written by the service itself
+    VOID Set(SettingId Id, DWORD Value) noexcept;
+
+    SettingsCacheStats GetStats() const;
+
+private:
+    ServiceSettings();
+    ~ServiceSettings();
+
+    VOID Run();
+
+    RegistrySettingsStore m_store;
+    SettingsCache m_cache;
+
+    HANDLE m_stopEvent;
+    std::thread m_thread;
+};
\ No newline at end of file
@@ -0,0 +1,208 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Typed, in-memory copies of the registry values the service consults. Readers get the cached value
+// with a relaxed load and never touch the registry; a single watcher re-reads the values under a key
+// when that key reports a change. The registry itself sits behind SettingsStore so that the cache
+// can run against an in-memory store off-device.
+//
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <functional>
+
+enum class SettingsHive : uint8_t
+{
+    LocalMachine,
+    CurrentUser
+};
+
+enum class SettingsKeyId : uint32_t
+{
+    AutoRotation,
+    Setup,
+    Explorer,
+    Count
+};
+
+enum class SettingId : uint32_t
+{
+    // HKLM\...\AutoRotation\Enable, the action center rotation lock
+    AutoRotationEnable,
+    // HKLM\SYSTEM\Setup\OOBEInProgress, tablet states must be left alone while set
+    OOBEInProgress,
+    // HKCU\...\Explorer\TabletPostureTaskbar
+    TabletPostureTaskbar,
+    Count
+};
+
+// No DWORD value of that name under the key
+inline constexpr uint32_t SETTING_MISSING = UINT32_MAX;
+
+struct SettingsKeyDescriptor
+{
+    SettingsHive Hive;
+    const wchar_t *Path;
+};
+
+struct SettingDescriptor
+{
+    SettingsKeyId Key;
+    const wchar_t *ValueName;
+    // Used when the value is missing or is not a DWORD, SETTING_MISSING if that has to be told apart
+    uint32_t Default;
+};
+
+inline constexpr SettingsKeyDescriptor SETTINGS_KEYS[(uint32_t)SettingsKeyId::Count] = {
+    {SettingsHive::LocalMachine, L"SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\AutoRotation"},
+    {SettingsHive::LocalMachine, L"SYSTEM\\Setup"},
+    {SettingsHive::CurrentUser, L"Software\\Microsoft\\Windows\\CurrentVersion\\Explorer"},
+};
+
+inline constexpr SettingDescriptor SETTINGS[(uint32_t)SettingId::Count] = {
+    {SettingsKeyId::AutoRotation, L"Enable", 1},
+    {SettingsKeyId::Setup, L"OOBEInProgress", 0},
+    {SettingsKeyId::Explorer, L"TabletPostureTaskbar", SETTING_MISSING},
+};
+
+struct SettingsCacheStats
+{
+    uint64_t Refreshes;
+    // Values read from the store, every one of them is registry I/O on the device
+    uint64_t StoreReads;
+    uint64_t Lookups;
+    // Refreshed values which differed from the cached ones
+    uint64_t Changes;
+};
+
+//
+// Where the settings come from, the registry on the device
+//
+class SettingsStore
+{
+public:
+    virtual ~SettingsStore() = default;
+
+    // Returns false if the value does not exist or is not a DWORD
+    virtual bool ReadDword(const SettingsKeyDescriptor &Key, const wchar_t *ValueName, uint32_t &Value) = 0;
+};
+
+class SettingsCache
+{
+public:
+    // Called on the refreshing thread for every value which changed
+    using ChangedCallback = std::function<void(SettingId Id, uint32_t Value)>;
+
+    explicit SettingsCache(SettingsStore &Store) : m_store(Store)
+    {
+        for (uint32_t i = 0; i < (uint32_t)SettingId::Count; i++)
+        {
+            m_values[i].store(SETTINGS[i].Default, std::memory_order_relaxed);
+        }
+    }
+
+    SettingsCache(const SettingsCache &) = delete;
+    SettingsCache &operator=(const SettingsCache &) = delete;
+
+    // Must be set before the cache is shared with the refreshing thread
+    void SetChangedCallback(ChangedCallback Callback)
+    {
+        m_changed = std::move(Callback);
+    }
+
+    uint32_t Get(SettingId Id) const noexcept
+    {
+        m_lookups.fetch_add(1, std::memory_order_relaxed);
+        return m_values[(uint32_t)Id].load(std::memory_order_relaxed);
+    }
+
+    // Records a value the service wrote itself, ahead of the change notification for it
+    void Set(SettingId Id, uint32_t Value) noexcept
+    {
+        m_values[(uint32_t)Id].store(Value, std::memory_order_relaxed);
+    }
+
+    void RefreshAll()
+    {
+        for (uint32_t i = 0; i < (uint32_t)SettingsKeyId::Count; i++)
+        {
+            RefreshKey((SettingsKeyId)i);
+        }
+    }
+
+    // Re-reads every value under the key. Only one thread may refresh at a time.
+    void RefreshKey(SettingsKeyId Key)
+    {
+        m_refreshes.fetch_add(1, std::memory_order_relaxed);
+
+        for (uint32_t i = 0; i < (uint32_t)SettingId::Count; i++)
+        {
+            const SettingDescriptor &setting = SETTINGS[i];
+
+            if (setting.Key != Key)
+            {
+                continue;
+            }
+
+            uint32_t value = setting.Default;
+            m_storeReads.fetch_add(1, std::memory_order_relaxed);
+
+            if (!m_store.ReadDword(SETTINGS_KEYS[(uint32_t)Key], setting.ValueName, value))
+            {
+                value = setting.Default;
+            }
+
+            if (m_values[i].exchange(value, std::memory_order_relaxed) != value)
+            {
+                m_changes.fetch_add(1, std::memory_order_relaxed);
+
+                if (m_changed)
+                {
+                    m_changed((SettingId)i, value);
+                }
+            }
+        }
+    }
+
+    SettingsCacheStats GetStats() const
+    {
+        return SettingsCacheStats{
+            m_refreshes.load(std::memory_order_relaxed),
+            m_storeReads.load(std::memory_order_relaxed),
+            m_lookups.load(std::memory_order_relaxed),
+            m_changes.load(std::memory_order_relaxed)};
+    }
+
+private:
+    SettingsStore &m_store;
+    ChangedCallback m_changed;
+
+    std::array<std::atomic<uint32_t>, (uint32_t)SettingId::Count> m_values;
+
+    std::atomic<uint64_t> m_refreshes{0};
+    std::atomic<uint64_t> m_storeReads{0};
+    mutable std::atomic<uint64_t> m_lookups{0};
+    std::atomic<uint64_t> m_changes{0};
+};
\ No newline at end of file
@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Low overhead tracing of the phases of display transitions. Spans go into a fixed ring buffer
+// without taking any lock and can be exported as Chrome trace event JSON (chrome://tracing,
+// ui.perfetto.dev). The oldest spans are overwritten once the ring is full.
+//
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+// Must be a power of two
+constexpr inline uint32_t SPAN_TRACER_CAPACITY = 2048;
+
+class SpanTracer
+{
+public:
+    static SpanTracer &instance();
+
+    // Microseconds on a monotonic clock
+    static uint64_t Now();
+
+    // Name must be a string literal, only the pointer is kept
+    void Record(const char *Name, uint64_t Start, uint64_t End);
+
+    // Records a phase which just ended and returns the end, which is the start of the next phase
+    uint64_t EndPhase(const char *Name, uint64_t Start);
+
+    std::string ExportChromeTrace() const;
+
+private:
+    // Sequence is odd while the slot is being written, readers skip such slots
+    struct Slot
+    {
+        std::atomic<uint64_t> Sequence{0};
+        std::atomic<const char *> Name{nullptr};
+        std::atomic<uint64_t> Start{0};
+        std::atomic<uint64_t> End{0};
+        std::atomic<uint32_t> ThreadId{0};
+    };
+
+    static uint32_t CurrentThreadId();
+
+    std::atomic<uint64_t> m_next{0};
+    std::array<Slot, SPAN_TRACER_CAPACITY> m_slots;
+};
+
+HRESULT WINAPI
+WriteSpanTrace(CONST WCHAR *FileName);
\ No newline at end of file
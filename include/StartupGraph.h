@@ -0,0 +1,227 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Runs the service startup as a graph of steps. A step starts as soon as every step it depends on
+// succeeded, steps which do not depend on each other run concurrently. A step whose dependency
+// failed is skipped rather than run. Dependencies can only name steps added before, so the graph
+// cannot have cycles. Only standard C++ is used so that the scheduling can be checked off-device
+// with fake steps.
+//
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+enum class StartupStepStatus : uint8_t
+{
+    Pending,
+    Succeeded,
+    Failed,
+    Skipped
+};
+
+struct StartupStepTiming
+{
+    const char *Name;
+    StartupStepStatus Status;
+    uint64_t StartMicroseconds;
+    uint64_t EndMicroseconds;
+    // 0 is the thread which called Run
+    uint32_t Worker;
+};
+
+class StartupGraph
+{
+public:
+    using StepId = uint32_t;
+    using Clock = uint64_t (*)();
+
+    // Microseconds on a monotonic clock
+    static uint64_t SteadyNow()
+    {
+        return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+    }
+
+    explicit StartupGraph(Clock Now = SteadyNow) : m_now(Now)
+    {
+    }
+
+    // Name must be a string literal, only the pointer is kept. Returns the id to depend on.
+    StepId Add(const char *Name, std::initializer_list<StepId> DependsOn, std::function<bool()> Run)
+    {
+        StepId id = (StepId)m_steps.size();
+        Step step{};
+
+        step.Run = std::move(Run);
+        step.Timing = StartupStepTiming{Name, StartupStepStatus::Pending, 0, 0, 0};
+
+        for (StepId dependency : DependsOn)
+        {
+            if (dependency < id)
+            {
+                m_steps[dependency].Dependents.push_back(id);
+                step.Remaining++;
+            }
+        }
+
+        m_steps.push_back(std::move(step));
+        return id;
+    }
+
+    // Runs the graph on the calling thread and up to Workers - 1 more. Returns true if every step succeeded.
+    bool Run(uint32_t Workers)
+    {
+        std::vector<std::thread> helpers;
+
+        for (StepId i = 0; i < (StepId)m_steps.size(); i++)
+        {
+            if (m_steps[i].Remaining == 0)
+            {
+                m_ready.push_back(i);
+            }
+        }
+
+        for (uint32_t i = 1; i < Workers && i < (uint32_t)m_steps.size(); i++)
+        {
+            helpers.emplace_back([this, i] { RunWorker(i); });
+        }
+
+        RunWorker(0);
+
+        for (std::thread &helper : helpers)
+        {
+            helper.join();
+        }
+
+        for (const Step &step : m_steps)
+        {
+            if (step.Timing.Status != StartupStepStatus::Succeeded)
+            {
+                return false;
+            }
+        }
+
+        return true;
+    }
+
+    std::vector<StartupStepTiming> GetTimeline() const
+    {
+        std::vector<StartupStepTiming> timeline;
+
+        for (const Step &step : m_steps)
+        {
+            timeline.push_back(step.Timing);
+        }
+
+        return timeline;
+    }
+
+    StartupStepStatus GetStatus(StepId Id) const
+    {
+        return m_steps[Id].Timing.Status;
+    }
+
+private:
+    struct Step
+    {
+        std::function<bool()> Run;
+        std::vector<StepId> Dependents;
+        uint32_t Remaining;
+        // A dependency did not succeed
+        bool Blocked;
+        StartupStepTiming Timing;
+    };
+
+    void RunWorker(uint32_t Worker)
+    {
+        std::unique_lock lock{m_lock};
+
+        while (true)
+        {
+            m_wake.wait(lock, [this] { return !m_ready.empty() || m_finished == m_steps.size(); });
+
+            if (m_ready.empty())
+            {
+                return;
+            }
+
+            StepId id = m_ready.front();
+            m_ready.pop_front();
+
+            Step &step = m_steps[id];
+            StartupStepStatus status = StartupStepStatus::Skipped;
+            uint64_t start = m_now();
+
+            if (!step.Blocked)
+            {
+                lock.unlock();
+
+                try
+                {
+                    status = step.Run() ? StartupStepStatus::Succeeded : StartupStepStatus::Failed;
+                }
+                catch (...)
+                {
+                    status = StartupStepStatus::Failed;
+                }
+
+                lock.lock();
+            }
+
+            step.Timing.Status = status;
+            step.Timing.StartMicroseconds = start;
+            step.Timing.EndMicroseconds = m_now();
+            step.Timing.Worker = Worker;
+
+            for (StepId dependent : step.Dependents)
+            {
+                m_steps[dependent].Blocked |= status != StartupStepStatus::Succeeded;
+
+                if (--m_steps[dependent].Remaining == 0)
+                {
+                    m_ready.push_back(dependent);
+                }
+            }
+
+            m_finished++;
+            m_wake.notify_all();
+        }
+    }
+
+    Clock m_now;
+    std::vector<Step> m_steps;
+
+    std::mutex m_lock;
+    std::condition_variable m_wake;
+    std::deque<StepId> m_ready;
+    size_t m_finished = 0;
+};
\ No newline at end of file
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Publishes an immutable value to any number of threads. Readers pin the current epoch in a slot and
+// load the published pointer, without ever taking a lock or waiting on a writer. Writers copy the value,
+// change the copy and swap it in; the old copy is freed once no reader pinned an epoch it could still
+// be visible in. Writers are rare and take a lock amongst themselves. Only standard C++ is used.
+//
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+template <typename T, uint32_t ReaderSlots = 64> class SnapshotCell
+{
+    static_assert(ReaderSlots > 0, "Readers need at least one slot");
+
+public:
+    //
+    // Keeps a snapshot alive for as long as it is in scope
+    //
+    class Guard
+    {
+    public:
+        Guard(const Guard &) = delete;
+        Guard &operator=(const Guard &) = delete;
+
+        Guard(Guard &&Other) noexcept : m_slot(std::exchange(Other.m_slot, nullptr)), m_value(Other.m_value)
+        {
+        }
+
+        ~Guard()
+        {
+            if (m_slot != nullptr)
+            {
+                m_slot->store(0, std::memory_order_release);
+            }
+        }
+
+        const T *operator->() const
+        {
+            return m_value;
+        }
+
+        const T &operator*() const
+        {
+            return *m_value;
+        }
+
+    private:
+        friend class SnapshotCell;
+
+        Guard(std::atomic<uint64_t> *Slot, const T *Value) : m_slot(Slot), m_value(Value)
+        {
+        }
+
+        std::atomic<uint64_t> *m_slot;
+        const T *m_value;
+    };
+
+    explicit SnapshotCell(T Initial) : m_current(new T(std::move(Initial)))
+    {
+    }
+
+    SnapshotCell(const SnapshotCell &) = delete;
+    SnapshotCell &operator=(const SnapshotCell &) = delete;
+
+    ~SnapshotCell()
+    {
+        delete m_current.load();
+
+        for (auto &retired : m_retired)
+        {
+            delete retired.first;
+        }
+    }
+
+    Guard Read() const
+    {
+        uint32_t start = (uint32_t)(std::hash<std::thread::id>{}(std::this_thread::get_id()) % ReaderSlots);
+
+        for (uint32_t i = start;; i = (i + 1) % ReaderSlots)
+        {
+            uint64_t idle = 0;
+            uint64_t epoch = m_epoch.load();
+
+            // A pinned epoch is never 0, the pointer loaded afterwards was published at that epoch or later
+            if (m_slots[i].compare_exchange_strong(idle, epoch))
+            {
+                return Guard(&m_slots[i], m_current.load());
+            }
+        }
+    }
+
+    // Copies the current value out
+    T Load() const
+    {
+        return *Read();
+    }
+
+    //
+    // Subject: Publishes a changed copy of the value
+    //
+    // Parameters:
+    //
+    //             Mutate: Changes the copy it is handed, returns false to leave the value as it is
+    //
+    // Returns: Whether a new value was published
+    //
+    template <typename F> bool Update(F &&Mutate)
+    {
+        std::lock_guard lock{m_writeLock};
+        T *next = new T(*m_current.load());
+
+        if (!Mutate(*next))
+        {
+            delete next;
+            return false;
+        }
+
+        const T *previous = m_current.exchange(next);
+        m_retired.emplace_back(previous, m_epoch.fetch_add(1));
+        m_published++;
+
+        ReclaimLocked();
+        return true;
+    }
+
+    uint64_t GetPublishedCount()
+    {
+        std::lock_guard lock{m_writeLock};
+        return m_published;
+    }
+
+    // Snapshots replaced but still possibly in use by a reader
+    size_t GetRetiredCount()
+    {
+        std::lock_guard lock{m_writeLock};
+        return m_retired.size();
+    }
+
+private:
+    void ReclaimLocked()
+    {
+        uint64_t oldest = UINT64_MAX;
+
+        for (const auto &slot : m_slots)
+        {
+            uint64_t epoch = slot.load();
+
+            if (epoch != 0 && epoch < oldest)
+            {
+                oldest = epoch;
+            }
+        }
+
+        // A reader which pinned an epoch after the one a value got retired at loaded a newer value
+        for (size_t i = 0; i < m_retired.size();)
+        {
+            if (m_retired[i].second < oldest)
+            {
+                delete m_retired[i].first;
+                m_retired[i] = m_retired.back();
+                m_retired.pop_back();
+            }
+            else
+            {
+                i++;
+            }
+        }
+    }
+
+    std::atomic<const T *> m_current;
+    mutable std::atomic<uint64_t> m_epoch{1};
+    mutable std::array<std::atomic<uint64_t>, ReaderSlots> m_slots{};
+    std::mutex m_writeLock;
+    std::vector<std::pair<const T *, uint64_t>> m_retired;
+    uint64_t m_published{0};
+};
\ No newline at end of file
@@ -28,10 +28,11 @@ THE SOFTWARE.
 */
 #include "pch.h"
 #include "ActiveMonitorWindowHandler.h"
+#include "CoroutineTask.h"
+#include "RefreshRateController.h"
 #include "TabletPostureManager.h"
 #include "VirtualDesktop.h"
 #include "WorkAreas.h"
-#include <on_thread_executor.h>
 #include <tchar.h>
 
 #define MAX_TITLE_LENGTH 255
@@ -52,7 +53,8 @@ const wchar_t SystemAppsFolder[] = _T("SYSTEMAPPS");
 const wchar_t CoreWindow[] = _T("Windows.UI.Core.CoreWindow");
 const wchar_t SearchUI[] = _T("SearchUI.exe");
 const wchar_t PropertyMovedOnOpening[] = _T("FancyZones_MovedOnOpening");
-OnThreadExecutor m_dpiUnawareThread;
+// Places new windows off the WinEvent thread, waits in there suspend rather than sleep
+CoroutineLoop m_windowPlacementLoop;
 std::vector<HWINEVENTHOOK> m_staticWinEventHooks;
 
 static BOOL CALLBACK
@@ -159,8 +161,8 @@ ScreenToWorkAreaCoords(HWND window, RECT &rect)
     }
 }
 
-static void
-SizeWindowToRect(HWND window, RECT rect) noexcept
+static Task<void>
+SizeWindowToRect(HWND window, RECT rect)
 {
     WINDOWPLACEMENT placement{};
     GetWindowPlacement(window, &placement);
@@ -168,7 +170,7 @@ SizeWindowToRect(HWND window, RECT rect) noexcept
     // Wait if SW_SHOWMINIMIZED would be removed from window (Issue #1685)
     for (int i = 0; i < 5 && (placement.showCmd == SW_SHOWMINIMIZED); ++i)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(100));
+        co_await ResumeAfter(std::chrono::milliseconds(100));
         GetWindowPlacement(window, &placement);
     }
 
@@ -241,8 +243,8 @@ FitOnScreen(const RECT &windowRect, const RECT &originMonitorRect, const RECT &d
     return {left, top, left + W, top + H};
 }
 
-static void
-OpenWindowOnActiveMonitor(HWND window, HMONITOR monitor) noexcept
+static Task<void>
+OpenWindowOnActiveMonitor(HWND window, HMONITOR monitor)
 {
     // By default Windows opens new window on primary monitor.
     // Try to preserve window width and height, adjust top-left corner if needed.
@@ -251,7 +253,7 @@ OpenWindowOnActiveMonitor(HWND window, HMONITOR monitor) noexcept
     {
         // Certain applications by design open in last known position, regardless of FancyZones.
         // If that position is on currently active monitor, skip custom positioning.
-        return;
+        co_return;
     }
 
     WINDOWPLACEMENT placement{};
@@ -266,7 +268,7 @@ OpenWindowOnActiveMonitor(HWND window, HMONITOR monitor) noexcept
             if (GetMonitorInfo(monitor, &destMi))
             {
                 RECT newPosition = FitOnScreen(placement.rcNormalPosition, originMi.rcWork, destMi.rcWork);
-                SizeWindowToRect(window, newPosition);
+                co_await SizeWindowToRect(window, newPosition);
             }
         }
     }
@@ -522,7 +524,7 @@ get_process_path(HWND window) noexcept
     return name;
 }
 
-inline static std::wstring
+static Task<std::wstring>
 get_process_path_waiting_uwp(HWND window)
 {
     const static std::wstring appFrameHost = _T("ApplicationFrameHost.exe");
@@ -533,25 +535,25 @@ get_process_path_waiting_uwp(HWND window)
     while (++attempt < 30 && processPath.length() >= appFrameHost.length() &&
            processPath.compare(processPath.length() - appFrameHost.length(), appFrameHost.length(), appFrameHost) == 0)
     {
-        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+        co_await ResumeAfter(std::chrono::milliseconds(5));
         processPath = get_process_path(window);
     }
 
-    return processPath;
+    co_return processPath;
 }
 
-static bool
+static Task<bool>
 IsExcluded(HWND window)
 {
-    std::wstring processPath = get_process_path_waiting_uwp(window);
+    std::wstring processPath = co_await get_process_path_waiting_uwp(window);
     CharUpperBuff(const_cast<std::wstring &>(processPath).data(), static_cast<DWORD>(processPath.length()));
 
     if (IsExcludedByDefault(window, processPath))
     {
-        return true;
+        co_return true;
     }
 
-    return false;
+    co_return false;
 }
 
 static bool
@@ -591,11 +593,6 @@ IsProcessable(HWND window) noexcept
         return false;
     }
 
-    if (IsExcluded(window))
-    {
-        return false;
-    }
-
     // Switch between virtual desktops results with posting same windows messages that also indicate
     // creation of new window. We need to check if window being processed is on currently active desktop.
     if (!VirtualDesktop::instance().IsWindowOnCurrentDesktop(window))
@@ -619,6 +616,41 @@ RetrieveMovedOnOpeningProperty(HWND window)
     return handle != nullptr;
 }
 
+//
+// The process of a UWP window may take a while to show up, the exclusions are checked once it did.
+// Only windows that are placed get stamped, a window shown again meanwhile is placed once.
+//
+static Task<void>
+PlaceCreatedWindow(HWND window, HMONITOR monitor)
+{
+    // Spawned placements have nobody to rethrow to, a failure is logged and only loses this window
+    try
+    {
+        if (co_await IsExcluded(window))
+        {
+            co_return;
+        }
+
+        if (RetrieveMovedOnOpeningProperty(window))
+        {
+            co_return;
+        }
+
+        StampMovedOnOpeningProperty(window);
+        co_await OpenWindowOnActiveMonitor(window, monitor);
+    }
+    catch (const std::exception &e)
+    {
+        OutputDebugStringA("ActiveMonitorWindowHandler: placing a new window failed: ");
+        OutputDebugStringA(e.what());
+        OutputDebugStringA("\n");
+    }
+    catch (...)
+    {
+        OutputDebugStringA("ActiveMonitorWindowHandler: placing a new window failed\n");
+    }
+}
+
 static void
 WindowCreated(HWND window) noexcept
 {
@@ -641,8 +673,7 @@ WindowCreated(HWND window) noexcept
     bool isMoved = RetrieveMovedOnOpeningProperty(window);
     if (!isMoved)
     {
-        StampMovedOnOpeningProperty(window);
-        m_dpiUnawareThread.submit(OnThreadExecutor::task_t{[&] { OpenWindowOnActiveMonitor(window, active); }}).wait();
+        Spawn(m_windowPlacementLoop, PlaceCreatedWindow(window, active));
     }
 }
 
@@ -692,13 +723,48 @@ WinHookProc(
     }
 }
 
+//
+// Foreground switches, window drags and scrolling are the closest thing to touch and pen input a
+// service sees, any of them keeps the panels at their highest refresh rate for a while
+//
+static void CALLBACK
+InteractionHookProc(
+    HWINEVENTHOOK winEventHook,
+    DWORD event,
+    HWND window,
+    LONG object,
+    LONG child,
+    DWORD eventThread,
+    DWORD eventTime)
+{
+    UNREFERENCED_PARAMETER(winEventHook);
+    UNREFERENCED_PARAMETER(event);
+    UNREFERENCED_PARAMETER(window);
+    UNREFERENCED_PARAMETER(object);
+    UNREFERENCED_PARAMETER(child);
+    UNREFERENCED_PARAMETER(eventThread);
+    UNREFERENCED_PARAMETER(eventTime);
+
+    RefreshRateController::instance().OnInteraction();
+}
+
+//
+// Subject: Places new windows on the monitor the cursor is on until the service stops
+//
+// Parameters:
+//
+//             StopEvent: Signaled when the service is asked to stop, the placements already started are
+//                        finished before returning
+//
 VOID
-ActiveMonitorWindowHandlerMain()
+ActiveMonitorWindowHandlerMain(HANDLE StopEvent)
 {
     CoInitialize(NULL);
 
     SetProcessDpiAwareness(PROCESS_PER_MONITOR_DPI_AWARE);
 
+    std::thread windowPlacementThread{[] { m_windowPlacementLoop.Run(); }};
+
     std::array<DWORD, 6> events_to_subscribe = {
         EVENT_OBJECT_NAMECHANGE, EVENT_OBJECT_UNCLOAKED, EVENT_OBJECT_SHOW, EVENT_OBJECT_CREATE};
     for (const auto event : events_to_subscribe)
@@ -711,23 +777,42 @@ ActiveMonitorWindowHandlerMain()
         }
     }
 
-    MSG msg;
-    while (GetMessage(&msg, NULL, 0, 0))
+    std::array<std::pair<DWORD, DWORD>, 3> interaction_event_ranges = {{
+        {EVENT_SYSTEM_FOREGROUND, EVENT_SYSTEM_FOREGROUND},
+        {EVENT_SYSTEM_MOVESIZESTART, EVENT_SYSTEM_MOVESIZEEND},
+        {EVENT_SYSTEM_SCROLLINGSTART, EVENT_SYSTEM_SCROLLINGEND},
+    }};
+    for (const auto &[first, last] : interaction_event_ranges)
     {
-        if (msg.message == WM_QUIT)
+        auto hook = SetWinEventHook(first, last, nullptr, InteractionHookProc, 0, 0, WINEVENT_OUTOFCONTEXT);
+        if (hook)
         {
-            break;
+            m_staticWinEventHooks.emplace_back(hook);
         }
+    }
 
-        if (msg.message == WM_SETTINGCHANGE && msg.wParam == SPI_SETWORKAREA)
+    MSG msg;
+    BOOL running = TRUE;
+    while (running && MsgWaitForMultipleObjects(1, &StopEvent, FALSE, INFINITE, QS_ALLINPUT) == WAIT_OBJECT_0 + 1)
+    {
+        while (PeekMessage(&msg, NULL, 0, 0, PM_REMOVE))
         {
-            SetTabletPostureState(TRUE);
-            SetTabletPostureTaskbarState(TRUE);
-            UpdateMonitorWorkAreas();
+            if (msg.message == WM_QUIT)
+            {
+                running = FALSE;
+                break;
+            }
+
+            if (msg.message == WM_SETTINGCHANGE && msg.wParam == SPI_SETWORKAREA)
+            {
+                SetTabletPostureState(TRUE);
+                SetTabletPostureTaskbarState(TRUE);
+                UpdateMonitorWorkAreas();
+            }
+
+            TranslateMessage(&msg);
+            DispatchMessage(&msg);
         }
-        
-        TranslateMessage(&msg);
-        DispatchMessage(&msg);
     }
 
     m_staticWinEventHooks.erase(
@@ -737,5 +822,10 @@ ActiveMonitorWindowHandlerMain()
             [](const HWINEVENTHOOK hook) { return UnhookWinEvent(hook); }),
         end(m_staticWinEventHooks));
 
+    // No hook spawns placements anymore, the ones still waiting for their window run to completion so
+    // that no coroutine frame is left behind
+    m_windowPlacementLoop.StopWhenIdle();
+    windowPlacementThread.join();
+
     CoUninitialize();
 }
\ No newline at end of file
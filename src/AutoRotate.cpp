@@ -21,18 +21,48 @@
  */
 #include "pch.h"
 #include "AutoRotate.h"
+#include "DeviceInventory.h"
 #include "DisplayRotationManager.h"
+#include "DisplayTransitionJobs.h"
+#include "DisplayTransitionScheduler.h"
+#include "FlipGesture.h"
+#include "HingeTransitionPredictor.h"
+#include "OrientationFusion.h"
+#include "PostureFilter.h"
+#include "RefreshRateController.h"
+#include "SensorDispatchQueue.h"
+#include "SensorSubscriptionManager.h"
+#include "SensorTrace.h"
+#include "ServiceSettings.h"
+#include "ServiceStorage.h"
+#include "SpanTracer.h"
+#include "StartupGraph.h"
+#include "StateSnapshot.h"
 #include "TabletPostureManager.h"
 #include "WorkAreas.h"
 #include <powrprof.h>
 #include <tchar.h>
+#include <mutex>
+#include <thread>
 
 #define WINDOWS_AUTO_ROTATION_KEY_PATH _T("SOFTWARE\\Microsoft\\Windows\\CurrentVersion\\AutoRotation")
 
-BOOLEAN AutoRotationEnabled = TRUE;
+//
+// Everything the sensor callbacks, the power callbacks, the service control handler and the registry loop
+// share. Readers never block; writers publish a changed copy.
+//
+struct AutoRotateState
+{
+    BOOLEAN AutoRotationEnabled;
+    BOOLEAN IsDisplay1SingleScreenFavorite;
+    INT Panel1Orientation;
+    INT Panel2Orientation;
+    BOOLEAN FoundAllSensors;
+    // The posture filter's current hinge position, so that the flip callback can tell a swap apart
+    HingePosition CommittedPosition;
+};
 
-INT Panel1Orientation = 0;
-INT Panel2Orientation = 0;
+SnapshotCell<AutoRotateState> g_AutoRotateState(AutoRotateState{TRUE, FALSE, 0, 0, FALSE, HingePosition::Unknown});
 
 //
 // The handle the power notify event registration
@@ -46,22 +76,86 @@ TwoPanelHingedDevicePosture g_PostureSensor{nullptr};
 FlipSensor g_FlipSensor{nullptr};
 
 //
-// The event token for the orientation sensor on orientation changed event
+// The sensor event subscriptions, attached and detached by g_SensorSubscriptions only
 //
-event_token postureEventToken;
-event_token flipEventToken;
+class PostureSensorHandle final : public SensorHandle
+{
+public:
+    bool Attach() override;
+    void Detach() override;
+    void Resync() override;
+
+private:
+    event_token m_token;
+};
+
+class FlipSensorHandle final : public SensorHandle
+{
+public:
+    bool Attach() override;
+    void Detach() override;
+    void Resync() override;
+
+private:
+    event_token m_token;
+};
+
+PostureSensorHandle g_PostureSensorHandle;
+FlipSensorHandle g_FlipSensorHandle;
+SensorSubscriptionManager g_SensorSubscriptions(g_PostureSensorHandle, g_FlipSensorHandle);
 
 //
-// Is the event subscribed
+// Serializes the posture transitions, as DisplayTransitionScheduler requires. The refresh rate changes are
+// serialized against them by the mode set lock of SetDisplayStates.
 //
-BOOLEAN postureSubscribed = FALSE;
-BOOLEAN flipSubscribed = FALSE;
+std::mutex g_DisplayTransitionLock;
 
-BOOLEAN FoundAllSensors = FALSE;
+HingeTransitionPredictor g_HingeTransitionPredictor;
 
-BOOLEAN IsDisplay1SingleScreenFavorite = FALSE;
+//
+// A sensor reading on its way from the sensor callbacks to the sensor worker
+//
+struct SensorEvent
+{
+    // 0 unless the reading is known to change the displays, the worker takes one once it does
+    ULONG64 Ticket;
+    TwoPanelHingedDevicePostureReading PostureReading{nullptr};
+    FlipSensorReading FlipReading{nullptr};
+};
+
+// Only postures are coalesced on overflow, a flip or a resync is kept or, with sixteen of them queued, rejected.
+// An event with neither reading asks the worker to resync with the current posture.
+SensorDispatchQueue<SensorEvent, 16> g_SensorEvents;
+std::thread g_SensorWorker;
+
+//
+// The last posture delivered, owned by the sensor worker
+//
+TwoPanelHingedDevicePostureReading g_LastPostureReading{nullptr};
 
-CRITICAL_SECTION g_AutoRotationCriticalSection;
+//
+// Written by the sensor worker only
+//
+struct
+{
+    std::atomic<ULONG64> Swaps;
+    std::atomic<ULONG64> Toggles;
+    std::atomic<ULONG64> TotalLatencyMicroseconds;
+    std::atomic<ULONG64> MaxLatencyMicroseconds;
+} g_FlipGestureCounters;
+
+//
+// Owned by the sensor worker
+//
+OrientationFusion g_OrientationFusion;
+PostureFilter g_PostureFilter(DefaultPostureFilterSettings);
+
+//
+// The sensor events seen since the service started, up to a megabyte of trace
+//
+constexpr size_t SENSOR_TRACE_MAX_BYTES = 1024 * 1024;
+std::mutex g_SensorTraceLock;
+SensorTraceWriter g_SensorTrace;
 
 INT WINAPI
 ConvertSimpleOrientationToDMDO(SimpleOrientation orientation)
@@ -85,142 +179,555 @@ ConvertSimpleOrientationToDMDO(SimpleOrientation orientation)
     return DMDO_DEFAULT;
 }
 
+HingePosition WINAPI
+ConvertHingeStateToHingePosition(Windows::Internal::System::HingeState state)
+{
+    switch (state)
+    {
+    case Windows::Internal::System::HingeState::Closed: {
+        return HingePosition::Closed;
+    }
+    case Windows::Internal::System::HingeState::Concave: {
+        return HingePosition::Concave;
+    }
+    case Windows::Internal::System::HingeState::Flat: {
+        return HingePosition::Flat;
+    }
+    case Windows::Internal::System::HingeState::Convex: {
+        return HingePosition::Convex;
+    }
+    case Windows::Internal::System::HingeState::Full: {
+        return HingePosition::Full;
+    }
+    }
+
+    return HingePosition::Unknown;
+}
+
+VOID WINAPI
+GetDisplayStatesForHingePosition(
+    HingePosition Position, BOOLEAN Display1Favorite, BOOLEAN &Display1State, BOOLEAN &Display2State)
+{
+    bool Display1On = true;
+    bool Display2On = true;
+
+    GetPanelStatesForHingePosition(Position, Display1Favorite, Display1On, Display2On);
+
+    Display1State = Display1On ? TRUE : FALSE;
+    Display2State = Display2On ? TRUE : FALSE;
+}
+
+UINT8 WINAPI
+ConvertSimpleOrientationToPostureOrientation(SimpleOrientation orientation)
+{
+    if (orientation == SimpleOrientation::Faceup || orientation == SimpleOrientation::Facedown)
+    {
+        return POSTURE_ORIENTATION_UNKNOWN;
+    }
+
+    return (UINT8)ConvertSimpleOrientationToDMDO(orientation);
+}
+
+PostureSample WINAPI
+ConvertPostureReadingToSample(TwoPanelHingedDevicePostureReading reading)
+{
+    return PostureSample{
+        ConvertHingeStateToHingePosition(reading.HingeState()),
+        ConvertSimpleOrientationToPostureOrientation(reading.Panel1Orientation()),
+        ConvertSimpleOrientationToPostureOrientation(reading.Panel2Orientation())};
+}
+
+std::u16string WINAPI
+ConvertPanelIdToTraceId(CONST hstring &PanelId)
+{
+    return std::u16string(reinterpret_cast<const char16_t *>(PanelId.c_str()), PanelId.size());
+}
+
+VOID WINAPI
+RecordSensorEvent(CONST SensorEvent &Event, uint64_t TimeMicroseconds)
+{
+    std::lock_guard lock{g_SensorTraceLock};
+
+    if (g_SensorTrace.GetBuffer().size() >= SENSOR_TRACE_MAX_BYTES)
+    {
+        return;
+    }
+
+    if (Event.PostureReading != nullptr)
+    {
+        g_SensorTrace.AppendPosture(
+            TimeMicroseconds,
+            ConvertPanelIdToTraceId(Event.PostureReading.Panel1Id()),
+            ConvertPanelIdToTraceId(Event.PostureReading.Panel2Id()),
+            ConvertPostureReadingToSample(Event.PostureReading));
+    }
+    else
+    {
+        // Only the start of a flip gesture is queued
+        g_SensorTrace.AppendFlip(TimeMicroseconds, SENSOR_TRACE_GESTURE_STARTED);
+    }
+}
+
+VOID WINAPI
+GetFlipGestureCounters(PFLIP_GESTURE_COUNTERS Counters)
+{
+    Counters->Swaps = g_FlipGestureCounters.Swaps;
+    Counters->Toggles = g_FlipGestureCounters.Toggles;
+    Counters->TotalLatencyMicroseconds = g_FlipGestureCounters.TotalLatencyMicroseconds;
+    Counters->MaxLatencyMicroseconds = g_FlipGestureCounters.MaxLatencyMicroseconds;
+}
+
+//
+// Subject: Writes the sensor events seen so far to a trace file, for ReplaySensorTrace
+//
+// Parameters:
+//
+//             FileName: The name of the file in the service data directory
+//
+// Returns: ERROR_SUCCESS if successful
+//
 HRESULT WINAPI
-SetPanelsOrientationState(TwoPanelHingedDevicePostureReading reading)
+WriteSensorTrace(CONST WCHAR *FileName)
 {
-    CONST WCHAR *panel1Id = reading.Panel1Id().c_str();
-    CONST WCHAR *panel2Id = reading.Panel2Id().c_str();
+    std::vector<uint8_t> trace;
+    std::wstring path;
+    DWORD written = 0;
+    HRESULT Status = ERROR_SUCCESS;
 
-    BOOLEAN Display1State = TRUE;
-    BOOLEAN Display2State = TRUE;
+    {
+        std::lock_guard lock{g_SensorTraceLock};
+        trace = g_SensorTrace.GetBuffer();
+    }
 
-    if (AutoRotationEnabled)
+    Status = GetServiceDataFilePath(FileName, path);
+    if (Status != ERROR_SUCCESS)
     {
-        SimpleOrientation Panel1SimpleOrientation = reading.Panel1Orientation();
-        SimpleOrientation Panel2SimpleOrientation = reading.Panel2Orientation();
+        return Status;
+    }
 
-        BOOLEAN Panel1UnknownOrientation =
-            Panel1SimpleOrientation == SimpleOrientation::Faceup || Panel1SimpleOrientation == SimpleOrientation::Facedown;
-        BOOLEAN Panel2UnknownOrientation =
-            Panel2SimpleOrientation == SimpleOrientation::Faceup || Panel2SimpleOrientation == SimpleOrientation::Facedown;
+    HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
 
-        if (Panel1UnknownOrientation && !Panel2UnknownOrientation)
-        {
-            Panel1SimpleOrientation = Panel2SimpleOrientation;
-        }
-        else if (Panel2UnknownOrientation && !Panel1UnknownOrientation)
+    if (!WriteFile(file, trace.data(), (DWORD)trace.size(), &written, NULL) || written != trace.size())
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(file);
+
+    return Status;
+}
+
+//
+// Subject: Prepares an expected transition on the transition jobs worker, dropped if a transition starts first
+//
+// Parameters:
+//
+//             Slot: Which kind of expected transition it is
+//
+//             panel1Id, panel2Id: The Panel Container Identifiers
+//
+//             Panel1Orientation, Panel2Orientation: The expected orientation of each panel
+//
+//             Display1State, Display2State: Whether each panel is expected to be on
+//
+VOID WINAPI
+PostPrestageDisplayStates(
+    PrestageSlot Slot,
+    hstring panel1Id,
+    hstring panel2Id,
+    INT Panel1Orientation,
+    INT Panel2Orientation,
+    BOOLEAN Display1State,
+    BOOLEAN Display2State)
+{
+    DisplayTransitionJobs::instance().Post(DisplayTransitionJobs::instance().GetGeneration(), "Prestage", [=] {
+        PrestageDisplayStates(
+            Slot,
+            panel1Id.c_str(),
+            panel2Id.c_str(),
+            Panel1Orientation,
+            Panel2Orientation,
+            Display1State,
+            Display2State);
+    });
+}
+
+//
+// Subject: Applies a posture confirmed by the posture filter
+//
+// Parameters:
+//
+//             reading: The last posture reading, for the panel ids
+//
+//             posture: The posture to apply, face up and face down already resolved
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+SetPanelsOrientationState(TwoPanelHingedDevicePostureReading reading, CONST PostureSample &posture)
+{
+    hstring panel1Id = reading.Panel1Id();
+    hstring panel2Id = reading.Panel2Id();
+    HingePosition position = posture.Position;
+    HingePosition predicted = HingePosition::Unknown;
+
+    BOOLEAN Display1State = TRUE;
+    BOOLEAN Display2State = TRUE;
+    HRESULT Status = ERROR_SUCCESS;
+
+    g_AutoRotateState.Update([&](AutoRotateState &State) {
+        if (!State.AutoRotationEnabled)
         {
-            Panel2SimpleOrientation = Panel1SimpleOrientation;
+            return false;
         }
 
-        Panel1Orientation = ConvertSimpleOrientationToDMDO(Panel1SimpleOrientation);
-        Panel2Orientation = ConvertSimpleOrientationToDMDO(Panel2SimpleOrientation);
+        State.Panel1Orientation = posture.Orientation1;
+        State.Panel2Orientation = posture.Orientation2;
+        return true;
+    });
+
+    AutoRotateState state = g_AutoRotateState.Load();
+    INT Panel1Orientation = state.Panel1Orientation;
+    INT Panel2Orientation = state.Panel2Orientation;
+
+    GetDisplayStatesForHingePosition(position, state.IsDisplay1SingleScreenFavorite, Display1State, Display2State);
+
+    Status = SetDisplayStates(
+        panel1Id.c_str(), panel2Id.c_str(), Panel1Orientation, Panel2Orientation, Display1State, Display2State);
+
+    // Prepare the transitions likely to come next, in the background once this one is done: the one the hinge is
+    // heading for, and in a single screen posture a flip to the other panel. Folded back, both are expected. A
+    // cancelled transition leaves that to the newer one already waiting, the predictor still sees its posture.
+    predicted = g_HingeTransitionPredictor.Observe(position);
+    if (Status == ERROR_CANCELLED)
+    {
+        return Status;
+    }
+
+    if (predicted != HingePosition::Unknown)
+    {
+        BOOLEAN NextDisplay1State = TRUE;
+        BOOLEAN NextDisplay2State = TRUE;
+
+        GetDisplayStatesForHingePosition(
+            predicted, state.IsDisplay1SingleScreenFavorite, NextDisplay1State, NextDisplay2State);
+
+        PostPrestageDisplayStates(
+            PrestageSlot::Hinge,
+            panel1Id,
+            panel2Id,
+            Panel1Orientation,
+            Panel2Orientation,
+            NextDisplay1State,
+            NextDisplay2State);
     }
 
-    // All displays must not be enabled
-    if (reading.HingeState() == Windows::Internal::System::HingeState::Full)
+    if (IsSingleScreenPosture(position))
     {
-        Display1State = IsDisplay1SingleScreenFavorite ? TRUE : FALSE;
-        Display2State = IsDisplay1SingleScreenFavorite ? FALSE : TRUE;
+        BOOLEAN NextDisplay1State = TRUE;
+        BOOLEAN NextDisplay2State = TRUE;
+
+        GetDisplayStatesForHingePosition(
+            position, !state.IsDisplay1SingleScreenFavorite, NextDisplay1State, NextDisplay2State);
+
+        PostPrestageDisplayStates(
+            PrestageSlot::Flip,
+            panel1Id,
+            panel2Id,
+            Panel1Orientation,
+            Panel2Orientation,
+            NextDisplay1State,
+            NextDisplay2State);
     }
 
-    return SetDisplayStates(panel1Id, panel2Id, Panel1Orientation, Panel2Orientation, Display1State, Display2State);
+    return Status;
 }
 
-VOID WINAPI
-ToggleFavoriteSingleScreenDisplay()
+//
+// Subject: Applies the last delivered posture, unless a newer request is about to
+//
+// Parameters:
+//
+//             Ticket: The request number from DisplayTransitionScheduler::Request
+//
+// Returns: FALSE if the posture still needs applying, a newer request superseded this one
+//
+// Remarks: Must be called on the sensor worker
+//
+BOOLEAN WINAPI
+ApplyLatestPostureState(ULONG64 Ticket)
 {
-    EnterCriticalSection(&g_AutoRotationCriticalSection);
-    IsDisplay1SingleScreenFavorite = IsDisplay1SingleScreenFavorite ? FALSE : TRUE;
-    SetPanelsOrientationState(g_PostureSensor.GetCurrentPostureAsync().get());
-    LeaveCriticalSection(&g_AutoRotationCriticalSection);
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    HRESULT Status = ERROR_CANCELLED;
+
+    if (g_LastPostureReading == nullptr)
+    {
+        return TRUE;
+    }
+
+    std::lock_guard lock{g_DisplayTransitionLock};
+
+    if (scheduler.Begin(Ticket))
+    {
+        Status = SetPanelsOrientationState(g_LastPostureReading, g_PostureFilter.GetCurrent());
+        scheduler.End(Status);
+    }
+
+    return Status != ERROR_CANCELLED;
 }
 
+//
+// Subject: Runs the posture logic for the readings the sensor callbacks queued
+//
 VOID WINAPI
-TogglePostureScreenOrientationState()
+SensorWorkerMain()
 {
-    EnterCriticalSection(&g_AutoRotationCriticalSection);
-    SetPanelsOrientationState(g_PostureSensor.GetCurrentPostureAsync().get());
-    LeaveCriticalSection(&g_AutoRotationCriticalSection);
+    decltype(g_SensorEvents)::Entry entry{};
+    SensorDispatchWait wait = SensorDispatchWait::Reading;
+    BOOLEAN applyPending = FALSE;
+    // When the flip gesture waiting for its swap was read, 0 if none is
+    uint64_t flipSwapStart = 0;
+
+    init_apartment();
+
+    while (wait != SensorDispatchWait::Closed)
+    {
+        // The posture filter runs on the clock the readings are stamped with, in milliseconds
+        uint64_t deadline = g_PostureFilter.NextDeadline();
+        uint64_t now = decltype(g_SensorEvents)::Now() / 1000;
+        ULONG64 ticket = 0;
+        BOOLEAN committed = FALSE;
+
+        if (deadline == POSTURE_FILTER_NO_DEADLINE)
+        {
+            wait = g_SensorEvents.Pop(entry) ? SensorDispatchWait::Reading : SensorDispatchWait::Closed;
+        }
+        else
+        {
+            wait = g_SensorEvents.PopFor(entry, deadline > now ? (deadline - now) * 1000 : 0);
+        }
+
+        switch (wait)
+        {
+        case SensorDispatchWait::Reading:
+            SpanTracer::instance().Record("SensorQueue", entry.EnqueuedMicroseconds, SpanTracer::Now());
+
+            if (entry.Reading.PostureReading == nullptr && entry.Reading.FlipReading == nullptr)
+            {
+                try
+                {
+                    entry.Reading.PostureReading = g_PostureSensor.GetCurrentPostureAsync().get();
+                }
+                catch (...)
+                {
+                    // The next posture event brings the state instead
+                }
+
+                if (entry.Reading.PostureReading == nullptr)
+                {
+                    break;
+                }
+            }
+
+            // A flip leaves the shell state alone, the posture it swaps in already set it
+            if (entry.Reading.PostureReading != nullptr)
+            {
+                SetTabletPostureState(TRUE);
+                SetTabletPostureTaskbarState(TRUE);
+                UpdateMonitorWorkAreas();
+                SetWallpaperSpanStyle();
+            }
+
+            ticket = entry.Reading.Ticket;
+            RecordSensorEvent(entry.Reading, entry.EnqueuedMicroseconds);
+
+            if (entry.Reading.PostureReading != nullptr)
+            {
+                g_LastPostureReading = entry.Reading.PostureReading;
+                committed = g_PostureFilter.Observe(
+                    g_OrientationFusion.Fuse(ConvertPostureReadingToSample(g_LastPostureReading)),
+                    entry.EnqueuedMicroseconds / 1000);
+            }
+            else
+            {
+                g_AutoRotateState.Update([](AutoRotateState &State) {
+                    State.IsDisplay1SingleScreenFavorite = State.IsDisplay1SingleScreenFavorite ? FALSE : TRUE;
+                    return true;
+                });
+
+                // Only queued at the start of a gesture. With both panels on there is nothing to swap,
+                // otherwise the other panel's transition was staged when this posture was applied.
+                if (DecideFlipGesture(true, g_PostureFilter.GetCurrent().Position) == FlipGestureAction::Swap)
+                {
+                    flipSwapStart = flipSwapStart != 0 ? flipSwapStart : entry.EnqueuedMicroseconds;
+                    applyPending = TRUE;
+
+                    // The callback saw the posture before the one just committed and did not take a ticket
+                    if (ticket == 0)
+                    {
+                        ticket = DisplayTransitionScheduler::instance().Request();
+                    }
+                }
+                else
+                {
+                    g_FlipGestureCounters.Toggles++;
+                }
+            }
+            break;
+        case SensorDispatchWait::Timeout:
+            // The pending posture held without any further reading
+            committed = g_PostureFilter.Poll(deadline);
+            break;
+        case SensorDispatchWait::Closed:
+            break;
+        }
+
+        // Only a posture which made it through the filter is worth superseding the transition in flight for
+        if (committed)
+        {
+            HingePosition position = g_PostureFilter.GetCurrent().Position;
+
+            g_AutoRotateState.Update([position](AutoRotateState &State) {
+                State.CommittedPosition = position;
+                return true;
+            });
+
+            ticket = DisplayTransitionScheduler::instance().Request();
+            applyPending = TRUE;
+        }
+
+        // A superseded apply is retried with the newer request, which is already queued
+        if (applyPending && ticket != 0)
+        {
+            applyPending = !ApplyLatestPostureState(ticket);
+
+            if (!applyPending && flipSwapStart != 0)
+            {
+                uint64_t swapEnd = SpanTracer::Now();
+                uint64_t latency = swapEnd - flipSwapStart;
+
+                SpanTracer::instance().Record("FlipSwap", flipSwapStart, swapEnd);
+                g_FlipGestureCounters.Swaps++;
+                g_FlipGestureCounters.TotalLatencyMicroseconds += latency;
+                if (latency > g_FlipGestureCounters.MaxLatencyMicroseconds)
+                {
+                    g_FlipGestureCounters.MaxLatencyMicroseconds = latency;
+                }
+                flipSwapStart = 0;
+            }
+        }
+    }
+
+    uninit_apartment();
 }
 
 VOID
 OnPostureChanged(
     TwoPanelHingedDevicePosture const & /*sender*/,
-    TwoPanelHingedDevicePostureReadingChangedEventArgs const & /*args*/)
+    TwoPanelHingedDevicePostureReadingChangedEventArgs const &args)
 {
-    SetTabletPostureState(TRUE);
-    SetTabletPostureTaskbarState(TRUE);
-    UpdateMonitorWorkAreas();
-    SetWallpaperSpanStyle();
+    g_SensorSubscriptions.OnEvent(SensorKind::Posture);
 
-    TogglePostureScreenOrientationState();
+    // Most readings never make it through the posture filter, the worker takes a ticket for those which do
+    g_SensorEvents.Push(SensorEvent{0, args.Reading(), nullptr}, true);
 }
 
 VOID
 OnFlipSensorReadingChanged(FlipSensor const & /*sender*/, FlipSensorReadingChangedEventArgs const &args)
 {
-    if (!FoundAllSensors)
+    if (!g_AutoRotateState.Read()->FoundAllSensors)
     {
         return;
     }
 
-    SetTabletPostureState(TRUE);
-    SetTabletPostureTaskbarState(TRUE);
-    UpdateMonitorWorkAreas();
-    SetWallpaperSpanStyle();
+    g_SensorSubscriptions.OnEvent(SensorKind::Flip);
 
+    // Only the start of a gesture toggles the favorite screen, and only a swap of the panel which is on
+    // changes the displays. Anything else must not take a ticket as it would supersede the transition in
+    // flight for nothing.
     FlipSensorReading reading = args.Reading();
     if (reading.GestureState() == GestureState::Started)
     {
-        ToggleFavoriteSingleScreenDisplay();
+        BOOLEAN swap =
+            DecideFlipGesture(true, g_AutoRotateState.Read()->CommittedPosition) == FlipGestureAction::Swap;
+
+        g_SensorEvents.Push(
+            SensorEvent{swap ? DisplayTransitionScheduler::instance().Request() : 0, nullptr, reading}, false);
+    }
+}
+
+bool
+PostureSensorHandle::Attach()
+{
+    try
+    {
+        m_token = g_PostureSensor.PostureChanged(OnPostureChanged);
+    }
+    catch (...)
+    {
+        return false;
+    }
+
+    return true;
+}
+
+void
+PostureSensorHandle::Detach()
+{
+    g_PostureSensor.PostureChanged(m_token);
+}
+
+void
+PostureSensorHandle::Resync()
+{
+    // Fetching the posture blocks, it is left to the worker rather than the power callback
+    g_SensorEvents.Push(SensorEvent{0, nullptr, nullptr}, false);
+}
+
+bool
+FlipSensorHandle::Attach()
+{
+    try
+    {
+        m_token = g_FlipSensor.ReadingChanged(OnFlipSensorReadingChanged);
+    }
+    catch (...)
+    {
+        return false;
     }
+
+    return true;
+}
+
+void
+FlipSensorHandle::Detach()
+{
+    g_FlipSensor.ReadingChanged(m_token);
+}
+
+void
+FlipSensorHandle::Resync()
+{
+    // A flip is a gesture, there is no state to catch up on
 }
 
 VOID
-OnSystemSuspendStatusChanged(
-    ULONG PowerEvent,
-    TwoPanelHingedDevicePosture const &postureSensor,
-    FlipSensor const &flipSensor)
+OnSystemSuspendStatusChanged(ULONG PowerEvent)
 {
     if (PowerEvent == PBT_APMSUSPEND)
     {
         // Entering
-
-        //
-        // Unsubscribe to sensor events
-        //
-        if (postureSubscribed)
-        {
-            postureSensor.PostureChanged(postureEventToken);
-            postureSubscribed = FALSE;
-        }
-
-        if (flipSubscribed)
-        {
-            flipSensor.ReadingChanged(flipEventToken);
-            flipSubscribed = FALSE;
-        }
+        g_SensorSubscriptions.OnSuspend(true, GetTickCount64());
     }
     else if (PowerEvent == PBT_APMRESUMEAUTOMATIC || PowerEvent == PBT_APMRESUMESUSPEND)
     {
         // AutoResume
         // ManualResume
-
-        //
-        // Subscribe to sensor events
-        //
-        if (!postureSubscribed)
-        {
-            postureEventToken = postureSensor.PostureChanged(OnPostureChanged);
-            postureSubscribed = TRUE;
-        }
-
-        if (!flipSubscribed)
-        {
-            flipEventToken = flipSensor.ReadingChanged(OnFlipSensorReadingChanged);
-            flipSubscribed = TRUE;
-        }
+        g_SensorSubscriptions.OnSuspend(false, GetTickCount64());
     }
 }
 
@@ -229,7 +736,19 @@ OnPowerEvent(_In_ GUID SettingGuid, _In_ PVOID Value, _In_ ULONG ValueLength, _I
 {
     UNREFERENCED_PARAMETER(Context);
 
-    if (!FoundAllSensors)
+    if (IsEqualGUID(GUID_ACDC_POWER_SOURCE, SettingGuid))
+    {
+        if (ValueLength != sizeof(DWORD))
+        {
+            return;
+        }
+
+        // 0 is AC, anything else is a battery or a short term source such as a UPS
+        RefreshRateController::instance().OnPowerSourceChanged(*(DWORD *)Value != 0);
+        return;
+    }
+
+    if (!g_AutoRotateState.Read()->FoundAllSensors)
     {
         return;
     }
@@ -247,43 +766,15 @@ OnPowerEvent(_In_ GUID SettingGuid, _In_ PVOID Value, _In_ ULONG ValueLength, _I
         {
         case 0:
             // Display Off
-
-            //
-            // Unsubscribe to sensor events
-            //
-            if (postureSubscribed)
-            {
-                g_PostureSensor.PostureChanged(postureEventToken);
-                postureSubscribed = FALSE;
-            }
-
-            if (flipSubscribed)
-            {
-                g_FlipSensor.ReadingChanged(flipEventToken);
-                flipSubscribed = FALSE;
-            }
+            g_SensorSubscriptions.OnDisplayState(SensorDisplayState::Off, GetTickCount64());
             break;
         case 1:
             // Display On
-
-            //
-            // Subscribe to sensor events
-            //
-            if (!postureSubscribed)
-            {
-                postureEventToken = g_PostureSensor.PostureChanged(OnPostureChanged);
-                postureSubscribed = TRUE;
-            }
-
-            if (!flipSubscribed)
-            {
-                flipEventToken = g_FlipSensor.ReadingChanged(OnFlipSensorReadingChanged);
-                flipSubscribed = TRUE;
-            }
+            g_SensorSubscriptions.OnDisplayState(SensorDisplayState::On, GetTickCount64());
             break;
         case 2:
-            // Display Dimmed
-
+            // Display Dimmed, only the posture sensor stays attached
+            g_SensorSubscriptions.OnDisplayState(SensorDisplayState::Dimmed, GetTickCount64());
             break;
         default:
             // Unknown
@@ -299,107 +790,122 @@ SuspendResumeCallback(PVOID context, ULONG powerEvent, PVOID setting)
     UNREFERENCED_PARAMETER(context);
     UNREFERENCED_PARAMETER(setting);
 
-    if (FoundAllSensors)
+    if (g_AutoRotateState.Read()->FoundAllSensors)
     {
-        OnSystemSuspendStatusChanged(powerEvent, g_PostureSensor, g_FlipSensor);
+        OnSystemSuspendStatusChanged(powerEvent);
     }
 
     return ERROR_SUCCESS;
 }
 
 VOID
-SetupAutoRotation(HKEY autoRotationKey)
+SetupAutoRotation()
 {
-    DWORD type = REG_DWORD, size = sizeof(DWORD);
+    // Read under the snapshot's write lock, so that the startup and the settings watcher cannot
+    // publish out of order
+    g_AutoRotateState.Update([](AutoRotateState &State) {
+        DWORD enabled = ServiceSettings::instance().Get(SettingId::AutoRotationEnable);
 
-    //
-    // Check if rotation is enabled
-    //
-    DWORD enabled = 0;
-    RegQueryValueEx(autoRotationKey, _T("Enable"), NULL, &type, (LPBYTE)&enabled, &size);
+        if ((enabled != 0 && enabled != 1) || State.AutoRotationEnabled == (enabled == 1))
+        {
+            return false;
+        }
 
-    if (enabled == 1)
-    {
-        AutoRotationEnabled = TRUE;
-    }
-    else if (enabled == 0)
+        State.AutoRotationEnabled = enabled == 1;
+        return true;
+    });
+}
+
+VOID
+OnSettingChanged(SettingId Id, DWORD /*Value*/)
+{
+    switch (Id)
     {
-        AutoRotationEnabled = FALSE;
+    case SettingId::AutoRotationEnable:
+        SetupAutoRotation();
+        break;
+    default:
+        break;
     }
 }
 
+//
+// Subject: Brings up the sensors and lays out the panels until the service stops
+//
+// Parameters:
+//
+//             StopEvent: Signaled when the service is asked to stop, the sensors are then released and
+//                        the shell states the service set are undone
+//
 VOID
-AutoRotateMain()
+AutoRotateMain(HANDLE StopEvent)
 {
     init_apartment();
 
-    SetExtendedDisplayConfiguration();
-    SetTabletPostureState(TRUE);
-    SetTabletPostureTaskbarState(TRUE);
-    UpdateMonitorWorkAreas();
-    SetWallpaperSpanStyle();
+    // The startup steps run concurrently where they do not depend on each other. The helper threads
+    // need no apartment of their own, they join the multithreaded apartment of this thread.
+    StartupGraph startup(SpanTracer::Now);
 
-    {
-        try
-        {
-            g_PostureSensor = TwoPanelHingedDevicePosture::GetDefaultAsync().get();
-        }
-        catch (...)
-        {
-            uninit_apartment();
-            return;
-        }
+    startup.Add("StartupTabletPosture", {}, [] { return SetTabletPostureState(TRUE) != FALSE; });
+    startup.Add("StartupTabletPostureTaskbar", {}, [] { return SetTabletPostureTaskbarState(TRUE) != FALSE; });
+    startup.Add("StartupWorkAreas", {}, [] { return UpdateMonitorWorkAreas() != FALSE; });
+    startup.Add("StartupWallpaperSpanStyle", {}, [] { return SetWallpaperSpanStyle() != FALSE; });
 
-        if (g_PostureSensor == NULL)
-        {
-            uninit_apartment();
-            return;
-        }
+    StartupGraph::StepId inventory = startup.Add(
+        "StartupDeviceInventory", {}, [] { return SUCCEEDED(DeviceInventory::instance().EnsurePopulated()); });
 
-        try
-        {
-            g_FlipSensor = FlipSensor::GetDefaultAsync().get();
-        }
-        catch (...)
-        {
-            uninit_apartment();
-            return;
-        }
+    StartupGraph::StepId postureSensor = startup.Add("StartupPostureSensor", {}, [] {
+        g_PostureSensor = TwoPanelHingedDevicePosture::GetDefaultAsync().get();
+        return g_PostureSensor != NULL;
+    });
 
-        if (g_FlipSensor == NULL)
-        {
-            uninit_apartment();
-            return;
-        }
+    StartupGraph::StepId flipSensor = startup.Add("StartupFlipSensor", {}, [] {
+        g_FlipSensor = FlipSensor::GetDefaultAsync().get();
+        return g_FlipSensor != NULL;
+    });
 
-        FoundAllSensors = TRUE;
-    }
-    
-    InitializeCriticalSectionAndSpinCount(&g_AutoRotationCriticalSection, 0x00000400);
+    // The first posture apply also turns on and extends to every panel the posture wants on, so it
+    // replaces the separate extend which used to come first. The inventory it resolves the panels
+    // with is populated by then.
+    StartupGraph::StepId sensors = startup.Add("StartupSensors", {postureSensor, flipSensor, inventory}, [] {
+        g_AutoRotateState.Update([](AutoRotateState &State) {
+            State.FoundAllSensors = TRUE;
+            return true;
+        });
 
-    // Set initial state
-    TogglePostureScreenOrientationState();
+        g_SensorWorker = std::thread{SensorWorkerMain};
+
+        RefreshRateController::instance().Start(
+            [](RefreshRateTier Tier) { return SetPanelsRefreshRate(Tier == RefreshRateTier::High); });
 
-    {
         DEVICE_NOTIFY_SUBSCRIBE_PARAMETERS powerParams{};
         powerParams.Callback = SuspendResumeCallback;
 
         PowerRegisterSuspendResumeNotification(DEVICE_NOTIFY_CALLBACK, &powerParams, &m_systemSuspendHandle);
 
-        //
-        // Subscribe to sensor events
-        //
-        if (!postureSubscribed)
-        {
-            postureEventToken = g_PostureSensor.PostureChanged(OnPostureChanged);
-            postureSubscribed = TRUE;
-        }
+        // Attaching the posture sensor resyncs it, which sets the initial state. From then on the
+        // posture comes with the sensor events.
+        g_SensorSubscriptions.Start(GetTickCount64());
+        return true;
+    });
 
-        if (!flipSubscribed)
-        {
-            flipEventToken = g_FlipSensor.ReadingChanged(OnFlipSensorReadingChanged);
-            flipSubscribed = TRUE;
-        }
+    startup.Run(4);
+
+    for (CONST StartupStepTiming &step : startup.GetTimeline())
+    {
+        SpanTracer::instance().Record(step.Name, step.StartMicroseconds, step.EndMicroseconds);
+    }
+
+    if (startup.GetStatus(sensors) != StartupStepStatus::Succeeded)
+    {
+        // Without the sensors nothing lays the panels out, leave them all extended
+        SetExtendedDisplayConfiguration();
+
+        g_PostureSensor = NULL;
+        g_FlipSensor = NULL;
+
+        uninit_apartment();
+        return;
     }
 
     //
@@ -417,33 +923,13 @@ AutoRotateMain()
         RegCloseKey(autoRotationKey);
     }
 
-    if (SUCCEEDED(RegOpenKeyEx(HKEY_LOCAL_MACHINE, WINDOWS_AUTO_ROTATION_KEY_PATH, NULL, KEY_READ, &autoRotationKey)))
-    {
-        HANDLE hEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
-
-        while (true)
-        {
-            SetupAutoRotation(autoRotationKey);
-
-            RegNotifyChangeKeyValue(autoRotationKey, false, REG_NOTIFY_CHANGE_LAST_SET, hEvent, true);
-
-            // Check whether to stop the service.
-            if (WaitForSingleObject(hEvent, INFINITE) == WAIT_FAILED)
-            {
-                break;
-            }
-        }
+    //
+    // Later changes to the rotation lock come through OnSettingChanged
+    //
+    SetupAutoRotation();
 
-        RegCloseKey(autoRotationKey);
-    }
-    else
-    {
-        // Wait indefinitely
-        while (true)
-        {
-            Sleep(4294967295ull);
-        }
-    }
+    // The sensor worker and the callbacks do the work from here on
+    WaitForSingleObject(StopEvent, INFINITE);
 
     {
         if (m_systemSuspendHandle != NULL)
@@ -452,24 +938,20 @@ AutoRotateMain()
             m_systemSuspendHandle = NULL;
         }
 
-        //
-        // Unsubscribe to sensor events
-        //
-        if (postureSubscribed)
-        {
-            g_PostureSensor.PostureChanged(postureEventToken);
-            postureSubscribed = FALSE;
-        }
+        g_SensorSubscriptions.Stop(GetTickCount64());
+    }
 
-        if (flipSubscribed)
-        {
-            g_FlipSensor.ReadingChanged(flipEventToken);
-            flipSubscribed = FALSE;
-        }
+    g_SensorEvents.Close();
+    if (g_SensorWorker.joinable())
+    {
+        g_SensorWorker.join();
     }
 
     {
-        FoundAllSensors = FALSE;
+        g_AutoRotateState.Update([](AutoRotateState &State) {
+            State.FoundAllSensors = FALSE;
+            return true;
+        });
         g_PostureSensor = NULL;
         g_FlipSensor = NULL;
     }
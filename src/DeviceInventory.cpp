@@ -0,0 +1,286 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include <SetupAPI.h>
+#include <cfgmgr32.h>
+#include <Devpkey.h>
+#include "DeviceProperties.h"
+#include "DeviceInventory.h"
+
+//
+// Large enough for the property values of nearly every devnode, so that the size probe
+// round-trip only happens for the odd device with a huge hardware id list
+//
+constexpr inline DWORD DEFAULT_PROPERTY_BUFFER_SIZE = 1024;
+
+static BOOL
+GetDevicePropertyBuffer(
+    HDEVINFO devInfo,
+    PSP_DEVINFO_DATA devData,
+    CONST DEVPROPKEY *propertyKey,
+    std::vector<BYTE> &buffer)
+{
+    DEVPROPTYPE devProptype;
+    DWORD dwBuffersize = 0;
+
+    if (SetupDiGetDeviceProperty(
+            devInfo, devData, propertyKey, &devProptype, buffer.data(), (DWORD)buffer.size(), &dwBuffersize, 0))
+    {
+        return TRUE;
+    }
+
+    if (GetLastError() != ERROR_INSUFFICIENT_BUFFER)
+    {
+        return FALSE;
+    }
+
+    buffer.resize(dwBuffersize);
+
+    return SetupDiGetDeviceProperty(
+        devInfo, devData, propertyKey, &devProptype, buffer.data(), (DWORD)buffer.size(), NULL, 0);
+}
+
+HRESULT
+SetupDiDeviceSource::EnumeratePanelDevices(const std::function<void(DeviceNodeRecord &&)> &callback)
+{
+    HDEVINFO devInfo;
+    SP_DEVINFO_DATA devData{};
+    std::vector<BYTE> buffer(DEFAULT_PROPERTY_BUFFER_SIZE);
+    WCHAR instanceId[MAX_DEVICE_ID_LEN];
+
+    if ((devInfo = SetupDiGetClassDevs(NULL, NULL, NULL, DIGCF_ALLCLASSES)) == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    devData.cbSize = sizeof(SP_DEVINFO_DATA);
+
+    for (DWORD i = 0; SetupDiEnumDeviceInfo(devInfo, i, &devData); i++)
+    {
+        DeviceNodeRecord record;
+
+        // The panel id is the rarest property, query it first so that the vast majority
+        // of devnodes are discarded after a single call
+        if (!GetDevicePropertyBuffer(devInfo, &devData, &DEVPKEY_Device_PanelId, buffer))
+        {
+            continue;
+        }
+
+        record.PanelId = (LPCWSTR)buffer.data();
+
+        if (GetDevicePropertyBuffer(devInfo, &devData, &DEVPKEY_Device_Driver, buffer))
+        {
+            record.DriverKey = (LPCWSTR)buffer.data();
+        }
+
+        if (GetDevicePropertyBuffer(devInfo, &devData, &DEVPKEY_Device_HardwareIds, buffer))
+        {
+            for (LPCWSTR hardwareId = (LPCWSTR)buffer.data(); *hardwareId; hardwareId += wcslen(hardwareId) + 1)
+            {
+                record.HardwareIds.emplace_back(hardwareId);
+            }
+        }
+
+        if (SetupDiGetDeviceInstanceId(devInfo, &devData, instanceId, ARRAYSIZE(instanceId), NULL))
+        {
+            record.InstanceId = instanceId;
+        }
+
+        callback(std::move(record));
+    }
+
+    if (!SetupDiDestroyDeviceInfoList(devInfo))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return ERROR_SUCCESS;
+}
+
+DeviceInventory &
+DeviceInventory::instance()
+{
+    static SetupDiDeviceSource source;
+    static DeviceInventory self(source);
+    return self;
+}
+
+DeviceInventory::DeviceInventory(DeviceSource &source) : m_source(source)
+{
+}
+
+std::wstring
+DeviceInventory::NormalizeKey(const std::wstring &key)
+{
+    std::wstring normalized = key;
+    CharUpperBuff(normalized.data(), (DWORD)normalized.length());
+    return normalized;
+}
+
+HRESULT
+DeviceInventory::Refresh()
+{
+    std::vector<DeviceNodeRecord> records;
+
+    // Enumerate outside of the lock, lookups keep being served from the previous table meanwhile
+    HRESULT Status = m_source.EnumeratePanelDevices([&](DeviceNodeRecord &&record) {
+        records.emplace_back(std::move(record));
+    });
+
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    std::unique_lock lock{m_lock};
+
+    m_instanceIds.clear();
+    m_driverKeys.clear();
+    m_panelIds.clear();
+    m_hardwareIds.clear();
+    m_hardwareIdOffsets.clear();
+    m_monitorDeviceIdIndex.clear();
+    m_instanceIdIndex.clear();
+    m_hardwareIdIndex.clear();
+
+    m_hardwareIdOffsets.emplace_back(0);
+
+    for (auto &record : records)
+    {
+        size_t row = m_panelIds.size();
+
+        for (auto &hardwareId : record.HardwareIds)
+        {
+            std::wstring key = NormalizeKey(hardwareId);
+
+            if (!record.DriverKey.empty())
+            {
+                m_monitorDeviceIdIndex.emplace(key + L"\\" + NormalizeKey(record.DriverKey), row);
+            }
+
+            m_hardwareIdIndex.emplace(std::move(key), row);
+            m_hardwareIds.emplace_back(std::move(hardwareId));
+        }
+
+        m_hardwareIdOffsets.emplace_back(m_hardwareIds.size());
+        m_instanceIdIndex.emplace(NormalizeKey(record.InstanceId), row);
+        m_instanceIds.emplace_back(std::move(record.InstanceId));
+        m_driverKeys.emplace_back(std::move(record.DriverKey));
+        m_panelIds.emplace_back(std::move(record.PanelId));
+    }
+
+    m_populated = TRUE;
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT
+DeviceInventory::EnsurePopulated()
+{
+    {
+        std::shared_lock lock{m_lock};
+        if (m_populated)
+        {
+            return ERROR_SUCCESS;
+        }
+    }
+
+    return Refresh();
+}
+
+size_t
+DeviceInventory::GetDeviceCount() const
+{
+    std::shared_lock lock{m_lock};
+    return m_panelIds.size();
+}
+
+std::optional<size_t>
+DeviceInventory::FindByMonitorDeviceId(CONST WCHAR *DeviceId) const
+{
+    std::shared_lock lock{m_lock};
+
+    auto it = m_monitorDeviceIdIndex.find(NormalizeKey(DeviceId));
+    if (it == m_monitorDeviceIdIndex.end())
+    {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+std::optional<size_t>
+DeviceInventory::FindByInstanceId(CONST WCHAR *InstanceId) const
+{
+    std::shared_lock lock{m_lock};
+
+    auto it = m_instanceIdIndex.find(NormalizeKey(InstanceId));
+    if (it == m_instanceIdIndex.end())
+    {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+std::vector<size_t>
+DeviceInventory::FindByHardwareId(CONST WCHAR *HardwareId) const
+{
+    std::vector<size_t> rows;
+    std::shared_lock lock{m_lock};
+
+    auto range = m_hardwareIdIndex.equal_range(NormalizeKey(HardwareId));
+    for (auto it = range.first; it != range.second; it++)
+    {
+        rows.emplace_back(it->second);
+    }
+
+    return rows;
+}
+
+std::wstring
+DeviceInventory::GetInstanceId(size_t row) const
+{
+    std::shared_lock lock{m_lock};
+    return row < m_instanceIds.size() ? m_instanceIds[row] : std::wstring{};
+}
+
+std::wstring
+DeviceInventory::GetPanelId(size_t row) const
+{
+    std::shared_lock lock{m_lock};
+    return row < m_panelIds.size() ? m_panelIds[row] : std::wstring{};
+}
+
+BOOLEAN
+DeviceInventory::IsDeviceBoundToPanelId(CONST WCHAR *DeviceId, CONST WCHAR *DevicePanelId) const
+{
+    std::shared_lock lock{m_lock};
+
+    auto it = m_monitorDeviceIdIndex.find(NormalizeKey(DeviceId));
+    if (it == m_monitorDeviceIdIndex.end())
+    {
+        return FALSE;
+    }
+
+    return lstrcmp(m_panelIds[it->second].c_str(), DevicePanelId) == 0;
+}
\ No newline at end of file
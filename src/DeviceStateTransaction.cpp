@@ -0,0 +1,179 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include <SetupAPI.h>
+#include "DeviceInventory.h"
+#include "DeviceStateTransaction.h"
+#include <algorithm>
+
+VOID
+DeviceStateTransaction::Add(CONST WCHAR *PanelId, CONST WCHAR *HardwareId, BOOLEAN Enable)
+{
+    m_operations.emplace_back(DeviceStateOperation{PanelId, HardwareId, Enable});
+}
+
+BOOLEAN
+DeviceStateTransaction::IsEmpty() const
+{
+    return m_operations.empty();
+}
+
+const std::vector<DeviceStateResult> &
+DeviceStateTransaction::GetResults() const
+{
+    return m_results;
+}
+
+//
+// Subject: Maps every queued operation to the device instances it applies to
+//
+// Returns: TRUE if every operation matched at least one device
+//
+BOOLEAN
+DeviceStateTransaction::ResolveTargets(std::vector<std::pair<std::wstring, BOOLEAN>> &Targets) const
+{
+    DeviceInventory &inventory = DeviceInventory::instance();
+    BOOLEAN resolvedAll = TRUE;
+
+    Targets.clear();
+
+    for (const auto &operation : m_operations)
+    {
+        BOOLEAN resolved = FALSE;
+
+        for (size_t row : inventory.FindByHardwareId(operation.HardwareId.c_str()))
+        {
+            if (inventory.GetPanelId(row) != operation.PanelId)
+            {
+                continue;
+            }
+
+            std::wstring instanceId = inventory.GetInstanceId(row);
+
+            // A later operation on the same device wins
+            auto it = std::find_if(Targets.begin(), Targets.end(), [&](const auto &target) {
+                return target.first == instanceId;
+            });
+
+            if (it != Targets.end())
+            {
+                it->second = operation.Enable;
+            }
+            else
+            {
+                Targets.emplace_back(std::move(instanceId), operation.Enable);
+            }
+
+            resolved = TRUE;
+        }
+
+        resolvedAll = resolvedAll && resolved;
+    }
+
+    return resolvedAll;
+}
+
+//
+// Subject: Applies all queued enablement changes
+//
+// Returns: ERROR_SUCCESS if every matched device changed state
+//
+HRESULT
+DeviceStateTransaction::Commit()
+{
+    HDEVINFO devInfo;
+    SP_DEVINFO_DATA devData{};
+    SP_PROPCHANGE_PARAMS pcParams{};
+    LARGE_INTEGER frequency, start, end;
+    std::vector<std::pair<std::wstring, BOOLEAN>> targets;
+    HRESULT Status = ERROR_SUCCESS;
+
+    m_results.clear();
+
+    if (m_operations.empty())
+    {
+        return ERROR_SUCCESS;
+    }
+
+    Status = DeviceInventory::instance().EnsurePopulated();
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    // Devices may have shown up since the inventory was built
+    if (!ResolveTargets(targets))
+    {
+        if (SUCCEEDED(DeviceInventory::instance().Refresh()))
+        {
+            ResolveTargets(targets);
+        }
+    }
+
+    if (targets.empty())
+    {
+        return ERROR_SUCCESS;
+    }
+
+    if ((devInfo = SetupDiCreateDeviceInfoList(NULL, NULL)) == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    QueryPerformanceFrequency(&frequency);
+
+    pcParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
+    pcParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
+    pcParams.Scope = DICS_FLAG_GLOBAL;
+    pcParams.HwProfile = 0;
+
+    for (const auto &target : targets)
+    {
+        DeviceStateResult result{target.first, target.second, ERROR_SUCCESS, 0};
+
+        QueryPerformanceCounter(&start);
+
+        devData.cbSize = sizeof(SP_DEVINFO_DATA);
+        pcParams.StateChange = target.second ? DICS_ENABLE : DICS_DISABLE;
+
+        if (!SetupDiOpenDeviceInfo(devInfo, target.first.c_str(), NULL, 0, &devData) ||
+            !SetupDiSetClassInstallParams(
+                devInfo, &devData, (PSP_CLASSINSTALL_HEADER)&pcParams, sizeof(SP_PROPCHANGE_PARAMS)) ||
+            !SetupDiChangeState(devInfo, &devData))
+        {
+            result.Status = HRESULT_FROM_WIN32(GetLastError());
+            Status = result.Status;
+        }
+
+        QueryPerformanceCounter(&end);
+        result.DurationMicroseconds = (end.QuadPart - start.QuadPart) * 1000000 / frequency.QuadPart;
+
+        m_results.emplace_back(std::move(result));
+    }
+
+    if (!SetupDiDestroyDeviceInfoList(devInfo))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return Status;
+}
\ No newline at end of file
@@ -0,0 +1,323 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayBindingCache.h"
+#include "ServiceStorage.h"
+#include <algorithm>
+#include <tchar.h>
+
+#define DISPLAY_BINDING_CACHE_FILE_NAME _T("DisplayBindings.bin")
+
+constexpr inline DWORD DISPLAY_BINDING_CACHE_MAGIC = 0x42434453; // SDCB
+constexpr inline WORD DISPLAY_BINDING_CACHE_VERSION = 1;
+constexpr inline WORD DISPLAY_BINDING_CACHE_MAX_ENTRIES = 16;
+
+#pragma pack(push, 1)
+typedef struct _DISPLAY_BINDING_CACHE_HEADER
+{
+    DWORD Magic;
+    WORD Version;
+    WORD EntryCount;
+    DWORD EntrySize;
+} DISPLAY_BINDING_CACHE_HEADER, *PDISPLAY_BINDING_CACHE_HEADER;
+
+typedef struct _DISPLAY_BINDING_CACHE_ENTRY
+{
+    WCHAR PanelId[128];
+    WCHAR AdapterDeviceName[32];
+    WCHAR MonitorDeviceId[128];
+    DWORD AdapterIndex;
+    DWORD HasBestDisplayMode;
+    DEVMODE BestDisplayMode;
+} DISPLAY_BINDING_CACHE_ENTRY, *PDISPLAY_BINDING_CACHE_ENTRY;
+#pragma pack(pop)
+
+DisplayBindingCache &
+DisplayBindingCache::instance()
+{
+    static DisplayBindingCache self;
+    return self;
+}
+
+std::vector<DisplayBinding>::iterator
+DisplayBindingCache::FindByPanelId(CONST WCHAR *PanelId)
+{
+    return std::find_if(m_bindings.begin(), m_bindings.end(), [&](const DisplayBinding &binding) {
+        return binding.PanelId == PanelId;
+    });
+}
+
+std::vector<DisplayBinding>::iterator
+DisplayBindingCache::FindByAdapterDeviceName(CONST WCHAR *AdapterDeviceName)
+{
+    return std::find_if(m_bindings.begin(), m_bindings.end(), [&](const DisplayBinding &binding) {
+        return binding.AdapterDeviceName == AdapterDeviceName;
+    });
+}
+
+HRESULT
+DisplayBindingCache::Load()
+{
+    std::lock_guard lock{m_lock};
+    return LoadLocked();
+}
+
+HRESULT
+DisplayBindingCache::LoadLocked()
+{
+    std::wstring path;
+    DISPLAY_BINDING_CACHE_HEADER header{};
+    DISPLAY_BINDING_CACHE_ENTRY entry{};
+    DWORD bytesRead = 0;
+    std::vector<DisplayBinding> bindings;
+
+    m_loaded = TRUE;
+
+    HRESULT Status = GetServiceDataFilePath(DISPLAY_BINDING_CACHE_FILE_NAME, path);
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    HANDLE file = CreateFile(
+        path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!ReadFile(file, &header, sizeof(header), &bytesRead, NULL) || bytesRead != sizeof(header) ||
+        header.Magic != DISPLAY_BINDING_CACHE_MAGIC || header.Version != DISPLAY_BINDING_CACHE_VERSION ||
+        header.EntrySize != sizeof(DISPLAY_BINDING_CACHE_ENTRY) || header.EntryCount > DISPLAY_BINDING_CACHE_MAX_ENTRIES)
+    {
+        CloseHandle(file);
+        return ERROR_INVALID_DATA;
+    }
+
+    for (WORD i = 0; i < header.EntryCount; i++)
+    {
+        if (!ReadFile(file, &entry, sizeof(entry), &bytesRead, NULL) || bytesRead != sizeof(entry))
+        {
+            CloseHandle(file);
+            return ERROR_INVALID_DATA;
+        }
+
+        // Never trust strings coming from disk to be terminated
+        entry.PanelId[ARRAYSIZE(entry.PanelId) - 1] = L'\0';
+        entry.AdapterDeviceName[ARRAYSIZE(entry.AdapterDeviceName) - 1] = L'\0';
+        entry.MonitorDeviceId[ARRAYSIZE(entry.MonitorDeviceId) - 1] = L'\0';
+
+        DisplayBinding binding{};
+        binding.PanelId = entry.PanelId;
+        binding.AdapterIndex = entry.AdapterIndex;
+        binding.AdapterDeviceName = entry.AdapterDeviceName;
+        binding.MonitorDeviceId = entry.MonitorDeviceId;
+        binding.HasBestDisplayMode = entry.HasBestDisplayMode ? TRUE : FALSE;
+        binding.BestDisplayMode = entry.BestDisplayMode;
+
+        bindings.emplace_back(std::move(binding));
+    }
+
+    CloseHandle(file);
+
+    m_bindings = std::move(bindings);
+    m_dirty = FALSE;
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT
+DisplayBindingCache::Save()
+{
+    std::wstring path;
+    std::wstring temporaryPath;
+    DISPLAY_BINDING_CACHE_HEADER header{};
+    DWORD bytesWritten = 0;
+    BOOL result = TRUE;
+
+    std::lock_guard lock{m_lock};
+
+    if (!m_dirty)
+    {
+        return ERROR_SUCCESS;
+    }
+
+    HRESULT Status = GetServiceDataFilePath(DISPLAY_BINDING_CACHE_FILE_NAME, path);
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    temporaryPath = path + L".tmp";
+
+    HANDLE file =
+        CreateFile(temporaryPath.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    header.Magic = DISPLAY_BINDING_CACHE_MAGIC;
+    header.Version = DISPLAY_BINDING_CACHE_VERSION;
+    header.EntryCount = (WORD)min(m_bindings.size(), (size_t)DISPLAY_BINDING_CACHE_MAX_ENTRIES);
+    header.EntrySize = sizeof(DISPLAY_BINDING_CACHE_ENTRY);
+
+    result = WriteFile(file, &header, sizeof(header), &bytesWritten, NULL);
+
+    for (WORD i = 0; result && i < header.EntryCount; i++)
+    {
+        DISPLAY_BINDING_CACHE_ENTRY entry{};
+        const DisplayBinding &binding = m_bindings[i];
+
+        StringCchCopy(entry.PanelId, ARRAYSIZE(entry.PanelId), binding.PanelId.c_str());
+        StringCchCopy(entry.AdapterDeviceName, ARRAYSIZE(entry.AdapterDeviceName), binding.AdapterDeviceName.c_str());
+        StringCchCopy(entry.MonitorDeviceId, ARRAYSIZE(entry.MonitorDeviceId), binding.MonitorDeviceId.c_str());
+        entry.AdapterIndex = binding.AdapterIndex;
+        entry.HasBestDisplayMode = binding.HasBestDisplayMode;
+        entry.BestDisplayMode = binding.BestDisplayMode;
+
+        result = WriteFile(file, &entry, sizeof(entry), &bytesWritten, NULL);
+    }
+
+    if (!result)
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+        CloseHandle(file);
+        DeleteFile(temporaryPath.c_str());
+        return Status;
+    }
+
+    CloseHandle(file);
+
+    if (!MoveFileEx(temporaryPath.c_str(), path.c_str(), MOVEFILE_REPLACE_EXISTING))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    m_dirty = FALSE;
+
+    return ERROR_SUCCESS;
+}
+
+BOOLEAN
+DisplayBindingCache::Lookup(CONST WCHAR *PanelId, DisplayBinding &Binding)
+{
+    std::lock_guard lock{m_lock};
+
+    if (!m_loaded)
+    {
+        LoadLocked();
+    }
+
+    auto it = FindByPanelId(PanelId);
+    if (it == m_bindings.end())
+    {
+        return FALSE;
+    }
+
+    Binding = *it;
+    return TRUE;
+}
+
+VOID
+DisplayBindingCache::Update(
+    CONST WCHAR *PanelId,
+    DWORD AdapterIndex,
+    CONST DISPLAY_DEVICE &Adapter,
+    CONST DISPLAY_DEVICE &Monitor)
+{
+    std::lock_guard lock{m_lock};
+
+    auto it = FindByPanelId(PanelId);
+    if (it == m_bindings.end())
+    {
+        DisplayBinding binding{};
+        binding.PanelId = PanelId;
+        it = m_bindings.emplace(m_bindings.end(), std::move(binding));
+    }
+    else if (
+        it->AdapterIndex == AdapterIndex && it->AdapterDeviceName == Adapter.DeviceName &&
+        it->MonitorDeviceId == Monitor.DeviceID)
+    {
+        return;
+    }
+
+    // The adapter changed, whatever mode was known for the previous one is meaningless now
+    if (it->AdapterDeviceName != Adapter.DeviceName)
+    {
+        it->HasBestDisplayMode = FALSE;
+    }
+
+    it->AdapterIndex = AdapterIndex;
+    it->AdapterDeviceName = Adapter.DeviceName;
+    it->MonitorDeviceId = Monitor.DeviceID;
+    m_dirty = TRUE;
+}
+
+VOID
+DisplayBindingCache::Remove(CONST WCHAR *PanelId)
+{
+    std::lock_guard lock{m_lock};
+
+    auto it = FindByPanelId(PanelId);
+    if (it != m_bindings.end())
+    {
+        m_bindings.erase(it);
+        m_dirty = TRUE;
+    }
+}
+
+BOOLEAN
+DisplayBindingCache::GetBestDisplayMode(CONST WCHAR *AdapterDeviceName, PDEVMODE DevMode)
+{
+    std::lock_guard lock{m_lock};
+
+    auto it = FindByAdapterDeviceName(AdapterDeviceName);
+    if (it == m_bindings.end() || !it->HasBestDisplayMode)
+    {
+        return FALSE;
+    }
+
+    memcpy(DevMode, &it->BestDisplayMode, sizeof(DEVMODE));
+    return TRUE;
+}
+
+VOID
+DisplayBindingCache::SetBestDisplayMode(CONST WCHAR *AdapterDeviceName, CONST DEVMODE &DevMode)
+{
+    std::lock_guard lock{m_lock};
+
+    auto it = FindByAdapterDeviceName(AdapterDeviceName);
+    if (it == m_bindings.end())
+    {
+        return;
+    }
+
+    if (it->HasBestDisplayMode && memcmp(&it->BestDisplayMode, &DevMode, sizeof(DEVMODE)) == 0)
+    {
+        return;
+    }
+
+    it->HasBestDisplayMode = TRUE;
+    it->BestDisplayMode = DevMode;
+    m_dirty = TRUE;
+}
\ No newline at end of file
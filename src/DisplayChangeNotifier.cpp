@@ -0,0 +1,151 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include <dbt.h>
+#include "DisplayChangeNotifier.h"
+#include <tchar.h>
+
+CONST WCHAR DisplayChangeNotifierClassName[] = _T("SurfaceDisplayConfiguratorDisplayChangeNotifier");
+
+DisplayChangeNotifier &
+DisplayChangeNotifier::instance()
+{
+    static DisplayChangeNotifier self;
+    return self;
+}
+
+DisplayChangeNotifier::DisplayChangeNotifier() : m_thread{[this] { MessageLoop(); }}
+{
+}
+
+DisplayChangeNotifier::~DisplayChangeNotifier()
+{
+    DWORD threadId = m_threadId;
+
+    if (threadId != 0)
+    {
+        PostThreadMessage(threadId, WM_QUIT, 0, 0);
+    }
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+ULONG
+DisplayChangeNotifier::GetDisplayGeneration() const
+{
+    return m_displayGeneration;
+}
+
+ULONG
+DisplayChangeNotifier::GetDeviceGeneration() const
+{
+    return m_deviceGeneration;
+}
+
+BOOLEAN
+DisplayChangeNotifier::WaitForDisplayChange(ULONG Generation, DWORD TimeoutMs)
+{
+    std::unique_lock lock{m_waitLock};
+
+    return m_displayChanged.wait_for(
+        lock, std::chrono::milliseconds(TimeoutMs), [&] { return m_displayGeneration != Generation; });
+}
+
+LRESULT CALLBACK
+DisplayChangeNotifier::WindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM lParam)
+{
+    DisplayChangeNotifier *self = reinterpret_cast<DisplayChangeNotifier *>(GetWindowLongPtr(hwnd, GWLP_USERDATA));
+
+    if (message == WM_NCCREATE)
+    {
+        self = reinterpret_cast<DisplayChangeNotifier *>(reinterpret_cast<LPCREATESTRUCT>(lParam)->lpCreateParams);
+        SetWindowLongPtr(hwnd, GWLP_USERDATA, reinterpret_cast<LONG_PTR>(self));
+    }
+
+    if (self != NULL)
+    {
+        switch (message)
+        {
+        case WM_DISPLAYCHANGE:
+        {
+            std::lock_guard lock{self->m_waitLock};
+            self->m_displayGeneration++;
+            self->m_displayChanged.notify_all();
+            break;
+        }
+        case WM_DEVICECHANGE:
+            if (wParam == DBT_DEVNODES_CHANGED)
+            {
+                self->m_deviceGeneration++;
+            }
+            break;
+        }
+    }
+
+    return DefWindowProc(hwnd, message, wParam, lParam);
+}
+
+VOID
+DisplayChangeNotifier::MessageLoop()
+{
+    WNDCLASSEX windowClass{sizeof(WNDCLASSEX)};
+    MSG msg;
+
+    m_threadId = GetCurrentThreadId();
+
+    windowClass.lpfnWndProc = WindowProc;
+    windowClass.hInstance = GetModuleHandle(NULL);
+    windowClass.lpszClassName = DisplayChangeNotifierClassName;
+
+    RegisterClassEx(&windowClass);
+
+    // Broadcasts are not delivered to message-only windows, this needs to be a hidden top level window
+    HWND window = CreateWindowEx(
+        0,
+        DisplayChangeNotifierClassName,
+        DisplayChangeNotifierClassName,
+        WS_OVERLAPPED,
+        0,
+        0,
+        0,
+        0,
+        NULL,
+        NULL,
+        windowClass.hInstance,
+        this);
+
+    if (window == NULL)
+    {
+        return;
+    }
+
+    while (GetMessage(&msg, NULL, 0, 0) > 0)
+    {
+        TranslateMessage(&msg);
+        DispatchMessage(&msg);
+    }
+
+    DestroyWindow(window);
+}
\ No newline at end of file
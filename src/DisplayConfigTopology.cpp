@@ -0,0 +1,314 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayConfigTopology.h"
+
+static BOOLEAN
+IsSameLuid(CONST LUID &Left, CONST LUID &Right)
+{
+    return Left.LowPart == Right.LowPart && Left.HighPart == Right.HighPart;
+}
+
+static BOOLEAN
+IsPanelPath(CONST DISPLAYCONFIG_PATH_INFO &Path, CONST DisplayConfigPanelSource &Panel)
+{
+    return IsSameLuid(Path.sourceInfo.adapterId, Panel.AdapterId) && Path.sourceInfo.id == Panel.SourceId;
+}
+
+static BOOLEAN
+IsTargetInUse(CONST std::vector<DISPLAYCONFIG_PATH_INFO> &Paths, CONST DISPLAYCONFIG_PATH_TARGET_INFO &Target)
+{
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : Paths)
+    {
+        if (IsSameLuid(path.targetInfo.adapterId, Target.adapterId) && path.targetInfo.id == Target.id)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// Whether another source currently drives the target of Path
+//
+static BOOLEAN
+IsTargetClaimed(CONST DisplayConfigTopology &Current, CONST DISPLAYCONFIG_PATH_INFO &Path)
+{
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : Current.Paths)
+    {
+        BOOLEAN sameTarget = IsSameLuid(path.targetInfo.adapterId, Path.targetInfo.adapterId) &&
+                             path.targetInfo.id == Path.targetInfo.id;
+        BOOLEAN sameSource = IsSameLuid(path.sourceInfo.adapterId, Path.sourceInfo.adapterId) &&
+                             path.sourceInfo.id == Path.sourceInfo.id;
+
+        if ((path.flags & DISPLAYCONFIG_PATH_ACTIVE) && sameTarget && !sameSource)
+        {
+            return TRUE;
+        }
+    }
+
+    return FALSE;
+}
+
+//
+// Copies the mode referenced by ModeIndex over to Target and returns its new index
+//
+static UINT32
+CopyDisplayConfigMode(CONST DisplayConfigTopology &Current, UINT32 ModeIndex, DisplayConfigTopology &Target)
+{
+    if (ModeIndex == DISPLAYCONFIG_PATH_MODE_IDX_INVALID || ModeIndex >= Current.Modes.size())
+    {
+        return DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+    }
+
+    Target.Modes.push_back(Current.Modes[ModeIndex]);
+    return (UINT32)(Target.Modes.size() - 1);
+}
+
+//
+// Subject: Reads every path the display adapters can drive
+//
+// Parameters:
+//
+//             Topology: Receives the paths and modes
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+QueryDisplayConfigTopology(DisplayConfigTopology &Topology)
+{
+    UINT32 pathCount = 0;
+    UINT32 modeCount = 0;
+    LONG Status = ERROR_SUCCESS;
+
+    // The topology can change between sizing and querying, in which case the buffers need to grow again
+    do
+    {
+        Status = GetDisplayConfigBufferSizes(QDC_ALL_PATHS, &pathCount, &modeCount);
+        if (Status != ERROR_SUCCESS)
+        {
+            return Status;
+        }
+
+        Topology.Paths.resize(pathCount);
+        Topology.Modes.resize(modeCount);
+
+        Status = QueryDisplayConfig(
+            QDC_ALL_PATHS, &pathCount, Topology.Paths.data(), &modeCount, Topology.Modes.data(), NULL);
+    } while (Status == ERROR_INSUFFICIENT_BUFFER);
+
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    Topology.Paths.resize(pathCount);
+    Topology.Modes.resize(modeCount);
+
+    return ERROR_SUCCESS;
+}
+
+//
+// Subject: Finds the display configuration source of a GDI display device
+//
+// Parameters:
+//
+//             Topology: The topology from QueryDisplayConfigTopology
+//
+//             GdiDeviceName: The display device name (\\.\DISPLAYn)
+//
+//             Source: Receives the adapter and source identifiers
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+GetDisplayConfigPanelSource(
+    CONST DisplayConfigTopology &Topology,
+    CONST WCHAR *GdiDeviceName,
+    DisplayConfigPanelSource &Source)
+{
+    DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName;
+
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : Topology.Paths)
+    {
+        RtlZeroMemory(&sourceName, sizeof(sourceName));
+        sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+        sourceName.header.size = sizeof(sourceName);
+        sourceName.header.adapterId = path.sourceInfo.adapterId;
+        sourceName.header.id = path.sourceInfo.id;
+
+        if (DisplayConfigGetDeviceInfo(&sourceName.header) != ERROR_SUCCESS)
+        {
+            continue;
+        }
+
+        if (wcscmp(sourceName.viewGdiDeviceName, GdiDeviceName) == 0)
+        {
+            Source.AdapterId = path.sourceInfo.adapterId;
+            Source.SourceId = path.sourceInfo.id;
+            return ERROR_SUCCESS;
+        }
+    }
+
+    return ERROR_NOT_FOUND;
+}
+
+//
+// Subject: Builds the paths and modes realizing a layout plan, without calling into the system
+//
+// Parameters:
+//
+//             Current: The topology from QueryDisplayConfigTopology
+//
+//             Panels: The source each panel is scanned out from
+//
+//             Plan: The layout to realize, the panel modes and the active state are used
+//
+//             Target: Receives the active paths and their modes, ready for SetDisplayConfig
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+BuildDisplayConfigTopology(
+    CONST DisplayConfigTopology &Current,
+    CONST std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> &Panels,
+    CONST TopologyPlan &Plan,
+    DisplayConfigTopology &Target)
+{
+    Target.Paths.clear();
+    Target.Modes.clear();
+
+    // Keep displays which are not panels (external monitors) as they are
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : Current.Paths)
+    {
+        if (!(path.flags & DISPLAYCONFIG_PATH_ACTIVE) || IsPanelPath(path, Panels[0]) ||
+            IsPanelPath(path, Panels[1]))
+        {
+            continue;
+        }
+
+        DISPLAYCONFIG_PATH_INFO kept = path;
+        kept.sourceInfo.modeInfoIdx = CopyDisplayConfigMode(Current, path.sourceInfo.modeInfoIdx, Target);
+        kept.targetInfo.modeInfoIdx = CopyDisplayConfigMode(Current, path.targetInfo.modeInfoIdx, Target);
+        Target.Paths.push_back(kept);
+    }
+
+    for (uint32_t panel = 0; panel < LAYOUT_PANEL_COUNT; panel++)
+    {
+        CONST LayoutPanelPlan &plan = Plan.Panels[panel];
+        CONST DISPLAYCONFIG_PATH_INFO *selected = NULL;
+
+        // Leaving a panel out of the supplied configuration detaches it
+        if (!plan.Active)
+        {
+            continue;
+        }
+
+        // The active path keeps the current target and timing, otherwise take the first free connected target
+        for (CONST DISPLAYCONFIG_PATH_INFO &path : Current.Paths)
+        {
+            if (!IsPanelPath(path, Panels[panel]) || IsTargetInUse(Target.Paths, path.targetInfo) ||
+                IsTargetClaimed(Current, path))
+            {
+                continue;
+            }
+
+            if (path.flags & DISPLAYCONFIG_PATH_ACTIVE)
+            {
+                selected = &path;
+                break;
+            }
+
+            if (selected == NULL && path.targetInfo.targetAvailable)
+            {
+                selected = &path;
+            }
+        }
+
+        if (selected == NULL)
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        DISPLAYCONFIG_PATH_INFO path = *selected;
+        DISPLAYCONFIG_MODE_INFO sourceMode = {};
+
+        path.flags = DISPLAYCONFIG_PATH_ACTIVE;
+        path.targetInfo.rotation = (DISPLAYCONFIG_ROTATION)(DISPLAYCONFIG_ROTATION_IDENTITY + plan.Orientation);
+
+        if (path.sourceInfo.modeInfoIdx != DISPLAYCONFIG_PATH_MODE_IDX_INVALID &&
+            path.sourceInfo.modeInfoIdx < Current.Modes.size())
+        {
+            sourceMode = Current.Modes[path.sourceInfo.modeInfoIdx];
+        }
+        else
+        {
+            sourceMode.infoType = DISPLAYCONFIG_MODE_INFO_TYPE_SOURCE;
+            sourceMode.adapterId = path.sourceInfo.adapterId;
+            sourceMode.id = path.sourceInfo.id;
+            sourceMode.sourceMode.pixelFormat = DISPLAYCONFIG_PIXELFORMAT_32BPP;
+        }
+
+        // Source modes are in desktop space, like the rotated DEVMODE sizes the plan was made from
+        sourceMode.sourceMode.width = plan.Width;
+        sourceMode.sourceMode.height = plan.Height;
+        sourceMode.sourceMode.position.x = plan.X;
+        sourceMode.sourceMode.position.y = plan.Y;
+
+        Target.Modes.push_back(sourceMode);
+        path.sourceInfo.modeInfoIdx = (UINT32)(Target.Modes.size() - 1);
+
+        path.targetInfo.modeInfoIdx = CopyDisplayConfigMode(Current, path.targetInfo.modeInfoIdx, Target);
+        if (path.targetInfo.modeInfoIdx == DISPLAYCONFIG_PATH_MODE_IDX_INVALID)
+        {
+            // No timing known for a panel coming back, let the driver pick its preferred one
+            path.targetInfo.scaling = DISPLAYCONFIG_SCALING_PREFERRED;
+            path.targetInfo.scanLineOrdering = DISPLAYCONFIG_SCANLINE_ORDERING_UNSPECIFIED;
+            path.targetInfo.refreshRate = {0, 0};
+        }
+
+        Target.Paths.push_back(path);
+    }
+
+    return Target.Paths.empty() ? ERROR_INVALID_PARAMETER : ERROR_SUCCESS;
+}
+
+//
+// Subject: Commits a topology built by BuildDisplayConfigTopology in one go
+//
+// Parameters:
+//
+//             Target: The paths and modes to apply
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+ApplyDisplayConfigTopology(DisplayConfigTopology &Target)
+{
+    return SetDisplayConfig(
+        (UINT32)Target.Paths.size(),
+        Target.Paths.data(),
+        (UINT32)Target.Modes.size(),
+        Target.Modes.data(),
+        SDC_APPLY | SDC_USE_SUPPLIED_DISPLAY_CONFIG | SDC_ALLOW_CHANGES | SDC_SAVE_TO_DATABASE);
+}
\ No newline at end of file
@@ -0,0 +1,305 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayChangeNotifier.h"
+#include "DisplayModeCatalog.h"
+#include <algorithm>
+#include <numeric>
+
+BOOL
+EnumDisplaySettingsModeSource::EnumDisplayMode(CONST WCHAR *DeviceName, DWORD ModeIndex, PDEVMODE DevMode)
+{
+    return EnumDisplaySettings(DeviceName, ModeIndex, DevMode);
+}
+
+DisplayModeKey
+DisplayModeCatalog::KeyFromDevMode(const DEVMODE &DevMode)
+{
+    return DisplayModeKey{DevMode.dmPelsHeight, DevMode.dmPelsWidth, DevMode.dmDisplayFrequency, DevMode.dmBitsPerPel};
+}
+
+HRESULT
+DisplayModeCatalog::Build(CONST WCHAR *DeviceName, DisplayModeSource &Source)
+{
+    std::vector<DEVMODE> modes;
+    std::vector<size_t> order;
+    DEVMODE deviceMode;
+
+    RtlZeroMemory(&deviceMode, sizeof(DEVMODE));
+    deviceMode.dmSize = sizeof(DEVMODE);
+
+    for (DWORD i = 0; Source.EnumDisplayMode(DeviceName, i, &deviceMode); i++)
+    {
+        modes.emplace_back(deviceMode);
+    }
+
+    order.resize(modes.size());
+    std::iota(order.begin(), order.end(), 0);
+
+    // Stable so that the first mode reported by the driver is kept amongst identical keys
+    std::stable_sort(order.begin(), order.end(), [&](size_t left, size_t right) {
+        return KeyFromDevMode(modes[left]) < KeyFromDevMode(modes[right]);
+    });
+
+    m_keys.clear();
+    m_modes.clear();
+    m_keys.reserve(order.size());
+    m_modes.reserve(order.size());
+
+    for (size_t index : order)
+    {
+        DisplayModeKey key = KeyFromDevMode(modes[index]);
+
+        if (!m_keys.empty() && m_keys.back() == key)
+        {
+            continue;
+        }
+
+        m_keys.emplace_back(key);
+        m_modes.emplace_back(modes[index]);
+    }
+
+    return m_keys.empty() ? ERROR_NOT_FOUND : ERROR_SUCCESS;
+}
+
+BOOLEAN
+DisplayModeCatalog::IsEmpty() const
+{
+    return m_keys.empty();
+}
+
+size_t
+DisplayModeCatalog::GetModeCount() const
+{
+    return m_keys.size();
+}
+
+const DisplayModeKey &
+DisplayModeCatalog::GetKey(size_t Index) const
+{
+    return m_keys[Index];
+}
+
+const DEVMODE &
+DisplayModeCatalog::GetMode(size_t Index) const
+{
+    return m_modes[Index];
+}
+
+std::optional<size_t>
+DisplayModeCatalog::Find(const DisplayModeKey &Key) const
+{
+    auto it = std::lower_bound(m_keys.begin(), m_keys.end(), Key);
+    if (it == m_keys.end() || !(*it == Key))
+    {
+        return std::nullopt;
+    }
+
+    return (size_t)(it - m_keys.begin());
+}
+
+//
+// Subject: Finds the highest refresh rate mode of a given resolution
+//
+std::optional<size_t>
+DisplayModeCatalog::FindBestForResolution(DWORD Width, DWORD Height) const
+{
+    // Keys of the same resolution are contiguous and sorted by ascending refresh rate,
+    // the best one is right before the first key of the next resolution
+    auto it = std::upper_bound(m_keys.begin(), m_keys.end(), DisplayModeKey{Height, Width, MAXDWORD, MAXDWORD});
+    if (it == m_keys.begin())
+    {
+        return std::nullopt;
+    }
+
+    it--;
+    if (it->Height != Height || it->Width != Width)
+    {
+        return std::nullopt;
+    }
+
+    return (size_t)(it - m_keys.begin());
+}
+
+std::optional<size_t>
+MaxResolutionDisplayModePolicy::Select(const DisplayModeCatalog &Catalog) const
+{
+    if (Catalog.IsEmpty())
+    {
+        return std::nullopt;
+    }
+
+    return Catalog.GetModeCount() - 1;
+}
+
+std::optional<size_t>
+MaxRefreshDisplayModePolicy::Select(const DisplayModeCatalog &Catalog) const
+{
+    std::optional<size_t> best;
+
+    // Ties go to the later, larger, mode
+    for (size_t i = 0; i < Catalog.GetModeCount(); i++)
+    {
+        if (!best || Catalog.GetKey(i).Frequency >= Catalog.GetKey(*best).Frequency)
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+MatchDisplayModePolicy::MatchDisplayModePolicy(const DEVMODE &Reference) :
+    m_reference(DisplayModeCatalog::KeyFromDevMode(Reference))
+{
+}
+
+std::optional<size_t>
+MatchDisplayModePolicy::Select(const DisplayModeCatalog &Catalog) const
+{
+    std::optional<size_t> match = Catalog.Find(m_reference);
+
+    if (!match)
+    {
+        match = Catalog.FindBestForResolution(m_reference.Width, m_reference.Height);
+    }
+
+    // The reference panel may be rotated compared to the one being looked up
+    if (!match)
+    {
+        match = Catalog.Find(
+            DisplayModeKey{m_reference.Width, m_reference.Height, m_reference.Frequency, m_reference.BitsPerPel});
+    }
+
+    if (!match)
+    {
+        match = Catalog.FindBestForResolution(m_reference.Height, m_reference.Width);
+    }
+
+    if (!match)
+    {
+        match = MaxResolutionDisplayModePolicy().Select(Catalog);
+    }
+
+    return match;
+}
+
+RefreshRateDisplayModePolicy::RefreshRateDisplayModePolicy(const DEVMODE &Reference, BOOLEAN Highest) :
+    m_reference(DisplayModeCatalog::KeyFromDevMode(Reference)), m_highest(Highest)
+{
+}
+
+std::optional<size_t>
+RefreshRateDisplayModePolicy::Select(const DisplayModeCatalog &Catalog) const
+{
+    std::optional<size_t> best;
+
+    for (size_t i = 0; i < Catalog.GetModeCount(); i++)
+    {
+        const DisplayModeKey &key = Catalog.GetKey(i);
+        BOOLEAN sameResolution = (key.Width == m_reference.Width && key.Height == m_reference.Height) ||
+                                 (key.Width == m_reference.Height && key.Height == m_reference.Width);
+
+        if (!sameResolution || key.BitsPerPel != m_reference.BitsPerPel)
+        {
+            continue;
+        }
+
+        if (!best || (m_highest ? key.Frequency > Catalog.GetKey(*best).Frequency
+                                : key.Frequency < Catalog.GetKey(*best).Frequency))
+        {
+            best = i;
+        }
+    }
+
+    return best;
+}
+
+DisplayModeCatalogs &
+DisplayModeCatalogs::instance()
+{
+    static EnumDisplaySettingsModeSource source;
+    static DisplayModeCatalogs self(source);
+    return self;
+}
+
+DisplayModeCatalogs::DisplayModeCatalogs(DisplayModeSource &Source) : m_source(Source)
+{
+}
+
+VOID
+DisplayModeCatalogs::Invalidate()
+{
+    std::lock_guard lock{m_lock};
+    m_catalogs.clear();
+}
+
+//
+// Subject: Selects a display mode for a display device
+//
+// Parameters:
+//
+//             DeviceName: The GDI name of the display device
+//
+//             Policy: The policy picking the mode
+//
+//             DevMode: The selected mode
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT
+DisplayModeCatalogs::SelectDisplayMode(CONST WCHAR *DeviceName, const DisplayModePolicy &Policy, PDEVMODE DevMode)
+{
+    std::lock_guard lock{m_lock};
+
+    // Mode lists only change when monitors or adapters come and go, mode sets do not affect them
+    ULONG deviceGeneration = DisplayChangeNotifier::instance().GetDeviceGeneration();
+    if (deviceGeneration != m_deviceGeneration)
+    {
+        m_catalogs.clear();
+        m_deviceGeneration = deviceGeneration;
+    }
+
+    auto it = m_catalogs.find(DeviceName);
+    if (it == m_catalogs.end())
+    {
+        DisplayModeCatalog catalog;
+
+        HRESULT Status = catalog.Build(DeviceName, m_source);
+        if (Status != ERROR_SUCCESS)
+        {
+            return Status;
+        }
+
+        it = m_catalogs.emplace(DeviceName, std::move(catalog)).first;
+    }
+
+    std::optional<size_t> index = Policy.Select(it->second);
+    if (!index)
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    memcpy(DevMode, &it->second.GetMode(*index), sizeof(DEVMODE));
+
+    return ERROR_SUCCESS;
+}
\ No newline at end of file
@@ -23,10 +23,26 @@
 #include <SetupAPI.h>
 #include <Devpkey.h>
 #include "DeviceProperties.h"
+#include "DeviceInventory.h"
+#include "DisplayBindingCache.h"
+#include "DisplayModeCatalog.h"
+#include "DisplayChangeNotifier.h"
+#include "DisplayLayoutPlanner.h"
+#include "DisplayConfigTopology.h"
+#include "DisplayTransitionJobs.h"
+#include "DisplayTransitionScheduler.h"
+#include "DisplaySettleWaiter.h"
+#include "DisplayTargetInventory.h"
+#include "SpanTracer.h"
 #include "AutoRotationApiPort.h"
 #include "WorkAreas.h"
 #include "DisplayRotationManager.h"
 #include <tchar.h>
+#include <atomic>
+#include <mutex>
+#include <optional>
+
+#define DIGITIZER_HARDWARE_ID _T("HID_DEVICE_UP:000D_U:000F")
 
 //
 // Subject: Gets a display device
@@ -64,224 +80,108 @@ GetDisplayDeviceById(DWORD PanelId, PDISPLAY_DEVICE DisplayDevice, PDISPLAY_DEVI
 BOOLEAN WINAPI
 IsDeviceBoundToPanelId(CONST WCHAR *DeviceName, CONST WCHAR *DevicePanelId)
 {
-    HDEVINFO devInfo;
-    DWORD dwBuffersize;
-    SP_DEVINFO_DATA devData{};
-    DEVPROPTYPE devProptype;
-    LPWSTR devBuffer;
-    DWORD i = 0;
-    SP_CLASSINSTALL_HEADER ciHeader{};
-    SP_PROPCHANGE_PARAMS pcParams{};
-
-    if ((devInfo = SetupDiGetClassDevs(NULL, NULL, NULL, DIGCF_ALLCLASSES)) == NULL)
+    if (FAILED(DeviceInventory::instance().EnsurePopulated()))
     {
         return FALSE;
     }
 
-    devData.cbSize = sizeof(SP_DEVINFO_DATA);
-
-    while (TRUE)
-    {
-        SetupDiEnumDeviceInfo(devInfo, i++, &devData);
-        if (GetLastError() == ERROR_NO_MORE_ITEMS)
-        {
-            break;
-        }
-
-        SetupDiGetDeviceProperty(
-            devInfo, &devData, &DEVPKEY_Device_HardwareIds, &devProptype, NULL, 0, &dwBuffersize, 0);
-
-        if ((devBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, dwBuffersize)) == NULL)
-        {
-            continue;
-        }
-
-        if (!SetupDiGetDeviceProperty(
-                devInfo, &devData, &DEVPKEY_Device_HardwareIds, &devProptype, (PBYTE)devBuffer, dwBuffersize, NULL, 0))
-        {
-            continue;
-        }
-
-        SIZE_T index = 0;
-        SIZE_T length = wcslen(devBuffer);
-        SIZE_T lengthDeviceName = wcslen(DeviceName);
-        BOOLEAN match = FALSE;
-
-        while (length > 0)
-        {
-            if (index >= dwBuffersize)
-            {
-                break;
-            }
-
-            match = memcmp(DeviceName, devBuffer + index, min(lengthDeviceName, length) * sizeof(WCHAR)) == 0;
-
-            if (match)
-            {
-                break;
-            }
-
-            index += length + 1;
-
-            if (index >= dwBuffersize)
-            {
-                break;
-            }
-
-            length = wcslen(devBuffer + index);
-        }
-
-        if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-        {
-            continue;
-        }
-
-        if (!match)
-        {
-            continue;
-        }
-
-        SIZE_T DeviceNameOffset = length + 1;
-
-        SetupDiGetDeviceProperty(devInfo, &devData, &DEVPKEY_Device_Driver, &devProptype, NULL, 0, &dwBuffersize, 0);
-
-        if ((devBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, dwBuffersize)) == NULL)
-        {
-            continue;
-        }
-
-        if (!SetupDiGetDeviceProperty(
-                devInfo, &devData, &DEVPKEY_Device_Driver, &devProptype, (PBYTE)devBuffer, dwBuffersize, NULL, 0))
-        {
-            continue;
-        }
-
-        index = 0;
-        length = wcslen(devBuffer);
-        match = FALSE;
-
-        while (length > 0)
-        {
-            if (index >= dwBuffersize)
-            {
-                break;
-            }
-
-            match = memcmp(
-                        DeviceName + DeviceNameOffset,
-                        devBuffer + index,
-                        min(lengthDeviceName - DeviceNameOffset, length) * sizeof(WCHAR)) == 0;
-
-            if (match)
-            {
-                break;
-            }
-
-            index += length + 1;
+    return DeviceInventory::instance().IsDeviceBoundToPanelId(DeviceName, DevicePanelId);
+}
 
-            if (index >= dwBuffersize)
-            {
-                break;
-            }
+//
+// Subject: Gets a display device
+//
+// Parameters:
+//
+//			   DevicePanelId: The Panel Container Identifier
+//
+//             DisplayDevice: The corresponding display device
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+GetDisplayDeviceByPanelId(CONST WCHAR *DevicePanelId, PDISPLAY_DEVICE DisplayDevice)
+{
+    DISPLAY_DEVICE DisplayDevice2 = {0};
+    DisplayBinding binding;
+    DisplayTargetRecord target;
 
-            length = wcslen(devBuffer + index);
-        }
+    // The display target inventory answers from memory until the next display change or mode set
+    if (DisplayTargetInventory::instance().Lookup(DevicePanelId, target) == ERROR_SUCCESS)
+    {
+        RtlZeroMemory(DisplayDevice, sizeof(DISPLAY_DEVICE));
+        DisplayDevice->cb = sizeof(DISPLAY_DEVICE);
+        DisplayDevice->StateFlags = (target.Active ? DISPLAY_DEVICE_ATTACHED_TO_DESKTOP : 0) |
+                                    (target.Primary ? DISPLAY_DEVICE_PRIMARY_DEVICE : 0);
+        StringCchCopy(DisplayDevice->DeviceName, ARRAYSIZE(DisplayDevice->DeviceName), target.GdiDeviceName.c_str());
 
-        if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-        {
-            continue;
-        }
+        return ERROR_SUCCESS;
+    }
 
-        if (!match)
+    // Try the last known binding first, it only costs a single adapter lookup to confirm it
+    if (DisplayBindingCache::instance().Lookup(DevicePanelId, binding))
+    {
+        if (SUCCEEDED(GetDisplayDeviceById(binding.AdapterIndex, DisplayDevice, &DisplayDevice2)) &&
+            binding.AdapterDeviceName == DisplayDevice->DeviceName &&
+            lstrcmpi(binding.MonitorDeviceId.c_str(), DisplayDevice2.DeviceID) == 0)
         {
-            continue;
+            return ERROR_SUCCESS;
         }
 
-        SetupDiGetDeviceProperty(devInfo, &devData, &DEVPKEY_Device_PanelId, &devProptype, NULL, 0, &dwBuffersize, 0);
-
-        if ((devBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, dwBuffersize)) == NULL)
-        {
-            continue;
-        }
+        DisplayBindingCache::instance().Remove(DevicePanelId);
+    }
 
-        if (!SetupDiGetDeviceProperty(
-                devInfo, &devData, &DEVPKEY_Device_PanelId, &devProptype, (PBYTE)devBuffer, dwBuffersize, NULL, 0))
-        {
-            continue;
-        }
+    for (DWORD attempt = 0; attempt < 2; attempt++)
+    {
+        DWORD i = 0;
 
-        if (lstrcmp(devBuffer, DevicePanelId))
+        while (SUCCEEDED(GetDisplayDeviceById(i, DisplayDevice, &DisplayDevice2)))
         {
-            if (!HeapFree(GetProcessHeap(), 0, devBuffer))
+            if (IsDeviceBoundToPanelId(DisplayDevice2.DeviceID, DevicePanelId))
             {
-                continue;
+                DisplayBindingCache::instance().Update(DevicePanelId, i, *DisplayDevice, DisplayDevice2);
+                DisplayBindingCache::instance().Save();
+                return ERROR_SUCCESS;
             }
 
-            continue;
-        }
-
-        if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-        {
-            continue;
+            i++;
         }
 
-        if (!SetupDiDestroyDeviceInfoList(devInfo))
+        // The device inventory may be stale (devnode arrival, driver reinstall), rebuild it once and retry
+        if (attempt == 0 && FAILED(DeviceInventory::instance().Refresh()))
         {
-            return FALSE;
+            break;
         }
-
-        return TRUE;
-    }
-
-    if (!SetupDiDestroyDeviceInfoList(devInfo))
-    {
-        return FALSE;
     }
 
-    return FALSE;
+    return ERROR_NOT_FOUND;
 }
 
 //
-// Subject: Gets a display device
+// Subject: Gets the display mode to use for a display device
 //
 // Parameters:
 //
-//			   DevicePanelId: The Panel Container Identifier
+//             DisplayDevice: The display device
 //
-//             DisplayDevice: The corresponding display device
+//             deviceMode: The current mode if the device is attached, the mode picked by the policy otherwise
+//
+//             Policy: The policy picking a mode for detached devices, the maximum resolution if NULL
 //
 // Returns: ERROR_SUCCESS if successful
 //
 HRESULT WINAPI
-GetDisplayDeviceByPanelId(CONST WCHAR *DevicePanelId, PDISPLAY_DEVICE DisplayDevice)
-{
-    DWORD i = 0;
-    DISPLAY_DEVICE DisplayDevice2 = {0};
-
-    while (SUCCEEDED(GetDisplayDeviceById(i++, DisplayDevice, &DisplayDevice2)))
-    {
-        if (IsDeviceBoundToPanelId(DisplayDevice2.DeviceID, DevicePanelId))
-        {
-            return ERROR_SUCCESS;
-        }
-    }
-
-    return ERROR_NOT_FOUND;
-}
-
-HRESULT WINAPI
-GetDisplayDeviceBestDisplayMode(PDISPLAY_DEVICE DisplayDevice, PDEVMODE deviceMode)
+GetDisplayDeviceBestDisplayMode(
+    PDISPLAY_DEVICE DisplayDevice,
+    PDEVMODE deviceMode,
+    CONST DisplayModePolicy *Policy = NULL)
 {
-    DWORD i = 0;
-    DWORD maxHeightSeen = 0;
-    DEVMODE deviceMode2;
+    static CONST MaxResolutionDisplayModePolicy DefaultPolicy;
+    HRESULT Status = ERROR_SUCCESS;
 
     RtlZeroMemory(deviceMode, sizeof(DEVMODE));
     deviceMode->dmSize = sizeof(DEVMODE);
 
-    RtlZeroMemory(&deviceMode2, sizeof(DEVMODE));
-    deviceMode2.dmSize = sizeof(DEVMODE);
-
     if (DisplayDevice->StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP)
     {
         if (!EnumDisplaySettings(DisplayDevice->DeviceName, ENUM_CURRENT_SETTINGS, deviceMode))
@@ -293,202 +193,539 @@ GetDisplayDeviceBestDisplayMode(PDISPLAY_DEVICE DisplayDevice, PDEVMODE deviceMo
     }
     else
     {
-        while (TRUE)
+        // The persisted mode was picked using the default policy
+        if (Policy == NULL && DisplayBindingCache::instance().GetBestDisplayMode(DisplayDevice->DeviceName, deviceMode))
         {
-            if (!EnumDisplaySettings(DisplayDevice->DeviceName, i, &deviceMode2))
-            {
-                break;
-            }
-
-            if (deviceMode2.dmPelsHeight > maxHeightSeen)
-            {
-                maxHeightSeen = deviceMode2.dmPelsHeight;
-                memcpy(deviceMode, &deviceMode2, sizeof(DEVMODE));
-            }
+            return ERROR_SUCCESS;
+        }
 
-            i++;
+        Status = DisplayModeCatalogs::instance().SelectDisplayMode(
+            DisplayDevice->DeviceName, Policy != NULL ? *Policy : DefaultPolicy, deviceMode);
+        if (Status != ERROR_SUCCESS)
+        {
+            return Status;
         }
 
-        if (maxHeightSeen == 0)
+        if (Policy == NULL)
         {
-            return ERROR_NOT_FOUND;
+            DisplayBindingCache::instance().SetBestDisplayMode(DisplayDevice->DeviceName, *deviceMode);
+            DisplayBindingCache::instance().Save();
         }
 
         return ERROR_SUCCESS;
     }
 }
 
+//
+// Subject: Gets the display modes to use for both panels, a panel coming back
+//          matches the mode of the panel which stayed on
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+GetDisplayDevicesBestDisplayModes(
+    PDISPLAY_DEVICE DisplayDevice1,
+    PDISPLAY_DEVICE DisplayDevice2,
+    PDEVMODE DevMode1,
+    PDEVMODE DevMode2)
+{
+    BOOLEAN attached1 = (DisplayDevice1->StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP) != 0;
+    BOOLEAN attached2 = (DisplayDevice2->StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP) != 0;
+    HRESULT Status = ERROR_SUCCESS;
+
+    if (attached1 == attached2)
+    {
+        Status = GetDisplayDeviceBestDisplayMode(DisplayDevice1, DevMode1);
+        if (Status != ERROR_SUCCESS)
+        {
+            return Status;
+        }
+
+        return GetDisplayDeviceBestDisplayMode(DisplayDevice2, DevMode2);
+    }
+
+    PDISPLAY_DEVICE attachedDevice = attached1 ? DisplayDevice1 : DisplayDevice2;
+    PDISPLAY_DEVICE detachedDevice = attached1 ? DisplayDevice2 : DisplayDevice1;
+    PDEVMODE attachedMode = attached1 ? DevMode1 : DevMode2;
+    PDEVMODE detachedMode = attached1 ? DevMode2 : DevMode1;
+
+    Status = GetDisplayDeviceBestDisplayMode(attachedDevice, attachedMode);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    MatchDisplayModePolicy policy(*attachedMode);
+    return GetDisplayDeviceBestDisplayMode(detachedDevice, detachedMode, &policy);
+}
+
+//
+// Subject: Gets the physical location of a panel
+//
+// Parameters:
+//
+//             InstanceId: The instance id of the monitor devnode of the panel
+//
+//             Pld: The _PLD buffer of the panel
+//
+// Returns: ERROR_SUCCESS if successful
+//
 HRESULT WINAPI
-GetDisplayDevicePLD(CONST WCHAR *DeviceName, PACPI_PLD_V2_BUFFER Pld)
+GetDisplayDevicePLD(CONST WCHAR *InstanceId, PACPI_PLD_V2_BUFFER Pld)
 {
     HDEVINFO DeviceInfo = INVALID_HANDLE_VALUE;
     SP_DEVINFO_DATA devData = {0};
     DEVPROPTYPE devProptype;
+    BYTE buffer[64] = {0};
+    DWORD requiredSize = 0;
 
-    if (!SetupDiOpenDeviceInfo(DeviceInfo, DeviceName, NULL, 0, NULL))
+    DeviceInfo = SetupDiCreateDeviceInfoList(NULL, NULL);
+    if (DeviceInfo == INVALID_HANDLE_VALUE)
     {
-        return ERROR_NOT_FOUND;
+        return HRESULT_FROM_WIN32(GetLastError());
     }
 
     devData.cbSize = sizeof(SP_DEVINFO_DATA);
 
+    if (!SetupDiOpenDeviceInfo(DeviceInfo, InstanceId, NULL, 0, &devData))
+    {
+        SetupDiDestroyDeviceInfoList(DeviceInfo);
+
+        return ERROR_NOT_FOUND;
+    }
+
+    // Firmware may hand out a longer buffer than revision 2, only the common part is of interest
     if (!SetupDiGetDeviceProperty(
             DeviceInfo,
             &devData,
             &DEVPKEY_Device_PhysicalDeviceLocation,
             &devProptype,
-            (PBYTE)Pld,
-            sizeof(ACPI_PLD_V2_BUFFER),
-            NULL,
-            0))
+            buffer,
+            sizeof(buffer),
+            &requiredSize,
+            0) ||
+        devProptype != DEVPROP_TYPE_BINARY || requiredSize < sizeof(ACPI_PLD_V2_BUFFER))
     {
         SetupDiDestroyDeviceInfoList(DeviceInfo);
 
-        return ERROR_NOT_ENOUGH_MEMORY;
+        return ERROR_NOT_FOUND;
     }
 
     SetupDiDestroyDeviceInfoList(DeviceInfo);
 
+    RtlCopyMemory(Pld, buffer, sizeof(ACPI_PLD_V2_BUFFER));
+
     return ERROR_SUCCESS;
 }
 
 //
-// Subject: Sets a device enablement state based on its panel id attachment
+// Subject: Gets where the first panel physically sits next to the second one
 //
 // Parameters:
 //
-//			   devicePanelId: The Panel Container Identifier
-//
-//             deviceHardwareId: The corresponding compatible hardware id to toggle
-//
-//             enabledState: The enablement state for such device, if found
+//             DisplayPanelId1, DisplayPanelId2: The Panel Container Identifiers, already bound to a display
 //
-// Returns: ERROR_SUCCESS if successful
+// Returns: The side, read from the panels _PLD once and remembered from then on
 //
-HRESULT WINAPI
-SetHardwareEnabledStateForPanel(CONST WCHAR *devicePanelId, CONST WCHAR *deviceHardwareId, BOOLEAN enabledState)
+LayoutPanelSide WINAPI
+GetFirstPanelSide(CONST WCHAR *DisplayPanelId1, CONST WCHAR *DisplayPanelId2)
 {
-    HDEVINFO devInfo;
-    DWORD dwBuffersize;
-    SP_DEVINFO_DATA devData{};
-    DEVPROPTYPE devProptype;
-    LPWSTR devBuffer;
-    DWORD i = 0;
-    SP_CLASSINSTALL_HEADER ciHeader{};
-    SP_PROPCHANGE_PARAMS pcParams{};
+    static std::mutex lock;
+    static std::optional<LayoutPanelSide> firstPanelSide;
+    CONST WCHAR *panelIds[LAYOUT_PANEL_COUNT] = {DisplayPanelId1, DisplayPanelId2};
+    LayoutPanelLocation locations[LAYOUT_PANEL_COUNT] = {};
+    std::lock_guard guard{lock};
 
-    if ((devInfo = SetupDiGetClassDevs(NULL, NULL, NULL, DIGCF_ALLCLASSES)) == NULL)
+    if (firstPanelSide)
     {
-        return HRESULT_FROM_WIN32(GetLastError());
+        return *firstPanelSide;
     }
 
-    devData.cbSize = sizeof(SP_DEVINFO_DATA);
-
-    while (TRUE)
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
     {
-        SetupDiEnumDeviceInfo(devInfo, i++, &devData);
-        if (GetLastError() == ERROR_NO_MORE_ITEMS)
+        DisplayTargetRecord target;
+        ACPI_PLD_V2_BUFFER pld = {0};
+
+        if (DisplayTargetInventory::instance().Lookup(panelIds[i], target) != ERROR_SUCCESS)
         {
-            break;
+            // Not resolved yet, try again on the next transition
+            return LayoutPanelSide::Left;
         }
 
-        SetupDiGetDeviceProperty(
-            devInfo, &devData, &DEVPKEY_Device_HardwareIds, &devProptype, NULL, 0, &dwBuffersize, 0);
+        // Panels without a _PLD are reported on an unknown surface, which leaves the historical layout
+        locations[i].Panel = 0xFF;
 
-        if ((devBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, dwBuffersize)) == NULL)
+        if (GetDisplayDevicePLD(target.InstanceId.c_str(), &pld) == ERROR_SUCCESS)
         {
-            continue;
+            locations[i] = LayoutPanelLocation{(uint8_t)pld.Panel, pld.HorizontalOffset, pld.VerticalOffset};
         }
+    }
 
-        if (!SetupDiGetDeviceProperty(
-                devInfo, &devData, &DEVPKEY_Device_HardwareIds, &devProptype, (PBYTE)devBuffer, dwBuffersize, NULL, 0))
-        {
-            continue;
-        }
+    firstPanelSide = ComputeFirstPanelSide(locations[0], locations[1]);
+    return *firstPanelSide;
+}
+
+struct
+{
+    std::atomic<ULONG64> ExecutedModeSets;
+    std::atomic<ULONG64> ElidedModeSets;
+    std::atomic<ULONG64> SkippedTransitions;
+} g_TopologyApplyCounters;
+
+VOID WINAPI
+GetTopologyApplyCounters(PTOPOLOGY_APPLY_COUNTERS Counters)
+{
+    Counters->ExecutedModeSets = g_TopologyApplyCounters.ExecutedModeSets;
+    Counters->ElidedModeSets = g_TopologyApplyCounters.ElidedModeSets;
+    Counters->SkippedTransitions = g_TopologyApplyCounters.SkippedTransitions;
+}
+
+//
+// Subject: Executes a display layout plan
+//
+// Parameters:
+//
+//             Plan: The plan computed by PlanDisplayLayout
+//
+//             DisplayDevices: The display device of each panel
+//
+//             DevModes: The mode of each panel, updated with the planned layout
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+ApplyTopologyPlan(CONST TopologyPlan &Plan, PDISPLAY_DEVICE DisplayDevices[], PDEVMODE DevModes[])
+{
+    HRESULT Status = ERROR_SUCCESS;
+
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
+    {
+        CONST LayoutPanelPlan &panel = Plan.Panels[i];
+
+        DevModes[i]->dmPelsWidth = panel.Width;
+        DevModes[i]->dmPelsHeight = panel.Height;
+        DevModes[i]->dmPosition.x = panel.X;
+        DevModes[i]->dmPosition.y = panel.Y;
+        DevModes[i]->dmDisplayOrientation = panel.Orientation;
+    }
 
-        SIZE_T index = 0;
-        SIZE_T length = wcslen(devBuffer);
-        BOOLEAN match = FALSE;
+    for (uint32_t i = 0; i < Plan.StepCount; i++)
+    {
+        CONST LayoutStep &step = Plan.Steps[i];
+        DWORD flags = CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET;
+        uint64_t stepStart = SpanTracer::Now();
 
-        while (length > 0)
+        switch (step.Kind)
         {
-            match = lstrcmp(devBuffer + index, deviceHardwareId) == 0;
-            if (match)
+        case LayoutStepKind::SetPrimaryMode:
+            flags |= CDS_SET_PRIMARY;
+            [[fallthrough]];
+        case LayoutStepKind::SetMode:
+        case LayoutStepKind::Detach:
+            if (ChangeDisplaySettingsEx(
+                    DisplayDevices[step.Panel]->DeviceName, DevModes[step.Panel], NULL, flags, NULL) !=
+                DISP_CHANGE_SUCCESSFUL)
             {
-                break;
+                return HRESULT_FROM_WIN32(GetLastError());
             }
-
-            index += length + 1;
-            length = wcslen(devBuffer + index);
+            SpanTracer::instance().EndPhase("ChangeDisplaySettingsEx", stepStart);
+            break;
+        case LayoutStepKind::NotifyRotation:
+            Status = NotifyAutoRotationAlpcPortOfOrientationChange(Plan.NotifyOrientation);
+            if (FAILED(Status))
+            {
+                return Status;
+            }
+            SpanTracer::instance().EndPhase("NotifyRotation", stepStart);
+            break;
+        case LayoutStepKind::Commit:
+            if (ChangeDisplaySettingsEx(NULL, NULL, NULL, 0, NULL) != DISP_CHANGE_SUCCESSFUL)
+            {
+                return HRESULT_FROM_WIN32(GetLastError());
+            }
+            SpanTracer::instance().EndPhase("CommitDisplaySettings", stepStart);
+            break;
         }
+    }
 
-        if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-        {
-            continue;
-        }
+    return Status;
+}
 
-        if (!match)
-        {
-            continue;
-        }
+//
+// Subject: Realizes the panel layout of a plan with a single SetDisplayConfig call
+//
+// Parameters:
+//
+//             Plan: The plan computed by PlanDisplayLayout
+//
+//             DisplayDevices: The display device of each panel
+//
+// Returns: ERROR_SUCCESS if successful, nothing was changed otherwise
+//
+HRESULT WINAPI
+ApplyTopologyPlanSingleShot(CONST TopologyPlan &Plan, PDISPLAY_DEVICE DisplayDevices[])
+{
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> sources{};
+    HRESULT Status = ERROR_SUCCESS;
+
+    Status = QueryDisplayConfigTopology(current);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
 
-        SetupDiGetDeviceProperty(devInfo, &devData, &DEVPKEY_Device_PanelId, &devProptype, NULL, 0, &dwBuffersize, 0);
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
+    {
+        DisplayTargetRecord panel;
 
-        if ((devBuffer = (LPWSTR)HeapAlloc(GetProcessHeap(), 0, dwBuffersize)) == NULL)
+        if (DisplayTargetInventory::instance().LookupByGdiDeviceName(DisplayDevices[i]->DeviceName, panel) ==
+            ERROR_SUCCESS)
         {
+            sources[i] = panel.Source;
             continue;
         }
 
-        if (!SetupDiGetDeviceProperty(
-                devInfo, &devData, &DEVPKEY_Device_PanelId, &devProptype, (PBYTE)devBuffer, dwBuffersize, NULL, 0))
+        Status = GetDisplayConfigPanelSource(current, DisplayDevices[i]->DeviceName, sources[i]);
+        if (Status != ERROR_SUCCESS)
         {
-            continue;
+            return Status;
         }
+    }
 
-        if (lstrcmp(devBuffer, devicePanelId))
-        {
-            if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-            {
-                continue;
-            }
+    Status = BuildDisplayConfigTopology(current, sources, Plan, target);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
 
-            continue;
-        }
+    return ApplyDisplayConfigTopology(target);
+}
 
-        if (!HeapFree(GetProcessHeap(), 0, devBuffer))
-        {
-            continue;
-        }
+//
+// The resolved devices, modes and layout plan of a transition
+//
+struct StagedDisplayStates
+{
+    std::wstring PanelId1;
+    std::wstring PanelId2;
+    INT Orientation1;
+    INT Orientation2;
+    BOOLEAN State1;
+    BOOLEAN State2;
+    ULONG DisplayGeneration;
+    ULONG DeviceGeneration;
+    uint64_t PrepareMicroseconds;
+    DISPLAY_DEVICE DisplayDevices[LAYOUT_PANEL_COUNT];
+    DEVMODE DevModes[LAYOUT_PANEL_COUNT];
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> CurrentLayout;
+    TopologyPlan Plan;
+};
 
-        ciHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
-        ciHeader.InstallFunction = DIF_PROPERTYCHANGE;
-        pcParams.ClassInstallHeader = ciHeader;
-        pcParams.StateChange = enabledState ? DICS_ENABLE : DICS_DISABLE;
-        pcParams.Scope = DICS_FLAG_GLOBAL;
-        pcParams.HwProfile = 0;
+//
+// Held from reading the live display configuration until the mode set made from it is committed, by the panel
+// transitions and the refresh rate changes alike, so that neither commits modes read before the other one's
+// change. Taken before g_StagedDisplayStatesLock.
+//
+std::mutex g_DisplayModeSetLock;
 
-        if (!SetupDiSetClassInstallParams(
-                devInfo, &devData, (PSP_CLASSINSTALL_HEADER)&pcParams, sizeof(SP_PROPCHANGE_PARAMS)))
+//
+// The transitions prepared ahead of time because they are expected to come next, one per slot
+//
+std::mutex g_StagedDisplayStatesLock;
+std::optional<StagedDisplayStates> g_StagedDisplayStates[(UINT)PrestageSlot::Count];
+
+struct
+{
+    std::atomic<ULONG64> Staged;
+    std::atomic<ULONG64> Hits;
+    std::atomic<ULONG64> Misses;
+    std::atomic<ULONG64> SavedMicroseconds;
+} g_PrestageCounters;
+
+VOID WINAPI
+GetPrestageCounters(PPRESTAGE_COUNTERS Counters)
+{
+    Counters->Staged = g_PrestageCounters.Staged;
+    Counters->Hits = g_PrestageCounters.Hits;
+    Counters->Misses = g_PrestageCounters.Misses;
+    Counters->SavedMicroseconds = g_PrestageCounters.SavedMicroseconds;
+}
+
+//
+// Subject: Resolves the devices and modes of both panels and plans their layout
+//
+// Parameters:
+//
+//             DisplayPanelId1, DisplayPanelId2: The Panel Container Identifiers
+//
+//             DisplayOrientation1, DisplayOrientation2: The requested orientation of each panel
+//
+//             DisplayState1, DisplayState2: Whether each panel should be on
+//
+//             Staged: Receives the resolved transition
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+PrepareDisplayStates(
+    CONST WCHAR *DisplayPanelId1,
+    CONST WCHAR *DisplayPanelId2,
+    INT DisplayOrientation1,
+    INT DisplayOrientation2,
+    BOOLEAN DisplayState1,
+    BOOLEAN DisplayState2,
+    StagedDisplayStates &Staged)
+{
+    SpanTracer &tracer = SpanTracer::instance();
+    uint64_t prepareStart = SpanTracer::Now();
+    uint64_t phaseStart = prepareStart;
+    std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> displayInputs{};
+    HRESULT Status = ERROR_SUCCESS;
+
+    // Sampled first so that any change while preparing invalidates the result
+    Staged.DisplayGeneration = DisplayChangeNotifier::instance().GetDisplayGeneration();
+    Staged.DeviceGeneration = DisplayChangeNotifier::instance().GetDeviceGeneration();
+    Staged.PanelId1 = DisplayPanelId1;
+    Staged.PanelId2 = DisplayPanelId2;
+    Staged.Orientation1 = DisplayOrientation1;
+    Staged.Orientation2 = DisplayOrientation2;
+    Staged.State1 = DisplayState1;
+    Staged.State2 = DisplayState2;
+
+    Status = GetDisplayDeviceByPanelId(DisplayPanelId1, &Staged.DisplayDevices[0]);
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    Status = GetDisplayDeviceByPanelId(DisplayPanelId2, &Staged.DisplayDevices[1]);
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    phaseStart = tracer.EndPhase("PanelLookup", phaseStart);
+
+    Status = GetDisplayDevicesBestDisplayModes(
+        &Staged.DisplayDevices[0], &Staged.DisplayDevices[1], &Staged.DevModes[0], &Staged.DevModes[1]);
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    phaseStart = tracer.EndPhase("ModeSelection", phaseStart);
+
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
+    {
+        CONST DISPLAY_DEVICE &device = Staged.DisplayDevices[i];
+        CONST DEVMODE &mode = Staged.DevModes[i];
+
+        displayInputs[i] = LayoutPanelInput{
+            (int32_t)mode.dmPelsWidth,
+            (int32_t)mode.dmPelsHeight,
+            (int32_t)mode.dmDisplayOrientation,
+            (device.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP) != 0};
+
+        Staged.CurrentLayout[i] = LayoutPanelPlan{
+            (int32_t)mode.dmPelsWidth,
+            (int32_t)mode.dmPelsHeight,
+            mode.dmPosition.x,
+            mode.dmPosition.y,
+            (int32_t)mode.dmDisplayOrientation,
+            (device.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP) != 0,
+            (device.StateFlags & DISPLAY_DEVICE_PRIMARY_DEVICE) != 0};
+    }
+
+    Staged.Plan = PlanDisplayLayout(
+        displayInputs,
+        DisplayOrientation1,
+        DisplayOrientation2,
+        DisplayState1 && DisplayState2 ? LayoutPanelStates::Both
+        : DisplayState1                ? LayoutPanelStates::FirstOnly
+                                       : LayoutPanelStates::SecondOnly,
+        GetFirstPanelSide(DisplayPanelId1, DisplayPanelId2));
+
+    Staged.PrepareMicroseconds = tracer.EndPhase("Plan", phaseStart) - prepareStart;
+
+    return ERROR_SUCCESS;
+}
+
+//
+// Subject: Takes the staged transition which is the requested one, if one of them is and is still up to date
+//
+// Returns: TRUE if Staged was filled in
+//
+BOOLEAN WINAPI
+TakeStagedDisplayStates(
+    CONST WCHAR *DisplayPanelId1,
+    CONST WCHAR *DisplayPanelId2,
+    INT DisplayOrientation1,
+    INT DisplayOrientation2,
+    BOOLEAN DisplayState1,
+    BOOLEAN DisplayState2,
+    StagedDisplayStates &Staged)
+{
+    std::lock_guard lock{g_StagedDisplayStatesLock};
+    BOOLEAN anyStaged = FALSE;
+    BOOLEAN hit = FALSE;
+
+    for (std::optional<StagedDisplayStates> &slot : g_StagedDisplayStates)
+    {
+        if (!slot)
         {
             continue;
         }
 
-        if (!SetupDiChangeState(devInfo, &devData))
+        CONST StagedDisplayStates &staged = *slot;
+        anyStaged = TRUE;
+
+        if (!hit && staged.PanelId1 == DisplayPanelId1 && staged.PanelId2 == DisplayPanelId2 &&
+            staged.Orientation1 == DisplayOrientation1 && staged.Orientation2 == DisplayOrientation2 &&
+            staged.State1 == DisplayState1 && staged.State2 == DisplayState2 &&
+            staged.DisplayGeneration == DisplayChangeNotifier::instance().GetDisplayGeneration() &&
+            staged.DeviceGeneration == DisplayChangeNotifier::instance().GetDeviceGeneration())
         {
-            continue;
+            Staged = staged;
+            hit = TRUE;
         }
+
+        // Whatever happens now the displays are about to change, which makes every slot stale
+        slot.reset();
     }
 
-    if (!SetupDiDestroyDeviceInfoList(devInfo))
+    if (hit)
     {
-        return HRESULT_FROM_WIN32(GetLastError());
+        g_PrestageCounters.Hits++;
+        g_PrestageCounters.SavedMicroseconds += Staged.PrepareMicroseconds;
+    }
+    else if (anyStaged)
+    {
+        g_PrestageCounters.Misses++;
     }
 
-    return ERROR_SUCCESS;
+    return hit;
 }
 
+//
+// Subject: Prepares a transition expected to come next, so that only applying it is left when it does
+//
+// Parameters:
+//
+//             Slot: Where to keep it, replacing what was staged there before
+//
+//             DisplayPanelId1, DisplayPanelId2: The Panel Container Identifiers
+//
+//             DisplayOrientation1, DisplayOrientation2: The expected orientation of each panel
+//
+//             DisplayState1, DisplayState2: Whether each panel is expected to be on
+//
+// Returns: ERROR_SUCCESS if successful
+//
 HRESULT WINAPI
-SetDisplayStates(
+PrestageDisplayStates(
+    PrestageSlot Slot,
     CONST WCHAR *DisplayPanelId1,
     CONST WCHAR *DisplayPanelId2,
     INT DisplayOrientation1,
@@ -496,286 +733,336 @@ SetDisplayStates(
     BOOLEAN DisplayState1,
     BOOLEAN DisplayState2)
 {
-    DISPLAY_DEVICE DisplayDevice1 = {0};
-    DISPLAY_DEVICE DisplayDevice2 = {0};
-    DEVMODE DevMode1 = {0};
-    DEVMODE DevMode2 = {0};
-    BOOLEAN lastDisplayState1 = FALSE;
-    BOOLEAN lastDisplayState2 = FALSE;
+    StagedDisplayStates staged{};
     HRESULT Status = ERROR_SUCCESS;
 
-    /*BOOLEAN IsSingleScreen = (!DisplayState1 && DisplayState2) || (!DisplayState2 && DisplayState1);
+    if (!DisplayState1 && !DisplayState2)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
 
-    if (IsSingleScreen && (lastDisplayState1 == DisplayState1) && (lastDisplayState2 == DisplayState2))
+    // Runs on the transition jobs worker, which a transition holding the lock may be waiting for. The displays are
+    // changing anyway, what would be read now is stale by the time it is used.
+    std::unique_lock modeSetLock{g_DisplayModeSetLock, std::try_to_lock};
+    if (!modeSetLock.owns_lock())
     {
-        goto exit;
-    }*/
+        return ERROR_BUSY;
+    }
 
-    Status = GetDisplayDeviceByPanelId(DisplayPanelId1, &DisplayDevice1);
+    Status = PrepareDisplayStates(
+        DisplayPanelId1,
+        DisplayPanelId2,
+        DisplayOrientation1,
+        DisplayOrientation2,
+        DisplayState1,
+        DisplayState2,
+        staged);
     if (FAILED(Status))
     {
-        goto exit;
+        return Status;
     }
 
-    Status = GetDisplayDeviceByPanelId(DisplayPanelId2, &DisplayDevice2);
-    if (FAILED(Status))
+    std::lock_guard lock{g_StagedDisplayStatesLock};
+    g_StagedDisplayStates[(UINT)Slot] = std::move(staged);
+    g_PrestageCounters.Staged++;
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT WINAPI
+SetDisplayStates(
+    CONST WCHAR *DisplayPanelId1,
+    CONST WCHAR *DisplayPanelId2,
+    INT DisplayOrientation1,
+    INT DisplayOrientation2,
+    BOOLEAN DisplayState1,
+    BOOLEAN DisplayState2)
+{
+    StagedDisplayStates prepared{};
+    BOOLEAN lastDisplayState1 = FALSE;
+    BOOLEAN lastDisplayState2 = FALSE;
+    std::vector<std::wstring> digitizersOff;
+    std::vector<std::wstring> digitizersOn;
+    DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    ULONG jobGeneration = 0;
+    SpanTracer &tracer = SpanTracer::instance();
+    uint64_t transitionStart = 0;
+    uint64_t phaseStart = 0;
+    PDISPLAY_DEVICE displayDevices[LAYOUT_PANEL_COUNT] = {&prepared.DisplayDevices[0], &prepared.DisplayDevices[1]};
+    PDEVMODE displayModes[LAYOUT_PANEL_COUNT] = {&prepared.DevModes[0], &prepared.DevModes[1]};
+    CONST std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> &currentLayout = prepared.CurrentLayout;
+    CONST TopologyPlan &plan = prepared.Plan;
+    TopologyPlan changes{};
+    TickCountDisplaySettleClock settleClock;
+    std::optional<SystemDisplaySettleSource> settleSource;
+    std::unique_lock modeSetLock{g_DisplayModeSetLock, std::defer_lock};
+    DisplayLiveState settleTarget{};
+    ULONG settleGeneration = 0;
+    uint32_t modeSetCount = 0;
+    HRESULT Status = ERROR_SUCCESS;
+
+    if (!DisplayState1 && !DisplayState2)
     {
-        goto exit;
+        return ERROR_INVALID_PARAMETER;
     }
 
-    Status = GetDisplayDeviceBestDisplayMode(&DisplayDevice1, &DevMode1);
-    if (FAILED(Status))
+    transitionStart = SpanTracer::Now();
+
+    // Drops the follow up jobs of the previous transitions which did not run yet
+    jobGeneration = jobs.BeginTransition();
+
+    // The staged or prepared modes must still be the live ones when committed
+    modeSetLock.lock();
+
+    if (!TakeStagedDisplayStates(
+            DisplayPanelId1,
+            DisplayPanelId2,
+            DisplayOrientation1,
+            DisplayOrientation2,
+            DisplayState1,
+            DisplayState2,
+            prepared))
     {
-        goto exit;
+        Status = PrepareDisplayStates(
+            DisplayPanelId1,
+            DisplayPanelId2,
+            DisplayOrientation1,
+            DisplayOrientation2,
+            DisplayState1,
+            DisplayState2,
+            prepared);
+        if (FAILED(Status))
+        {
+            goto exit;
+        }
     }
 
-    Status = GetDisplayDeviceBestDisplayMode(&DisplayDevice2, &DevMode2);
-    if (FAILED(Status))
+    // Only now are the device names of the panels known
+    settleSource.emplace(prepared.DisplayDevices[0].DeviceName, prepared.DisplayDevices[1].DeviceName);
+
+    phaseStart = SpanTracer::Now();
+
+    // Superseded transitions stop before touching anything, the newer one starts from the live state
+    if (scheduler.IsSuperseded())
     {
+        Status = ERROR_CANCELLED;
         goto exit;
     }
 
-    lastDisplayState1 = (DisplayDevice1.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP);
-    lastDisplayState2 = (DisplayDevice2.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP);
+    lastDisplayState1 = (prepared.DisplayDevices[0].StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP);
+    lastDisplayState2 = (prepared.DisplayDevices[1].StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP);
+
+    // Only keep what the live configuration does not match yet
+    changes = DiffTopologyPlan(plan, currentLayout);
+
+    g_TopologyApplyCounters.ExecutedModeSets += CountModeSteps(changes);
+    g_TopologyApplyCounters.ElidedModeSets += CountModeSteps(plan) - CountModeSteps(changes);
+
+    phaseStart = tracer.EndPhase("Diff", phaseStart);
 
+    if (changes.StepCount == 0)
+    {
+        g_TopologyApplyCounters.SkippedTransitions++;
+        goto exit;
+    }
+
+    // First make sure matching sensors are off to avoid init issues
     if (DisplayState1 == FALSE && lastDisplayState1)
     {
-        // First make sure matching sensors are off to avoid init issues
-        Status = SetHardwareEnabledStateForPanel(DisplayPanelId1, _T("HID_DEVICE_UP:000D_U:000F"), FALSE);
-        if (FAILED(Status))
-        {
-            // goto exit;
-            //  Non fatal for now
-            Status = ERROR_SUCCESS;
-        }
+        digitizersOff.emplace_back(DisplayPanelId1);
     }
 
     if (DisplayState2 == FALSE && lastDisplayState2)
     {
-        // First make sure matching sensors are off to avoid init issues
-        Status = SetHardwareEnabledStateForPanel(DisplayPanelId2, _T("HID_DEVICE_UP:000D_U:000F"), FALSE);
-        if (FAILED(Status))
-        {
-            // goto exit;
-            //  Non fatal for now
-            Status = ERROR_SUCCESS;
-        }
+        digitizersOff.emplace_back(DisplayPanelId2);
     }
 
-    // DevMode1.dmFields = DM_PELSWIDTH | DM_PELSHEIGHT | DM_POSITION | DM_DISPLAYORIENTATION;
-    DevMode1.dmPosition.x = 0;
-    DevMode1.dmPosition.y = 0;
+    // Non fatal for now
+    jobs.DisableDigitizers(digitizersOff, DIGITIZER_HARDWARE_ID);
 
-    // DevMode2.dmFields = DM_PELSWIDTH | DM_PELSHEIGHT | DM_POSITION | DM_DISPLAYORIENTATION;
-    DevMode2.dmPosition.x = 0;
-    DevMode2.dmPosition.y = 0;
+    phaseStart = tracer.EndPhase("DigitizerDisable", phaseStart);
 
-    //
-    // In order to switch from portrait to landscape and vice versa we need to swap the resolution width and height
-    // So we check for that
-    //
-    if ((DevMode1.dmDisplayOrientation + DisplayOrientation1) % 2 == 1)
+    // Digitizers turned off here stay in the disabled set, the next transition with their panel on enables them
+    if (scheduler.IsSuperseded())
     {
-        INT temp = DevMode1.dmPelsHeight;
-        DevMode1.dmPelsHeight = DevMode1.dmPelsWidth;
-        DevMode1.dmPelsWidth = temp;
+        Status = ERROR_CANCELLED;
+        goto exit;
     }
 
-    DevMode1.dmDisplayOrientation = DisplayOrientation1;
-
-    if ((DevMode2.dmDisplayOrientation + DisplayOrientation2) % 2 == 1)
+    settleTarget.Panels = plan.Panels;
+    settleTarget.MonitorCount = GetSystemMetrics(SM_CMONITORS);
+    for (uint32_t i = 0; i < LAYOUT_PANEL_COUNT; i++)
     {
-        INT temp = DevMode2.dmPelsHeight;
-        DevMode2.dmPelsHeight = DevMode2.dmPelsWidth;
-        DevMode2.dmPelsWidth = temp;
+        settleTarget.MonitorCount += (plan.Panels[i].Active ? 1 : 0) - (currentLayout[i].Active ? 1 : 0);
     }
 
-    DevMode2.dmDisplayOrientation = DisplayOrientation2;
+    // Sampled before the mode set so that its broadcast cannot be missed
+    settleGeneration = settleSource->GetGeneration();
+    modeSetCount = CountModeSteps(changes);
 
-    // Both displays on
-    if (DisplayState1 && DisplayState2)
+    // One SetDisplayConfig call when possible, otherwise one ChangeDisplaySettingsEx per panel and a commit
+    if (modeSetCount != 0 && ApplyTopologyPlanSingleShot(plan, displayDevices) == ERROR_SUCCESS)
     {
-        switch (DisplayOrientation1)
-        {
-        case DMDO_DEFAULT: {
-            DevMode1.dmPosition.x = -1 * DevMode2.dmPelsWidth;
-            break;
-        }
-        case DMDO_180: {
-            DevMode2.dmPosition.x = -1 * DevMode1.dmPelsWidth;
-            break;
-        }
-        case DMDO_90: {
-            DevMode1.dmPosition.y = -1 * DevMode2.dmPelsHeight;
-            break;
-        }
-        case DMDO_270: {
-            DevMode2.dmPosition.y = -1 * DevMode1.dmPelsHeight;
-            break;
-        }
-        }
+        changes = WithoutModeSteps(changes);
+    }
 
-        BOOLEAN IsDisplay1Primary = DevMode1.dmPosition.x == 0 && DevMode1.dmPosition.y == 0;
+    phaseStart = tracer.EndPhase("SetDisplayConfig", phaseStart);
 
-        if (ChangeDisplaySettingsEx(
-                IsDisplay1Primary ? DisplayDevice1.DeviceName : DisplayDevice2.DeviceName,
-                IsDisplay1Primary ? &DevMode1 : &DevMode2,
-                NULL,
-                CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET | CDS_SET_PRIMARY,
-                NULL) != DISP_CHANGE_SUCCESSFUL)
-        {
-            Status = HRESULT_FROM_WIN32(GetLastError());
-            goto exit;
-        }
+    Status = ApplyTopologyPlan(changes, displayDevices, displayModes);
 
-        if (ChangeDisplaySettingsEx(
-                IsDisplay1Primary ? DisplayDevice2.DeviceName : DisplayDevice1.DeviceName,
-                IsDisplay1Primary ? &DevMode2 : &DevMode1,
-                NULL,
-                CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET,
-                NULL) != DISP_CHANGE_SUCCESSFUL)
-        {
-            Status = HRESULT_FROM_WIN32(GetLastError());
-            goto exit;
-        }
+    // Also after a partial failure, the panels may be on or off by now
+    if (modeSetCount != 0)
+    {
+        DisplayTargetInventory::instance().Invalidate();
     }
-    // Left on, Right off
-    else if (DisplayState1 && !DisplayState2)
+
+    if (FAILED(Status))
     {
-        if (lastDisplayState1 && !lastDisplayState2)
-        {
-            Status = NotifyAutoRotationAlpcPortOfOrientationChange(DisplayOrientation2);
-            if (FAILED(Status))
-            {
-                goto exit;
-            }
-        }
-        else
-        {
-            if (ChangeDisplaySettingsEx(
-                    DisplayDevice1.DeviceName,
-                    &DevMode1,
-                    NULL,
-                    CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET | CDS_SET_PRIMARY,
-                    NULL) != DISP_CHANGE_SUCCESSFUL)
-            {
-                Status = HRESULT_FROM_WIN32(GetLastError());
-                goto exit;
-            }
+        goto exit;
+    }
 
-            if (lastDisplayState2)
-            {
-                DevMode2.dmPelsWidth = 0;
-                DevMode2.dmPelsHeight = 0;
-
-                if (ChangeDisplaySettingsEx(
-                        DisplayDevice2.DeviceName,
-                        &DevMode2,
-                        NULL,
-                        CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET,
-                        NULL) != DISP_CHANGE_SUCCESSFUL)
-                {
-                    Status = HRESULT_FROM_WIN32(GetLastError());
-                    goto exit;
-                }
-            }
-        }
+    // Panels turned on come back with their digitizer off, record it before anything can cancel the transition
+    if (DisplayState1 == TRUE && !lastDisplayState1)
+    {
+        jobs.MarkDigitizerDisabled(DisplayPanelId1);
     }
-    // Left off, Right on
-    else if (!DisplayState1 && DisplayState2)
+
+    if (DisplayState2 == TRUE && !lastDisplayState2)
     {
-        if (!lastDisplayState1 && lastDisplayState2)
-        {
-            Status = NotifyAutoRotationAlpcPortOfOrientationChange(DisplayOrientation2);
-            if (FAILED(Status))
-            {
-                goto exit;
-            }
-        }
-        else
-        {
-            if (ChangeDisplaySettingsEx(
-                    DisplayDevice2.DeviceName,
-                    &DevMode2,
-                    NULL,
-                    CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET | CDS_SET_PRIMARY,
-                    NULL) != DISP_CHANGE_SUCCESSFUL)
-            {
-                Status = HRESULT_FROM_WIN32(GetLastError());
-                goto exit;
-            }
+        jobs.MarkDigitizerDisabled(DisplayPanelId2);
+    }
 
-            if (lastDisplayState1)
-            {
-                DevMode1.dmPelsWidth = 0;
-                DevMode1.dmPelsHeight = 0;
-
-                if (ChangeDisplaySettingsEx(
-                        DisplayDevice1.DeviceName,
-                        &DevMode1,
-                        NULL,
-                        CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET,
-                        NULL) != DISP_CHANGE_SUCCESSFUL)
-                {
-                    Status = HRESULT_FROM_WIN32(GetLastError());
-                    goto exit;
-                }
-            }
-        }
+    modeSetLock.unlock();
+
+    phaseStart = tracer.EndPhase("ApplyTopologyPlan", phaseStart);
+
+    // Make sure the display configuration is switched, past the timeout carry on like the fixed delay used to
+    if (modeSetCount != 0)
+    {
+        DisplaySettleWaiter(settleClock, *settleSource, DisplaySettleStatistics::instance())
+            .Wait(settleTarget, settleGeneration);
     }
 
-    // Commit changes now
-    if (ChangeDisplaySettingsEx(NULL, NULL, NULL, 0, NULL) != DISP_CHANGE_SUCCESSFUL)
+    phaseStart = tracer.EndPhase("SettleWait", phaseStart);
+
+    // Not any earlier once the mode set is issued: the newer transition must see it live to diff against it. The
+    // panels turned on above are in the disabled set already, whichever transition runs next enables them.
+    if (scheduler.IsSuperseded())
     {
-        Status = HRESULT_FROM_WIN32(GetLastError());
+        Status = ERROR_CANCELLED;
         goto exit;
     }
 
-    // Wait a second to make sure the display configuration is switched
-    Sleep(1000);
-
     // Need to fix work areas if multiple displays due to Windows Shy Taskbar bugs...
     if (DisplayState1 && DisplayState2)
     {
-        if (!UpdateMonitorWorkAreas())
-        {
-            Status = HRESULT_FROM_WIN32(GetLastError());
-            goto exit;
-        }
+        jobs.Post(jobGeneration, "UpdateMonitorWorkAreas", [] { UpdateMonitorWorkAreas(); });
     }
 
-    // Display needs to be turned on but was not currently attached
-    if (DisplayState1 == TRUE && !lastDisplayState1)
+exit:
+    if (modeSetLock.owns_lock())
     {
-        // First make sure matching sensors are on to avoid init issues
-        Status = SetHardwareEnabledStateForPanel(DisplayPanelId1, _T("HID_DEVICE_UP:000D_U:000F"), TRUE);
-        if (FAILED(Status))
-        {
-            // goto exit;
-            //  Non fatal for now
-            Status = ERROR_SUCCESS;
-        }
+        modeSetLock.unlock();
     }
 
-    // Display needs to be turned on but was not currently attached
-    if (DisplayState2 == TRUE && !lastDisplayState2)
+    // Also queued when nothing changed, it picks up digitizers left off by a superseded transition
+    if (DisplayState1)
     {
-        // First make sure matching sensors are on to avoid init issues
-        Status = SetHardwareEnabledStateForPanel(DisplayPanelId2, _T("HID_DEVICE_UP:000D_U:000F"), TRUE);
-        if (FAILED(Status))
-        {
-            // goto exit;
-            //  Non fatal for now
-            Status = ERROR_SUCCESS;
-        }
+        digitizersOn.emplace_back(DisplayPanelId1);
     }
 
-exit:
+    if (DisplayState2)
+    {
+        digitizersOn.emplace_back(DisplayPanelId2);
+    }
+
+    jobs.PostEnableDigitizers(jobGeneration, digitizersOn, DIGITIZER_HARDWARE_ID);
+
+    phaseStart = tracer.EndPhase("SetDisplayStates", transitionStart);
+    jobs.EndTransition(phaseStart - transitionStart);
+
     return Status;
 }
 
 HRESULT WINAPI
 SetExtendedDisplayConfiguration()
 {
-    return SetDisplayConfig(0, NULL, 0, NULL, SDC_APPLY | SDC_TOPOLOGY_EXTEND | SDC_PATH_PERSIST_IF_REQUIRED);
+    std::lock_guard lock{g_DisplayModeSetLock};
+
+    LONG Status = SetDisplayConfig(0, NULL, 0, NULL, SDC_APPLY | SDC_TOPOLOGY_EXTEND | SDC_PATH_PERSIST_IF_REQUIRED);
+    DisplayTargetInventory::instance().Invalidate();
+
+    return Status;
+}
+
+//
+// Subject: Switches every attached panel to its highest or lowest refresh rate at the current resolution
+//
+// Parameters:
+//
+//             Highest: TRUE for the highest refresh rate, FALSE for the lowest
+//
+// Returns: ERROR_SUCCESS if successful, the panels are changed in a single mode set
+//
+HRESULT WINAPI
+SetPanelsRefreshRate(BOOLEAN Highest)
+{
+    DISPLAY_DEVICE DisplayDevice = {0};
+    DISPLAY_DEVICE DisplayDevice2 = {0};
+    BOOLEAN changed = FALSE;
+    DWORD i = 0;
+
+    if (FAILED(DeviceInventory::instance().EnsurePopulated()))
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    // The current modes are read under the lock, a panel transition may just have moved or rotated the panels
+    std::lock_guard lock{g_DisplayModeSetLock};
+
+    while (SUCCEEDED(GetDisplayDeviceById(i++, &DisplayDevice, &DisplayDevice2)))
+    {
+        DEVMODE current = {0};
+        DEVMODE target = {0};
+
+        if (!(DisplayDevice.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP) ||
+            !DeviceInventory::instance().FindByMonitorDeviceId(DisplayDevice2.DeviceID))
+        {
+            continue;
+        }
+
+        current.dmSize = sizeof(DEVMODE);
+        if (!EnumDisplaySettings(DisplayDevice.DeviceName, ENUM_CURRENT_SETTINGS, &current))
+        {
+            continue;
+        }
+
+        if (DisplayModeCatalogs::instance().SelectDisplayMode(
+                DisplayDevice.DeviceName, RefreshRateDisplayModePolicy(current, Highest), &target) != ERROR_SUCCESS ||
+            target.dmDisplayFrequency == current.dmDisplayFrequency)
+        {
+            continue;
+        }
+
+        // Only the refresh rate changes, position and orientation stay as they are
+        current.dmDisplayFrequency = target.dmDisplayFrequency;
+        current.dmFields = DM_DISPLAYFREQUENCY;
+
+        if (ChangeDisplaySettingsEx(
+                DisplayDevice.DeviceName, &current, NULL, CDS_UPDATEREGISTRY | CDS_GLOBAL | CDS_NORESET, NULL) !=
+            DISP_CHANGE_SUCCESSFUL)
+        {
+            return HRESULT_FROM_WIN32(GetLastError());
+        }
+
+        changed = TRUE;
+    }
+
+    if (changed && ChangeDisplaySettingsEx(NULL, NULL, NULL, 0, NULL) != DISP_CHANGE_SUCCESSFUL)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    return ERROR_SUCCESS;
 }
\ No newline at end of file
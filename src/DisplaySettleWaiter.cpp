@@ -0,0 +1,221 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayChangeNotifier.h"
+#include "DisplaySettleWaiter.h"
+#include <algorithm>
+
+ULONGLONG
+TickCountDisplaySettleClock::GetMilliseconds() const
+{
+    return GetTickCount64();
+}
+
+SystemDisplaySettleSource::SystemDisplaySettleSource(CONST WCHAR *DeviceName1, CONST WCHAR *DeviceName2)
+    : m_deviceNames{DeviceName1, DeviceName2}
+{
+}
+
+ULONG
+SystemDisplaySettleSource::GetGeneration() const
+{
+    return DisplayChangeNotifier::instance().GetDisplayGeneration();
+}
+
+BOOLEAN
+SystemDisplaySettleSource::WaitForChange(ULONG Generation, DWORD TimeoutMs)
+{
+    return DisplayChangeNotifier::instance().WaitForDisplayChange(Generation, TimeoutMs);
+}
+
+HRESULT
+SystemDisplaySettleSource::QueryLiveState(DisplayLiveState &State)
+{
+    DISPLAY_DEVICE displayDevice;
+    DEVMODE deviceMode;
+
+    State = DisplayLiveState{};
+    State.MonitorCount = GetSystemMetrics(SM_CMONITORS);
+
+    for (uint32_t panel = 0; panel < LAYOUT_PANEL_COUNT; panel++)
+    {
+        BOOLEAN found = FALSE;
+
+        RtlZeroMemory(&displayDevice, sizeof(DISPLAY_DEVICE));
+        displayDevice.cb = sizeof(DISPLAY_DEVICE);
+
+        for (DWORD i = 0; EnumDisplayDevices(NULL, i, &displayDevice, 0); i++)
+        {
+            if (wcscmp(displayDevice.DeviceName, m_deviceNames[panel]) == 0)
+            {
+                found = TRUE;
+                break;
+            }
+        }
+
+        if (!found)
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        if (!(displayDevice.StateFlags & DISPLAY_DEVICE_ATTACHED_TO_DESKTOP))
+        {
+            continue;
+        }
+
+        RtlZeroMemory(&deviceMode, sizeof(DEVMODE));
+        deviceMode.dmSize = sizeof(DEVMODE);
+
+        if (!EnumDisplaySettings(m_deviceNames[panel], ENUM_CURRENT_SETTINGS, &deviceMode))
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        State.Panels[panel] = LayoutPanelPlan{
+            (int32_t)deviceMode.dmPelsWidth,
+            (int32_t)deviceMode.dmPelsHeight,
+            deviceMode.dmPosition.x,
+            deviceMode.dmPosition.y,
+            (int32_t)deviceMode.dmDisplayOrientation,
+            true,
+            (displayDevice.StateFlags & DISPLAY_DEVICE_PRIMARY_DEVICE) != 0};
+    }
+
+    return ERROR_SUCCESS;
+}
+
+DisplaySettleStatistics &
+DisplaySettleStatistics::instance()
+{
+    static DisplaySettleStatistics self;
+    return self;
+}
+
+VOID
+DisplaySettleStatistics::Record(ULONGLONG Milliseconds, BOOLEAN Settled)
+{
+    std::lock_guard lock{m_lock};
+    DWORD bucket = 0;
+
+    while (bucket < DISPLAY_SETTLE_BUCKET_COUNT - 1 && Milliseconds > (16ULL << bucket))
+    {
+        bucket++;
+    }
+
+    if (Settled)
+    {
+        m_stats.Settled++;
+    }
+    else
+    {
+        m_stats.TimedOut++;
+    }
+
+    m_stats.TotalMilliseconds += Milliseconds;
+    m_stats.MaxMilliseconds = std::max<ULONG64>(m_stats.MaxMilliseconds, Milliseconds);
+    m_stats.Buckets[bucket]++;
+}
+
+VOID
+DisplaySettleStatistics::GetStats(PDISPLAY_SETTLE_STATS Stats)
+{
+    std::lock_guard lock{m_lock};
+    *Stats = m_stats;
+}
+
+DisplaySettleWaiter::DisplaySettleWaiter(
+    const DisplaySettleClock &Clock,
+    DisplaySettleSource &Source,
+    DisplaySettleStatistics &Statistics,
+    DWORD TimeoutMs,
+    DWORD PollMs)
+    : m_clock(Clock), m_source(Source), m_statistics(Statistics), m_timeoutMs(TimeoutMs), m_pollMs(PollMs)
+{
+}
+
+BOOLEAN
+DisplaySettleWaiter::IsLayoutLive(const DisplayLiveState &Target, const DisplayLiveState &Live)
+{
+    if (Target.MonitorCount != Live.MonitorCount)
+    {
+        return FALSE;
+    }
+
+    for (uint32_t panel = 0; panel < LAYOUT_PANEL_COUNT; panel++)
+    {
+        const LayoutPanelPlan &target = Target.Panels[panel];
+        const LayoutPanelPlan &live = Live.Panels[panel];
+
+        if (target.Active != live.Active)
+        {
+            return FALSE;
+        }
+
+        if (target.Active && (!IsSamePanelMode(target, live) || target.Primary != live.Primary))
+        {
+            return FALSE;
+        }
+    }
+
+    return TRUE;
+}
+
+//
+// Subject: Waits until the desktop matches the requested layout
+//
+// Parameters:
+//
+//             Target: The layout the last mode set asked for
+//
+//             Generation: The display change generation sampled before the mode set
+//
+// Returns: ERROR_SUCCESS once the layout is live, ERROR_TIMEOUT if it did not show up in time
+//
+HRESULT
+DisplaySettleWaiter::Wait(const DisplayLiveState &Target, ULONG Generation)
+{
+    ULONGLONG start = m_clock.GetMilliseconds();
+    ULONGLONG elapsed = 0;
+    DisplayLiveState live;
+
+    for (;;)
+    {
+        // Broadcasts may arrive before the settings are readable, always confirm with the live state
+        if (m_source.QueryLiveState(live) == ERROR_SUCCESS && IsLayoutLive(Target, live))
+        {
+            m_statistics.Record(m_clock.GetMilliseconds() - start, TRUE);
+            return ERROR_SUCCESS;
+        }
+
+        elapsed = m_clock.GetMilliseconds() - start;
+        if (elapsed >= m_timeoutMs)
+        {
+            m_statistics.Record(elapsed, FALSE);
+            return ERROR_TIMEOUT;
+        }
+
+        if (m_source.WaitForChange(Generation, (DWORD)std::min<ULONGLONG>(m_timeoutMs - elapsed, m_pollMs)))
+        {
+            Generation = m_source.GetGeneration();
+        }
+    }
+}
\ No newline at end of file
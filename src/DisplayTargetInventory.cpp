@@ -0,0 +1,356 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "DisplayChangeNotifier.h"
+#include "DisplayTargetInventory.h"
+#include <algorithm>
+
+static BOOLEAN
+IsSameLuid(CONST LUID &Left, CONST LUID &Right)
+{
+    return Left.LowPart == Right.LowPart && Left.HighPart == Right.HighPart;
+}
+
+static std::wstring
+NormalizeKey(CONST WCHAR *Key)
+{
+    std::wstring normalized = Key;
+    CharUpperBuff(normalized.data(), (DWORD)normalized.length());
+    return normalized;
+}
+
+HRESULT
+DisplayConfigTargetSource::QueryPaths(DisplayConfigTopology &Topology)
+{
+    return QueryDisplayConfigTopology(Topology);
+}
+
+HRESULT
+DisplayConfigTargetSource::GetSourceGdiDeviceName(LUID AdapterId, UINT32 SourceId, std::wstring &GdiDeviceName)
+{
+    DISPLAYCONFIG_SOURCE_DEVICE_NAME sourceName = {};
+
+    sourceName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME;
+    sourceName.header.size = sizeof(sourceName);
+    sourceName.header.adapterId = AdapterId;
+    sourceName.header.id = SourceId;
+
+    LONG Status = DisplayConfigGetDeviceInfo(&sourceName.header);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    GdiDeviceName = sourceName.viewGdiDeviceName;
+    return ERROR_SUCCESS;
+}
+
+HRESULT
+DisplayConfigTargetSource::GetTargetDevicePath(LUID AdapterId, UINT32 TargetId, std::wstring &DevicePath)
+{
+    DISPLAYCONFIG_TARGET_DEVICE_NAME targetName = {};
+
+    targetName.header.type = DISPLAYCONFIG_DEVICE_INFO_GET_TARGET_NAME;
+    targetName.header.size = sizeof(targetName);
+    targetName.header.adapterId = AdapterId;
+    targetName.header.id = TargetId;
+
+    LONG Status = DisplayConfigGetDeviceInfo(&targetName.header);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    DevicePath = targetName.monitorDevicePath;
+    return ERROR_SUCCESS;
+}
+
+DisplayTargetInventory &
+DisplayTargetInventory::instance()
+{
+    static DisplayConfigTargetSource source;
+    static DisplayTargetInventory self(source);
+    return self;
+}
+
+DisplayTargetInventory::DisplayTargetInventory(DisplayTargetSource &Source) : m_source(Source)
+{
+}
+
+std::wstring
+DisplayTargetInventory::InstanceIdFromDevicePath(CONST std::wstring &DevicePath)
+{
+    std::wstring instanceId = DevicePath;
+
+    if (instanceId.compare(0, 4, L"\\\\?\\") == 0)
+    {
+        instanceId.erase(0, 4);
+    }
+
+    // Drop the interface class guid
+    size_t guid = instanceId.rfind(L"#{");
+    if (guid != std::wstring::npos)
+    {
+        instanceId.erase(guid);
+    }
+
+    std::replace(instanceId.begin(), instanceId.end(), L'#', L'\\');
+    return instanceId;
+}
+
+//
+// Subject: Rebuilds the records from the current display paths
+//
+// Returns: ERROR_SUCCESS if successful, the previous records are kept otherwise
+//
+HRESULT
+DisplayTargetInventory::RefreshLocked()
+{
+    struct ResolvedTarget
+    {
+        LUID AdapterId;
+        UINT32 TargetId;
+        std::wstring InstanceId;
+        std::wstring PanelId;
+    };
+
+    DisplayConfigTopology topology;
+    std::vector<ResolvedTarget> targets;
+    std::vector<DisplayTargetRecord> records;
+    DeviceInventory &devices = DeviceInventory::instance();
+    ULONG displayGeneration = DisplayChangeNotifier::instance().GetDisplayGeneration();
+    ULONG deviceGeneration = DisplayChangeNotifier::instance().GetDeviceGeneration();
+
+    // Panels which just arrived are not in the device inventory yet
+    HRESULT Status =
+        m_populated && deviceGeneration != m_deviceGeneration ? devices.Refresh() : devices.EnsurePopulated();
+    if (FAILED(Status))
+    {
+        return Status;
+    }
+
+    m_stats.Refreshes++;
+    m_stats.QueryCalls++;
+
+    Status = m_source.QueryPaths(topology);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    // QDC_ALL_PATHS lists every source a target could be driven by, each target is named only once
+    auto resolveTarget = [&](CONST DISPLAYCONFIG_PATH_TARGET_INFO &Target) -> CONST ResolvedTarget & {
+        for (CONST ResolvedTarget &target : targets)
+        {
+            if (IsSameLuid(target.AdapterId, Target.adapterId) && target.TargetId == Target.id)
+            {
+                return target;
+            }
+        }
+
+        ResolvedTarget &target =
+            targets.emplace_back(ResolvedTarget{Target.adapterId, Target.id, std::wstring(), std::wstring()});
+        std::wstring devicePath;
+
+        m_stats.DeviceInfoCalls++;
+        if (m_source.GetTargetDevicePath(Target.adapterId, Target.id, devicePath) == ERROR_SUCCESS)
+        {
+            target.InstanceId = InstanceIdFromDevicePath(devicePath);
+
+            std::optional<size_t> row = devices.FindByInstanceId(target.InstanceId.c_str());
+            if (row)
+            {
+                target.PanelId = devices.GetPanelId(*row);
+            }
+        }
+
+        return target;
+    };
+
+    auto isClaimed = [&](CONST DISPLAYCONFIG_PATH_INFO &Path) {
+        for (CONST DisplayTargetRecord &record : records)
+        {
+            if ((IsSameLuid(record.Source.AdapterId, Path.sourceInfo.adapterId) &&
+                 record.Source.SourceId == Path.sourceInfo.id) ||
+                (IsSameLuid(record.Source.AdapterId, Path.targetInfo.adapterId) &&
+                 record.TargetId == Path.targetInfo.id))
+            {
+                return TRUE;
+            }
+        }
+
+        return FALSE;
+    };
+
+    // Active paths first, so that inactive panels only get sources nobody scans out from
+    for (BOOLEAN active : {TRUE, FALSE})
+    {
+        for (CONST DISPLAYCONFIG_PATH_INFO &path : topology.Paths)
+        {
+            if (((path.flags & DISPLAYCONFIG_PATH_ACTIVE) != 0) != active || isClaimed(path))
+            {
+                continue;
+            }
+
+            CONST ResolvedTarget &target = resolveTarget(path.targetInfo);
+            if (target.PanelId.empty())
+            {
+                continue;
+            }
+
+            DisplayTargetRecord record{
+                target.PanelId,
+                target.InstanceId,
+                std::wstring{},
+                DisplayConfigPanelSource{path.sourceInfo.adapterId, path.sourceInfo.id},
+                path.targetInfo.id,
+                active,
+                FALSE};
+
+            m_stats.DeviceInfoCalls++;
+            if (m_source.GetSourceGdiDeviceName(path.sourceInfo.adapterId, path.sourceInfo.id, record.GdiDeviceName) !=
+                ERROR_SUCCESS)
+            {
+                continue;
+            }
+
+            if (active && path.sourceInfo.modeInfoIdx < topology.Modes.size())
+            {
+                CONST DISPLAYCONFIG_MODE_INFO &mode = topology.Modes[path.sourceInfo.modeInfoIdx];
+
+                record.Primary = mode.infoType == DISPLAYCONFIG_MODE_INFO_TYPE_SOURCE &&
+                                 mode.sourceMode.position.x == 0 && mode.sourceMode.position.y == 0;
+            }
+
+            records.emplace_back(std::move(record));
+        }
+    }
+
+    m_records = std::move(records);
+    m_panelIdIndex.clear();
+    m_gdiDeviceNameIndex.clear();
+
+    for (size_t i = 0; i < m_records.size(); i++)
+    {
+        m_panelIdIndex.emplace(NormalizeKey(m_records[i].PanelId.c_str()), i);
+        m_gdiDeviceNameIndex.emplace(NormalizeKey(m_records[i].GdiDeviceName.c_str()), i);
+    }
+
+    m_populated = TRUE;
+    m_invalidated = FALSE;
+    m_displayGeneration = displayGeneration;
+    m_deviceGeneration = deviceGeneration;
+
+    return ERROR_SUCCESS;
+}
+
+HRESULT
+DisplayTargetInventory::EnsureCurrentLocked()
+{
+    if (m_populated && !m_invalidated &&
+        m_displayGeneration == DisplayChangeNotifier::instance().GetDisplayGeneration() &&
+        m_deviceGeneration == DisplayChangeNotifier::instance().GetDeviceGeneration())
+    {
+        return ERROR_SUCCESS;
+    }
+
+    return RefreshLocked();
+}
+
+//
+// Subject: Gets the display source and target of a panel
+//
+// Parameters:
+//
+//             PanelId: The Panel Container Identifier
+//
+//             Record: Receives the source, target and state of the panel
+//
+// Returns: ERROR_SUCCESS if successful, ERROR_NOT_FOUND if the panel has no display target
+//
+HRESULT
+DisplayTargetInventory::Lookup(CONST WCHAR *PanelId, DisplayTargetRecord &Record)
+{
+    std::lock_guard lock{m_lock};
+
+    HRESULT Status = EnsureCurrentLocked();
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    m_stats.Lookups++;
+
+    auto it = m_panelIdIndex.find(NormalizeKey(PanelId));
+    if (it == m_panelIdIndex.end())
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    Record = m_records[it->second];
+    return ERROR_SUCCESS;
+}
+
+HRESULT
+DisplayTargetInventory::LookupByGdiDeviceName(CONST WCHAR *GdiDeviceName, DisplayTargetRecord &Record)
+{
+    std::lock_guard lock{m_lock};
+
+    HRESULT Status = EnsureCurrentLocked();
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    m_stats.Lookups++;
+
+    auto it = m_gdiDeviceNameIndex.find(NormalizeKey(GdiDeviceName));
+    if (it == m_gdiDeviceNameIndex.end())
+    {
+        return ERROR_NOT_FOUND;
+    }
+
+    Record = m_records[it->second];
+    return ERROR_SUCCESS;
+}
+
+VOID
+DisplayTargetInventory::GetStats(PDISPLAY_TARGET_INVENTORY_STATS Stats)
+{
+    std::lock_guard lock{m_lock};
+    *Stats = m_stats;
+}
+
+//
+// Subject: Queries the display paths again on the next lookup
+//
+// Remarks: Called after each mode set. Its WM_DISPLAYCHANGE is broadcast later, until then the records would still
+//          carry the active and primary state from before.
+//
+VOID
+DisplayTargetInventory::Invalidate()
+{
+    std::lock_guard lock{m_lock};
+
+    m_invalidated = TRUE;
+}
\ No newline at end of file
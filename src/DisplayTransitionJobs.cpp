@@ -0,0 +1,189 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceStateTransaction.h"
+#include "DisplayTransitionJobs.h"
+#include "SpanTracer.h"
+#include <algorithm>
+
+DisplayTransitionJobs &
+DisplayTransitionJobs::instance()
+{
+    static DisplayTransitionJobs self;
+    return self;
+}
+
+ULONG
+DisplayTransitionJobs::BeginTransition()
+{
+    std::lock_guard lock{m_lock};
+    return ++m_generation;
+}
+
+ULONG
+DisplayTransitionJobs::GetGeneration()
+{
+    std::lock_guard lock{m_lock};
+    return m_generation;
+}
+
+VOID
+DisplayTransitionJobs::EndTransition(ULONGLONG HoldMicroseconds)
+{
+    std::lock_guard lock{m_lock};
+
+    m_stats.Transitions++;
+    m_stats.TotalHoldMicroseconds += HoldMicroseconds;
+    m_stats.MaxHoldMicroseconds = std::max<ULONG64>(m_stats.MaxHoldMicroseconds, HoldMicroseconds);
+}
+
+VOID
+DisplayTransitionJobs::Post(ULONG Generation, const char *Name, std::function<VOID()> Job)
+{
+    m_executor.submit(OnThreadExecutor::task_t{[this, Generation, Name, Job = std::move(Job)] {
+        uint64_t start = SpanTracer::Now();
+
+        {
+            std::lock_guard lock{m_lock};
+
+            if (Generation != m_generation)
+            {
+                m_stats.JobsCancelled++;
+                return;
+            }
+
+            m_stats.JobsExecuted++;
+        }
+
+        Job();
+
+        SpanTracer::instance().EndPhase(Name, start);
+    }});
+}
+
+//
+// Subject: Disables the digitizers of panels about to be turned off
+//
+// Parameters:
+//
+//             PanelIds: The panels to disable the digitizer of
+//
+//             HardwareId: The hardware id of the digitizer devices
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT
+DisplayTransitionJobs::DisableDigitizers(const std::vector<std::wstring> &PanelIds, CONST WCHAR *HardwareId)
+{
+    HRESULT Status = ERROR_SUCCESS;
+
+    if (PanelIds.empty())
+    {
+        return ERROR_SUCCESS;
+    }
+
+    // Runs on the worker too so that it is ordered after an enable job which may already be running
+    m_executor
+        .submit(OnThreadExecutor::task_t{[&] {
+            DeviceStateTransaction transaction;
+
+            for (const std::wstring &panelId : PanelIds)
+            {
+                transaction.Add(panelId.c_str(), HardwareId, FALSE);
+            }
+
+            Status = transaction.Commit();
+
+            for (const std::wstring &panelId : PanelIds)
+            {
+                MarkDigitizerDisabled(panelId.c_str());
+            }
+        }})
+        .wait();
+
+    return Status;
+}
+
+VOID
+DisplayTransitionJobs::MarkDigitizerDisabled(CONST WCHAR *PanelId)
+{
+    std::lock_guard lock{m_lock};
+    m_disabledDigitizers.emplace(PanelId);
+}
+
+//
+// Subject: Queues enabling the digitizers of panels which are on again
+//
+// Parameters:
+//
+//             Generation: The transition the job belongs to
+//
+//             PanelIds: The panels which are on after the transition
+//
+//             HardwareId: The hardware id of the digitizer devices
+//
+VOID
+DisplayTransitionJobs::PostEnableDigitizers(
+    ULONG Generation,
+    const std::vector<std::wstring> &PanelIds,
+    CONST WCHAR *HardwareId)
+{
+    std::wstring hardwareId = HardwareId;
+
+    // Panels are only taken off the disabled set once enabled, a cancelled job leaves them for the next transition
+    Post(Generation, "DigitizerEnable", [this, PanelIds, hardwareId] {
+        DeviceStateTransaction transaction;
+        std::vector<std::wstring> enabled;
+
+        {
+            std::lock_guard lock{m_lock};
+
+            for (const std::wstring &panelId : PanelIds)
+            {
+                if (m_disabledDigitizers.count(panelId) != 0)
+                {
+                    transaction.Add(panelId.c_str(), hardwareId.c_str(), TRUE);
+                    enabled.push_back(panelId);
+                }
+            }
+        }
+
+        if (transaction.IsEmpty() || FAILED(transaction.Commit()))
+        {
+            return;
+        }
+
+        std::lock_guard lock{m_lock};
+
+        for (const std::wstring &panelId : enabled)
+        {
+            m_disabledDigitizers.erase(panelId);
+        }
+    });
+}
+
+VOID
+DisplayTransitionJobs::GetStats(PDISPLAY_TRANSITION_STATS Stats)
+{
+    std::lock_guard lock{m_lock};
+    *Stats = m_stats;
+}
\ No newline at end of file
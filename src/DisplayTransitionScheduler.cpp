@@ -0,0 +1,87 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayTransitionScheduler.h"
+
+DisplayTransitionScheduler &
+DisplayTransitionScheduler::instance()
+{
+    static DisplayTransitionScheduler self;
+    return self;
+}
+
+ULONG64
+DisplayTransitionScheduler::Request()
+{
+    return ++m_latest;
+}
+
+BOOLEAN
+DisplayTransitionScheduler::Begin(ULONG64 Ticket)
+{
+    ULONG64 latest = m_latest;
+
+    // Requests may win the lock out of order, only a newer request which did not run yet supersedes this one
+    if (latest > Ticket && latest > m_lastStarted)
+    {
+        m_coalesced++;
+        return FALSE;
+    }
+
+    if (Ticket > m_lastStarted)
+    {
+        m_lastStarted = Ticket;
+    }
+
+    m_running = TRUE;
+    return TRUE;
+}
+
+VOID
+DisplayTransitionScheduler::End(HRESULT Status)
+{
+    if (Status == ERROR_CANCELLED)
+    {
+        m_cancelled++;
+    }
+    else
+    {
+        m_completed++;
+    }
+
+    m_running = FALSE;
+}
+
+BOOLEAN
+DisplayTransitionScheduler::IsSuperseded() const
+{
+    return m_running && m_latest > m_lastStarted;
+}
+
+VOID
+DisplayTransitionScheduler::GetStats(PDISPLAY_SCHEDULER_STATS Stats) const
+{
+    Stats->Requested = m_latest;
+    Stats->Coalesced = m_coalesced;
+    Stats->Cancelled = m_cancelled;
+    Stats->Completed = m_completed;
+}
\ No newline at end of file
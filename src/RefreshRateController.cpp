@@ -0,0 +1,147 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "RefreshRateController.h"
+
+RefreshRateController &
+RefreshRateController::instance()
+{
+    static RefreshRateController self;
+    return self;
+}
+
+RefreshRateController::~RefreshRateController()
+{
+    {
+        std::lock_guard lock{m_lock};
+        m_stop = TRUE;
+    }
+
+    m_wake.notify_one();
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+VOID
+RefreshRateController::Start(std::function<HRESULT(RefreshRateTier)> Apply)
+{
+    std::lock_guard lock{m_lock};
+
+    if (m_thread.joinable())
+    {
+        return;
+    }
+
+    m_apply = std::move(Apply);
+    m_lastInteraction = GetTickCount64();
+    m_thread = std::thread{[this] { Run(); }};
+}
+
+VOID
+RefreshRateController::OnInteraction()
+{
+    m_lastInteraction.store(GetTickCount64(), std::memory_order_relaxed);
+
+    // While at the high tier the thread picks the new time up at its idle deadline, only going back
+    // up needs waking it
+    if (m_appliedTier.load(std::memory_order_relaxed) == RefreshRateTier::Low)
+    {
+        {
+            std::lock_guard lock{m_lock};
+            m_pending = TRUE;
+            m_stats.InteractionWakeups++;
+        }
+
+        m_wake.notify_one();
+    }
+}
+
+VOID
+RefreshRateController::OnPowerSourceChanged(BOOLEAN OnBattery)
+{
+    {
+        std::lock_guard lock{m_lock};
+        m_onBattery = OnBattery;
+        m_pending = TRUE;
+    }
+
+    m_wake.notify_one();
+}
+
+VOID
+RefreshRateController::GetStats(PREFRESH_RATE_STATS Stats)
+{
+    std::lock_guard lock{m_lock};
+    *Stats = m_stats;
+}
+
+VOID
+RefreshRateController::Run()
+{
+    std::unique_lock lock{m_lock};
+    RefreshRateGovernor governor(DefaultRefreshRateGovernorSettings, GetTickCount64());
+
+    while (!m_stop)
+    {
+        ULONGLONG now = GetTickCount64();
+
+        governor.OnInteraction(m_lastInteraction);
+        governor.OnPowerSource(m_onBattery);
+
+        RefreshRateTier tier = governor.Evaluate(now);
+        if (tier != m_appliedTier)
+        {
+            // Mode sets take a while, input and power changes must not wait on them
+            lock.unlock();
+            HRESULT Status = m_apply(tier);
+            lock.lock();
+
+            if (Status == ERROR_SUCCESS)
+            {
+                m_appliedTier = tier;
+                (tier == RefreshRateTier::High ? m_stats.SwitchesUp : m_stats.SwitchesDown)++;
+            }
+            else
+            {
+                m_stats.FailedSwitches++;
+            }
+        }
+
+        // A failed switch is retried on the next input or power change
+        uint64_t deadline = governor.NextDeadline(now);
+        auto woken = [this] { return m_pending || m_stop; };
+
+        if (deadline == REFRESH_RATE_NO_DEADLINE)
+        {
+            m_wake.wait(lock, woken);
+        }
+        else if (deadline > now)
+        {
+            m_wake.wait_for(lock, std::chrono::milliseconds(deadline - now), woken);
+        }
+
+        m_pending = FALSE;
+    }
+}
\ No newline at end of file
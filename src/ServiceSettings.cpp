@@ -0,0 +1,263 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "ServiceSettings.h"
+#include <string>
+
+static HKEY
+GetSettingsHiveRoot(SettingsHive Hive)
+{
+    return Hive == SettingsHive::LocalMachine ? HKEY_LOCAL_MACHINE : HKEY_CURRENT_USER;
+}
+
+bool
+RegistrySettingsStore::ReadDword(const SettingsKeyDescriptor &Key, const wchar_t *ValueName, uint32_t &Value)
+{
+    DWORD value = 0;
+    DWORD size = sizeof(DWORD);
+
+    if (RegGetValue(GetSettingsHiveRoot(Key.Hive), Key.Path, ValueName, RRF_RT_REG_DWORD, NULL, &value, &size) !=
+        ERROR_SUCCESS)
+    {
+        return false;
+    }
+
+    Value = value;
+    return true;
+}
+
+ServiceSettings &
+ServiceSettings::instance()
+{
+    static ServiceSettings self;
+    return self;
+}
+
+ServiceSettings::ServiceSettings() : m_cache(m_store)
+{
+    m_stopEvent = CreateEvent(NULL, TRUE, FALSE, NULL);
+    m_cache.RefreshAll();
+}
+
+ServiceSettings::~ServiceSettings()
+{
+    Stop();
+
+    if (m_stopEvent != NULL)
+    {
+        CloseHandle(m_stopEvent);
+    }
+}
+
+VOID
+ServiceSettings::Start(SettingsCache::ChangedCallback Changed)
+{
+    if (m_thread.joinable() || m_stopEvent == NULL)
+    {
+        return;
+    }
+
+    ResetEvent(m_stopEvent);
+    m_cache.SetChangedCallback(std::move(Changed));
+    m_thread = std::thread{[this] { Run(); }};
+}
+
+VOID
+ServiceSettings::Stop()
+{
+    if (!m_thread.joinable())
+    {
+        return;
+    }
+
+    SetEvent(m_stopEvent);
+    m_thread.join();
+}
+
+DWORD
+ServiceSettings::Get(SettingId Id) const noexcept
+{
+    return m_cache.Get(Id);
+}
+
+VOID
+ServiceSettings::Set(SettingId Id, DWORD Value) noexcept
+{
+    m_cache.Set(Id, Value);
+}
+
+SettingsCacheStats
+ServiceSettings::GetStats() const
+{
+    return m_cache.GetStats();
+}
+
+//
+// Subject: Opens a settings key to be watched, or the nearest of its ancestors which exists
+//
+// Parameters:
+//
+//             Descriptor: The settings key
+//
+//             Exists: Receives whether the key itself was opened
+//
+// Returns: The open key, NULL if not even the hive root could be opened
+//
+static HKEY
+OpenNearestSettingsKey(CONST SettingsKeyDescriptor &Descriptor, BOOL &Exists)
+{
+    std::wstring path = Descriptor.Path;
+    HKEY key = NULL;
+
+    Exists = TRUE;
+
+    // An empty path opens the hive root itself
+    while (RegOpenKeyEx(GetSettingsHiveRoot(Descriptor.Hive), path.c_str(), 0, KEY_NOTIFY | KEY_QUERY_VALUE, &key) !=
+           ERROR_SUCCESS)
+    {
+        Exists = FALSE;
+
+        if (path.empty())
+        {
+            return NULL;
+        }
+
+        size_t separator = path.rfind(L'\\');
+        path.resize(separator == std::wstring::npos ? 0 : separator);
+    }
+
+    return key;
+}
+
+//
+// A settings key is watched for its values once it exists. Until then its nearest existing ancestor is
+// watched for subkeys being created or deleted below it, and the key is looked for again on every change.
+//
+struct WatchedSettingsKey
+{
+    SettingsKeyId Id;
+    HKEY Key;
+    BOOL Exists;
+    // Auto reset, every wake re-arms the notification before reading
+    HANDLE Event;
+
+    // Returns TRUE if the key itself is watched
+    BOOL Arm()
+    {
+        // The key, or the ancestor, may have been deleted since it was opened
+        if (Key != NULL && Notify() == ERROR_SUCCESS)
+        {
+            return Exists;
+        }
+
+        Close();
+        Key = OpenNearestSettingsKey(SETTINGS_KEYS[(uint32_t)Id], Exists);
+
+        if (Key != NULL && Notify() != ERROR_SUCCESS)
+        {
+            Close();
+        }
+
+        return Key != NULL && Exists;
+    }
+
+    // Looks for the key again if only an ancestor is watched, returns TRUE if the key itself is watched
+    BOOL Rearm()
+    {
+        if (!Exists)
+        {
+            Close();
+        }
+
+        return Arm();
+    }
+
+    // An ancestor only reports subkeys being created or deleted, anywhere below it
+    LONG Notify()
+    {
+        return RegNotifyChangeKeyValue(
+            Key, !Exists, Exists ? REG_NOTIFY_CHANGE_LAST_SET : REG_NOTIFY_CHANGE_NAME, Event, TRUE);
+    }
+
+    VOID Close()
+    {
+        if (Key != NULL)
+        {
+            RegCloseKey(Key);
+            Key = NULL;
+        }
+    }
+};
+
+VOID
+ServiceSettings::Run()
+{
+    constexpr DWORD KeyCount = (DWORD)SettingsKeyId::Count;
+
+    WatchedSettingsKey keys[KeyCount] = {};
+    HANDLE handles[KeyCount + 1] = {m_stopEvent};
+    DWORD watched = 0;
+
+    for (DWORD i = 0; i < KeyCount; i++)
+    {
+        HANDLE event = CreateEvent(NULL, FALSE, FALSE, NULL);
+        if (event == NULL)
+        {
+            continue;
+        }
+
+        keys[watched] = WatchedSettingsKey{(SettingsKeyId)i, NULL, FALSE, event};
+        handles[watched + 1] = event;
+        keys[watched].Arm();
+        watched++;
+    }
+
+    // Anything written between the first read and arming the notifications
+    m_cache.RefreshAll();
+
+    while (true)
+    {
+        DWORD wait = WaitForMultipleObjects(watched + 1, handles, FALSE, INFINITE);
+
+        // Stopping, or the wait itself failed
+        if (wait == WAIT_OBJECT_0 || wait > WAIT_OBJECT_0 + watched)
+        {
+            break;
+        }
+
+        WatchedSettingsKey &key = keys[wait - WAIT_OBJECT_0 - 1];
+        BOOL existed = key.Exists;
+
+        // A key created or deleted since has its values back or gone, a key which is still missing
+        // keeps its defaults and needs no read
+        if (key.Rearm() || existed)
+        {
+            m_cache.RefreshKey(key.Id);
+        }
+    }
+
+    for (DWORD i = 0; i < watched; i++)
+    {
+        keys[i].Close();
+        CloseHandle(keys[i].Event);
+    }
+}
\ No newline at end of file
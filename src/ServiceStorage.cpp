@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "ServiceStorage.h"
+#include <tchar.h>
+
+#define SERVICE_DATA_DIRECTORY _T("%LOCALAPPDATA%\\SurfaceDisplayConfiguratorService")
+
+HRESULT WINAPI
+GetServiceDataFilePath(CONST WCHAR *FileName, std::wstring &Path)
+{
+    WCHAR directory[MAX_PATH];
+
+    DWORD length = ExpandEnvironmentStrings(SERVICE_DATA_DIRECTORY, directory, ARRAYSIZE(directory));
+    if (length == 0 || length > ARRAYSIZE(directory))
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!CreateDirectory(directory, NULL) && GetLastError() != ERROR_ALREADY_EXISTS)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    Path = directory;
+    Path += L"\\";
+    Path += FileName;
+
+    return ERROR_SUCCESS;
+}
\ No newline at end of file
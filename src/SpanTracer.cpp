@@ -0,0 +1,166 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "ServiceStorage.h"
+#include "SpanTracer.h"
+#include <chrono>
+#include <vector>
+
+static_assert((SPAN_TRACER_CAPACITY & (SPAN_TRACER_CAPACITY - 1)) == 0);
+
+SpanTracer &
+SpanTracer::instance()
+{
+    static SpanTracer self;
+    return self;
+}
+
+uint64_t
+SpanTracer::Now()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
+}
+
+uint32_t
+SpanTracer::CurrentThreadId()
+{
+    static std::atomic<uint32_t> nextThreadId{1};
+    thread_local uint32_t threadId = nextThreadId++;
+
+    return threadId;
+}
+
+void
+SpanTracer::Record(const char *Name, uint64_t Start, uint64_t End)
+{
+    uint64_t index = m_next.fetch_add(1, std::memory_order_relaxed);
+    Slot &slot = m_slots[index & (SPAN_TRACER_CAPACITY - 1)];
+
+    slot.Sequence.store(index * 2 + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+
+    slot.Name.store(Name, std::memory_order_relaxed);
+    slot.Start.store(Start, std::memory_order_relaxed);
+    slot.End.store(End, std::memory_order_relaxed);
+    slot.ThreadId.store(CurrentThreadId(), std::memory_order_relaxed);
+
+    slot.Sequence.store(index * 2 + 2, std::memory_order_release);
+}
+
+uint64_t
+SpanTracer::EndPhase(const char *Name, uint64_t Start)
+{
+    uint64_t end = Now();
+
+    Record(Name, Start, end);
+    return end;
+}
+
+std::string
+SpanTracer::ExportChromeTrace() const
+{
+    uint64_t next = m_next.load(std::memory_order_acquire);
+    uint64_t first = next > SPAN_TRACER_CAPACITY ? next - SPAN_TRACER_CAPACITY : 0;
+    std::string json = "{\"traceEvents\":[";
+    bool separator = false;
+    char event[256];
+
+    for (uint64_t index = first; index < next; index++)
+    {
+        const Slot &slot = m_slots[index & (SPAN_TRACER_CAPACITY - 1)];
+        uint64_t sequence = slot.Sequence.load(std::memory_order_acquire);
+
+        // Still being written, or already overwritten by a newer span
+        if (sequence != index * 2 + 2)
+        {
+            continue;
+        }
+
+        const char *name = slot.Name.load(std::memory_order_relaxed);
+        uint64_t start = slot.Start.load(std::memory_order_relaxed);
+        uint64_t end = slot.End.load(std::memory_order_relaxed);
+        uint32_t threadId = slot.ThreadId.load(std::memory_order_relaxed);
+
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (slot.Sequence.load(std::memory_order_relaxed) != sequence)
+        {
+            continue;
+        }
+
+        snprintf(
+            event,
+            sizeof(event),
+            "%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%u,\"ts\":%llu,\"dur\":%llu}",
+            separator ? "," : "",
+            name,
+            threadId,
+            (unsigned long long)start,
+            (unsigned long long)(end - start));
+
+        json += event;
+        separator = true;
+    }
+
+    json += "]}";
+    return json;
+}
+
+//
+// Subject: Writes the recorded spans to the service data directory
+//
+// Parameters:
+//
+//             FileName: The name of the trace file
+//
+// Returns: ERROR_SUCCESS if successful
+//
+HRESULT WINAPI
+WriteSpanTrace(CONST WCHAR *FileName)
+{
+    std::string json = SpanTracer::instance().ExportChromeTrace();
+    std::wstring path;
+    DWORD written = 0;
+    HRESULT Status = ERROR_SUCCESS;
+
+    Status = GetServiceDataFilePath(FileName, path);
+    if (Status != ERROR_SUCCESS)
+    {
+        return Status;
+    }
+
+    HANDLE file = CreateFile(path.c_str(), GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (file == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    if (!WriteFile(file, json.data(), (DWORD)json.size(), &written, NULL) || written != json.size())
+    {
+        Status = HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    CloseHandle(file);
+
+    return Status;
+}
\ No newline at end of file
@@ -26,6 +26,8 @@
 
 #include "AutoRotate.h"
 #include "ActiveMonitorWindowHandler.h"
+#include "ServiceSettings.h"
+#include "SpanTracer.h"
 
 TCHAR SVCNAME[] = TEXT("SurfaceDisplayConfiguratorService");
 
@@ -42,6 +44,7 @@ VOID
 SvcInit(DWORD, LPTSTR *);
 
 HPOWERNOTIFY m_hScreenStateNotify = NULL;
+HPOWERNOTIFY m_hPowerSourceNotify = NULL;
 
 //
 // Purpose:
@@ -92,6 +95,8 @@ SvcMain(DWORD dwArgc, LPTSTR *lpszArgv)
 
     m_hScreenStateNotify =
         RegisterPowerSettingNotification(gSvcStatusHandle, &GUID_CONSOLE_DISPLAY_STATE, DEVICE_NOTIFY_SERVICE_HANDLE);
+    m_hPowerSourceNotify =
+        RegisterPowerSettingNotification(gSvcStatusHandle, &GUID_ACDC_POWER_SOURCE, DEVICE_NOTIFY_SERVICE_HANDLE);
 
     // These SERVICE_STATUS members remain as set here
 
@@ -111,6 +116,12 @@ SvcMain(DWORD dwArgc, LPTSTR *lpszArgv)
         UnregisterPowerSettingNotification(m_hScreenStateNotify);
         m_hScreenStateNotify = NULL;
     }
+
+    if (m_hPowerSourceNotify != NULL)
+    {
+        UnregisterPowerSettingNotification(m_hPowerSourceNotify);
+        m_hPowerSourceNotify = NULL;
+    }
 }
 
 //
@@ -153,9 +164,12 @@ SvcInit(DWORD, LPTSTR *)
 
     ReportSvcStatus(SERVICE_RUNNING, NO_ERROR, 0);
 
+    // A single thread keeps the settings every other thread reads up to date
+    ServiceSettings::instance().Start(OnSettingChanged);
+
     // Perform work until service stops.
-    std::thread t1(AutoRotateMain);
-    std::thread t2(ActiveMonitorWindowHandlerMain);
+    std::thread t1(AutoRotateMain, ghSvcStopEvent);
+    std::thread t2(ActiveMonitorWindowHandlerMain, ghSvcStopEvent);
 
     while (1)
     {
@@ -163,8 +177,13 @@ SvcInit(DWORD, LPTSTR *)
 
         WaitForSingleObject(ghSvcStopEvent, INFINITE);
 
-        t1.detach();
-        t2.detach();
+        // No setting change may reach the workers while they wind down
+        ServiceSettings::instance().Stop();
+
+        // The sensors are released, the shell states reset and the window placements finished before
+        // the service reports it stopped
+        t1.join();
+        t2.join();
 
         ReportSvcStatus(SERVICE_STOPPED, NO_ERROR, 0);
         return;
@@ -198,7 +217,7 @@ ReportSvcStatus(DWORD dwCurrentState, DWORD dwWin32ExitCode, DWORD dwWaitHint)
     if (dwCurrentState == SERVICE_START_PENDING)
         gSvcStatus.dwControlsAccepted = 0;
     else
-        gSvcStatus.dwControlsAccepted = SERVICE_ACCEPT_STOP;
+        gSvcStatus.dwControlsAccepted = SERVICE_ACCEPT_STOP | SERVICE_ACCEPT_PARAMCHANGE;
 
     if ((dwCurrentState == SERVICE_RUNNING) || (dwCurrentState == SERVICE_STOPPED))
         gSvcStatus.dwCheckPoint = 0;
@@ -241,6 +260,13 @@ SvcCtrlHandler(DWORD dwCtrl, DWORD, LPVOID lpEventData, LPVOID lpContext)
     case SERVICE_CONTROL_INTERROGATE:
         break;
 
+    // sc control SurfaceDisplayConfiguratorService paramchange dumps the recent display transitions
+    // and the sensor events seen so far
+    case SERVICE_CONTROL_PARAMCHANGE:
+        WriteSpanTrace(L"DisplayTransitions.json");
+        WriteSensorTrace(L"SensorTrace.bin");
+        break;
+
     case SERVICE_CONTROL_POWEREVENT:
         broadCastSetting = (PPOWERBROADCAST_SETTING)lpEventData;
         OnPowerEvent(broadCastSetting->PowerSetting, broadCastSetting->Data, broadCastSetting->DataLength, lpContext);
@@ -31,6 +31,7 @@
 #include <strsafe.h>
 #include <cfgmgr32.h>
 #include <winternl.h>
+#include "ServiceSettings.h"
 #include "TabletPostureManager.h"
 
 ULONG64 WNF_TMCN_ISTABLETPOSTURE = 0x0F850339A3BC1035;
@@ -92,18 +93,8 @@ _RegSetKeyValue(HKEY hKey, LPCWSTR lpSubKey, LPCWSTR lpValueName, DWORD dwType,
 BOOLEAN WINAPI
 IsOOBEInProgress()
 {
-    DWORD oobeInProgress = 0;
-
-    HKEY key;
-    DWORD type = REG_DWORD, size = 8;
-
-    if (SUCCEEDED(RegOpenKeyEx(HKEY_LOCAL_MACHINE, _T("SYSTEM\\Setup"), NULL, KEY_READ, &key)))
-    {
-        RegQueryValueEx(key, _T("OOBEInProgress"), NULL, &type, (LPBYTE)&oobeInProgress, &size);
-        RegCloseKey(key);
-    }
-
-    return oobeInProgress == 1;
+    // Called for every posture and window event, served from the settings cache
+    return ServiceSettings::instance().Get(SettingId::OOBEInProgress) == 1;
 }
 
 BOOL WINAPI
@@ -184,18 +175,11 @@ SetTabletPostureTaskbarState(BOOLEAN state)
         return FALSE;
     }
 
-    HRESULT status = RegGetValue(
-        HKEY_CURRENT_USER,
-        _T("Software\\Microsoft\\Windows\\CurrentVersion\\Explorer"),
-        _T("TabletPostureTaskbar"),
-        REG_DWORD,
-        NULL,
-        &pvData,
-        &pcbData);
-
-    if (FAILED(status) || pvData != (BYTE)state)
+    HRESULT status = ERROR_SUCCESS;
+
+    // A missing value never matches the state so it gets written
+    if (ServiceSettings::instance().Get(SettingId::TabletPostureTaskbar) != pvData)
     {
-        pvData = (BYTE)state;
         status = _RegSetKeyValue(
             HKEY_CURRENT_USER,
             _T("Software\\Microsoft\\Windows\\CurrentVersion\\Explorer"),
@@ -203,6 +187,11 @@ SetTabletPostureTaskbarState(BOOLEAN state)
             REG_DWORD,
             (PBYTE)&pvData,
             pcbData);
+
+        if (SUCCEEDED(status))
+        {
+            ServiceSettings::instance().Set(SettingId::TabletPostureTaskbar, pvData);
+        }
     }
 
     return SUCCEEDED(status);
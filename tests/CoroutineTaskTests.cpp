@@ -0,0 +1,386 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "CoroutineTask.h"
+#include "TestHarness.h"
+
+//
+// Counts how many coroutine frames holding one are still alive
+//
+struct FrameTracker
+{
+    static inline std::atomic<int32_t> Live{0};
+
+    FrameTracker()
+    {
+        Live++;
+    }
+
+    ~FrameTracker()
+    {
+        Live--;
+    }
+};
+
+static Task<uint32_t>
+Double(uint32_t Value)
+{
+    FrameTracker tracker;
+    co_return Value * 2;
+}
+
+static Task<uint32_t>
+DoubleTwice(uint32_t Value)
+{
+    FrameTracker tracker;
+    uint32_t once = co_await Double(Value);
+    co_return co_await Double(once);
+}
+
+static Task<void>
+Throw()
+{
+    co_await ResumeAfter(std::chrono::microseconds(0));
+    throw std::runtime_error("Placement failed");
+}
+
+static Task<uint32_t>
+DelayedValue(uint32_t Value, uint32_t DelayMilliseconds, std::vector<uint32_t> &Order)
+{
+    FrameTracker tracker;
+    co_await ResumeAfter(std::chrono::milliseconds(DelayMilliseconds));
+    Order.push_back(Value);
+    co_return Value;
+}
+
+TEST_CASE(TasksStartOnlyWhenSpawned)
+{
+    CoroutineLoop loop;
+    bool ran = false;
+    uint32_t result = 0;
+
+    auto body = [&]() -> Task<void> {
+        ran = true;
+        result = co_await DoubleTwice(5);
+    };
+
+    {
+        Task<void> unused = body();
+    }
+
+    CHECK(!ran);
+
+    Spawn(loop, body());
+    CHECK(!ran);
+
+    loop.RunUntilIdle();
+    CHECK(ran);
+    CHECK_EQUAL(20u, result);
+
+    // Nested awaits run inline, only the spawn went through the loop
+    CHECK_EQUAL(1u, loop.GetStats().Resumptions);
+    CHECK_EQUAL(0, FrameTracker::Live.load());
+}
+
+TEST_CASE(ExceptionsReachTheAwaitingCoroutine)
+{
+    CoroutineLoop loop;
+    bool caught = false;
+
+    // A coroutine lambda reads its captures through the closure, which has to outlive it
+    auto body = [&]() -> Task<void> {
+        try
+        {
+            co_await Throw();
+        }
+        catch (const std::runtime_error &)
+        {
+            caught = true;
+        }
+    };
+
+    Spawn(loop, body());
+
+    // Nothing awaits this one, its exception is dropped with it
+    Spawn(loop, Throw());
+
+    loop.RunUntilIdle();
+    CHECK(caught);
+}
+
+TEST_CASE(TimersResumeInDeadlineOrder)
+{
+    CoroutineLoop loop;
+    std::vector<uint32_t> order;
+    uint64_t start = CoroutineLoop::Now();
+
+    for (uint32_t value : {3u, 1u, 2u, 4u})
+    {
+        Spawn(loop, [](uint32_t Value, std::vector<uint32_t> &Order) -> Task<void> {
+            // 1 and 2 share a deadline window, the timers set first go first
+            co_await DelayedValue(Value, Value >= 3 ? 20 * (Value - 2) : 5, Order);
+        }(value, order));
+    }
+
+    loop.RunUntilIdle();
+
+    CHECK(order == (std::vector<uint32_t>{1, 2, 3, 4}));
+    CHECK(CoroutineLoop::Now() - start >= 40000);
+    CHECK_EQUAL(4u, loop.GetStats().TimersFired);
+    CHECK_EQUAL(0, FrameTracker::Live.load());
+}
+
+TEST_CASE(WhenAllKeepsTheTaskOrder)
+{
+    CoroutineLoop loop;
+    std::vector<uint32_t> finished;
+    std::vector<uint32_t> values;
+    bool emptyDone = false;
+
+    auto body = [&]() -> Task<void> {
+        std::vector<Task<uint32_t>> tasks;
+
+        tasks.push_back(DelayedValue(1, 30, finished));
+        tasks.push_back(DelayedValue(2, 10, finished));
+        tasks.push_back(DelayedValue(3, 20, finished));
+
+        values = co_await WhenAll(std::move(tasks));
+
+        co_await WhenAll(std::vector<Task<void>>{});
+        emptyDone = true;
+    };
+
+    Spawn(loop, body());
+
+    uint64_t start = CoroutineLoop::Now();
+    loop.RunUntilIdle();
+
+    // The tasks ran concurrently, the whole wait is the longest one
+    CHECK(finished == (std::vector<uint32_t>{2, 3, 1}));
+    CHECK(values == (std::vector<uint32_t>{1, 2, 3}));
+    CHECK(CoroutineLoop::Now() - start < 55000);
+    CHECK(emptyDone);
+    CHECK_EQUAL(0, FrameTracker::Live.load());
+}
+
+TEST_CASE(WhenAllRethrowsOnceEveryTaskFinished)
+{
+    CoroutineLoop loop;
+    std::vector<uint32_t> finished;
+    bool caught = false;
+
+    auto body = [&]() -> Task<void> {
+        std::vector<Task<void>> tasks;
+
+        tasks.push_back(Throw());
+        tasks.push_back([](std::vector<uint32_t> &Finished) -> Task<void> {
+            co_await DelayedValue(7, 10, Finished);
+        }(finished));
+
+        try
+        {
+            co_await WhenAll(std::move(tasks));
+        }
+        catch (const std::runtime_error &)
+        {
+            caught = finished.size() == 1;
+        }
+    };
+
+    Spawn(loop, body());
+
+    loop.RunUntilIdle();
+    CHECK(caught);
+    CHECK_EQUAL(0, FrameTracker::Live.load());
+}
+
+TEST_CASE(ResumeOnMovesToTheOtherLoop)
+{
+    CoroutineLoop main;
+    CoroutineLoop placement;
+    std::thread placementThread{[&] { placement.Run(); }};
+    std::thread::id mainThread = std::this_thread::get_id();
+    std::thread::id afterMove;
+    std::thread::id afterTimer;
+    std::thread::id afterAwait;
+    std::thread::id afterReturn;
+    std::atomic<bool> done{false};
+
+    auto body = [&]() -> Task<void> {
+        co_await ResumeOn(placement);
+        afterMove = std::this_thread::get_id();
+
+        co_await ResumeAfter(std::chrono::milliseconds(1));
+        afterTimer = std::this_thread::get_id();
+
+        co_await DoubleTwice(1);
+        afterAwait = std::this_thread::get_id();
+
+        co_await ResumeOn(main);
+        afterReturn = std::this_thread::get_id();
+        done = true;
+    };
+
+    Spawn(main, body());
+
+    // The main loop goes idle while the coroutine is away on the placement loop
+    while (!done.load())
+    {
+        main.RunUntilIdle();
+        std::this_thread::yield();
+    }
+
+    placement.Stop();
+    placementThread.join();
+
+    CHECK(afterMove != mainThread);
+    CHECK(afterTimer == afterMove);
+    CHECK(afterAwait == afterMove);
+    CHECK(afterReturn == mainThread);
+}
+
+TEST_CASE(PostsFromOtherThreadsAllRun)
+{
+    constexpr uint32_t posters = 4;
+    constexpr uint32_t spawns = 5000;
+    CoroutineLoop loop;
+    std::atomic<uint32_t> completed{0};
+    std::thread runner{[&] { loop.Run(); }};
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 0; i < posters; i++)
+    {
+        threads.emplace_back([&] {
+            for (uint32_t j = 0; j < spawns; j++)
+            {
+                Spawn(loop, [](std::atomic<uint32_t> &Completed, uint32_t Delay) -> Task<void> {
+                    co_await ResumeAfter(std::chrono::microseconds(Delay));
+                    Completed++;
+                }(completed, j % 100));
+            }
+        });
+    }
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    while (completed.load() != posters * spawns)
+    {
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    loop.Stop();
+    runner.join();
+
+    CHECK_EQUAL(posters * spawns, completed.load());
+    CHECK_EQUAL(posters * spawns, loop.GetStats().TimersFired);
+}
+
+TEST_CASE(StopWhenIdleFinishesTheStartedCoroutines)
+{
+    CoroutineLoop loop;
+    std::vector<uint32_t> order;
+
+    for (uint32_t value : {2u, 1u, 3u})
+    {
+        Spawn(loop, [](uint32_t Value, std::vector<uint32_t> &Order) -> Task<void> {
+            co_await DelayedValue(Value, 10 * Value, Order);
+        }(value, order));
+    }
+
+    std::thread runner{[&] { loop.Run(); }};
+
+    // Asked to stop before any timer fired, the waits still run to their end and the frames are freed
+    loop.StopWhenIdle();
+    runner.join();
+
+    CHECK(order == (std::vector<uint32_t>{1, 2, 3}));
+    CHECK_EQUAL(3u, loop.GetStats().TimersFired);
+    CHECK_EQUAL(0, FrameTracker::Live.load());
+
+    // Nothing is pending, Run returns right away
+    loop.Run();
+}
+
+BENCHMARK_CASE(AwaitCost)
+{
+    CoroutineLoop loop;
+    volatile uint32_t sink = 0;
+
+    auto awaitFinished = [&]() -> Task<void> {
+        for (uint32_t i = 0; i < 1000000; i++)
+        {
+            sink = sink + co_await Double(i);
+        }
+    };
+    auto increment = [&]() -> Task<void> {
+        sink = sink + 1;
+        co_return;
+    };
+    auto yieldToLoop = []() -> Task<void> {
+        for (uint32_t i = 0; i < 100000; i++)
+        {
+            co_await ResumeAfter(std::chrono::microseconds(0));
+        }
+    };
+
+    double nested = MeasureNanoseconds(1, [&](uint64_t) {
+        Spawn(loop, awaitFinished());
+        loop.RunUntilIdle();
+    });
+
+    double spawn = MeasureNanoseconds(1000000, [&](uint64_t) {
+        Spawn(loop, increment());
+        loop.RunUntilIdle();
+    });
+
+    double timer = MeasureNanoseconds(1, [&](uint64_t) {
+        Spawn(loop, yieldToLoop());
+        loop.RunUntilIdle();
+    });
+
+    // 10000 placements waiting at once, which would be 10000 parked threads with a sleep per wait
+    std::atomic<uint32_t> completed{0};
+    double waiting = MeasureNanoseconds(1, [&](uint64_t) {
+        for (uint32_t i = 0; i < 10000; i++)
+        {
+            Spawn(loop, [](std::atomic<uint32_t> &Completed) -> Task<void> {
+                co_await ResumeAfter(std::chrono::milliseconds(50));
+                Completed++;
+            }(completed));
+        }
+        loop.RunUntilIdle();
+    });
+
+    double thread = MeasureNanoseconds(1000, [&](uint64_t) {
+        std::thread waiter{[&] { sink = sink + 1; }};
+        waiter.join();
+    });
+
+    ReportMeasurement("co_await of a task returning at once", nested / 1000000, "ns");
+    ReportMeasurement("Spawn and run to completion", spawn, "ns");
+    ReportMeasurement("ResumeAfter(0) round trip through the loop", timer / 100000, "ns");
+    ReportMeasurement("10000 coroutines waiting 50 ms each, one thread", waiting / 1000000, "ms");
+    ReportMeasurement("Thread start and join, for comparison", thread, "ns");
+}
\ No newline at end of file
@@ -0,0 +1,202 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "SetupDiFullWalk.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+#include <cwchar>
+
+constexpr inline uint32_t SYNTHETIC_TREE_SEED = 0x5EED1234;
+
+static std::wstring
+ToLower(std::wstring String)
+{
+    for (WCHAR &character : String)
+    {
+        character = (WCHAR)towlower(character);
+    }
+
+    return String;
+}
+
+TEST_CASE(GeneratorIsDeterministic)
+{
+    SyntheticDeviceTree first = GenerateSyntheticDeviceTree(2000, 2, SYNTHETIC_TREE_SEED);
+    SyntheticDeviceTree second = GenerateSyntheticDeviceTree(2000, 2, SYNTHETIC_TREE_SEED);
+    SyntheticDeviceTree other = GenerateSyntheticDeviceTree(2000, 2, SYNTHETIC_TREE_SEED + 1);
+    size_t panelDevices = 0;
+
+    CHECK_EQUAL(2000u, first.Devices.size());
+    CHECK_EQUAL(2u, first.Panels.size());
+
+    for (size_t i = 0; i < first.Devices.size(); i++)
+    {
+        CHECK(first.Devices[i].InstanceId == second.Devices[i].InstanceId);
+        panelDevices += first.Devices[i].PanelId.empty() ? 0 : 1;
+    }
+
+    CHECK_EQUAL(4u, panelDevices);
+    CHECK(first.Panels[0].PanelId == second.Panels[0].PanelId);
+    CHECK(first.Panels[0].PanelId != other.Panels[0].PanelId);
+}
+
+TEST_CASE(InventoryResolvesPanelDevices)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(5000, 2, SYNTHETIC_TREE_SEED);
+    SyntheticDeviceSource source(tree);
+    DeviceInventory inventory(source);
+
+    CHECK(SUCCEEDED(inventory.EnsurePopulated()));
+    CHECK_EQUAL(4u, inventory.GetDeviceCount());
+
+    for (const SyntheticPanel &panel : tree.Panels)
+    {
+        std::optional<size_t> monitor = inventory.FindByMonitorDeviceId(ToLower(panel.MonitorDeviceId).c_str());
+        std::optional<size_t> digitizer = inventory.FindByInstanceId(panel.DigitizerInstanceId.c_str());
+
+        CHECK(monitor.has_value());
+        CHECK(digitizer.has_value());
+        CHECK(monitor && inventory.GetInstanceId(*monitor) == panel.MonitorInstanceId);
+        CHECK(digitizer && inventory.GetPanelId(*digitizer) == panel.PanelId);
+
+        CHECK(inventory.IsDeviceBoundToPanelId(panel.MonitorDeviceId.c_str(), panel.PanelId.c_str()));
+    }
+
+    CHECK(!inventory.IsDeviceBoundToPanelId(tree.Panels[0].MonitorDeviceId.c_str(), tree.Panels[1].PanelId.c_str()));
+    CHECK(!inventory.IsDeviceBoundToPanelId(L"MONITOR\\NONE\\{0}\\0000", tree.Panels[0].PanelId.c_str()));
+    CHECK_EQUAL(2u, inventory.FindByHardwareId(ToLower(SYNTHETIC_DIGITIZER_HARDWARE_ID).c_str()).size());
+}
+
+TEST_CASE(RefreshPicksUpNewPanels)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(1000, 1, SYNTHETIC_TREE_SEED);
+    SyntheticDeviceSource source(tree);
+    DeviceInventory inventory(source);
+
+    CHECK(SUCCEEDED(inventory.EnsurePopulated()));
+    CHECK_EQUAL(2u, inventory.GetDeviceCount());
+
+    tree = GenerateSyntheticDeviceTree(1000, 2, SYNTHETIC_TREE_SEED);
+
+    // Populated already, only a refresh sees the second panel
+    CHECK(SUCCEEDED(inventory.EnsurePopulated()));
+    CHECK_EQUAL(2u, inventory.GetDeviceCount());
+
+    CHECK(SUCCEEDED(inventory.Refresh()));
+    CHECK_EQUAL(4u, inventory.GetDeviceCount());
+    CHECK(inventory.IsDeviceBoundToPanelId(tree.Panels[1].MonitorDeviceId.c_str(), tree.Panels[1].PanelId.c_str()));
+}
+
+TEST_CASE(SetupDiSourceWalksTheTreeOnce)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(10000, 2, SYNTHETIC_TREE_SEED);
+    SetupDiDeviceSource source;
+    DeviceInventory inventory(source);
+
+    FakeSetupApiSetDevices(tree.Devices);
+
+    CHECK(SUCCEEDED(inventory.Refresh()));
+
+    FakeSetupApiStats stats = FakeSetupApiGetStats();
+
+    // One panel id query per devnode, then the driver key and the hardware ids of the four panel devnodes
+    CHECK_EQUAL(1u, stats.DeviceListCalls);
+    CHECK_EQUAL(10000u + 2 * 4, stats.PropertyCalls);
+    CHECK_EQUAL(4u, stats.InstanceIdCalls);
+
+    FakeSetupApiResetStats();
+
+    for (const SyntheticPanel &panel : tree.Panels)
+    {
+        CHECK(inventory.IsDeviceBoundToPanelId(panel.MonitorDeviceId.c_str(), panel.PanelId.c_str()));
+        CHECK(FullWalkIsDeviceBoundToPanelId(panel.MonitorDeviceId.c_str(), panel.PanelId.c_str()));
+    }
+
+    // The full walk is only here to prove both agree, the inventory lookups themselves never reach SetupDi
+    CHECK_EQUAL(2u, FakeSetupApiGetStats().DeviceListCalls);
+}
+
+TEST_CASE(SyntheticSourceMatchesSetupDiSource)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(3000, 2, SYNTHETIC_TREE_SEED);
+    SyntheticDeviceSource syntheticSource(tree);
+    SetupDiDeviceSource setupDiSource;
+    std::vector<DeviceNodeRecord> synthetic;
+    std::vector<DeviceNodeRecord> setupDi;
+
+    FakeSetupApiSetDevices(tree.Devices);
+
+    syntheticSource.EnumeratePanelDevices([&](DeviceNodeRecord &&record) { synthetic.push_back(std::move(record)); });
+    setupDiSource.EnumeratePanelDevices([&](DeviceNodeRecord &&record) { setupDi.push_back(std::move(record)); });
+
+    CHECK_EQUAL(synthetic.size(), setupDi.size());
+
+    for (size_t i = 0; i < synthetic.size() && i < setupDi.size(); i++)
+    {
+        CHECK(synthetic[i].InstanceId == setupDi[i].InstanceId);
+        CHECK(synthetic[i].DriverKey == setupDi[i].DriverKey);
+        CHECK(synthetic[i].PanelId == setupDi[i].PanelId);
+        CHECK(synthetic[i].HardwareIds == setupDi[i].HardwareIds);
+    }
+}
+
+BENCHMARK_CASE(PanelLookupOnLargeTrees)
+{
+    for (size_t deviceCount : {10000, 50000, 100000})
+    {
+        SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(deviceCount, 2, SYNTHETIC_TREE_SEED);
+        SetupDiDeviceSource source;
+        DeviceInventory inventory(source);
+        const SyntheticPanel &panel = tree.Panels[1];
+        char name[96];
+        BOOLEAN bound = TRUE;
+
+        std::printf("  %zu devnodes\n", deviceCount);
+        FakeSetupApiSetDevices(tree.Devices);
+
+        double refresh = MeasureNanoseconds(1, [&](uint64_t) { inventory.Refresh(); });
+        FakeSetupApiStats refreshStats = FakeSetupApiGetStats();
+
+        FakeSetupApiResetStats();
+        double fullWalk = MeasureNanoseconds(10, [&](uint64_t) {
+            bound &= FullWalkIsDeviceBoundToPanelId(panel.MonitorDeviceId.c_str(), panel.PanelId.c_str());
+        });
+        FakeSetupApiStats fullWalkStats = FakeSetupApiGetStats();
+
+        double indexed = MeasureNanoseconds(100000, [&](uint64_t) {
+            bound &= inventory.IsDeviceBoundToPanelId(panel.MonitorDeviceId.c_str(), panel.PanelId.c_str());
+        });
+
+        CHECK(bound);
+
+        std::snprintf(name, sizeof(name), "inventory refresh, %llu SetupDi calls",
+            (unsigned long long)(refreshStats.EnumCalls + refreshStats.PropertyCalls + refreshStats.InstanceIdCalls));
+        ReportMeasurement(name, refresh / 1000.0, "us");
+
+        std::snprintf(name, sizeof(name), "full walk lookup, %llu SetupDi calls",
+            (unsigned long long)((fullWalkStats.EnumCalls + fullWalkStats.PropertyCalls) / 10));
+        ReportMeasurement(name, fullWalk / 1000.0, "us");
+
+        ReportMeasurement("inventory lookup, 0 SetupDi calls", indexed, "ns");
+    }
+}
\ No newline at end of file
@@ -0,0 +1,194 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "DeviceStateTransaction.h"
+#include "SetupDiFullWalk.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+constexpr inline uint32_t SYNTHETIC_TREE_SEED = 0x5EED1234;
+
+//
+// Transactions resolve through the process wide inventory, point it at a fresh tree
+//
+static SyntheticDeviceTree
+UseDeviceTree(size_t DeviceCount)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(DeviceCount, 2, SYNTHETIC_TREE_SEED);
+
+    FakeSetupApiSetDevices(tree.Devices);
+    DeviceInventory::instance().Refresh();
+    FakeSetupApiResetStats();
+
+    return tree;
+}
+
+static BOOLEAN
+IsEnabled(const std::wstring &InstanceId)
+{
+    for (const FakeDeviceNode &device : FakeSetupApiGetDevices())
+    {
+        if (device.InstanceId == InstanceId)
+        {
+            return device.Enabled;
+        }
+    }
+
+    return FALSE;
+}
+
+TEST_CASE(CommitOpensOnlyTheMatchedDevices)
+{
+    SyntheticDeviceTree tree = UseDeviceTree(10000);
+    DeviceStateTransaction transaction;
+
+    transaction.Add(tree.Panels[0].PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, FALSE);
+    transaction.Add(tree.Panels[1].PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, FALSE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, transaction.Commit());
+
+    FakeSetupApiStats stats = FakeSetupApiGetStats();
+
+    CHECK_EQUAL(1u, stats.DeviceListCalls);
+    CHECK_EQUAL(0u, stats.EnumCalls);
+    CHECK_EQUAL(0u, stats.PropertyCalls);
+    CHECK_EQUAL(2u, stats.OpenCalls);
+    CHECK_EQUAL(2u, stats.ChangeStateCalls);
+
+    CHECK(!IsEnabled(tree.Panels[0].DigitizerInstanceId));
+    CHECK(!IsEnabled(tree.Panels[1].DigitizerInstanceId));
+
+    CHECK_EQUAL(2u, transaction.GetResults().size());
+    for (const DeviceStateResult &result : transaction.GetResults())
+    {
+        CHECK_EQUAL(ERROR_SUCCESS, result.Status);
+        CHECK(!result.Enable);
+    }
+}
+
+TEST_CASE(LaterOperationOnTheSameDeviceWins)
+{
+    SyntheticDeviceTree tree = UseDeviceTree(1000);
+    DeviceStateTransaction transaction;
+
+    transaction.Add(tree.Panels[0].PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, FALSE);
+    transaction.Add(tree.Panels[0].PanelId.c_str(), L"HID_DEVICE_SYSTEM_DIGITIZER", TRUE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, transaction.Commit());
+
+    CHECK_EQUAL(1u, FakeSetupApiGetStateChanges().size());
+    CHECK_EQUAL(1u, transaction.GetResults().size());
+    CHECK(IsEnabled(tree.Panels[0].DigitizerInstanceId));
+}
+
+TEST_CASE(OperationsOnlyMatchTheirPanel)
+{
+    SyntheticDeviceTree tree = UseDeviceTree(1000);
+    DeviceStateTransaction transaction;
+
+    transaction.Add(tree.Panels[1].PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, FALSE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, transaction.Commit());
+
+    CHECK(IsEnabled(tree.Panels[0].DigitizerInstanceId));
+    CHECK(!IsEnabled(tree.Panels[1].DigitizerInstanceId));
+}
+
+TEST_CASE(UnknownDevicesRefreshTheInventoryOnce)
+{
+    SyntheticDeviceTree tree = UseDeviceTree(1000);
+    DeviceStateTransaction transaction;
+
+    transaction.Add(tree.Panels[0].PanelId.c_str(), L"HID_DEVICE_UP:000D_U:0004", FALSE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, transaction.Commit());
+    CHECK(transaction.GetResults().empty());
+
+    // One refresh walk, and nothing to open afterwards
+    CHECK_EQUAL(1u, FakeSetupApiGetStats().DeviceListCalls);
+    CHECK_EQUAL(0u, FakeSetupApiGetStats().ChangeStateCalls);
+}
+
+TEST_CASE(DevicesArrivingLaterAreFoundThroughTheRefresh)
+{
+    SyntheticDeviceTree tree = UseDeviceTree(1000);
+    DeviceStateTransaction transaction;
+    FakeDeviceNode pen{};
+
+    pen.InstanceId = L"HID\\SYNPEN&COL01\\7&1&0&0000";
+    pen.DriverKey = L"{745a17a0-74d3-11d0-b6fe-00a0c90f57da}\\0100";
+    pen.PanelId = tree.Panels[1].PanelId;
+    pen.HardwareIds = {L"HID_DEVICE_UP:000D_U:0002"};
+    pen.Enabled = TRUE;
+    FakeSetupApiGetDevices().push_back(pen);
+
+    transaction.Add(tree.Panels[1].PanelId.c_str(), L"HID_DEVICE_UP:000D_U:0002", FALSE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, transaction.Commit());
+    CHECK_EQUAL(1u, transaction.GetResults().size());
+    CHECK(!IsEnabled(pen.InstanceId));
+}
+
+BENCHMARK_CASE(DigitizerToggleOnLargeTrees)
+{
+    for (size_t deviceCount : {10000, 50000, 100000})
+    {
+        SyntheticDeviceTree tree = UseDeviceTree(deviceCount);
+        char name[96];
+
+        std::printf("  %zu devnodes, both digitizers off then on\n", deviceCount);
+
+        double fullWalk = MeasureNanoseconds(4, [&](uint64_t i) {
+            for (const SyntheticPanel &panel : tree.Panels)
+            {
+                FullWalkSetHardwareEnabledStateForPanel(
+                    panel.PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, (i & 1) != 0);
+            }
+        });
+
+        FakeSetupApiStats fullWalkStats = FakeSetupApiGetStats();
+        FakeSetupApiResetStats();
+
+        double transaction = MeasureNanoseconds(4, [&](uint64_t i) {
+            DeviceStateTransaction toggle;
+
+            for (const SyntheticPanel &panel : tree.Panels)
+            {
+                toggle.Add(panel.PanelId.c_str(), SYNTHETIC_DIGITIZER_HARDWARE_ID, (i & 1) != 0);
+            }
+
+            toggle.Commit();
+        });
+
+        FakeSetupApiStats transactionStats = FakeSetupApiGetStats();
+
+        std::snprintf(name, sizeof(name), "per panel full walks, %llu SetupDi calls",
+            (unsigned long long)((fullWalkStats.EnumCalls + fullWalkStats.PropertyCalls +
+                                  fullWalkStats.ChangeStateCalls) / 4));
+        ReportMeasurement(name, fullWalk / 1000.0, "us");
+
+        std::snprintf(name, sizeof(name), "transaction, %llu SetupDi calls",
+            (unsigned long long)((transactionStats.OpenCalls + transactionStats.ChangeStateCalls) / 4));
+        ReportMeasurement(name, transaction / 1000.0, "us");
+    }
+}
\ No newline at end of file
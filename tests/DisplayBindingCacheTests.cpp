@@ -0,0 +1,247 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "DisplayBindingCache.h"
+#include "FakeFileSystem.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+#define BINDING_CACHE_PATH L"C:\\Users\\Test\\AppData\\Local\\SurfaceDisplayConfiguratorService\\DisplayBindings.bin"
+
+static CONST WCHAR *g_TestPanelIds[] = {
+    L"{8DBC9C86-97A9-4BFF-9BC6-BFE95D3E6D01}",
+    L"{8DBC9C86-97A9-4BFF-9BC6-BFE95D3E6D02}"};
+
+static DISPLAY_DEVICE
+MakeDisplayDevice(CONST WCHAR *DeviceName, CONST WCHAR *DeviceId)
+{
+    DISPLAY_DEVICE device{};
+
+    device.cb = sizeof(DISPLAY_DEVICE);
+    StringCchCopy(device.DeviceName, ARRAYSIZE(device.DeviceName), DeviceName);
+    StringCchCopy(device.DeviceID, ARRAYSIZE(device.DeviceID), DeviceId);
+
+    return device;
+}
+
+static DEVMODE
+MakeDisplayMode(DWORD Width, DWORD Height, DWORD Frequency)
+{
+    DEVMODE mode{};
+
+    mode.dmSize = sizeof(DEVMODE);
+    mode.dmPelsWidth = Width;
+    mode.dmPelsHeight = Height;
+    mode.dmDisplayFrequency = Frequency;
+    mode.dmFields = DM_PELSWIDTH | DM_PELSHEIGHT | DM_DISPLAYFREQUENCY;
+
+    return mode;
+}
+
+//
+// The cache is a process wide singleton, every test starts from an empty one over an empty file system
+//
+static VOID
+ResetBindingCache()
+{
+    for (CONST WCHAR *panelId : g_TestPanelIds)
+    {
+        DisplayBindingCache::instance().Remove(panelId);
+    }
+
+    DisplayBindingCache::instance().Save();
+    FakeFileSystemReset();
+}
+
+static VOID
+BindBothPanels()
+{
+    DISPLAY_DEVICE adapter1 = MakeDisplayDevice(L"\\\\.\\DISPLAY1", L"");
+    DISPLAY_DEVICE monitor1 = MakeDisplayDevice(L"\\\\.\\DISPLAY1\\Monitor0", L"MONITOR\\SYN0000\\{4d36e96e}\\0000");
+    DISPLAY_DEVICE adapter2 = MakeDisplayDevice(L"\\\\.\\DISPLAY2", L"");
+    DISPLAY_DEVICE monitor2 = MakeDisplayDevice(L"\\\\.\\DISPLAY2\\Monitor0", L"MONITOR\\SYN0001\\{4d36e96e}\\0001");
+
+    DisplayBindingCache::instance().Update(g_TestPanelIds[0], 0, adapter1, monitor1);
+    DisplayBindingCache::instance().Update(g_TestPanelIds[1], 1, adapter2, monitor2);
+}
+
+TEST_CASE(BindingsSurviveARestart)
+{
+    DisplayBinding binding;
+    DEVMODE mode{};
+
+    ResetBindingCache();
+    BindBothPanels();
+    DisplayBindingCache::instance().SetBestDisplayMode(L"\\\\.\\DISPLAY2", MakeDisplayMode(1350, 1800, 60));
+
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Save());
+    CHECK_EQUAL(1u, FakeFileSystemGetFiles().count(BINDING_CACHE_PATH));
+    CHECK_EQUAL(1u, FakeFileSystemGetFiles().size());
+
+    // Forget everything in memory, as a fresh service process would
+    DisplayBindingCache::instance().Remove(g_TestPanelIds[0]);
+    DisplayBindingCache::instance().Remove(g_TestPanelIds[1]);
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Load());
+
+    CHECK(DisplayBindingCache::instance().Lookup(g_TestPanelIds[0], binding));
+    CHECK(binding.AdapterIndex == 0 && binding.AdapterDeviceName == L"\\\\.\\DISPLAY1");
+    CHECK(binding.MonitorDeviceId == L"MONITOR\\SYN0000\\{4d36e96e}\\0000");
+    CHECK(!binding.HasBestDisplayMode);
+
+    CHECK(DisplayBindingCache::instance().Lookup(g_TestPanelIds[1], binding));
+    CHECK(binding.AdapterIndex == 1 && binding.AdapterDeviceName == L"\\\\.\\DISPLAY2");
+
+    CHECK(DisplayBindingCache::instance().GetBestDisplayMode(L"\\\\.\\DISPLAY2", &mode));
+    CHECK(mode.dmPelsWidth == 1350 && mode.dmPelsHeight == 1800 && mode.dmDisplayFrequency == 60);
+    CHECK(!DisplayBindingCache::instance().GetBestDisplayMode(L"\\\\.\\DISPLAY1", &mode));
+}
+
+TEST_CASE(SaveOnlyWritesChanges)
+{
+    ResetBindingCache();
+    BindBothPanels();
+
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Save());
+    FakeFileSystemResetStats();
+
+    // Nothing changed since, neither the same bindings nor the same mode dirty the cache
+    BindBothPanels();
+    DisplayBindingCache::instance().SetBestDisplayMode(L"\\\\.\\DISPLAY1", MakeDisplayMode(1350, 1800, 60));
+    DisplayBindingCache::instance().Save();
+    FakeFileSystemResetStats();
+
+    DisplayBindingCache::instance().SetBestDisplayMode(L"\\\\.\\DISPLAY1", MakeDisplayMode(1350, 1800, 60));
+    BindBothPanels();
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Save());
+
+    CHECK_EQUAL(0u, FakeFileSystemGetStats().OpenCalls);
+    CHECK_EQUAL(0u, FakeFileSystemGetStats().WriteCalls);
+}
+
+TEST_CASE(SaveReplacesTheFileThroughATemporaryOne)
+{
+    ResetBindingCache();
+    BindBothPanels();
+
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Save());
+
+    FakeFileSystemStats stats = FakeFileSystemGetStats();
+
+    // A header and one write per entry, then a single rename over the previous file
+    CHECK_EQUAL(3u, stats.WriteCalls);
+    CHECK_EQUAL(1u, stats.MoveCalls);
+    CHECK_EQUAL(0u, FakeFileSystemGetFiles().count(BINDING_CACHE_PATH L".tmp"));
+}
+
+TEST_CASE(AdapterChangeForgetsTheBestMode)
+{
+    DisplayBinding binding;
+    DEVMODE mode{};
+    DISPLAY_DEVICE adapter = MakeDisplayDevice(L"\\\\.\\DISPLAY3", L"");
+    DISPLAY_DEVICE monitor = MakeDisplayDevice(L"\\\\.\\DISPLAY3\\Monitor0", L"MONITOR\\SYN0000\\{4d36e96e}\\0000");
+
+    ResetBindingCache();
+    BindBothPanels();
+    DisplayBindingCache::instance().SetBestDisplayMode(L"\\\\.\\DISPLAY1", MakeDisplayMode(1350, 1800, 60));
+
+    DisplayBindingCache::instance().Update(g_TestPanelIds[0], 2, adapter, monitor);
+
+    CHECK(DisplayBindingCache::instance().Lookup(g_TestPanelIds[0], binding));
+    CHECK_EQUAL(2u, binding.AdapterIndex);
+    CHECK(!binding.HasBestDisplayMode);
+    CHECK(!DisplayBindingCache::instance().GetBestDisplayMode(L"\\\\.\\DISPLAY3", &mode));
+}
+
+TEST_CASE(CorruptFilesAreIgnored)
+{
+    DisplayBinding binding;
+
+    ResetBindingCache();
+    BindBothPanels();
+    DisplayBindingCache::instance().Save();
+
+    std::vector<BYTE> valid = FakeFileSystemGetFiles()[BINDING_CACHE_PATH];
+
+    DisplayBindingCache::instance().Remove(g_TestPanelIds[0]);
+    DisplayBindingCache::instance().Remove(g_TestPanelIds[1]);
+
+    // Truncated within the last entry
+    FakeFileSystemGetFiles()[BINDING_CACHE_PATH] = std::vector<BYTE>(valid.begin(), valid.end() - 1);
+    CHECK_EQUAL(ERROR_INVALID_DATA, DisplayBindingCache::instance().Load());
+
+    // Another version of the format
+    FakeFileSystemGetFiles()[BINDING_CACHE_PATH] = valid;
+    FakeFileSystemGetFiles()[BINDING_CACHE_PATH][4] ^= 0xFF;
+    CHECK_EQUAL(ERROR_INVALID_DATA, DisplayBindingCache::instance().Load());
+
+    // Not a cache file at all
+    FakeFileSystemGetFiles()[BINDING_CACHE_PATH] = std::vector<BYTE>(valid.size(), 0xCC);
+    CHECK_EQUAL(ERROR_INVALID_DATA, DisplayBindingCache::instance().Load());
+
+    CHECK(!DisplayBindingCache::instance().Lookup(g_TestPanelIds[0], binding));
+
+    FakeFileSystemGetFiles()[BINDING_CACHE_PATH] = valid;
+    CHECK_EQUAL(ERROR_SUCCESS, DisplayBindingCache::instance().Load());
+    CHECK(DisplayBindingCache::instance().Lookup(g_TestPanelIds[0], binding));
+}
+
+BENCHMARK_CASE(FirstPanelLookupAfterStart)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(10000, 2, 0x5EED1234);
+    DisplayBinding binding;
+    char name[96];
+
+    ResetBindingCache();
+    BindBothPanels();
+    DisplayBindingCache::instance().Save();
+
+    // Cold: without a cache the first lookup after logon has to build the device inventory
+    FakeSetupApiSetDevices(tree.Devices);
+
+    double cold = MeasureNanoseconds(20, [&](uint64_t) {
+        SetupDiDeviceSource source;
+        DeviceInventory inventory(source);
+
+        inventory.Refresh();
+        inventory.IsDeviceBoundToPanelId(tree.Panels[0].MonitorDeviceId.c_str(), tree.Panels[0].PanelId.c_str());
+    });
+
+    FakeSetupApiStats setupApiStats = FakeSetupApiGetStats();
+
+    // Warm: the cache file is read once and answers the lookup
+    FakeFileSystemResetStats();
+
+    double warm = MeasureNanoseconds(20, [&](uint64_t) {
+        DisplayBindingCache::instance().Load();
+        DisplayBindingCache::instance().Lookup(g_TestPanelIds[0], binding);
+    });
+
+    FakeFileSystemStats fileStats = FakeFileSystemGetStats();
+
+    std::snprintf(name, sizeof(name), "cold, 10k devnodes, %llu SetupDi calls",
+        (unsigned long long)((setupApiStats.EnumCalls + setupApiStats.PropertyCalls) / 20));
+    ReportMeasurement(name, cold / 1000.0, "us");
+
+    std::snprintf(name, sizeof(name), "warm, %llu file reads", (unsigned long long)(fileStats.ReadCalls / 20));
+    ReportMeasurement(name, warm / 1000.0, "us");
+}
\ No newline at end of file
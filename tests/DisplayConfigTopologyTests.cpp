@@ -0,0 +1,352 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayConfigTopology.h"
+#include "FakeDisplayConfig.h"
+#include "TestHarness.h"
+
+constexpr LUID DUO_ADAPTER_ID = {0x1234, 0};
+constexpr UINT32 DUO_TARGET_IDS[] = {0x100, 0x101, 0x102};
+
+static DISPLAYCONFIG_PATH_INFO
+MakePath(UINT32 SourceId, UINT32 TargetId, BOOLEAN Active)
+{
+    DISPLAYCONFIG_PATH_INFO path{};
+
+    path.sourceInfo.adapterId = DUO_ADAPTER_ID;
+    path.sourceInfo.id = SourceId;
+    path.sourceInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+    path.targetInfo.adapterId = DUO_ADAPTER_ID;
+    path.targetInfo.id = TargetId;
+    path.targetInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+    path.targetInfo.rotation = DISPLAYCONFIG_ROTATION_IDENTITY;
+    path.targetInfo.scaling = DISPLAYCONFIG_SCALING_IDENTITY;
+    path.targetInfo.targetAvailable = TRUE;
+    path.flags = Active ? DISPLAYCONFIG_PATH_ACTIVE : 0;
+
+    return path;
+}
+
+//
+// The topology of a Duo with an external monitor, as QueryDisplayConfig(QDC_ALL_PATHS) lists it: the active
+// paths with their modes first, then every other source and target pairing. Sources 0 and 1 scan out the panels,
+// source 2 the external monitor. FirstActive and SecondActive tell which panels are on.
+//
+static FakeDisplayConfig
+RecordedDuoTopology(BOOLEAN FirstActive = TRUE, BOOLEAN SecondActive = TRUE)
+{
+    FakeDisplayConfig config;
+    const BOOLEAN active[] = {FirstActive, SecondActive, TRUE};
+    const UINT32 widths[] = {1350, 1350, 1920};
+    const UINT32 heights[] = {1800, 1800, 1080};
+    const LONG positions[] = {-1350, 0, 1350};
+
+    for (UINT32 source = 0; source < 3; source++)
+    {
+        if (!active[source])
+        {
+            continue;
+        }
+
+        DISPLAYCONFIG_PATH_INFO path = MakePath(source, DUO_TARGET_IDS[source], TRUE);
+        DISPLAYCONFIG_MODE_INFO sourceMode{};
+        DISPLAYCONFIG_MODE_INFO targetMode{};
+
+        sourceMode.infoType = DISPLAYCONFIG_MODE_INFO_TYPE_SOURCE;
+        sourceMode.id = source;
+        sourceMode.adapterId = DUO_ADAPTER_ID;
+        sourceMode.sourceMode.width = widths[source];
+        sourceMode.sourceMode.height = heights[source];
+        sourceMode.sourceMode.pixelFormat = DISPLAYCONFIG_PIXELFORMAT_32BPP;
+        sourceMode.sourceMode.position.x = positions[source];
+
+        targetMode.infoType = DISPLAYCONFIG_MODE_INFO_TYPE_TARGET;
+        targetMode.id = DUO_TARGET_IDS[source];
+        targetMode.adapterId = DUO_ADAPTER_ID;
+        targetMode.targetMode.targetVideoSignalInfo.activeSize = {widths[source], heights[source]};
+        targetMode.targetMode.targetVideoSignalInfo.vSyncFreq = {60, 1};
+
+        path.sourceInfo.modeInfoIdx = (UINT32)config.Modes.size();
+        config.Modes.push_back(sourceMode);
+        path.targetInfo.modeInfoIdx = (UINT32)config.Modes.size();
+        config.Modes.push_back(targetMode);
+        path.targetInfo.refreshRate = {60, 1};
+
+        config.Paths.push_back(path);
+    }
+
+    for (UINT32 source = 0; source < 3; source++)
+    {
+        for (UINT32 target = 0; target < 3; target++)
+        {
+            if (source != target || !active[source])
+            {
+                config.Paths.push_back(MakePath(source, DUO_TARGET_IDS[target], FALSE));
+            }
+        }
+    }
+
+    for (UINT32 source = 0; source < 3; source++)
+    {
+        WCHAR name[32];
+
+        std::swprintf(name, ARRAYSIZE(name), L"\\\\.\\DISPLAY%u", source + 1);
+        config.SourceNames.push_back({DUO_ADAPTER_ID, source, name});
+        std::swprintf(name, ARRAYSIZE(name), L"\\\\?\\DISPLAY#DUO%04X#1&0&UID%u", source, source);
+        config.TargetNames.push_back({DUO_ADAPTER_ID, DUO_TARGET_IDS[source], name});
+    }
+
+    return config;
+}
+
+static std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT>
+DuoPanelInputs(BOOLEAN FirstAttached, BOOLEAN SecondAttached)
+{
+    return {{{1350, 1800, 0, FirstAttached != FALSE}, {1350, 1800, 0, SecondAttached != FALSE}}};
+}
+
+static std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT>
+LookUpPanelSources(const DisplayConfigTopology &Topology)
+{
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, GetDisplayConfigPanelSource(Topology, L"\\\\.\\DISPLAY1", panels[0]));
+    CHECK_EQUAL(ERROR_SUCCESS, GetDisplayConfigPanelSource(Topology, L"\\\\.\\DISPLAY2", panels[1]));
+
+    return panels;
+}
+
+static const DISPLAYCONFIG_PATH_INFO *
+FindActivePath(const std::vector<DISPLAYCONFIG_PATH_INFO> &Paths, UINT32 SourceId)
+{
+    for (const DISPLAYCONFIG_PATH_INFO &path : Paths)
+    {
+        if (path.sourceInfo.id == SourceId && (path.flags & DISPLAYCONFIG_PATH_ACTIVE))
+        {
+            return &path;
+        }
+    }
+
+    return nullptr;
+}
+
+TEST_CASE(QueryFindsThePanelSources)
+{
+    FakeDisplayConfigSet(RecordedDuoTopology());
+
+    DisplayConfigTopology topology;
+    DisplayConfigPanelSource source{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(topology));
+    CHECK_EQUAL(FakeDisplayConfigGet().Paths.size(), topology.Paths.size());
+    CHECK_EQUAL(6u, topology.Modes.size());
+
+    CHECK_EQUAL(ERROR_SUCCESS, GetDisplayConfigPanelSource(topology, L"\\\\.\\DISPLAY2", source));
+    CHECK_EQUAL(1u, source.SourceId);
+    CHECK(source.AdapterId.LowPart == DUO_ADAPTER_ID.LowPart);
+
+    CHECK_EQUAL(ERROR_NOT_FOUND, GetDisplayConfigPanelSource(topology, L"\\\\.\\DISPLAY9", source));
+
+    FakeDisplayConfigStats stats = FakeDisplayConfigGetStats();
+    CHECK_EQUAL(1u, stats.BufferSizeCalls);
+    CHECK_EQUAL(1u, stats.QueryCalls);
+}
+
+TEST_CASE(BothPanelsKeepTheirTargetsAndTheExternalMonitor)
+{
+    FakeDisplayConfigSet(RecordedDuoTopology());
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(current));
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    TopologyPlan plan = PlanDisplayLayout(DuoPanelInputs(TRUE, TRUE), 1, 1, LayoutPanelStates::Both);
+
+    CHECK_EQUAL(ERROR_SUCCESS, BuildDisplayConfigTopology(current, panels, plan, target));
+    CHECK_EQUAL(3u, target.Paths.size());
+    CHECK_EQUAL(6u, target.Modes.size());
+
+    // The external monitor goes through untouched, ahead of the panels
+    CHECK_EQUAL(2u, target.Paths[0].sourceInfo.id);
+    CHECK_EQUAL(1920u, target.Modes[target.Paths[0].sourceInfo.modeInfoIdx].sourceMode.width);
+
+    for (UINT32 panel = 0; panel < LAYOUT_PANEL_COUNT; panel++)
+    {
+        const DISPLAYCONFIG_PATH_INFO *path = FindActivePath(target.Paths, panel);
+        CHECK(path != nullptr);
+        if (path == nullptr)
+        {
+            continue;
+        }
+
+        const DISPLAYCONFIG_SOURCE_MODE &mode = target.Modes[path->sourceInfo.modeInfoIdx].sourceMode;
+
+        CHECK_EQUAL(DUO_TARGET_IDS[panel], path->targetInfo.id);
+        CHECK(path->targetInfo.rotation == DISPLAYCONFIG_ROTATION_ROTATE90);
+        CHECK(path->targetInfo.modeInfoIdx != DISPLAYCONFIG_PATH_MODE_IDX_INVALID);
+        CHECK_EQUAL((UINT32)plan.Panels[panel].Width, mode.width);
+        CHECK_EQUAL((UINT32)plan.Panels[panel].Height, mode.height);
+        CHECK_EQUAL(plan.Panels[panel].X, mode.position.x);
+        CHECK_EQUAL(plan.Panels[panel].Y, mode.position.y);
+    }
+}
+
+TEST_CASE(SinglePanelLeavesTheOtherOneOut)
+{
+    FakeDisplayConfigSet(RecordedDuoTopology());
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(current));
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    TopologyPlan plan = PlanDisplayLayout(DuoPanelInputs(TRUE, TRUE), 0, 0, LayoutPanelStates::SecondOnly);
+
+    CHECK_EQUAL(ERROR_SUCCESS, BuildDisplayConfigTopology(current, panels, plan, target));
+    CHECK_EQUAL(2u, target.Paths.size());
+    CHECK(FindActivePath(target.Paths, 0) == nullptr);
+    CHECK(FindActivePath(target.Paths, 1) != nullptr);
+}
+
+TEST_CASE(PanelComingBackGetsThePreferredTiming)
+{
+    // The first panel was detached, its source has no path and no mode left
+    FakeDisplayConfigSet(RecordedDuoTopology(FALSE, TRUE));
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(current));
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    TopologyPlan plan = PlanDisplayLayout(DuoPanelInputs(FALSE, TRUE), 0, 0, LayoutPanelStates::Both);
+
+    CHECK_EQUAL(ERROR_SUCCESS, BuildDisplayConfigTopology(current, panels, plan, target));
+
+    const DISPLAYCONFIG_PATH_INFO *path = FindActivePath(target.Paths, 0);
+    CHECK(path != nullptr);
+    if (path != nullptr)
+    {
+        // Its own target, not the one of the second panel or the external monitor which are still driven
+        CHECK_EQUAL(DUO_TARGET_IDS[0], path->targetInfo.id);
+        CHECK_EQUAL(DISPLAYCONFIG_PATH_MODE_IDX_INVALID, path->targetInfo.modeInfoIdx);
+        CHECK(path->targetInfo.scaling == DISPLAYCONFIG_SCALING_PREFERRED);
+        CHECK_EQUAL(0u, path->targetInfo.refreshRate.Numerator);
+        CHECK_EQUAL(1350u, target.Modes[path->sourceInfo.modeInfoIdx].sourceMode.width);
+    }
+}
+
+TEST_CASE(NoTargetLeftForAPanelFails)
+{
+    FakeDisplayConfig config = RecordedDuoTopology(FALSE, TRUE);
+
+    // Nothing is plugged into the target of the first panel any more
+    for (DISPLAYCONFIG_PATH_INFO &path : config.Paths)
+    {
+        if (path.targetInfo.id == DUO_TARGET_IDS[0])
+        {
+            path.targetInfo.targetAvailable = FALSE;
+        }
+    }
+
+    FakeDisplayConfigSet(config);
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(current));
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    TopologyPlan plan = PlanDisplayLayout(DuoPanelInputs(FALSE, TRUE), 0, 0, LayoutPanelStates::Both);
+
+    CHECK_EQUAL(ERROR_NOT_FOUND, BuildDisplayConfigTopology(current, panels, plan, target));
+}
+
+TEST_CASE(ApplyCommitsTheLayoutInOneCall)
+{
+    FakeDisplayConfigSet(RecordedDuoTopology());
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(current));
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    // The same layout took two mode sets and the commit through ChangeDisplaySettingsEx
+    TopologyPlan plan = PlanDisplayLayout(DuoPanelInputs(TRUE, TRUE), 2, 2, LayoutPanelStates::Both);
+    CHECK_EQUAL(3u, plan.StepCount);
+
+    CHECK_EQUAL(ERROR_SUCCESS, BuildDisplayConfigTopology(current, panels, plan, target));
+
+    FakeDisplayConfigResetStats();
+    CHECK_EQUAL(ERROR_SUCCESS, ApplyDisplayConfigTopology(target));
+
+    CHECK_EQUAL(1u, FakeDisplayConfigGetStats().SetCalls);
+    CHECK_EQUAL(1u, FakeDisplayConfigGetApplied().size());
+    CHECK(FakeDisplayConfigGetApplied()[0].Flags & SDC_USE_SUPPLIED_DISPLAY_CONFIG);
+    CHECK(FakeDisplayConfigGetApplied()[0].Flags & SDC_SAVE_TO_DATABASE);
+
+    // Read back, the layout is what was planned
+    DisplayConfigTopology applied;
+
+    CHECK_EQUAL(ERROR_SUCCESS, QueryDisplayConfigTopology(applied));
+    for (UINT32 panel = 0; panel < LAYOUT_PANEL_COUNT; panel++)
+    {
+        const DISPLAYCONFIG_PATH_INFO *path = FindActivePath(applied.Paths, panel);
+        CHECK(path != nullptr);
+        if (path != nullptr)
+        {
+            CHECK(path->targetInfo.rotation == DISPLAYCONFIG_ROTATION_ROTATE180);
+            CHECK_EQUAL(plan.Panels[panel].X, applied.Modes[path->sourceInfo.modeInfoIdx].sourceMode.position.x);
+        }
+    }
+}
+
+BENCHMARK_CASE(BuildTopology)
+{
+    FakeDisplayConfigSet(RecordedDuoTopology());
+
+    DisplayConfigTopology current;
+    DisplayConfigTopology target;
+    volatile size_t sink = 0;
+
+    QueryDisplayConfigTopology(current);
+    std::array<DisplayConfigPanelSource, LAYOUT_PANEL_COUNT> panels = LookUpPanelSources(current);
+
+    double query = MeasureNanoseconds(100000, [&](uint64_t) {
+        QueryDisplayConfigTopology(current);
+        sink = sink + current.Paths.size();
+    });
+
+    double build = MeasureNanoseconds(1000000, [&](uint64_t i) {
+        TopologyPlan plan = PlanDisplayLayout(
+            DuoPanelInputs(TRUE, TRUE), (int32_t)(i & 3), (int32_t)(i & 3), (LayoutPanelStates)(i % 3));
+        BuildDisplayConfigTopology(current, panels, plan, target);
+        sink = sink + target.Paths.size();
+    });
+
+    ReportMeasurement("QueryDisplayConfigTopology", query, "ns");
+    ReportMeasurement("PlanDisplayLayout + BuildDisplayConfigTopology", build, "ns");
+}
\ No newline at end of file
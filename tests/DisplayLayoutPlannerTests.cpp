@@ -0,0 +1,313 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "DisplayLayoutPlanner.h"
+#include "TestHarness.h"
+#include <vector>
+
+//
+// A mode call the way SetDisplayStates issued them before the planner, the panel and what it got
+//
+struct LegacyModeCall
+{
+    uint8_t Panel;
+    bool Primary;
+    bool Detach;
+};
+
+struct LegacyLayout
+{
+    LayoutPanelPlan Panels[LAYOUT_PANEL_COUNT];
+    std::vector<LegacyModeCall> Calls;
+    bool NotifiedRotation;
+    int32_t NotifyOrientation;
+};
+
+//
+// The layout code SetDisplayStates ran before it was extracted into the planner, with the ChangeDisplaySettingsEx
+// calls recorded instead of issued. The panels were always laid out with the first one on the left.
+//
+static LegacyLayout
+LegacySetDisplayStates(
+    const std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> &Panels,
+    int32_t DisplayOrientation1,
+    int32_t DisplayOrientation2,
+    bool DisplayState1,
+    bool DisplayState2)
+{
+    LegacyLayout layout{};
+    LayoutPanelPlan &DevMode1 = layout.Panels[0];
+    LayoutPanelPlan &DevMode2 = layout.Panels[1];
+    const bool lastDisplayState1 = Panels[0].Attached;
+    const bool lastDisplayState2 = Panels[1].Attached;
+
+    DevMode1.Width = Panels[0].Width;
+    DevMode1.Height = Panels[0].Height;
+    DevMode2.Width = Panels[1].Width;
+    DevMode2.Height = Panels[1].Height;
+
+    if ((Panels[0].CurrentOrientation + DisplayOrientation1) % 2 == 1)
+    {
+        std::swap(DevMode1.Width, DevMode1.Height);
+    }
+
+    DevMode1.Orientation = DisplayOrientation1;
+
+    if ((Panels[1].CurrentOrientation + DisplayOrientation2) % 2 == 1)
+    {
+        std::swap(DevMode2.Width, DevMode2.Height);
+    }
+
+    DevMode2.Orientation = DisplayOrientation2;
+
+    if (DisplayState1 && DisplayState2)
+    {
+        switch (DisplayOrientation1)
+        {
+        case LAYOUT_ORIENTATION_DEFAULT:
+            DevMode1.X = -1 * DevMode2.Width;
+            break;
+        case LAYOUT_ORIENTATION_180:
+            DevMode2.X = -1 * DevMode1.Width;
+            break;
+        case LAYOUT_ORIENTATION_90:
+            DevMode1.Y = -1 * DevMode2.Height;
+            break;
+        case LAYOUT_ORIENTATION_270:
+            DevMode2.Y = -1 * DevMode1.Height;
+            break;
+        }
+
+        bool IsDisplay1Primary = DevMode1.X == 0 && DevMode1.Y == 0;
+
+        layout.Calls.push_back(LegacyModeCall{(uint8_t)(IsDisplay1Primary ? 0 : 1), true, false});
+        layout.Calls.push_back(LegacyModeCall{(uint8_t)(IsDisplay1Primary ? 1 : 0), false, false});
+    }
+    else if (DisplayState1 != DisplayState2)
+    {
+        const uint8_t on = DisplayState1 ? 0 : 1;
+        const bool lastOn = on == 0 ? lastDisplayState1 : lastDisplayState2;
+        const bool lastOff = on == 0 ? lastDisplayState2 : lastDisplayState1;
+
+        if (lastOn && !lastOff)
+        {
+            layout.NotifiedRotation = true;
+            layout.NotifyOrientation = DisplayOrientation2;
+        }
+        else
+        {
+            layout.Calls.push_back(LegacyModeCall{on, true, false});
+
+            if (lastOff)
+            {
+                layout.Panels[1 - on].Width = 0;
+                layout.Panels[1 - on].Height = 0;
+                layout.Calls.push_back(LegacyModeCall{(uint8_t)(1 - on), false, true});
+            }
+        }
+    }
+
+    return layout;
+}
+
+static bool
+MatchesLegacyLayout(const TopologyPlan &Plan, const LegacyLayout &Legacy, bool BothOn)
+{
+    std::vector<LegacyModeCall> calls;
+    bool notified = false;
+
+    if (Plan.StepCount == 0 || Plan.Steps[Plan.StepCount - 1].Kind != LayoutStepKind::Commit)
+    {
+        return false;
+    }
+
+    for (uint32_t i = 0; i + 1 < Plan.StepCount; i++)
+    {
+        const LayoutStep &step = Plan.Steps[i];
+
+        switch (step.Kind)
+        {
+        case LayoutStepKind::SetPrimaryMode:
+            calls.push_back(LegacyModeCall{step.Panel, true, false});
+            break;
+        case LayoutStepKind::SetMode:
+            calls.push_back(LegacyModeCall{step.Panel, false, false});
+            break;
+        case LayoutStepKind::Detach:
+            calls.push_back(LegacyModeCall{step.Panel, false, true});
+            break;
+        case LayoutStepKind::NotifyRotation:
+            notified = true;
+            break;
+        case LayoutStepKind::Commit:
+            return false;
+        }
+    }
+
+    if (notified != Legacy.NotifiedRotation || (notified && Plan.NotifyOrientation != Legacy.NotifyOrientation) ||
+        calls.size() != Legacy.Calls.size())
+    {
+        return false;
+    }
+
+    for (size_t i = 0; i < calls.size(); i++)
+    {
+        if (calls[i].Panel != Legacy.Calls[i].Panel || calls[i].Primary != Legacy.Calls[i].Primary ||
+            calls[i].Detach != Legacy.Calls[i].Detach)
+        {
+            return false;
+        }
+    }
+
+    // Only the panels a mode call is issued for carry meaningful geometry
+    for (const LegacyModeCall &call : calls)
+    {
+        const LayoutPanelPlan &planned = Plan.Panels[call.Panel];
+        const LayoutPanelPlan &legacy = Legacy.Panels[call.Panel];
+
+        if (planned.Width != legacy.Width || planned.Height != legacy.Height ||
+            planned.Orientation != legacy.Orientation)
+        {
+            return false;
+        }
+
+        if (BothOn && (planned.X != legacy.X || planned.Y != legacy.Y))
+        {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+TEST_CASE(PlannerMatchesTheLegacyLayoutExhaustively)
+{
+    static const int32_t sizes[][2] = {{1350, 1800}, {1800, 1350}, {1344, 1892}};
+    uint32_t combinations = 0;
+    uint32_t mismatches = 0;
+
+    for (const auto &size1 : sizes)
+    {
+        for (const auto &size2 : sizes)
+        {
+            for (int32_t current = 0; current < LAYOUT_ORIENTATION_COUNT * LAYOUT_ORIENTATION_COUNT; current++)
+            {
+                for (uint32_t attached = 0; attached < 4; attached++)
+                {
+                    std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> inputs{
+                        {{size1[0], size1[1], current / LAYOUT_ORIENTATION_COUNT, (attached & 1) != 0},
+                         {size2[0], size2[1], current % LAYOUT_ORIENTATION_COUNT, (attached & 2) != 0}}};
+
+                    for (int32_t orientation1 = 0; orientation1 < LAYOUT_ORIENTATION_COUNT; orientation1++)
+                    {
+                        for (int32_t orientation2 = 0; orientation2 < LAYOUT_ORIENTATION_COUNT; orientation2++)
+                        {
+                            for (uint32_t states = 0; states < (uint32_t)LayoutPanelStates::Count; states++)
+                            {
+                                bool on1 = states != (uint32_t)LayoutPanelStates::SecondOnly;
+                                bool on2 = states != (uint32_t)LayoutPanelStates::FirstOnly;
+
+                                TopologyPlan plan = PlanDisplayLayout(
+                                    inputs, orientation1, orientation2, (LayoutPanelStates)states);
+                                LegacyLayout legacy =
+                                    LegacySetDisplayStates(inputs, orientation1, orientation2, on1, on2);
+
+                                mismatches += MatchesLegacyLayout(plan, legacy, on1 && on2) ? 0 : 1;
+                                combinations++;
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    std::printf("    %u combinations\n", combinations);
+    CHECK_EQUAL(0u, mismatches);
+}
+
+TEST_CASE(PanelSidesRotateTheLayout)
+{
+    std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> inputs{{{1350, 1800, 0, true}, {1350, 1800, 0, true}}};
+
+    // The first panel physically on the right mirrors the historical layout
+    for (int32_t orientation = 0; orientation < LAYOUT_ORIENTATION_COUNT; orientation++)
+    {
+        TopologyPlan left =
+            PlanDisplayLayout(inputs, orientation, orientation, LayoutPanelStates::Both, LayoutPanelSide::Left);
+        TopologyPlan right =
+            PlanDisplayLayout(inputs, orientation, orientation, LayoutPanelStates::Both, LayoutPanelSide::Right);
+
+        CHECK(left.Panels[0].Primary == right.Panels[1].Primary);
+        CHECK(left.Panels[0].X == right.Panels[1].X && left.Panels[0].Y == right.Panels[1].Y);
+    }
+
+    // Stacked panels put the first one above the second when upright
+    TopologyPlan top = PlanDisplayLayout(inputs, 0, 0, LayoutPanelStates::Both, LayoutPanelSide::Top);
+
+    CHECK(top.Panels[1].Primary);
+    CHECK(top.Panels[0].X == 0 && top.Panels[0].Y == -1800);
+}
+
+TEST_CASE(DiffDropsSatisfiedSteps)
+{
+    std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> inputs{{{1350, 1800, 0, true}, {1350, 1800, 0, false}}};
+    TopologyPlan plan = PlanDisplayLayout(inputs, 0, 0, LayoutPanelStates::Both);
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> current{};
+
+    // Nothing applied yet, every step stays
+    CHECK_EQUAL(plan.StepCount, DiffTopologyPlan(plan, current).StepCount);
+
+    // Applied in full, nothing is left to do
+    current = plan.Panels;
+    CHECK_EQUAL(0u, DiffTopologyPlan(plan, current).StepCount);
+
+    // Only the secondary panel, on the left, is off: its mode set and the commit remain
+    current[0].Active = false;
+    TopologyPlan diff = DiffTopologyPlan(plan, current);
+
+    CHECK_EQUAL(2u, diff.StepCount);
+    CHECK(diff.Steps[0].Kind == LayoutStepKind::SetMode && diff.Steps[0].Panel == 0);
+    CHECK(diff.Steps[1].Kind == LayoutStepKind::Commit);
+
+    CHECK_EQUAL(0u, WithoutModeSteps(plan).StepCount);
+}
+
+BENCHMARK_CASE(PlanAndDiff)
+{
+    std::array<LayoutPanelInput, LAYOUT_PANEL_COUNT> inputs{{{1350, 1800, 0, true}, {1350, 1800, 1, true}}};
+    std::array<LayoutPanelPlan, LAYOUT_PANEL_COUNT> current{};
+    volatile uint32_t sink = 0;
+
+    double plan = MeasureNanoseconds(10000000, [&](uint64_t i) {
+        sink = sink + PlanDisplayLayout(inputs, (int32_t)(i & 3), (int32_t)((i >> 2) & 3), (LayoutPanelStates)(i % 3))
+                          .StepCount;
+    });
+
+    double diff = MeasureNanoseconds(10000000, [&](uint64_t i) {
+        TopologyPlan target = PlanDisplayLayout(inputs, (int32_t)(i & 3), 0, LayoutPanelStates::Both);
+        current[0].Active = (i & 4) != 0;
+        sink = sink + DiffTopologyPlan(target, current).StepCount;
+    });
+
+    ReportMeasurement("PlanDisplayLayout", plan, "ns");
+    ReportMeasurement("PlanDisplayLayout + DiffTopologyPlan", diff, "ns");
+}
\ No newline at end of file
@@ -0,0 +1,282 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayModeCatalog.h"
+#include "FakeDisplayChangeNotifier.h"
+#include "TestHarness.h"
+
+//
+// Serves a fixed mode list per device, in the order a driver would report it, and counts the calls
+//
+class FakeDisplayModeSource final : public DisplayModeSource
+{
+public:
+    BOOL EnumDisplayMode(CONST WCHAR *DeviceName, DWORD ModeIndex, PDEVMODE DevMode) override
+    {
+        Calls++;
+
+        auto it = Modes.find(DeviceName);
+        if (it == Modes.end() || ModeIndex >= it->second.size())
+        {
+            return FALSE;
+        }
+
+        *DevMode = it->second[ModeIndex];
+        return TRUE;
+    }
+
+    std::map<std::wstring, std::vector<DEVMODE>> Modes;
+    ULONG64 Calls = 0;
+};
+
+static DEVMODE
+MakeDisplayMode(DWORD Width, DWORD Height, DWORD Frequency, DWORD BitsPerPel = 32)
+{
+    DEVMODE mode{};
+
+    mode.dmSize = sizeof(DEVMODE);
+    mode.dmPelsWidth = Width;
+    mode.dmPelsHeight = Height;
+    mode.dmDisplayFrequency = Frequency;
+    mode.dmBitsPerPel = BitsPerPel;
+    mode.dmFields = DM_PELSWIDTH | DM_PELSHEIGHT | DM_DISPLAYFREQUENCY | DM_BITSPERPEL;
+
+    return mode;
+}
+
+//
+// The mode list of a Duo panel driver: every resolution up to the native one, in both orientations, at
+// several refresh rates and color depths, reported in no particular order and with duplicates
+//
+static std::vector<DEVMODE>
+MakePanelModes(size_t Count)
+{
+    static const DWORD frequencies[] = {48, 50, 59, 60, 90, 120};
+    static const DWORD depths[] = {8, 16, 32};
+    std::vector<DEVMODE> modes;
+    uint32_t state = 0x1234567;
+
+    for (DWORD step = 0; modes.size() < Count; step++)
+    {
+        DWORD width = 1350 - (step % 40) * 20;
+        DWORD height = 1800 - (step % 40) * 30;
+
+        for (DWORD frequency : frequencies)
+        {
+            for (DWORD depth : depths)
+            {
+                modes.emplace_back(step % 2 ? MakeDisplayMode(height, width, frequency, depth)
+                                            : MakeDisplayMode(width, height, frequency, depth));
+            }
+        }
+    }
+
+    modes.resize(Count);
+
+    for (size_t i = modes.size() - 1; i > 0; i--)
+    {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        std::swap(modes[i], modes[state % (i + 1)]);
+    }
+
+    return modes;
+}
+
+//
+// How a detached panel got its mode before the catalogs: every mode is enumerated and the tallest one kept
+//
+static BOOLEAN
+FullWalkSelectTallestMode(DisplayModeSource &Source, CONST WCHAR *DeviceName, PDEVMODE DevMode)
+{
+    DEVMODE deviceMode{};
+    DWORD maxHeightSeen = 0;
+
+    deviceMode.dmSize = sizeof(DEVMODE);
+
+    for (DWORD i = 0; Source.EnumDisplayMode(DeviceName, i, &deviceMode); i++)
+    {
+        if (deviceMode.dmPelsHeight > maxHeightSeen)
+        {
+            maxHeightSeen = deviceMode.dmPelsHeight;
+            *DevMode = deviceMode;
+        }
+    }
+
+    return maxHeightSeen != 0;
+}
+
+TEST_CASE(CatalogIsSortedAndDeduplicated)
+{
+    FakeDisplayModeSource source;
+    DisplayModeCatalog catalog;
+
+    source.Modes[L"\\\\.\\DISPLAY1"] = MakePanelModes(600);
+    source.Modes[L"\\\\.\\DISPLAY1"].push_back(source.Modes[L"\\\\.\\DISPLAY1"][17]);
+
+    CHECK_EQUAL(ERROR_SUCCESS, catalog.Build(L"\\\\.\\DISPLAY1", source));
+
+    CHECK(catalog.GetModeCount() <= 600);
+    for (size_t i = 1; i < catalog.GetModeCount(); i++)
+    {
+        CHECK(catalog.GetKey(i - 1) < catalog.GetKey(i));
+    }
+
+    for (const DEVMODE &mode : source.Modes[L"\\\\.\\DISPLAY1"])
+    {
+        std::optional<size_t> index = catalog.Find(DisplayModeCatalog::KeyFromDevMode(mode));
+
+        CHECK(index.has_value());
+        CHECK(index && catalog.GetMode(*index).dmDisplayFrequency == mode.dmDisplayFrequency);
+    }
+
+    CHECK_EQUAL(ERROR_NOT_FOUND, catalog.Build(L"\\\\.\\DISPLAY9", source));
+    CHECK(catalog.IsEmpty());
+}
+
+TEST_CASE(BestForResolutionPicksTheHighestRefresh)
+{
+    FakeDisplayModeSource source;
+    DisplayModeCatalog catalog;
+
+    source.Modes[L"\\\\.\\DISPLAY1"] = {
+        MakeDisplayMode(1350, 1800, 60),
+        MakeDisplayMode(1350, 1800, 48),
+        MakeDisplayMode(1800, 1350, 90),
+        MakeDisplayMode(1350, 1800, 90),
+        MakeDisplayMode(1200, 1600, 120)};
+
+    catalog.Build(L"\\\\.\\DISPLAY1", source);
+
+    std::optional<size_t> best = catalog.FindBestForResolution(1350, 1800);
+
+    CHECK(best && catalog.GetKey(*best) == (DisplayModeKey{1800, 1350, 90, 32}));
+    CHECK(!catalog.FindBestForResolution(1350, 1700).has_value());
+    CHECK(!catalog.FindBestForResolution(1, 1).has_value());
+}
+
+TEST_CASE(PoliciesSelectTheExpectedModes)
+{
+    FakeDisplayModeSource source;
+    DisplayModeCatalog catalog;
+
+    source.Modes[L"\\\\.\\DISPLAY1"] = {
+        MakeDisplayMode(1350, 1800, 60),
+        MakeDisplayMode(1350, 1800, 48),
+        MakeDisplayMode(1350, 1800, 90),
+        MakeDisplayMode(1350, 1800, 60, 16),
+        MakeDisplayMode(1200, 1600, 120),
+        MakeDisplayMode(1024, 768, 60)};
+
+    catalog.Build(L"\\\\.\\DISPLAY1", source);
+
+    auto selected = [&](const DisplayModePolicy &Policy) {
+        std::optional<size_t> index = Policy.Select(catalog);
+        return index ? catalog.GetKey(*index) : DisplayModeKey{};
+    };
+
+    // Tallest first, then the refresh rate breaks the tie
+    CHECK(selected(MaxResolutionDisplayModePolicy()) == (DisplayModeKey{1800, 1350, 90, 32}));
+    CHECK(selected(MaxRefreshDisplayModePolicy()) == (DisplayModeKey{1600, 1200, 120, 32}));
+
+    // The other panel's mode, as is, then at another refresh rate, then rotated
+    CHECK(selected(MatchDisplayModePolicy(MakeDisplayMode(1350, 1800, 48))) == (DisplayModeKey{1800, 1350, 48, 32}));
+    CHECK(selected(MatchDisplayModePolicy(MakeDisplayMode(1350, 1800, 75))) == (DisplayModeKey{1800, 1350, 90, 32}));
+    CHECK(selected(MatchDisplayModePolicy(MakeDisplayMode(768, 1024, 60))) == (DisplayModeKey{768, 1024, 60, 32}));
+    CHECK(selected(MatchDisplayModePolicy(MakeDisplayMode(640, 480, 60))) == (DisplayModeKey{1800, 1350, 90, 32}));
+
+    // Refresh rates at the current resolution, either orientation, at the same color depth only
+    CHECK(
+        selected(RefreshRateDisplayModePolicy(MakeDisplayMode(1800, 1350, 60), TRUE)) ==
+        (DisplayModeKey{1800, 1350, 90, 32}));
+    CHECK(
+        selected(RefreshRateDisplayModePolicy(MakeDisplayMode(1350, 1800, 60), FALSE)) ==
+        (DisplayModeKey{1800, 1350, 48, 32}));
+    CHECK(
+        selected(RefreshRateDisplayModePolicy(MakeDisplayMode(1350, 1800, 60, 16), TRUE)) ==
+        (DisplayModeKey{1800, 1350, 60, 16}));
+    CHECK(!RefreshRateDisplayModePolicy(MakeDisplayMode(640, 480, 60), TRUE).Select(catalog).has_value());
+}
+
+TEST_CASE(CatalogsAreOnlyRebuiltAfterADeviceChange)
+{
+    FakeDisplayModeSource source;
+    DisplayModeCatalogs catalogs(source);
+    DEVMODE mode{};
+
+    source.Modes[L"\\\\.\\DISPLAY1"] = MakePanelModes(400);
+    source.Modes[L"\\\\.\\DISPLAY2"] = MakePanelModes(300);
+
+    CHECK_EQUAL(ERROR_SUCCESS, catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY1", MaxResolutionDisplayModePolicy(), &mode));
+    CHECK_EQUAL(ERROR_SUCCESS, catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY2", MaxRefreshDisplayModePolicy(), &mode));
+    CHECK_EQUAL(401u + 301u, source.Calls);
+
+    // Our own mode sets raise WM_DISPLAYCHANGE, they do not change the mode lists
+    FakeDisplayChangeNotifierSendDisplayChange();
+    CHECK_EQUAL(ERROR_SUCCESS, catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY1", MaxRefreshDisplayModePolicy(), &mode));
+    CHECK_EQUAL(401u + 301u, source.Calls);
+
+    source.Modes[L"\\\\.\\DISPLAY1"] = {MakeDisplayMode(1920, 1080, 60)};
+    FakeDisplayChangeNotifierSendDeviceChange();
+
+    CHECK_EQUAL(ERROR_SUCCESS, catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY1", MaxResolutionDisplayModePolicy(), &mode));
+    CHECK_EQUAL(401u + 301u + 2u, source.Calls);
+    CHECK(mode.dmPelsWidth == 1920 && mode.dmPelsHeight == 1080);
+
+    catalogs.Invalidate();
+    CHECK_EQUAL(
+        ERROR_NOT_FOUND, catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY3", MaxResolutionDisplayModePolicy(), &mode));
+}
+
+BENCHMARK_CASE(DetachedPanelModeSelection)
+{
+    for (size_t modeCount : {100, 400, 1600})
+    {
+        FakeDisplayModeSource source;
+        DisplayModeCatalogs catalogs(source);
+        MaxResolutionDisplayModePolicy policy;
+        DEVMODE mode{};
+        char name[96];
+
+        source.Modes[L"\\\\.\\DISPLAY2"] = MakePanelModes(modeCount);
+
+        std::printf("  %zu modes\n", modeCount);
+
+        double fullWalk = MeasureNanoseconds(1000, [&](uint64_t) {
+            FullWalkSelectTallestMode(source, L"\\\\.\\DISPLAY2", &mode);
+        });
+
+        ULONG64 fullWalkCalls = source.Calls / 1000;
+        source.Calls = 0;
+
+        double catalog = MeasureNanoseconds(100000, [&](uint64_t) {
+            catalogs.SelectDisplayMode(L"\\\\.\\DISPLAY2", policy, &mode);
+        });
+
+        std::snprintf(name, sizeof(name), "full walk, %llu enumerations", (unsigned long long)fullWalkCalls);
+        ReportMeasurement(name, fullWalk, "ns");
+
+        std::snprintf(name, sizeof(name), "catalog, %llu enumerations once", (unsigned long long)source.Calls);
+        ReportMeasurement(name, catalog, "ns");
+    }
+}
\ No newline at end of file
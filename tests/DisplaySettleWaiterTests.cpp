@@ -0,0 +1,381 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayChangeNotifier.h"
+#include "DisplaySettleWaiter.h"
+#include "FakeDisplayChangeNotifier.h"
+#include "FakeDisplayDevices.h"
+#include "TestHarness.h"
+
+class FakeSettleClock final : public DisplaySettleClock
+{
+public:
+    ULONGLONG GetMilliseconds() const override
+    {
+        return Milliseconds;
+    }
+
+    ULONGLONG Milliseconds = 10000;
+};
+
+//
+// Something happening to the displays, at a time counted from the start of the wait
+//
+struct FakeSettleEvent
+{
+    ULONGLONG AtMs;
+    // Raises the generation, as a WM_DISPLAYCHANGE broadcast does
+    bool Broadcast;
+    // From then on the panels read back as requested, or not
+    bool Live;
+};
+
+//
+// Plays the events in simulated time: a wait moves the clock to the next broadcast or to its timeout
+//
+class FakeSettleSource final : public DisplaySettleSource
+{
+public:
+    FakeSettleSource(
+        FakeSettleClock &Clock,
+        const DisplayLiveState &Target,
+        const DisplayLiveState &Stale,
+        std::vector<FakeSettleEvent> Events,
+        ULONG Generation = 0)
+        : m_clock(Clock), m_start(Clock.Milliseconds), m_target(Target), m_stale(Stale), m_events(std::move(Events)),
+          m_generation(Generation)
+    {
+    }
+
+    ULONG GetGeneration() const override
+    {
+        return m_generation;
+    }
+
+    BOOLEAN WaitForChange(ULONG Generation, DWORD TimeoutMs) override
+    {
+        ULONGLONG deadline = m_clock.Milliseconds + TimeoutMs;
+
+        WaitGenerations.push_back(Generation);
+        WaitTimeouts.push_back(TimeoutMs);
+
+        // The broadcast came in before the wait started
+        if (m_generation != Generation)
+        {
+            return TRUE;
+        }
+
+        while (m_next < m_events.size() && m_start + m_events[m_next].AtMs <= deadline)
+        {
+            const FakeSettleEvent &event = m_events[m_next++];
+
+            m_clock.Milliseconds = (std::max)(m_clock.Milliseconds, m_start + event.AtMs);
+            m_live = event.Live;
+
+            if (event.Broadcast)
+            {
+                m_generation++;
+                return TRUE;
+            }
+        }
+
+        m_clock.Milliseconds = deadline;
+        return FALSE;
+    }
+
+    HRESULT QueryLiveState(DisplayLiveState &State) override
+    {
+        Queries++;
+        State = m_live ? m_target : m_stale;
+        return ERROR_SUCCESS;
+    }
+
+    std::vector<ULONG> WaitGenerations;
+    std::vector<DWORD> WaitTimeouts;
+    uint32_t Queries = 0;
+
+private:
+    FakeSettleClock &m_clock;
+    ULONGLONG m_start;
+    DisplayLiveState m_target;
+    DisplayLiveState m_stale;
+    std::vector<FakeSettleEvent> m_events;
+    size_t m_next = 0;
+    ULONG m_generation;
+    bool m_live = false;
+};
+
+// Both panels side by side, the first one primary
+static const DisplayLiveState BothPanels{
+    {{{1350, 1800, 0, 0, 0, true, true}, {1350, 1800, 1350, 0, 0, true, false}}}, 2};
+
+// What the desktop looked like before the second panel was turned on
+static const DisplayLiveState FirstPanelOnly{{{{1350, 1800, 0, 0, 0, true, true}, {}}}, 1};
+
+static FakeDisplayAdapter
+MakeAdapter(const wchar_t *DeviceName, const LayoutPanelPlan &Panel)
+{
+    FakeDisplayAdapter adapter{};
+
+    adapter.DeviceName = DeviceName;
+    adapter.Attached = Panel.Active;
+    adapter.Primary = Panel.Primary;
+    adapter.CurrentMode.dmSize = sizeof(DEVMODE);
+    adapter.CurrentMode.dmPelsWidth = Panel.Width;
+    adapter.CurrentMode.dmPelsHeight = Panel.Height;
+    adapter.CurrentMode.dmPosition.x = Panel.X;
+    adapter.CurrentMode.dmPosition.y = Panel.Y;
+    adapter.CurrentMode.dmDisplayOrientation = Panel.Orientation;
+    return adapter;
+}
+
+TEST_CASE(LiveLayoutComparison)
+{
+    DisplayLiveState live = BothPanels;
+
+    CHECK(DisplaySettleWaiter::IsLayoutLive(BothPanels, live));
+    CHECK(!DisplaySettleWaiter::IsLayoutLive(BothPanels, FirstPanelOnly));
+
+    // Another monitor came or went
+    live.MonitorCount = 3;
+    CHECK(!DisplaySettleWaiter::IsLayoutLive(BothPanels, live));
+
+    // The primary flag has not moved yet
+    live = BothPanels;
+    live.Panels[0].Primary = false;
+    live.Panels[1].Primary = true;
+    CHECK(!DisplaySettleWaiter::IsLayoutLive(BothPanels, live));
+
+    // Still rotating
+    live = BothPanels;
+    live.Panels[1].Orientation = 1;
+    CHECK(!DisplaySettleWaiter::IsLayoutLive(BothPanels, live));
+
+    // Whatever a panel that is off last reported does not matter
+    live = FirstPanelOnly;
+    live.Panels[1].Width = 640;
+    CHECK(DisplaySettleWaiter::IsLayoutLive(FirstPanelOnly, live));
+}
+
+TEST_CASE(SettlesOnTheBroadcastNotTheNextPoll)
+{
+    FakeSettleClock clock;
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, {{120, true, true}});
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics);
+    DISPLAY_SETTLE_STATS stats{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, waiter.Wait(BothPanels, 0));
+    statistics.GetStats(&stats);
+
+    // Two polls came back empty, the broadcast ended the third wait early
+    CHECK_EQUAL(10120u, clock.Milliseconds);
+    CHECK(source.WaitTimeouts == (std::vector<DWORD>{50, 50, 50}));
+    CHECK_EQUAL(4u, source.Queries);
+    CHECK_EQUAL(1u, stats.Settled);
+    CHECK_EQUAL(0u, stats.TimedOut);
+    CHECK_EQUAL(120u, stats.TotalMilliseconds);
+    CHECK_EQUAL(120u, stats.MaxMilliseconds);
+    CHECK_EQUAL(1u, stats.Buckets[3]);
+}
+
+TEST_CASE(AlreadyLiveReturnsWithoutWaiting)
+{
+    FakeSettleClock clock;
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, {{0, false, true}});
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics);
+    DISPLAY_SETTLE_STATS stats{};
+
+    // The only event happens before anything is read
+    source.WaitForChange(0, 0);
+    source.WaitTimeouts.clear();
+    source.WaitGenerations.clear();
+
+    CHECK_EQUAL(ERROR_SUCCESS, waiter.Wait(BothPanels, 0));
+    statistics.GetStats(&stats);
+
+    CHECK(source.WaitTimeouts.empty());
+    CHECK_EQUAL(1u, source.Queries);
+    CHECK_EQUAL(1u, stats.Settled);
+    CHECK_EQUAL(0u, stats.TotalMilliseconds);
+    CHECK_EQUAL(1u, stats.Buckets[0]);
+}
+
+TEST_CASE(BroadcastBeforeTheWaitDoesNotSpin)
+{
+    FakeSettleClock clock;
+    // The mode set already raised the generation to 1 when the wait starts, the settings only read back
+    // as requested 30 ms later and no second broadcast comes
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, {{30, false, true}}, 1);
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics);
+    DISPLAY_SETTLE_STATS stats{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, waiter.Wait(BothPanels, 0));
+    statistics.GetStats(&stats);
+
+    // The first wait returns at once and the next one waits past the new generation, up to the poll
+    CHECK(source.WaitGenerations == (std::vector<ULONG>{0, 1}));
+    CHECK_EQUAL(3u, source.Queries);
+    CHECK_EQUAL(50u, stats.TotalMilliseconds);
+    CHECK_EQUAL(1u, stats.Settled);
+}
+
+TEST_CASE(SpuriousWakeKeepsWaiting)
+{
+    FakeSettleClock clock;
+    // A broadcast for an intermediate layout, then the one that completes the transition
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, {{10, true, false}, {40, true, true}});
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics);
+    DISPLAY_SETTLE_STATS stats{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, waiter.Wait(BothPanels, 0));
+    statistics.GetStats(&stats);
+
+    CHECK(source.WaitGenerations == (std::vector<ULONG>{0, 1}));
+    CHECK_EQUAL(3u, source.Queries);
+    CHECK_EQUAL(40u, stats.TotalMilliseconds);
+    CHECK_EQUAL(1u, stats.Buckets[2]);
+}
+
+TEST_CASE(TimesOutWithoutOvershootingTheDeadline)
+{
+    FakeSettleClock clock;
+    std::vector<FakeSettleEvent> events;
+
+    // Broadcasts keep coming but the layout never shows up
+    for (ULONGLONG at = 30; at < 3000; at += 30)
+    {
+        events.push_back({at, true, false});
+    }
+
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, events);
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics);
+    DISPLAY_SETTLE_STATS stats{};
+
+    CHECK_EQUAL(ERROR_TIMEOUT, waiter.Wait(BothPanels, 0));
+    statistics.GetStats(&stats);
+
+    CHECK_EQUAL(10000u + DISPLAY_SETTLE_TIMEOUT_MS, clock.Milliseconds);
+    CHECK_EQUAL(0u, stats.Settled);
+    CHECK_EQUAL(1u, stats.TimedOut);
+    CHECK_EQUAL((ULONG64)DISPLAY_SETTLE_TIMEOUT_MS, stats.TotalMilliseconds);
+    CHECK_EQUAL(1u, stats.Buckets[DISPLAY_SETTLE_BUCKET_COUNT - 1]);
+
+    // Each of the 66 broadcasts woke it up, the last 20 ms ran out without one
+    CHECK_EQUAL(67u, source.WaitGenerations.size());
+    CHECK_EQUAL(68u, source.Queries);
+    CHECK_EQUAL(20u, source.WaitTimeouts.back());
+}
+
+TEST_CASE(ShortTimeoutEndsOnThePoll)
+{
+    FakeSettleClock clock;
+    FakeSettleSource source(clock, BothPanels, FirstPanelOnly, {});
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics, 120, 50);
+
+    CHECK_EQUAL(ERROR_TIMEOUT, waiter.Wait(BothPanels, 0));
+    CHECK(source.WaitTimeouts == (std::vector<DWORD>{50, 50, 20}));
+    CHECK_EQUAL(10120u, clock.Milliseconds);
+}
+
+TEST_CASE(NotifierWaitsPastTheGeneration)
+{
+    DisplayChangeNotifier &notifier = DisplayChangeNotifier::instance();
+    ULONG generation = notifier.GetDisplayGeneration();
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+
+    // Nothing changed, the wait runs out
+    CHECK(!notifier.WaitForDisplayChange(generation, 20));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(20));
+
+    // A broadcast before the wait returns it at once
+    FakeDisplayChangeNotifierSendDisplayChange();
+    start = std::chrono::steady_clock::now();
+    CHECK(notifier.WaitForDisplayChange(generation, 10000));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(1000));
+
+    // A broadcast during the wait wakes it up, device changes do not
+    generation = notifier.GetDisplayGeneration();
+    std::thread sender{[] {
+        FakeDisplayChangeNotifierSendDeviceChange();
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        FakeDisplayChangeNotifierSendDisplayChange();
+    }};
+
+    start = std::chrono::steady_clock::now();
+    CHECK(notifier.WaitForDisplayChange(generation, 10000));
+    CHECK(std::chrono::steady_clock::now() - start < std::chrono::milliseconds(5000));
+    CHECK_EQUAL(generation + 1, notifier.GetDisplayGeneration());
+    sender.join();
+}
+
+TEST_CASE(SystemSourceReadsThePanels)
+{
+    SystemDisplaySettleSource source(L"\\\\.\\DISPLAY1", L"\\\\.\\DISPLAY2");
+    DisplayLiveState live{};
+
+    FakeDisplayDevicesSet(
+        {MakeAdapter(L"\\\\.\\DISPLAY1", BothPanels.Panels[0]), MakeAdapter(L"\\\\.\\DISPLAY2", BothPanels.Panels[1])});
+    CHECK_EQUAL(ERROR_SUCCESS, source.QueryLiveState(live));
+    CHECK(DisplaySettleWaiter::IsLayoutLive(BothPanels, live));
+
+    FakeDisplayDevicesGet()[1].Attached = FALSE;
+    CHECK_EQUAL(ERROR_SUCCESS, source.QueryLiveState(live));
+    CHECK(DisplaySettleWaiter::IsLayoutLive(FirstPanelOnly, live));
+
+    // The panel is gone from the adapter list
+    FakeDisplayDevicesGet().pop_back();
+    CHECK_EQUAL(ERROR_NOT_FOUND, source.QueryLiveState(live));
+}
+
+TEST_CASE(SystemSourceTimesOutOnTheTickCount)
+{
+    SystemDisplaySettleSource source(L"\\\\.\\DISPLAY1", L"\\\\.\\DISPLAY2");
+    TickCountDisplaySettleClock clock;
+    DisplaySettleStatistics statistics;
+    DisplaySettleWaiter waiter(clock, source, statistics, 60, 20);
+    DISPLAY_SETTLE_STATS stats{};
+
+    FakeDisplayDevicesSet(
+        {MakeAdapter(L"\\\\.\\DISPLAY1", BothPanels.Panels[0]), MakeAdapter(L"\\\\.\\DISPLAY2", BothPanels.Panels[1])});
+    CHECK_EQUAL(ERROR_SUCCESS, waiter.Wait(BothPanels, source.GetGeneration()));
+
+    // The second panel never comes back, a broadcast in between does not end the wait
+    FakeDisplayDevicesGet()[1].Attached = FALSE;
+    std::thread sender{[] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+        FakeDisplayChangeNotifierSendDisplayChange();
+    }};
+
+    CHECK_EQUAL(ERROR_TIMEOUT, waiter.Wait(BothPanels, source.GetGeneration()));
+    sender.join();
+    statistics.GetStats(&stats);
+
+    CHECK_EQUAL(1u, stats.Settled);
+    CHECK_EQUAL(1u, stats.TimedOut);
+    CHECK(stats.MaxMilliseconds >= 60);
+}
\ No newline at end of file
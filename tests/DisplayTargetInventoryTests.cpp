@@ -0,0 +1,330 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "DisplayTargetInventory.h"
+#include "FakeDisplayChangeNotifier.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+constexpr inline uint32_t SYNTHETIC_TREE_SEED = 0x5EED1234;
+constexpr LUID DUO_ADAPTER_ID = {0x1234, 0};
+constexpr UINT32 DUO_SOURCE_COUNT = 3;
+constexpr UINT32 DUO_TARGET_IDS[] = {0x100, 0x101, 0x102};
+
+//
+// Serves a recorded topology and counts what the inventory asks for
+//
+class CountingTargetSource final : public DisplayTargetSource
+{
+public:
+    HRESULT QueryPaths(DisplayConfigTopology &Topology) override
+    {
+        QueryCalls++;
+        if (QueryStatus != ERROR_SUCCESS)
+        {
+            return QueryStatus;
+        }
+
+        Topology = Current;
+        return ERROR_SUCCESS;
+    }
+
+    HRESULT GetSourceGdiDeviceName(LUID, UINT32 SourceId, std::wstring &GdiDeviceName) override
+    {
+        WCHAR name[32];
+
+        SourceNameCalls++;
+        std::swprintf(name, ARRAYSIZE(name), L"\\\\.\\DISPLAY%u", SourceId + 1);
+        GdiDeviceName = name;
+
+        return ERROR_SUCCESS;
+    }
+
+    HRESULT GetTargetDevicePath(LUID, UINT32 TargetId, std::wstring &DevicePath) override
+    {
+        TargetNameCalls++;
+
+        auto it = DevicePaths.find(TargetId);
+        if (it == DevicePaths.end())
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        DevicePath = it->second;
+        return ERROR_SUCCESS;
+    }
+
+    DisplayConfigTopology Current;
+    std::map<UINT32, std::wstring> DevicePaths;
+    HRESULT QueryStatus = ERROR_SUCCESS;
+    uint64_t QueryCalls = 0;
+    uint64_t SourceNameCalls = 0;
+    uint64_t TargetNameCalls = 0;
+};
+
+//
+// "\\?\DISPLAY#SYN0000#5&...&0&UID0#{guid}" for "DISPLAY\SYN0000\5&...&0&UID0"
+//
+static std::wstring
+MonitorDevicePath(const std::wstring &InstanceId)
+{
+    std::wstring path = L"\\\\?\\" + InstanceId + L"#{e6f07b5f-ee97-4a90-b076-33f57bf4eaa7}";
+
+    std::replace(path.begin() + 4, path.end(), L'\\', L'#');
+    return path;
+}
+
+//
+// The two panels of the synthetic tree and an external monitor on the third source, as QDC_ALL_PATHS lists them.
+// The first panel is at the origin of the desktop, the second one is left of it.
+//
+static SyntheticDeviceTree
+UseDuoTopology(CountingTargetSource &Source, size_t DeviceCount, BOOLEAN SecondActive = TRUE)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(DeviceCount, 2, SYNTHETIC_TREE_SEED);
+    const BOOLEAN active[] = {TRUE, SecondActive, TRUE};
+    const LONG positions[] = {0, -1350, 1350};
+
+    FakeSetupApiSetDevices(tree.Devices);
+    DeviceInventory::instance().Refresh();
+
+    Source.Current = {};
+    Source.DevicePaths.clear();
+
+    for (UINT32 source = 0; source < DUO_SOURCE_COUNT; source++)
+    {
+        if (active[source])
+        {
+            DISPLAYCONFIG_PATH_INFO path{};
+            DISPLAYCONFIG_MODE_INFO mode{};
+
+            mode.infoType = DISPLAYCONFIG_MODE_INFO_TYPE_SOURCE;
+            mode.adapterId = DUO_ADAPTER_ID;
+            mode.id = source;
+            mode.sourceMode.position.x = positions[source];
+
+            path.sourceInfo = {DUO_ADAPTER_ID, source, (UINT32)Source.Current.Modes.size(), 0};
+            path.targetInfo.adapterId = DUO_ADAPTER_ID;
+            path.targetInfo.id = DUO_TARGET_IDS[source];
+            path.targetInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+            path.targetInfo.targetAvailable = TRUE;
+            path.flags = DISPLAYCONFIG_PATH_ACTIVE;
+
+            Source.Current.Modes.push_back(mode);
+            Source.Current.Paths.push_back(path);
+        }
+    }
+
+    for (UINT32 source = 0; source < DUO_SOURCE_COUNT; source++)
+    {
+        for (UINT32 target = 0; target < DUO_SOURCE_COUNT; target++)
+        {
+            if (source != target || !active[source])
+            {
+                DISPLAYCONFIG_PATH_INFO path{};
+
+                path.sourceInfo = {DUO_ADAPTER_ID, source, DISPLAYCONFIG_PATH_MODE_IDX_INVALID, 0};
+                path.targetInfo.adapterId = DUO_ADAPTER_ID;
+                path.targetInfo.id = DUO_TARGET_IDS[target];
+                path.targetInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+                path.targetInfo.targetAvailable = TRUE;
+
+                Source.Current.Paths.push_back(path);
+            }
+        }
+    }
+
+    Source.DevicePaths[DUO_TARGET_IDS[0]] = MonitorDevicePath(tree.Panels[0].MonitorInstanceId);
+    Source.DevicePaths[DUO_TARGET_IDS[1]] = MonitorDevicePath(tree.Panels[1].MonitorInstanceId);
+    Source.DevicePaths[DUO_TARGET_IDS[2]] = MonitorDevicePath(L"DISPLAY\\EXT1234\\5&1234&0&UID2");
+
+    return tree;
+}
+
+TEST_CASE(InstanceIdsComeFromTheDevicePath)
+{
+    CHECK(DisplayTargetInventory::InstanceIdFromDevicePath(
+              L"\\\\?\\DISPLAY#SYN0000#5&1A2B&0&UID0#{e6f07b5f-ee97-4a90-b076-33f57bf4eaa7}") ==
+          L"DISPLAY\\SYN0000\\5&1A2B&0&UID0");
+    CHECK(DisplayTargetInventory::InstanceIdFromDevicePath(L"DISPLAY#SYN0000#UID0") == L"DISPLAY\\SYN0000\\UID0");
+}
+
+TEST_CASE(EveryPanelResolvesToItsSourceAndTarget)
+{
+    CountingTargetSource source;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 1000);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+
+    for (UINT32 panel = 0; panel < 2; panel++)
+    {
+        CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[panel].PanelId.c_str(), record));
+        CHECK(record.PanelId == tree.Panels[panel].PanelId);
+        CHECK(record.InstanceId == tree.Panels[panel].MonitorInstanceId);
+        CHECK_EQUAL(panel, record.Source.SourceId);
+        CHECK_EQUAL(DUO_TARGET_IDS[panel], record.TargetId);
+        CHECK(record.Active);
+        CHECK(record.Primary == (panel == 0));
+    }
+
+    // Any case, by GDI device name too
+    std::wstring lower = tree.Panels[1].PanelId;
+    std::transform(lower.begin(), lower.end(), lower.begin(), [](WCHAR c) { return (WCHAR)std::towlower(c); });
+
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(lower.c_str(), record));
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.LookupByGdiDeviceName(L"\\\\.\\display2", record));
+    CHECK(record.PanelId == tree.Panels[1].PanelId);
+
+    // The external monitor is not a panel
+    CHECK_EQUAL(ERROR_NOT_FOUND, inventory.LookupByGdiDeviceName(L"\\\\.\\DISPLAY3", record));
+}
+
+TEST_CASE(InactivePanelGetsASourceNobodyScansOutFrom)
+{
+    CountingTargetSource source;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 1000, FALSE);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[1].PanelId.c_str(), record));
+    CHECK(!record.Active);
+    CHECK(!record.Primary);
+    CHECK_EQUAL(DUO_TARGET_IDS[1], record.TargetId);
+
+    // Sources 0 and 2 drive the first panel and the external monitor
+    CHECK_EQUAL(1u, record.Source.SourceId);
+}
+
+TEST_CASE(LookupsAreServedFromMemoryUntilTheDisplaysChange)
+{
+    CountingTargetSource source;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 1000);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+    DISPLAY_TARGET_INVENTORY_STATS stats{};
+
+    for (uint32_t i = 0; i < 1000; i++)
+    {
+        CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[i % 2].PanelId.c_str(), record));
+    }
+
+    // One query, each of the three targets named once, a source name per panel
+    CHECK_EQUAL(1u, source.QueryCalls);
+    CHECK_EQUAL(3u, source.TargetNameCalls);
+    CHECK_EQUAL(2u, source.SourceNameCalls);
+
+    inventory.GetStats(&stats);
+    CHECK_EQUAL(1u, stats.Refreshes);
+    CHECK_EQUAL(1000u, stats.Lookups);
+    CHECK_EQUAL(source.TargetNameCalls + source.SourceNameCalls, stats.DeviceInfoCalls);
+
+    // A mode set queries again, a device change also refreshes the device inventory
+    FakeDisplayChangeNotifierSendDisplayChange();
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[0].PanelId.c_str(), record));
+    CHECK_EQUAL(2u, source.QueryCalls);
+
+    FakeSetupApiResetStats();
+    FakeDisplayChangeNotifierSendDeviceChange();
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[0].PanelId.c_str(), record));
+    CHECK_EQUAL(3u, source.QueryCalls);
+    CHECK_EQUAL(1u, FakeSetupApiGetStats().DeviceListCalls);
+}
+
+TEST_CASE(ModeSetIsSeenBeforeItsDisplayChange)
+{
+    CountingTargetSource source;
+    CountingTargetSource detached;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 1000);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+
+    UseDuoTopology(detached, 1000, FALSE);
+
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[1].PanelId.c_str(), record));
+    CHECK(record.Active);
+
+    // The second panel is turned off, WM_DISPLAYCHANGE is not there yet
+    source.Current = detached.Current;
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[1].PanelId.c_str(), record));
+    CHECK(record.Active);
+
+    inventory.Invalidate();
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[1].PanelId.c_str(), record));
+    CHECK(!record.Active);
+    CHECK(!record.Primary);
+    CHECK_EQUAL(2u, source.QueryCalls);
+
+    // Served from memory again until the next change
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[0].PanelId.c_str(), record));
+    CHECK(record.Active);
+    CHECK_EQUAL(2u, source.QueryCalls);
+}
+
+TEST_CASE(FailedRefreshIsRetriedOnTheNextLookup)
+{
+    CountingTargetSource source;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 1000);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+
+    source.QueryStatus = ERROR_GEN_FAILURE;
+    CHECK_EQUAL(ERROR_GEN_FAILURE, inventory.Lookup(tree.Panels[0].PanelId.c_str(), record));
+
+    source.QueryStatus = ERROR_SUCCESS;
+    CHECK_EQUAL(ERROR_SUCCESS, inventory.Lookup(tree.Panels[0].PanelId.c_str(), record));
+    CHECK_EQUAL(2u, source.QueryCalls);
+}
+
+BENCHMARK_CASE(LookupCost)
+{
+    CountingTargetSource source;
+    SyntheticDeviceTree tree = UseDuoTopology(source, 10000);
+    DisplayTargetInventory inventory(source);
+    DisplayTargetRecord record{};
+    volatile size_t sink = 0;
+
+    double hit = MeasureNanoseconds(1000000, [&](uint64_t i) {
+        sink = sink + inventory.Lookup(tree.Panels[i % 2].PanelId.c_str(), record);
+    });
+
+    double byName = MeasureNanoseconds(1000000, [&](uint64_t i) {
+        sink = sink + inventory.LookupByGdiDeviceName(i % 2 ? L"\\\\.\\DISPLAY2" : L"\\\\.\\DISPLAY1", record);
+    });
+
+    // Every lookup after a mode set, what each one cost before the inventory
+    uint64_t queries = source.QueryCalls;
+    uint64_t deviceInfo = source.SourceNameCalls + source.TargetNameCalls;
+    double refresh = MeasureNanoseconds(10000, [&](uint64_t i) {
+        FakeDisplayChangeNotifierSendDisplayChange();
+        sink = sink + inventory.Lookup(tree.Panels[i % 2].PanelId.c_str(), record);
+    });
+
+    ReportMeasurement("Lookup, cached", hit, "ns");
+    ReportMeasurement("LookupByGdiDeviceName, cached", byName, "ns");
+    ReportMeasurement("Lookup after a display change", refresh, "ns");
+    ReportMeasurement(
+        "Lookup after a display change, DisplayConfig calls",
+        (double)(source.QueryCalls - queries + source.SourceNameCalls + source.TargetNameCalls - deviceInfo) /
+            10000.0,
+        "calls");
+}
\ No newline at end of file
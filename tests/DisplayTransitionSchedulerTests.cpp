@@ -0,0 +1,329 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "DisplayTransitionJobs.h"
+#include "DisplayTransitionScheduler.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+#include <future>
+
+constexpr inline uint32_t SYNTHETIC_TREE_SEED = 0x5EED1234;
+constexpr uint32_t TRANSITION_PHASES = 4;
+
+//
+// The scheduler is process wide, the tests compare its statistics before and after
+//
+static DISPLAY_SCHEDULER_STATS
+SchedulerStatsSince(const DISPLAY_SCHEDULER_STATS &Before)
+{
+    DISPLAY_SCHEDULER_STATS after{};
+
+    DisplayTransitionScheduler::instance().GetStats(&after);
+
+    return DISPLAY_SCHEDULER_STATS{
+        after.Requested - Before.Requested,
+        after.Coalesced - Before.Coalesced,
+        after.Cancelled - Before.Cancelled,
+        after.Completed - Before.Completed};
+}
+
+static DISPLAY_SCHEDULER_STATS
+SchedulerStats()
+{
+    DISPLAY_SCHEDULER_STATS stats{};
+
+    DisplayTransitionScheduler::instance().GetStats(&stats);
+    return stats;
+}
+
+//
+// Runs a transition the way SetDisplayStates does, giving up between its phases once superseded
+//
+static HRESULT
+RunTransition(ULONG64 Ticket, const std::function<VOID()> &Phase = [] {})
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    HRESULT Status = ERROR_SUCCESS;
+
+    if (!scheduler.Begin(Ticket))
+    {
+        return ERROR_CANCELLED;
+    }
+
+    for (uint32_t phase = 0; phase < TRANSITION_PHASES && Status == ERROR_SUCCESS; phase++)
+    {
+        Phase();
+
+        if (scheduler.IsSuperseded())
+        {
+            Status = ERROR_CANCELLED;
+        }
+    }
+
+    scheduler.End(Status);
+    return Status;
+}
+
+//
+// Waits until the transition jobs posted so far ran or were dropped
+//
+static VOID
+DrainTransitionJobs()
+{
+    DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+    std::promise<VOID> drained;
+
+    // A job of the current generation always runs, and after everything posted before it
+    jobs.Post(jobs.GetGeneration(), "Drain", [&] { drained.set_value(); });
+    drained.get_future().wait();
+}
+
+static BOOLEAN
+IsEnabled(const std::wstring &InstanceId)
+{
+    for (const FakeDeviceNode &device : FakeSetupApiGetDevices())
+    {
+        if (device.InstanceId == InstanceId)
+        {
+            return device.Enabled;
+        }
+    }
+
+    return FALSE;
+}
+
+TEST_CASE(SequentialRequestsAllRun)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    DISPLAY_SCHEDULER_STATS before = SchedulerStats();
+
+    for (uint32_t i = 0; i < 10; i++)
+    {
+        CHECK_EQUAL(ERROR_SUCCESS, RunTransition(scheduler.Request()));
+    }
+
+    DISPLAY_SCHEDULER_STATS stats = SchedulerStatsSince(before);
+
+    CHECK_EQUAL(10u, stats.Requested);
+    CHECK_EQUAL(10u, stats.Completed);
+    CHECK_EQUAL(0u, stats.Coalesced + stats.Cancelled);
+    CHECK(!scheduler.IsSuperseded());
+}
+
+TEST_CASE(QueuedRequestsCoalesceIntoTheNewest)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    DISPLAY_SCHEDULER_STATS before = SchedulerStats();
+    ULONG64 first = scheduler.Request();
+    ULONG64 second = scheduler.Request();
+    ULONG64 third = scheduler.Request();
+
+    // Winning the lock in order, only the newest one runs
+    CHECK_EQUAL(ERROR_CANCELLED, RunTransition(first));
+    CHECK_EQUAL(ERROR_CANCELLED, RunTransition(second));
+    CHECK_EQUAL(ERROR_SUCCESS, RunTransition(third));
+
+    DISPLAY_SCHEDULER_STATS stats = SchedulerStatsSince(before);
+
+    CHECK_EQUAL(2u, stats.Coalesced);
+    CHECK_EQUAL(1u, stats.Completed);
+
+    // Winning it out of order, the older one runs after the newest one since it reads the latest state too
+    first = scheduler.Request();
+    second = scheduler.Request();
+
+    CHECK_EQUAL(ERROR_SUCCESS, RunTransition(second));
+    CHECK_EQUAL(ERROR_SUCCESS, RunTransition(first));
+    CHECK_EQUAL(3u, SchedulerStatsSince(before).Completed);
+}
+
+TEST_CASE(RunningTransitionGivesUpBetweenPhases)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    DISPLAY_SCHEDULER_STATS before = SchedulerStats();
+    ULONG64 newer = 0;
+    uint32_t phases = 0;
+
+    // A request coming in during the second phase stops the transition right after it
+    CHECK_EQUAL(ERROR_CANCELLED, RunTransition(scheduler.Request(), [&] {
+                    if (++phases == 2)
+                    {
+                        newer = scheduler.Request();
+                    }
+                }));
+
+    CHECK_EQUAL(2u, phases);
+    CHECK_EQUAL(ERROR_SUCCESS, RunTransition(newer));
+
+    DISPLAY_SCHEDULER_STATS stats = SchedulerStatsSince(before);
+
+    CHECK_EQUAL(2u, stats.Requested);
+    CHECK_EQUAL(1u, stats.Cancelled);
+    CHECK_EQUAL(1u, stats.Completed);
+}
+
+TEST_CASE(CancelledTransitionLeavesTheDigitizerOfATurnedOnPanelToTheNextOne)
+{
+    SyntheticDeviceTree tree = GenerateSyntheticDeviceTree(1000, 2, SYNTHETIC_TREE_SEED);
+    DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+    DISPLAY_TRANSITION_STATS before{};
+    DISPLAY_TRANSITION_STATS after{};
+    std::promise<VOID> release;
+    std::shared_future<VOID> released = release.get_future().share();
+
+    // Both panels were off, their digitizers with them
+    for (FakeDeviceNode &device : tree.Devices)
+    {
+        device.Enabled = device.InstanceId != tree.Panels[0].DigitizerInstanceId &&
+                         device.InstanceId != tree.Panels[1].DigitizerInstanceId;
+    }
+
+    FakeSetupApiSetDevices(tree.Devices);
+    DeviceInventory::instance().Refresh();
+    jobs.GetStats(&before);
+
+    // Hold the worker so that the enable job of the cancelled transition is still queued when the next one starts
+    std::promise<VOID> holding;
+    jobs.Post(jobs.GetGeneration(), "Hold", [&holding, released] {
+        holding.set_value();
+        released.wait();
+    });
+    holding.get_future().wait();
+
+    // The cancelled transition turned both panels on, but only the first one got marked once its mode set went
+    // through, the way SetDisplayStates did when cancelled before reaching the end
+    ULONG cancelled = jobs.BeginTransition();
+    jobs.MarkDigitizerDisabled(tree.Panels[0].PanelId.c_str());
+    jobs.PostEnableDigitizers(
+        cancelled, {tree.Panels[0].PanelId, tree.Panels[1].PanelId}, SYNTHETIC_DIGITIZER_HARDWARE_ID);
+
+    // The newer transition finds nothing left to change and only queues its enable job
+    ULONG newer = jobs.BeginTransition();
+    jobs.PostEnableDigitizers(
+        newer, {tree.Panels[0].PanelId, tree.Panels[1].PanelId}, SYNTHETIC_DIGITIZER_HARDWARE_ID);
+
+    release.set_value();
+    DrainTransitionJobs();
+    jobs.GetStats(&after);
+
+    CHECK_EQUAL(1u, after.JobsCancelled - before.JobsCancelled);
+    CHECK(IsEnabled(tree.Panels[0].DigitizerInstanceId));
+
+    // Without being marked the panel is never enabled again
+    CHECK(!IsEnabled(tree.Panels[1].DigitizerInstanceId));
+}
+
+TEST_CASE(BurstsAlwaysApplyTheNewestRequest)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    DISPLAY_SCHEDULER_STATS before = SchedulerStats();
+    std::mutex rotationLock;
+    std::vector<std::thread> callers;
+    std::atomic<ULONG64> newestCompleted{0};
+    constexpr uint32_t threads = 8;
+    constexpr uint32_t requests = 2000;
+
+    for (uint32_t thread = 0; thread < threads; thread++)
+    {
+        callers.emplace_back([&]() {
+            for (uint32_t i = 0; i < requests; i++)
+            {
+                ULONG64 ticket = scheduler.Request();
+                std::lock_guard lock{rotationLock};
+
+                if (RunTransition(ticket, [] { std::this_thread::yield(); }) == ERROR_SUCCESS &&
+                    ticket > newestCompleted)
+                {
+                    newestCompleted = ticket;
+                }
+            }
+        });
+    }
+
+    for (std::thread &caller : callers)
+    {
+        caller.join();
+    }
+
+    DISPLAY_SCHEDULER_STATS stats = SchedulerStatsSince(before);
+
+    std::printf(
+        "    %llu requested, %llu coalesced, %llu cancelled, %llu completed\n",
+        (unsigned long long)stats.Requested,
+        (unsigned long long)stats.Coalesced,
+        (unsigned long long)stats.Cancelled,
+        (unsigned long long)stats.Completed);
+
+    CHECK_EQUAL((ULONG64)threads * requests, stats.Requested);
+    CHECK_EQUAL(stats.Requested, stats.Coalesced + stats.Cancelled + stats.Completed);
+    CHECK_EQUAL(before.Requested + stats.Requested, newestCompleted.load());
+    CHECK(!scheduler.IsSuperseded());
+}
+
+BENCHMARK_CASE(SchedulerOverhead)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    std::mutex rotationLock;
+    std::vector<std::thread> callers;
+    volatile ULONG64 sink = 0;
+
+    double uncontended = MeasureNanoseconds(10000000, [&](uint64_t) {
+        ULONG64 ticket = scheduler.Request();
+
+        if (scheduler.Begin(ticket))
+        {
+            sink = sink + scheduler.IsSuperseded();
+            scheduler.End(ERROR_SUCCESS);
+        }
+    });
+
+    // Callers bursting through a transition of 50us, how many of them end up applying one
+    DISPLAY_SCHEDULER_STATS before = SchedulerStats();
+
+    for (uint32_t thread = 0; thread < 8; thread++)
+    {
+        callers.emplace_back([&]() {
+            for (uint32_t i = 0; i < 500; i++)
+            {
+                ULONG64 ticket = scheduler.Request();
+                std::lock_guard lock{rotationLock};
+
+                RunTransition(ticket, [] {
+                    std::this_thread::sleep_for(std::chrono::microseconds(50 / TRANSITION_PHASES));
+                });
+            }
+        });
+    }
+
+    for (std::thread &caller : callers)
+    {
+        caller.join();
+    }
+
+    DISPLAY_SCHEDULER_STATS stats = SchedulerStatsSince(before);
+
+    ReportMeasurement("Request + Begin + IsSuperseded + End", uncontended, "ns");
+    ReportMeasurement("Burst of 4000 requests, completed", (double)stats.Completed, "requests");
+    ReportMeasurement("Burst of 4000 requests, coalesced", (double)stats.Coalesced, "requests");
+    ReportMeasurement("Burst of 4000 requests, cancelled", (double)stats.Cancelled, "requests");
+}
\ No newline at end of file
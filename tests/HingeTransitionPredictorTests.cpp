@@ -0,0 +1,284 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "DisplayTransitionJobs.h"
+#include "DisplayTransitionScheduler.h"
+#include "HingeTransitionPredictor.h"
+#include "SensorTraceReplay.h"
+#include "TestHarness.h"
+#include <future>
+
+constexpr int32_t DUO_PANEL_WIDTH = 1350;
+constexpr int32_t DUO_PANEL_HEIGHT = 1800;
+constexpr uint32_t TRANSITION_PHASES = 4;
+
+struct TimedHingeReading
+{
+    uint64_t TimeMs;
+    HingePosition Position;
+};
+
+//
+// Replays hinge readings through the posture filter and the prestaging, in portrait on both panels
+//
+static SensorReplayResult
+ReplayHingeReadings(std::initializer_list<TimedHingeReading> Readings)
+{
+    SensorTraceWriter writer;
+
+    for (const TimedHingeReading &reading : Readings)
+    {
+        writer.AppendPosture(reading.TimeMs * 1000, u"PANEL1", u"PANEL2", PostureSample{reading.Position, 0, 0});
+    }
+
+    const std::vector<uint8_t> &trace = writer.GetBuffer();
+    return ReplaySensorTrace(trace.data(), trace.size(), DUO_PANEL_WIDTH, DUO_PANEL_HEIGHT);
+}
+
+//
+// Applies confirmed hinge states the way ApplyLatestPostureState does: the transition under its scheduler ticket,
+// giving up between its phases once superseded, then the prestage of the predicted hinge state posted to the
+// transition jobs. The next transition takes what was staged, the way TakeStagedDisplayStates does.
+//
+class PrestagingTransitions
+{
+public:
+    HRESULT Apply(ULONG64 Ticket, HingePosition Position, const std::function<VOID()> &Phase = [] {})
+    {
+        DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+        DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+        HRESULT Status = ERROR_SUCCESS;
+
+        if (!scheduler.Begin(Ticket))
+        {
+            return ERROR_CANCELLED;
+        }
+
+        jobs.BeginTransition();
+        Take(Position);
+
+        for (uint32_t phase = 0; phase < TRANSITION_PHASES && Status == ERROR_SUCCESS; phase++)
+        {
+            Phase();
+
+            if (scheduler.IsSuperseded())
+            {
+                Status = ERROR_CANCELLED;
+            }
+        }
+
+        HingePosition predicted = m_predictor.Observe(Position);
+
+        if (Status != ERROR_CANCELLED && predicted != HingePosition::Unknown)
+        {
+            jobs.Post(jobs.GetGeneration(), "Prestage", [this, predicted] {
+                std::lock_guard lock{m_lock};
+
+                m_staged = predicted;
+                Staged++;
+            });
+        }
+
+        scheduler.End(Status);
+        return Status;
+    }
+
+    std::atomic<uint32_t> Staged{0};
+    uint32_t Hits{0};
+    uint32_t Misses{0};
+
+private:
+    VOID Take(HingePosition Position)
+    {
+        std::lock_guard lock{m_lock};
+
+        if (m_staged)
+        {
+            Hits += *m_staged == Position ? 1 : 0;
+            Misses += *m_staged != Position ? 1 : 0;
+        }
+
+        m_staged.reset();
+    }
+
+    HingeTransitionPredictor m_predictor;
+    std::mutex m_lock;
+    std::optional<HingePosition> m_staged;
+};
+
+//
+// Waits until the transition jobs posted so far ran or were dropped
+//
+static VOID
+DrainTransitionJobs()
+{
+    DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+    std::promise<VOID> drained;
+
+    jobs.Post(jobs.GetGeneration(), "Drain", [&] { drained.set_value(); });
+    drained.get_future().wait();
+}
+
+TEST_CASE(FoldingBackAndUnfoldingArePredicted)
+{
+    HingeTransitionPredictor predictor;
+
+    // The first reading has no trend yet
+    CHECK(predictor.Observe(HingePosition::Convex) == HingePosition::Unknown);
+
+    CHECK(predictor.Observe(HingePosition::Flat) == HingePosition::Unknown);
+    CHECK(predictor.Observe(HingePosition::Convex) == HingePosition::Full);
+    CHECK(predictor.Observe(HingePosition::Full) == HingePosition::Convex);
+
+    // Closing from full through convex is not heading for full again
+    CHECK(predictor.Observe(HingePosition::Convex) == HingePosition::Unknown);
+    CHECK(predictor.Observe(HingePosition::Flat) == HingePosition::Unknown);
+}
+
+TEST_CASE(MispredictedFoldBackIsAMiss)
+{
+    constexpr HingePosition trace[] = {
+        HingePosition::Flat, HingePosition::Convex, HingePosition::Flat, HingePosition::Concave};
+    HingeTransitionPredictor predictor;
+
+    CHECK_EQUAL(0u, ReplayHingeTrace(trace, ARRAYSIZE(trace)));
+
+    // Closing again drops the prediction instead of carrying it over
+    predictor.Observe(HingePosition::Flat);
+    CHECK(predictor.Observe(HingePosition::Convex) == HingePosition::Full);
+    CHECK(predictor.Observe(HingePosition::Flat) == HingePosition::Unknown);
+    CHECK(predictor.Observe(HingePosition::Concave) == HingePosition::Unknown);
+
+    // The staged fold back is not what is applied, both panels stay on
+    SensorReplayResult result = ReplayHingeReadings(
+        {{0, HingePosition::Flat}, {1000, HingePosition::Convex}, {2000, HingePosition::Flat}});
+
+    CHECK(result.Valid);
+    CHECK_EQUAL(3u, (uint32_t)result.Decisions.size());
+    CHECK_EQUAL(0u, result.PrestageHits);
+    CHECK(result.FinalLayout[0].Active && result.FinalLayout[1].Active);
+
+    for (const SensorReplayDecision &decision : result.Decisions)
+    {
+        CHECK(!decision.Prestaged);
+    }
+}
+
+TEST_CASE(ReversalJustAfterTheThresholdIsNotPrestaged)
+{
+    // Back to flat before convex is confirmed, nothing is applied or staged
+    SensorReplayResult result = ReplayHingeReadings(
+        {{0, HingePosition::Flat}, {1000, HingePosition::Convex}, {1200, HingePosition::Flat}});
+
+    CHECK_EQUAL(1u, (uint32_t)result.Decisions.size());
+    CHECK_EQUAL(0u, result.PrestageHits);
+
+    // Back to flat right after convex is confirmed misses the fold back staged for it, opening again stages it
+    // once more and folding back then hits
+    result = ReplayHingeReadings(
+        {{0, HingePosition::Flat},
+         {1000, HingePosition::Convex},
+         {1300, HingePosition::Flat},
+         {2000, HingePosition::Convex},
+         {2300, HingePosition::Full}});
+
+    CHECK_EQUAL(5u, (uint32_t)result.Decisions.size());
+
+    // Convex is confirmed at 1250, 50 ms before the reversal
+    CHECK_EQUAL((uint64_t)250000, result.Decisions[1].LatencyMicroseconds);
+    CHECK(!result.Decisions[2].Prestaged);
+    CHECK(!result.Decisions[3].Prestaged);
+    CHECK(result.Decisions[4].Prestaged);
+    CHECK_EQUAL(1u, result.PrestageHits);
+    CHECK(result.FinalLayout[0].Active != result.FinalLayout[1].Active);
+}
+
+TEST_CASE(PrestageOfASupersededTransitionIsDropped)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    DisplayTransitionJobs &jobs = DisplayTransitionJobs::instance();
+    PrestagingTransitions transitions;
+    DISPLAY_TRANSITION_STATS before{};
+    DISPLAY_TRANSITION_STATS after{};
+    std::promise<VOID> holding;
+    std::promise<VOID> release;
+    std::shared_future<VOID> released = release.get_future().share();
+
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Flat));
+    DrainTransitionJobs();
+    jobs.GetStats(&before);
+
+    // Hold the worker so that the fold back staged for convex is still queued when the reversal starts
+    jobs.Post(jobs.GetGeneration(), "Hold", [&holding, released] {
+        holding.set_value();
+        released.wait();
+    });
+    holding.get_future().wait();
+
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Convex));
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Flat));
+
+    release.set_value();
+    DrainTransitionJobs();
+    jobs.GetStats(&after);
+
+    CHECK_EQUAL(1u, after.JobsCancelled - before.JobsCancelled);
+    CHECK_EQUAL(0u, transitions.Staged.load());
+    CHECK_EQUAL(0u, transitions.Hits + transitions.Misses);
+}
+
+TEST_CASE(CancelledTransitionDoesNotPrestage)
+{
+    DisplayTransitionScheduler &scheduler = DisplayTransitionScheduler::instance();
+    PrestagingTransitions transitions;
+    ULONG64 newer = 0;
+    uint32_t phases = 0;
+
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Flat));
+
+    // Folded back while convex was still being applied
+    CHECK_EQUAL(ERROR_CANCELLED, transitions.Apply(scheduler.Request(), HingePosition::Convex, [&] {
+                    if (++phases == 2)
+                    {
+                        newer = scheduler.Request();
+                    }
+                }));
+
+    DrainTransitionJobs();
+    CHECK_EQUAL(0u, transitions.Staged.load());
+
+    // The newer transition runs from scratch and stages the unfolding, which then hits
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(newer, HingePosition::Full));
+    DrainTransitionJobs();
+    CHECK_EQUAL(1u, transitions.Staged.load());
+
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Convex));
+    CHECK_EQUAL(1u, transitions.Hits);
+    CHECK_EQUAL(0u, transitions.Misses);
+
+    // Opening up from flat a second time, a mispredicted fold back counts as a miss
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Flat));
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Convex));
+    DrainTransitionJobs();
+    CHECK_EQUAL(ERROR_SUCCESS, transitions.Apply(scheduler.Request(), HingePosition::Flat));
+    CHECK_EQUAL(1u, transitions.Misses);
+}
\ No newline at end of file
@@ -0,0 +1,334 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "OrientationFusion.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+constexpr uint8_t U = POSTURE_ORIENTATION_UNKNOWN;
+
+//
+// A reading and the posture the display code should have been handed once it was taken in
+//
+struct LabeledPostureStep
+{
+    uint64_t Time;
+    PostureSample Reading;
+    PostureSample Applied;
+};
+
+//
+// The readings go through the fusion and the filter like on the sensor worker, which polls the filter at
+// its deadlines in between readings
+//
+struct PosturePipeline
+{
+    explicit PosturePipeline(uint8_t Threshold = ORIENTATION_FUSION_DEFAULT_THRESHOLD) : Fusion(Threshold)
+    {
+    }
+
+    void Advance(uint64_t Now)
+    {
+        uint64_t deadline = Filter.NextDeadline();
+
+        if (deadline <= Now)
+        {
+            Applied += Filter.Poll(deadline) ? 1 : 0;
+        }
+    }
+
+    void Observe(uint64_t Now, const PostureSample &Reading)
+    {
+        Advance(Now);
+        Applied += Filter.Observe(Fusion.Fuse(Reading), Now) ? 1 : 0;
+    }
+
+    OrientationFusion Fusion;
+    PostureFilter Filter{DefaultPostureFilterSettings};
+    uint32_t Applied = 0;
+};
+
+// The index of the first step whose applied posture is not the labeled one, Count if there is none
+template <size_t Count>
+static size_t
+FirstMislabeledStep(const LabeledPostureStep (&Trace)[Count], PosturePipeline &Pipeline)
+{
+    for (size_t i = 0; i < Count; i++)
+    {
+        Pipeline.Observe(Trace[i].Time, Trace[i].Reading);
+
+        if (Pipeline.Filter.GetCurrent() != Trace[i].Applied)
+        {
+            std::printf("    step %zu at %llu ms\n", i, (unsigned long long)Trace[i].Time);
+            return i;
+        }
+    }
+
+    return Count;
+}
+
+//
+// Held upright, then laid flat: the panel still tilted reports a stray landscape reading while the other one
+// reads face up. Neither stray reading rotates, the turn to landscape with the hinge bent does.
+//
+constexpr LabeledPostureStep LaidFlatThenTurned[] = {
+    {0, {HingePosition::Flat, 0, 0}, {HingePosition::Flat, 0, 0}},
+    {300, {HingePosition::Flat, 1, U}, {HingePosition::Flat, 0, 0}},
+    {600, {HingePosition::Flat, U, U}, {HingePosition::Flat, 0, 0}},
+    {900, {HingePosition::Flat, 3, U}, {HingePosition::Flat, 0, 0}},
+    {1200, {HingePosition::Flat, U, U}, {HingePosition::Flat, 0, 0}},
+    {1500, {HingePosition::Convex, 1, U}, {HingePosition::Flat, 0, 0}},
+    {1800, {HingePosition::Convex, 1, 1}, {HingePosition::Convex, 1, 1}}};
+
+//
+// Folded back through convex, one panel face down. The hinge change waits for the power confirmation,
+// then the panel facing the user alone is enough to rotate.
+//
+constexpr LabeledPostureStep FoldedBackFaceDown[] = {
+    {0, {HingePosition::Flat, 0, 0}, {HingePosition::Flat, 0, 0}},
+    {200, {HingePosition::Convex, 0, 0}, {HingePosition::Flat, 0, 0}},
+    {400, {HingePosition::Full, 0, U}, {HingePosition::Flat, 0, 0}},
+    {600, {HingePosition::Full, U, 0}, {HingePosition::Flat, 0, 0}},
+    {900, {HingePosition::Full, U, U}, {HingePosition::Full, 0, 0}},
+    {1200, {HingePosition::Full, U, 1}, {HingePosition::Full, 0, 0}},
+    {1500, {HingePosition::Full, U, 1}, {HingePosition::Full, 1, 1}}};
+
+//
+// Unfolding with the hinge sensor flickering back to full: leaving full takes the hysteresis on top of the
+// power confirmation, and each flicker starts it over.
+//
+constexpr LabeledPostureStep UnfoldedWithFlicker[] = {
+    {0, {HingePosition::Full, 0, 0}, {HingePosition::Full, 0, 0}},
+    {300, {HingePosition::Convex, 0, 0}, {HingePosition::Full, 0, 0}},
+    {500, {HingePosition::Full, 0, 0}, {HingePosition::Full, 0, 0}},
+    {700, {HingePosition::Convex, 0, 0}, {HingePosition::Full, 0, 0}},
+    {1200, {HingePosition::Convex, 0, 0}, {HingePosition::Full, 0, 0}},
+    {1600, {HingePosition::Convex, 0, 0}, {HingePosition::Convex, 0, 0}},
+    {1700, {HingePosition::Full, 0, 0}, {HingePosition::Convex, 0, 0}},
+    {1800, {HingePosition::Convex, 0, 0}, {HingePosition::Convex, 0, 0}},
+    {2500, {HingePosition::Convex, 0, 0}, {HingePosition::Convex, 0, 0}}};
+
+//
+// Back to back the panels may legitimately disagree and the first reading is taken as is. Laid flat, the
+// same disagreement is never trusted however long it lasts.
+//
+constexpr LabeledPostureStep DisagreeingPanels[] = {
+    {0, {HingePosition::Full, 1, 3}, {HingePosition::Full, 1, 3}},
+    {300, {HingePosition::Full, 1, 1}, {HingePosition::Full, 1, 3}},
+    {600, {HingePosition::Full, 1, 1}, {HingePosition::Full, 1, 1}},
+    {900, {HingePosition::Flat, 1, 3}, {HingePosition::Full, 1, 1}},
+    {1200, {HingePosition::Flat, 1, 3}, {HingePosition::Full, 1, 1}},
+    {1350, {HingePosition::Flat, 1, 3}, {HingePosition::Flat, 1, 1}},
+    {1500, {HingePosition::Flat, 1, 3}, {HingePosition::Flat, 1, 1}},
+    {3000, {HingePosition::Flat, 1, 3}, {HingePosition::Flat, 1, 1}}};
+
+TEST_CASE(LaidFlatThenTurnedRotatesOnce)
+{
+    PosturePipeline pipeline;
+
+    CHECK_EQUAL(std::size(LaidFlatThenTurned), FirstMislabeledStep(LaidFlatThenTurned, pipeline));
+    CHECK_EQUAL(2u, pipeline.Applied);
+    CHECK_EQUAL(2u, pipeline.Fusion.GetStats().Commits);
+    CHECK_EQUAL(2u, pipeline.Fusion.GetStats().Held);
+
+    // The compile time score of the same trace agrees
+    OrientationFusionScore score =
+        ScoreOrientationFusion(LaidFlatTrace, (uint32_t)std::size(LaidFlatTrace), ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+    CHECK_EQUAL(7u, score.Correct);
+    CHECK_EQUAL(0u, score.WrongRotations);
+}
+
+TEST_CASE(FoldedBackFaceDownRotatesFromThePanelInView)
+{
+    PosturePipeline pipeline;
+
+    CHECK_EQUAL(std::size(FoldedBackFaceDown), FirstMislabeledStep(FoldedBackFaceDown, pipeline));
+    CHECK_EQUAL(3u, pipeline.Applied);
+
+    // Convex was still pending when full came in
+    CHECK_EQUAL(1u, pipeline.Filter.GetStats().Suppressed);
+}
+
+TEST_CASE(UnfoldingWaitsOutTheFlicker)
+{
+    PosturePipeline pipeline;
+
+    CHECK_EQUAL(std::size(UnfoldedWithFlicker), FirstMislabeledStep(UnfoldedWithFlicker, pipeline));
+    CHECK_EQUAL(2u, pipeline.Applied);
+    CHECK_EQUAL(2u, pipeline.Filter.GetStats().Suppressed);
+}
+
+TEST_CASE(DisagreeingPanelsOnlyTrustedBackToBack)
+{
+    PosturePipeline pipeline;
+
+    CHECK_EQUAL(std::size(DisagreeingPanels), FirstMislabeledStep(DisagreeingPanels, pipeline));
+    CHECK_EQUAL(3u, pipeline.Applied);
+    CHECK_EQUAL(5u, pipeline.Fusion.GetStats().Held);
+    CHECK(pipeline.Fusion.GetConfidence() < ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+}
+
+struct SyntheticSessionScore
+{
+    uint32_t Readings;
+    // Readings after which the applied orientation was the one the device was held in
+    uint32_t Correct;
+    // Applied orientation changes to something the device was not held in
+    uint32_t WrongRotations;
+    uint32_t Rotations;
+};
+
+//
+// Subject: Replays a synthetic session held mostly flat, a reading every 200 ms
+//
+// Parameters:
+//
+//             Seed: Picks the turns and the noise
+//
+//             Threshold: The fusion threshold, 0 behaves like the historical copy-the-other-panel fallback
+//
+// Returns: How the applied orientation compares with the one the device was held in
+//
+static SyntheticSessionScore
+ReplaySyntheticSession(uint32_t Seed, uint32_t Readings, uint8_t Threshold)
+{
+    SyntheticRandom random(Seed);
+    PosturePipeline pipeline(Threshold);
+    SyntheticSessionScore score{};
+    uint8_t held = 0;
+    uint8_t applied = U;
+    uint8_t stray = 0;
+    uint32_t strayLeft = 0;
+    bool strayed = false;
+    uint32_t segmentLeft = 0;
+
+    for (uint32_t i = 0; i < Readings; i++)
+    {
+        uint64_t now = i * 200ULL;
+        PostureSample reading{random.Next() % 4 == 0 ? HingePosition::Convex : HingePosition::Flat, held, held};
+
+        // The device is turned every 20 to 40 readings
+        if (segmentLeft == 0)
+        {
+            held = (uint8_t)((held + 1 + random.Next() % 3) % 4);
+            segmentLeft = 20 + random.Next() % 20;
+            reading.Orientation1 = held;
+            reading.Orientation2 = held;
+        }
+
+        segmentLeft--;
+
+        // Runs of one or two stray readings from a tilted panel, the other one reads face up or right. Three
+        // agreeing readings are a turn, so a run is always followed by a good reading.
+        if (strayLeft == 0 && !strayed && random.Next() % 100 < 15)
+        {
+            stray = (uint8_t)((held + 1 + random.Next() % 3) % 4);
+            strayLeft = 1 + random.Next() % 2;
+        }
+
+        strayed = strayLeft != 0 && reading.Position == HingePosition::Flat;
+
+        if (strayed)
+        {
+            reading.Orientation1 = stray;
+            reading.Orientation2 = random.Next() % 2 ? U : held;
+            strayLeft--;
+        }
+        else if (random.Next() % 5 == 0)
+        {
+            // A panel lying face up
+            reading.Orientation2 = U;
+        }
+
+        pipeline.Observe(now, reading);
+        pipeline.Advance(now + 199);
+
+        uint8_t current = pipeline.Filter.GetCurrent().Orientation1;
+
+        if (current != applied && applied != U)
+        {
+            score.Rotations++;
+            score.WrongRotations += current != held ? 1 : 0;
+        }
+
+        applied = current;
+        score.Readings++;
+        score.Correct += current == held ? 1 : 0;
+    }
+
+    return score;
+}
+
+TEST_CASE(SyntheticSessionsNeverRotateWrongly)
+{
+    uint32_t wrongWithout = 0;
+
+    for (uint32_t seed = 1; seed <= 20; seed++)
+    {
+        SyntheticSessionScore fused = ReplaySyntheticSession(seed, 2000, ORIENTATION_FUSION_DEFAULT_THRESHOLD);
+        SyntheticSessionScore unfused = ReplaySyntheticSession(seed, 2000, 0);
+
+        CHECK_EQUAL(0u, fused.WrongRotations);
+        CHECK(fused.Rotations > 0);
+        CHECK(fused.Correct * 100 >= fused.Readings * 90);
+        wrongWithout += unfused.WrongRotations;
+    }
+
+    // The stray runs long enough to get past the filter do rotate without the fusion
+    CHECK(wrongWithout > 0);
+}
+
+BENCHMARK_CASE(SyntheticSessionAccuracy)
+{
+    constexpr uint32_t sessions = 50;
+    constexpr uint32_t readings = 5000;
+    SyntheticSessionScore totals[2]{};
+    const uint8_t thresholds[2] = {0, ORIENTATION_FUSION_DEFAULT_THRESHOLD};
+
+    for (uint32_t t = 0; t < 2; t++)
+    {
+        for (uint32_t seed = 1; seed <= sessions; seed++)
+        {
+            SyntheticSessionScore score = ReplaySyntheticSession(seed, readings, thresholds[t]);
+
+            totals[t].Readings += score.Readings;
+            totals[t].Correct += score.Correct;
+            totals[t].WrongRotations += score.WrongRotations;
+            totals[t].Rotations += score.Rotations;
+        }
+    }
+
+    ReportMeasurement("Correct, threshold 0", 100.0 * totals[0].Correct / totals[0].Readings, "%");
+    ReportMeasurement("Correct, default threshold", 100.0 * totals[1].Correct / totals[1].Readings, "%");
+    ReportMeasurement("Wrong rotations, threshold 0", (double)totals[0].WrongRotations, "");
+    ReportMeasurement("Wrong rotations, default threshold", (double)totals[1].WrongRotations, "");
+    ReportMeasurement("Rotations, threshold 0", (double)totals[0].Rotations, "");
+    ReportMeasurement("Rotations, default threshold", (double)totals[1].Rotations, "");
+
+    PosturePipeline pipeline;
+    double perReading = MeasureNanoseconds(10000000, [&](uint64_t i) {
+        uint8_t orientation = (uint8_t)((i >> 4) & 3);
+        pipeline.Observe(i * 200, PostureSample{HingePosition::Flat, orientation, i & 1 ? U : orientation});
+    });
+
+    ReportMeasurement("Fuse + Observe per reading", perReading, "ns");
+}
\ No newline at end of file
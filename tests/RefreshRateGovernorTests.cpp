@@ -0,0 +1,271 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeTickCount.h"
+#include "RefreshRateController.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+constexpr uint64_t SIMULATED_DAY_MS = 8 * 60 * 60 * 1000;
+
+struct SimulatedSession
+{
+    uint32_t Switches;
+    uint64_t LowTierMs;
+};
+
+//
+// Drives a governor through a day of sporadic input and power source changes, the way the controller does: only
+// at the inputs and at the deadlines the governor hands out
+//
+static SimulatedSession
+SimulateDay(RefreshRateGovernorSettings Settings, uint32_t Seed)
+{
+    SyntheticRandom random(Seed);
+    RefreshRateGovernor governor(Settings, 0);
+    RefreshRateTier tier = RefreshRateTier::High;
+    SimulatedSession session{};
+    uint64_t now = 0;
+
+    while (now < SIMULATED_DAY_MS)
+    {
+        // Input every few seconds while in use, with pauses of up to two minutes
+        uint64_t next = now + (random.Next() % 4 == 0 ? random.Next() % 120000 : random.Next() % 5000);
+
+        while (governor.NextDeadline(now) <= next)
+        {
+            uint64_t deadline = governor.NextDeadline(now);
+
+            session.LowTierMs += tier == RefreshRateTier::Low ? deadline - now : 0;
+            now = deadline;
+            tier = governor.Evaluate(now);
+        }
+
+        session.LowTierMs += tier == RefreshRateTier::Low ? next - now : 0;
+        now = next;
+
+        // Loose charger contacts now and then
+        if (random.Next() % 50 == 0)
+        {
+            governor.OnPowerSource(random.Next() % 2 == 0);
+        }
+
+        governor.OnInteraction(now);
+        tier = governor.Evaluate(now);
+    }
+
+    session.Switches = governor.GetSwitchCount();
+    return session;
+}
+
+static BOOLEAN
+WaitFor(const std::function<bool()> &Condition)
+{
+    for (uint32_t i = 0; i < 2000; i++)
+    {
+        if (Condition())
+        {
+            return TRUE;
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    return FALSE;
+}
+
+TEST_CASE(IdleDropsTheRateAtTheDeadline)
+{
+    RefreshRateGovernor governor(DefaultRefreshRateGovernorSettings, 0);
+
+    CHECK(governor.Evaluate(29999) == RefreshRateTier::High);
+    CHECK_EQUAL(30000u, governor.NextDeadline(29999));
+    CHECK(governor.Evaluate(30000) == RefreshRateTier::Low);
+    CHECK_EQUAL(REFRESH_RATE_NO_DEADLINE, governor.NextDeadline(30000));
+
+    // Input brings it back up right away, dwell time or not
+    governor.OnInteraction(30001);
+    CHECK(governor.Evaluate(30001) == RefreshRateTier::High);
+    CHECK_EQUAL(60001u, governor.NextDeadline(30001));
+    CHECK_EQUAL(2u, governor.GetSwitchCount());
+}
+
+TEST_CASE(DwellTimeHoldsOffDropping)
+{
+    RefreshRateGovernor governor(DefaultRefreshRateGovernorSettings, 0);
+
+    governor.Evaluate(30000);
+    governor.OnInteraction(31000);
+    governor.Evaluate(31000);
+
+    // Unplugged a second after going up, the drop waits for the dwell time
+    governor.OnPowerSource(true);
+    CHECK(governor.Evaluate(32000) == RefreshRateTier::High);
+    CHECK_EQUAL(36000u, governor.NextDeadline(32000));
+    CHECK(governor.Evaluate(35999) == RefreshRateTier::High);
+    CHECK(governor.Evaluate(36000) == RefreshRateTier::Low);
+
+    // On battery input does not bring it back up
+    governor.OnInteraction(37000);
+    CHECK(governor.Evaluate(37000) == RefreshRateTier::Low);
+    CHECK_EQUAL(3u, governor.GetSwitchCount());
+}
+
+TEST_CASE(DeadlinesSeeEverySwitchPollingWould)
+{
+    // The controller only evaluates at inputs and deadlines, polling every 10ms must not find anything else
+    for (uint32_t seed = 1; seed <= 16; seed++)
+    {
+        SyntheticRandom random(seed);
+        RefreshRateGovernor driven(DefaultRefreshRateGovernorSettings, 0);
+        RefreshRateGovernor polled(DefaultRefreshRateGovernorSettings, 0);
+        uint64_t deadline = driven.NextDeadline(0);
+        uint64_t nextInput = 0;
+        uint32_t mismatches = 0;
+
+        for (uint64_t now = 0; now < 600000; now += 10)
+        {
+            bool input = now == nextInput;
+
+            if (input)
+            {
+                bool onBattery = random.Next() % 10 == 0;
+
+                nextInput = now + 10 * (random.Next() % 6000);
+
+                for (RefreshRateGovernor *governor : {&driven, &polled})
+                {
+                    governor->OnInteraction(now);
+                    governor->OnPowerSource(onBattery);
+                }
+            }
+
+            RefreshRateTier tier = polled.Evaluate(now);
+
+            if (input || now >= deadline)
+            {
+                mismatches += driven.Evaluate(now) != tier;
+                deadline = driven.NextDeadline(now);
+            }
+        }
+
+        CHECK_EQUAL(0u, mismatches);
+        CHECK_EQUAL(polled.GetSwitchCount(), driven.GetSwitchCount());
+    }
+}
+
+TEST_CASE(FlappingChargerIsRateLimited)
+{
+    RefreshRateGovernor withDwell(DefaultRefreshRateGovernorSettings, 0);
+    RefreshRateGovernor withoutDwell({DefaultRefreshRateGovernorSettings.IdleTimeoutMs, 0}, 0);
+
+    // A charger contact bouncing every second for a minute while the device is in use
+    for (uint64_t now = 0; now < 60000; now += 1000)
+    {
+        for (RefreshRateGovernor *governor : {&withDwell, &withoutDwell})
+        {
+            governor->OnInteraction(now);
+            governor->OnPowerSource((now / 1000) % 2 == 1);
+            governor->Evaluate(now);
+        }
+    }
+
+    std::printf(
+        "    %u switches with the dwell time, %u without\n",
+        withDwell.GetSwitchCount(),
+        withoutDwell.GetSwitchCount());
+
+    // Going up is never held back, so only the drops are limited to one per dwell time
+    CHECK_EQUAL(59u, withoutDwell.GetSwitchCount());
+    CHECK(withDwell.GetSwitchCount() <= 2 * (60000 / DefaultRefreshRateGovernorSettings.MinDwellMs));
+}
+
+TEST_CASE(ControllerAppliesTheTiersTheGovernorSettlesOn)
+{
+    RefreshRateController &controller = RefreshRateController::instance();
+    std::atomic<uint32_t> applied{0};
+    std::atomic<RefreshRateTier> lastTier{RefreshRateTier::High};
+    std::atomic<bool> failing{false};
+    REFRESH_RATE_STATS stats{};
+
+    controller.Start([&](RefreshRateTier Tier) {
+        if (failing)
+        {
+            return (HRESULT)ERROR_GEN_FAILURE;
+        }
+
+        lastTier = Tier;
+        applied++;
+        return (HRESULT)ERROR_SUCCESS;
+    });
+
+    // Unplugged right away, the dwell time since starting holds the drop off
+    controller.OnPowerSourceChanged(TRUE);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    CHECK_EQUAL(0u, applied.load());
+
+    FakeTickCountAdvance(DefaultRefreshRateGovernorSettings.MinDwellMs);
+    controller.OnPowerSourceChanged(TRUE);
+    CHECK(WaitFor([&] { return applied == 1; }));
+    CHECK(lastTier == RefreshRateTier::Low);
+
+    // Plugged back in with recent input, straight back up
+    controller.OnInteraction();
+    controller.OnPowerSourceChanged(FALSE);
+    CHECK(WaitFor([&] { return applied == 2; }));
+    CHECK(lastTier == RefreshRateTier::High);
+
+    // A failed switch is counted and leaves the applied tier alone
+    failing = true;
+    FakeTickCountAdvance(DefaultRefreshRateGovernorSettings.MinDwellMs);
+    controller.OnPowerSourceChanged(TRUE);
+    CHECK(WaitFor([&] {
+        controller.GetStats(&stats);
+        return stats.FailedSwitches != 0;
+    }));
+
+    controller.GetStats(&stats);
+    CHECK_EQUAL(1u, stats.SwitchesDown);
+    CHECK_EQUAL(1u, stats.SwitchesUp);
+    CHECK_EQUAL(2u, applied.load());
+}
+
+BENCHMARK_CASE(GovernorCost)
+{
+    RefreshRateGovernor governor(DefaultRefreshRateGovernorSettings, 0);
+    volatile uint64_t sink = 0;
+    SimulatedSession session{};
+
+    double evaluate = MeasureNanoseconds(100000000, [&](uint64_t i) {
+        governor.OnInteraction(i & ~(uint64_t)0xFFFF);
+        sink = sink + (uint64_t)governor.Evaluate(i) + governor.NextDeadline(i);
+    });
+
+    double day = MeasureNanoseconds(100, [&](uint64_t i) {
+        session = SimulateDay(DefaultRefreshRateGovernorSettings, (uint32_t)i + 1);
+    });
+
+    ReportMeasurement("OnInteraction + Evaluate + NextDeadline", evaluate, "ns");
+    ReportMeasurement("Simulated 8h day", day / 1000.0, "us");
+    ReportMeasurement("Simulated 8h day, switches", (double)session.Switches, "switches");
+    ReportMeasurement("Simulated 8h day, at the low tier", (double)session.LowTierMs / 60000.0, "min");
+}
\ No newline at end of file
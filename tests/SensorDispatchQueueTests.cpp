@@ -0,0 +1,283 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "SensorDispatchQueue.h"
+#include "TestHarness.h"
+
+//
+// A synthetic reading, postures may be coalesced, flips and resyncs may not
+//
+struct FakeSensorEvent
+{
+    char Kind;
+    uint32_t Sequence;
+};
+
+typedef SensorDispatchQueue<FakeSensorEvent, 4> SmallQueue;
+
+static bool
+PushPosture(SmallQueue &Queue, uint32_t Sequence)
+{
+    return Queue.Push(FakeSensorEvent{'P', Sequence}, true);
+}
+
+static bool
+PushFlip(SmallQueue &Queue, uint32_t Sequence)
+{
+    return Queue.Push(FakeSensorEvent{'F', Sequence}, false);
+}
+
+static std::string
+Drain(SmallQueue &Queue)
+{
+    SmallQueue::Entry entry{};
+    std::string order;
+
+    while (Queue.PopFor(entry, 0) == SensorDispatchWait::Reading)
+    {
+        order += entry.Reading.Kind;
+        order += std::to_string(entry.Reading.Sequence);
+        order += ' ';
+    }
+
+    return order;
+}
+
+TEST_CASE(ReadingsComeOutInOrder)
+{
+    SmallQueue queue;
+
+    CHECK(PushPosture(queue, 1));
+    CHECK(PushFlip(queue, 2));
+    CHECK(PushPosture(queue, 3));
+
+    CHECK_EQUAL(std::string("P1 F2 P3 "), Drain(queue));
+    CHECK_EQUAL(3u, queue.GetStats().Pushed);
+    CHECK_EQUAL(3u, queue.GetStats().Dispatched);
+}
+
+TEST_CASE(OverflowCoalescesTheOldestPosture)
+{
+    SmallQueue queue;
+
+    CHECK(PushFlip(queue, 1));
+    CHECK(PushPosture(queue, 2));
+    CHECK(PushFlip(queue, 3));
+    CHECK(PushPosture(queue, 4));
+
+    // The flips stay where they are, the posture behind the first one gives way
+    CHECK(PushPosture(queue, 5));
+    CHECK(PushFlip(queue, 6));
+
+    CHECK_EQUAL(std::string("F1 F3 P5 F6 "), Drain(queue));
+
+    SensorDispatchStats stats = queue.GetStats();
+    CHECK_EQUAL(6u, stats.Pushed);
+    CHECK_EQUAL(2u, stats.Coalesced);
+    CHECK_EQUAL(0u, stats.Rejected);
+}
+
+TEST_CASE(OverflowNeverDropsAFlip)
+{
+    SmallQueue queue;
+
+    for (uint32_t i = 1; i <= 4; i++)
+    {
+        CHECK(PushFlip(queue, i));
+    }
+
+    // Nothing queued may go, whichever kind comes next is turned down
+    CHECK(!PushFlip(queue, 5));
+    CHECK(!PushPosture(queue, 6));
+
+    SensorDispatchStats stats = queue.GetStats();
+    CHECK_EQUAL(4u, stats.Pushed);
+    CHECK_EQUAL(0u, stats.Coalesced);
+    CHECK_EQUAL(2u, stats.Rejected);
+
+    CHECK_EQUAL(std::string("F1 F2 F3 F4 "), Drain(queue));
+
+    // Room again once the worker caught up
+    CHECK(PushFlip(queue, 7));
+    CHECK_EQUAL(std::string("F7 "), Drain(queue));
+}
+
+TEST_CASE(CoalescingWrapsAroundTheRing)
+{
+    SmallQueue queue;
+    SmallQueue::Entry entry{};
+
+    // Moves the head to the middle of the ring
+    CHECK(PushFlip(queue, 1));
+    CHECK(PushFlip(queue, 2));
+    CHECK(queue.PopFor(entry, 0) == SensorDispatchWait::Reading);
+    CHECK(queue.PopFor(entry, 0) == SensorDispatchWait::Reading);
+
+    CHECK(PushFlip(queue, 3));
+    CHECK(PushFlip(queue, 4));
+    CHECK(PushPosture(queue, 5));
+    CHECK(PushFlip(queue, 6));
+    CHECK(PushPosture(queue, 7));
+    CHECK(PushPosture(queue, 8));
+
+    CHECK_EQUAL(std::string("F3 F4 F6 P8 "), Drain(queue));
+    CHECK_EQUAL(2u, queue.GetStats().Coalesced);
+}
+
+TEST_CASE(CloseHandsOutWhatIsQueued)
+{
+    SmallQueue queue;
+    SmallQueue::Entry entry{};
+
+    CHECK(queue.PopFor(entry, 1000) == SensorDispatchWait::Timeout);
+
+    CHECK(PushPosture(queue, 1));
+    queue.Close();
+    CHECK(!PushFlip(queue, 2));
+
+    CHECK(queue.Pop(entry));
+    CHECK_EQUAL(1u, entry.Reading.Sequence);
+    CHECK(!queue.Pop(entry));
+    CHECK(queue.PopFor(entry, 1000) == SensorDispatchWait::Closed);
+
+    // Closed is not an overflow
+    CHECK_EQUAL(0u, queue.GetStats().Rejected);
+}
+
+TEST_CASE(WorkerSeesEveryFlipOfABurst)
+{
+    constexpr uint32_t flips = 2000;
+    SensorDispatchQueue<FakeSensorEvent, 16> queue;
+    std::vector<uint32_t> seen;
+    uint32_t postures = 0;
+
+    std::thread worker{[&] {
+        decltype(queue)::Entry entry{};
+
+        while (queue.Pop(entry))
+        {
+            if (entry.Reading.Kind == 'F')
+            {
+                seen.push_back(entry.Reading.Sequence);
+            }
+            else
+            {
+                postures++;
+            }
+        }
+    }};
+
+    // Ten postures for every flip, far more than the worker keeps up with at times
+    for (uint32_t i = 0; i < flips; i++)
+    {
+        for (uint32_t j = 0; j < 10; j++)
+        {
+            queue.Push(FakeSensorEvent{'P', i * 10 + j}, true);
+        }
+
+        while (!queue.Push(FakeSensorEvent{'F', i}, false))
+        {
+            std::this_thread::yield();
+        }
+    }
+
+    queue.Close();
+    worker.join();
+
+    SensorDispatchStats stats = queue.GetStats();
+
+    CHECK_EQUAL(flips, (uint32_t)seen.size());
+    CHECK(std::is_sorted(seen.begin(), seen.end()));
+    CHECK_EQUAL(stats.Pushed, stats.Dispatched + stats.Coalesced);
+    CHECK_EQUAL(stats.Pushed - flips, (uint64_t)postures + stats.Coalesced);
+}
+
+BENCHMARK_CASE(OverflowAndLatency)
+{
+    SensorDispatchQueue<FakeSensorEvent, 16> queue;
+    decltype(queue)::Entry entry{};
+
+    double push = MeasureNanoseconds(5000000, [&](uint64_t i) {
+        queue.Push(FakeSensorEvent{'P', (uint32_t)i}, true);
+        queue.PopFor(entry, 0);
+    });
+
+    // A full queue of flips with one posture at the front, each push drops the posture and moves 15 flips
+    for (uint32_t i = 0; i < 15; i++)
+    {
+        queue.Push(FakeSensorEvent{'F', i}, false);
+    }
+
+    double coalesce = MeasureNanoseconds(5000000, [&](uint64_t i) {
+        queue.Push(FakeSensorEvent{'P', (uint32_t)i}, true);
+    });
+
+    SensorDispatchQueue<FakeSensorEvent, 16> full;
+    for (uint32_t i = 0; i < 16; i++)
+    {
+        full.Push(FakeSensorEvent{'F', i}, false);
+    }
+
+    double reject = MeasureNanoseconds(5000000, [&](uint64_t i) {
+        full.Push(FakeSensorEvent{'F', (uint32_t)i}, false);
+    });
+
+    ReportMeasurement("Push + PopFor, not full", push, "ns");
+    ReportMeasurement("Push coalescing the oldest posture behind 15 flips", coalesce, "ns");
+    ReportMeasurement("Push rejected, 16 flips queued", reject, "ns");
+
+    // Dispatch latency to a worker that takes 200 us per reading, a burst of 20 readings every 10 ms
+    SensorDispatchQueue<FakeSensorEvent, 16> burst;
+    uint32_t flips = 0;
+    std::thread worker{[&] {
+        decltype(burst)::Entry taken{};
+
+        while (burst.Pop(taken))
+        {
+            flips += taken.Reading.Kind == 'F' ? 1 : 0;
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+        }
+    }};
+
+    for (uint32_t round = 0; round < 50; round++)
+    {
+        for (uint32_t i = 0; i < 20; i++)
+        {
+            burst.Push(FakeSensorEvent{i % 5 == 0 ? 'F' : 'P', i}, i % 5 != 0);
+        }
+
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    }
+
+    burst.Close();
+    worker.join();
+
+    SensorDispatchStats stats = burst.GetStats();
+
+    ReportMeasurement("Burst readings pushed", (double)stats.Pushed, "");
+    ReportMeasurement("Burst flips dispatched, out of 200", (double)flips, "");
+    ReportMeasurement("Burst postures coalesced", (double)stats.Coalesced, "");
+    ReportMeasurement("Burst pushes rejected", (double)stats.Rejected, "");
+    ReportMeasurement(
+        "Burst mean dispatch latency", (double)stats.TotalLatencyMicroseconds / (double)stats.Dispatched, "us");
+    ReportMeasurement("Burst max dispatch latency", (double)stats.MaxLatencyMicroseconds, "us");
+}
\ No newline at end of file
@@ -0,0 +1,278 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "SensorSubscriptionManager.h"
+#include "TestHarness.h"
+
+//
+// Records what the manager did with it, attaches fail while FailAttach is set
+//
+class FakeSensorHandle final : public SensorHandle
+{
+public:
+    bool Attach() override
+    {
+        AttachCalls++;
+
+        if (FailAttach)
+        {
+            return false;
+        }
+
+        Attached = true;
+        return true;
+    }
+
+    void Detach() override
+    {
+        Attached = false;
+        Detaches++;
+    }
+
+    void Resync() override
+    {
+        // Resyncing a sensor which is not subscribed would read a stale state
+        ResyncedWhileDetached |= !Attached;
+        Resyncs++;
+    }
+
+    bool Attached = false;
+    bool FailAttach = false;
+    bool ResyncedWhileDetached = false;
+    uint32_t AttachCalls = 0;
+    uint32_t Detaches = 0;
+    uint32_t Resyncs = 0;
+};
+
+TEST_CASE(StartAndStopAttachAndDetachBoth)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+
+    CHECK(manager.GetMode() == SensorSubscriptionMode::Detached);
+
+    manager.Start(0);
+    CHECK(manager.GetMode() == SensorSubscriptionMode::Full);
+    CHECK(posture.Attached && flip.Attached);
+    CHECK_EQUAL(1u, posture.Resyncs);
+    CHECK_EQUAL(1u, flip.Resyncs);
+
+    manager.Stop(1000);
+    CHECK(manager.GetMode() == SensorSubscriptionMode::Detached);
+    CHECK(!posture.Attached && !flip.Attached);
+
+    SensorSubscriptionStats stats = manager.GetStats(1000);
+    CHECK_EQUAL(2u, stats.Transitions);
+    CHECK_EQUAL(2u, stats.Attaches);
+    CHECK_EQUAL(2u, stats.Detaches);
+    CHECK(!posture.ResyncedWhileDetached && !flip.ResyncedWhileDetached);
+}
+
+TEST_CASE(DimmingKeepsOnlyThePostureSensor)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+
+    manager.Start(0);
+    manager.OnDisplayState(SensorDisplayState::Dimmed, 100);
+
+    CHECK(manager.GetMode() == SensorSubscriptionMode::Reduced);
+    CHECK(posture.Attached && !flip.Attached);
+    CHECK_EQUAL(0u, posture.Detaches);
+
+    // Coming back resyncs the flip sensor alone, the posture sensor never missed a reading
+    manager.OnDisplayState(SensorDisplayState::On, 200);
+    CHECK(flip.Attached);
+    CHECK_EQUAL(1u, posture.Resyncs);
+    CHECK_EQUAL(2u, flip.Resyncs);
+}
+
+TEST_CASE(SuspendAndDisplayOffDetachEverything)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+
+    manager.Start(0);
+
+    manager.OnSuspend(true, 100);
+    CHECK(!posture.Attached && !flip.Attached);
+
+    // The display turning on while suspended changes nothing
+    manager.OnDisplayState(SensorDisplayState::On, 150);
+    CHECK(manager.GetMode() == SensorSubscriptionMode::Detached);
+
+    manager.OnSuspend(false, 200);
+    CHECK(posture.Attached && flip.Attached);
+    CHECK_EQUAL(2u, posture.Resyncs);
+
+    manager.OnDisplayState(SensorDisplayState::Off, 300);
+    CHECK(!posture.Attached && !flip.Attached);
+
+    SensorSubscriptionStats stats = manager.GetStats(300);
+    CHECK_EQUAL(4u, stats.Transitions);
+    CHECK_EQUAL(4u, stats.Attaches);
+    CHECK_EQUAL(4u, stats.Detaches);
+    CHECK_EQUAL(200u, stats.AttachedMilliseconds[(uint32_t)SensorKind::Posture]);
+    CHECK_EQUAL(100u, stats.DetachedMilliseconds[(uint32_t)SensorKind::Posture]);
+}
+
+TEST_CASE(FailedAttachIsRetriedOnTheNextChange)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+
+    flip.FailAttach = true;
+    manager.Start(0);
+
+    CHECK(posture.Attached && !flip.Attached);
+    CHECK_EQUAL(0u, flip.Resyncs);
+
+    // The mode stays full, the change still retries the flip sensor
+    flip.FailAttach = false;
+    manager.OnSuspend(false, 100);
+
+    CHECK(flip.Attached);
+    CHECK_EQUAL(2u, flip.AttachCalls);
+    CHECK_EQUAL(1u, flip.Resyncs);
+    CHECK_EQUAL(1u, posture.AttachCalls);
+    CHECK_EQUAL(1u, manager.GetStats(100).Transitions);
+}
+
+TEST_CASE(WakeupsSavedFollowTheAttachedRate)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+
+    // Time before the service starts does not count
+    manager.OnDisplayState(SensorDisplayState::On, 5000);
+    manager.Start(10000);
+
+    // 10 posture readings a second for 10 seconds, then the display is off for 30 seconds
+    for (uint32_t i = 0; i < 100; i++)
+    {
+        manager.OnEvent(SensorKind::Posture);
+    }
+
+    manager.OnDisplayState(SensorDisplayState::Off, 20000);
+
+    SensorSubscriptionStats stats = manager.GetStats(50000);
+    CHECK_EQUAL(100u, stats.Events[(uint32_t)SensorKind::Posture]);
+    CHECK_EQUAL(0u, stats.Events[(uint32_t)SensorKind::Flip]);
+    CHECK_EQUAL(10000u, stats.AttachedMilliseconds[(uint32_t)SensorKind::Posture]);
+    CHECK_EQUAL(30000u, stats.DetachedMilliseconds[(uint32_t)SensorKind::Flip]);
+    CHECK_EQUAL(300u, stats.EstimatedWakeupsSaved);
+}
+
+TEST_CASE(EventsRaceStateChanges)
+{
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+    std::vector<std::thread> callbacks;
+    constexpr uint32_t events = 200000;
+
+    manager.Start(0);
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        callbacks.emplace_back([&, i] {
+            for (uint32_t j = 0; j < events; j++)
+            {
+                manager.OnEvent(i & 1 ? SensorKind::Flip : SensorKind::Posture);
+            }
+        });
+    }
+
+    for (uint64_t now = 1; now <= 10000; now++)
+    {
+        manager.OnDisplayState(now & 1 ? SensorDisplayState::Dimmed : SensorDisplayState::On, now);
+    }
+
+    for (std::thread &callback : callbacks)
+    {
+        callback.join();
+    }
+
+    SensorSubscriptionStats stats = manager.GetStats(10000);
+    CHECK_EQUAL(2u * events, stats.Events[(uint32_t)SensorKind::Posture]);
+    CHECK_EQUAL(2u * events, stats.Events[(uint32_t)SensorKind::Flip]);
+    CHECK_EQUAL(10001u, stats.Transitions);
+    CHECK_EQUAL(1u, posture.AttachCalls);
+    CHECK(!flip.ResyncedWhileDetached);
+}
+
+BENCHMARK_CASE(SubscriptionDay)
+{
+    static const SensorDisplayState displays[] = {
+        SensorDisplayState::On, SensorDisplayState::Dimmed, SensorDisplayState::Off, SensorDisplayState::On};
+    FakeSensorHandle posture;
+    FakeSensorHandle flip;
+    SensorSubscriptionManager manager(posture, flip);
+    SensorSubscriptionManager bench(posture, flip);
+    uint64_t now = 0;
+
+    bench.Start(0);
+
+    double onEvent = MeasureNanoseconds(10000000, [&](uint64_t i) { bench.OnEvent((SensorKind)(i & 1)); });
+    double change = MeasureNanoseconds(1000000, [&](uint64_t i) {
+        bench.OnDisplayState(i & 1 ? SensorDisplayState::Dimmed : SensorDisplayState::On, i);
+    });
+
+    // A day in 15 minute blocks: screen on, dimmed, off or suspended, with 10 readings a second from whatever
+    // is attached
+    manager.Start(0);
+
+    for (uint32_t block = 0; block < 96; block++)
+    {
+        manager.OnSuspend(block % 8 == 7, now);
+        manager.OnDisplayState(displays[block % 4], now);
+
+        for (uint32_t kind = 0; kind < (uint32_t)SensorKind::Count; kind++)
+        {
+            if (IsSensorAttachedInMode(manager.GetMode(), (SensorKind)kind))
+            {
+                for (uint32_t i = 0; i < 9000; i++)
+                {
+                    manager.OnEvent((SensorKind)kind);
+                }
+            }
+        }
+
+        now += 15 * 60 * 1000;
+    }
+
+    SensorSubscriptionStats stats = manager.GetStats(now);
+    uint64_t attached = stats.AttachedMilliseconds[(uint32_t)SensorKind::Flip];
+    uint64_t delivered = stats.Events[0] + stats.Events[1];
+
+    ReportMeasurement("SensorSubscriptionManager::OnEvent", onEvent, "ns");
+    ReportMeasurement("Display state change, dimmed and back", change, "ns");
+    ReportMeasurement("Flip sensor attached", 100.0 * attached / now, "% of the day");
+    ReportMeasurement("Transitions", (double)stats.Transitions, "per day");
+    ReportMeasurement("Readings delivered", (double)delivered, "per day");
+    ReportMeasurement("Estimated wakeups saved", (double)stats.EstimatedWakeupsSaved, "per day");
+}
\ No newline at end of file
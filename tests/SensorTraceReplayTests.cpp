@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "PostureFilter.h"
+#include "SensorTraceReplay.h"
+#include "SyntheticDeviceTree.h"
+#include "TestHarness.h"
+
+constexpr int32_t DUO_PANEL_WIDTH = 1350;
+constexpr int32_t DUO_PANEL_HEIGHT = 1800;
+
+//
+// Builds a trace the way the service records one, times in milliseconds
+//
+class TraceBuilder
+{
+public:
+    TraceBuilder &Posture(uint64_t TimeMs, HingePosition Position, uint8_t Orientation1, uint8_t Orientation2)
+    {
+        PostureSample sample{Position, Orientation1, Orientation2};
+
+        m_writer.AppendPosture(TimeMs * 1000, u"PANEL1", u"PANEL2", sample);
+        return *this;
+    }
+
+    TraceBuilder &Flip(uint64_t TimeMs)
+    {
+        m_writer.AppendFlip(TimeMs * 1000, SENSOR_TRACE_GESTURE_STARTED);
+        return *this;
+    }
+
+    SensorReplayResult Replay() const
+    {
+        const std::vector<uint8_t> &trace = m_writer.GetBuffer();
+        return ReplaySensorTrace(trace.data(), trace.size(), DUO_PANEL_WIDTH, DUO_PANEL_HEIGHT);
+    }
+
+    const std::vector<uint8_t> &GetBuffer() const
+    {
+        return m_writer.GetBuffer();
+    }
+
+private:
+    SensorTraceWriter m_writer;
+};
+
+TEST_CASE(LateReadingAppliesThePendingPostureFirst)
+{
+    PostureFilter filter(DefaultPostureFilterSettings);
+
+    CHECK(filter.Observe({HingePosition::Flat, 0, 0}, 0));
+
+    // Folded back, confirmed at 1400 unless another reading comes in before
+    CHECK(!filter.Observe({HingePosition::Full, 0, 0}, 1000));
+    CHECK_EQUAL(1400u, filter.NextDeadline());
+
+    // The worker was busy past the deadline, the next reading is already a rotation
+    CHECK(filter.Observe({HingePosition::Full, 1, 1}, 2000));
+    CHECK(filter.GetCurrent() == (PostureSample{HingePosition::Full, 0, 0}));
+
+    // The rotation is pending in turn, and nothing was suppressed
+    CHECK_EQUAL(2250u, filter.NextDeadline());
+    CHECK_EQUAL(0u, filter.GetStats().Suppressed);
+    CHECK(filter.Poll(2250));
+    CHECK(filter.GetCurrent() == (PostureSample{HingePosition::Full, 1, 1}));
+    CHECK_EQUAL(3u, filter.GetStats().Applied);
+}
+
+TEST_CASE(ReadingsBeforeTheDeadlineStillSuppress)
+{
+    PostureFilter filter(DefaultPostureFilterSettings);
+
+    filter.Observe({HingePosition::Flat, 0, 0}, 0);
+    filter.Observe({HingePosition::Convex, 0, 0}, 1000);
+
+    // Back to flat before confirming, convex never applies
+    CHECK(!filter.Observe({HingePosition::Flat, 0, 0}, 1100));
+    CHECK_EQUAL(POSTURE_FILTER_NO_DEADLINE, filter.NextDeadline());
+    CHECK_EQUAL(1u, filter.GetStats().Suppressed);
+    CHECK_EQUAL(1u, filter.GetStats().Applied);
+
+    // Coming back late to the applied posture applies the pending one on the way
+    filter.Observe({HingePosition::Convex, 0, 0}, 2000);
+    CHECK(filter.Observe({HingePosition::Flat, 0, 0}, 5000));
+    CHECK(filter.GetCurrent().Position == HingePosition::Convex);
+    CHECK_EQUAL(5250u, filter.NextDeadline());
+}
+
+TEST_CASE(JitteryFoldBackAppliesThreePostures)
+{
+    CHECK_EQUAL(3u, ReplayPostureTrace(JitteryFoldBackTrace, ARRAYSIZE(JitteryFoldBackTrace)));
+
+    // Without the poll ahead of each reading, the readings coming in past a deadline now apply it themselves
+    PostureFilter filter(DefaultPostureFilterSettings);
+
+    for (const TimedPostureSample &reading : JitteryFoldBackTrace)
+    {
+        filter.Observe(reading.Sample, reading.Time);
+    }
+
+    filter.Poll(POSTURE_FILTER_NO_DEADLINE - 1);
+    CHECK_EQUAL(3u, filter.GetStats().Applied);
+}
+
+TEST_CASE(TraceRoundTrips)
+{
+    TraceBuilder builder;
+    SensorTraceEvent event{};
+
+    builder.Posture(0, HingePosition::Flat, 0, 0)
+        .Flip(500)
+        .Posture(1000, HingePosition::Full, 1, POSTURE_ORIENTATION_UNKNOWN);
+
+    const std::vector<uint8_t> &trace = builder.GetBuffer();
+    SensorTraceReader reader(trace.data(), trace.size());
+
+    CHECK(reader.Next(event) && event.Kind == SensorTraceEventKind::Posture && event.TimeMicroseconds == 0);
+    CHECK(reader.Next(event) && event.Kind == SensorTraceEventKind::Flip && event.TimeMicroseconds == 500000);
+    CHECK(reader.Next(event) && event.Kind == SensorTraceEventKind::Posture);
+    CHECK(event.Posture == (PostureSample{HingePosition::Full, 1, POSTURE_ORIENTATION_UNKNOWN}));
+    CHECK(event.Panel1 == 0 && event.Panel2 == 1);
+    CHECK(!reader.Next(event));
+    CHECK(reader.IsValid());
+    CHECK_EQUAL(2u, reader.GetPanelIds().size());
+
+    // Cut in the middle of an event
+    SensorTraceReader truncated(trace.data(), trace.size() - 1);
+    while (truncated.Next(event))
+    {
+    }
+
+    CHECK(!truncated.IsValid());
+}
+
+TEST_CASE(ReplayFoldsBackAndFlips)
+{
+    SensorReplayResult result = TraceBuilder()
+                                    .Posture(0, HingePosition::Flat, 0, 0)
+                                    .Posture(1000, HingePosition::Convex, 0, 0)
+                                    .Posture(1100, HingePosition::Full, 0, 0)
+                                    .Posture(1150, HingePosition::Convex, 0, 0)
+                                    .Posture(1200, HingePosition::Full, 0, 0)
+                                    .Flip(3000)
+                                    .Posture(4000, HingePosition::Flat, 0, 0)
+                                    .Flip(5000)
+                                    .Replay();
+
+    CHECK(result.Valid);
+    CHECK_EQUAL(8u, result.Events);
+
+    // Flat, full from the reading at 1200, the flip swapping panels, flat again. The flip on flat only picks
+    // the favorite screen.
+    CHECK_EQUAL(4u, (uint32_t)result.Decisions.size());
+    CHECK_EQUAL(1u, result.FlipSwaps);
+
+    if (result.Decisions.size() == 4)
+    {
+        CHECK_EQUAL(4u, result.Decisions[1].EventIndex);
+        CHECK_EQUAL(400000u, result.Decisions[1].LatencyMicroseconds);
+        CHECK_EQUAL(5u, result.Decisions[2].EventIndex);
+        CHECK_EQUAL(0u, result.Decisions[2].LatencyMicroseconds);
+    }
+
+    CHECK(result.FinalLayout[0].Active && result.FinalLayout[1].Active);
+}
+
+TEST_CASE(FlipWhileFoldedBackIsPrestaged)
+{
+    SensorReplayResult result = TraceBuilder()
+                                    .Posture(0, HingePosition::Flat, 0, 0)
+                                    .Posture(1000, HingePosition::Full, 0, 0)
+                                    .Flip(3000)
+                                    .Flip(4000)
+                                    .Posture(5000, HingePosition::Convex, 0, 0)
+                                    .Replay();
+
+    CHECK(result.Valid);
+    CHECK_EQUAL(2u, result.FlipSwaps);
+    CHECK_EQUAL(5u, (uint32_t)result.Decisions.size());
+
+    // Folded back, the unfold is expected as well as a flip. Both flips and the unfold find their transition
+    // staged, the flips no longer lose the slot to the hinge prediction.
+    if (result.Decisions.size() == 5)
+    {
+        CHECK(!result.Decisions[0].Prestaged);
+        CHECK(!result.Decisions[1].Prestaged);
+        CHECK(result.Decisions[2].Prestaged);
+        CHECK(result.Decisions[3].Prestaged);
+        CHECK(result.Decisions[4].Prestaged);
+    }
+
+    CHECK_EQUAL(3u, result.PrestageHits);
+}
+
+TEST_CASE(CorruptTraceIsRejected)
+{
+    TraceBuilder builder;
+    builder.Posture(0, HingePosition::Flat, 0, 0);
+
+    std::vector<uint8_t> trace = builder.GetBuffer();
+    trace[0] = 'X';
+
+    SensorReplayResult result = ReplaySensorTrace(trace.data(), trace.size(), DUO_PANEL_WIDTH, DUO_PANEL_HEIGHT);
+
+    CHECK(!result.Valid);
+    CHECK_EQUAL(0u, result.Events);
+}
+
+BENCHMARK_CASE(ReplayThroughput)
+{
+    SyntheticRandom random(0x5EED);
+    TraceBuilder builder;
+    PostureFilter filter(DefaultPostureFilterSettings);
+    volatile uint32_t sink = 0;
+    uint64_t time = 0;
+    constexpr uint32_t events = 100000;
+    static const HingePosition positions[] = {
+        HingePosition::Flat, HingePosition::Concave, HingePosition::Convex, HingePosition::Full};
+
+    // Sensor chatter every few tens of milliseconds, a flip now and then
+    for (uint32_t i = 0; i < events; i++)
+    {
+        time += random.Next() % 100;
+
+        if (random.Next() % 50 == 0)
+        {
+            builder.Flip(time);
+        }
+        else
+        {
+            uint8_t orientation = (uint8_t)(random.Next() % 4);
+            builder.Posture(time, positions[random.Next() % 4], orientation, orientation);
+        }
+    }
+
+    double observe = MeasureNanoseconds(10000000, [&](uint64_t i) {
+        sink = sink + filter.Observe({positions[(i >> 3) & 3], (uint8_t)(i & 3), (uint8_t)(i & 3)}, i * 20);
+    });
+
+    SensorReplayResult result{};
+    double replay = MeasureNanoseconds(10, [&](uint64_t) { result = builder.Replay(); });
+
+    ReportMeasurement("PostureFilter::Observe", observe, "ns");
+    ReportMeasurement("ReplaySensorTrace, per event", replay / events, "ns");
+    ReportMeasurement("Trace size, per event", (double)builder.GetBuffer().size() / events, "bytes");
+    ReportMeasurement("Display transitions", 1000.0 * result.Decisions.size() / events, "per 1000 events");
+
+    // A session of reading folded back: unfold to flat, fold back, flip a few times, and over again
+    TraceBuilder session;
+    uint64_t cycleStart = 0;
+
+    for (uint32_t cycle = 0; cycle < 1000; cycle++, cycleStart += 20000)
+    {
+        session.Posture(cycleStart, HingePosition::Flat, 0, 0)
+            .Posture(cycleStart + 2000, HingePosition::Convex, 0, 0)
+            .Posture(cycleStart + 4000, HingePosition::Full, 0, 0)
+            .Flip(cycleStart + 8000)
+            .Flip(cycleStart + 12000)
+            .Flip(cycleStart + 14000)
+            .Posture(cycleStart + 16000, HingePosition::Convex, 0, 0);
+    }
+
+    SensorReplayResult sessionResult = session.Replay();
+
+    ReportMeasurement("Session transitions", (double)sessionResult.Decisions.size(), "");
+    ReportMeasurement(
+        "Session transitions found prestaged",
+        100.0 * sessionResult.PrestageHits / sessionResult.Decisions.size(),
+        "%");
+}
\ No newline at end of file
@@ -0,0 +1,245 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "SettingsCache.h"
+#include "TestHarness.h"
+
+//
+// An in-memory registry, counting the reads that would be registry I/O on the device
+//
+class FakeSettingsStore final : public SettingsStore
+{
+public:
+    bool ReadDword(const SettingsKeyDescriptor &Key, const wchar_t *ValueName, uint32_t &Value) override
+    {
+        std::lock_guard lock{m_lock};
+        auto value = m_values.find(MakeName(Key, ValueName));
+
+        m_reads++;
+
+        if (value == m_values.end())
+        {
+            return false;
+        }
+
+        Value = value->second;
+        return true;
+    }
+
+    void Write(SettingId Id, uint32_t Value)
+    {
+        const SettingDescriptor &setting = SETTINGS[(uint32_t)Id];
+
+        std::lock_guard lock{m_lock};
+        m_values[MakeName(SETTINGS_KEYS[(uint32_t)setting.Key], setting.ValueName)] = Value;
+    }
+
+    void Delete(SettingId Id)
+    {
+        const SettingDescriptor &setting = SETTINGS[(uint32_t)Id];
+
+        std::lock_guard lock{m_lock};
+        m_values.erase(MakeName(SETTINGS_KEYS[(uint32_t)setting.Key], setting.ValueName));
+    }
+
+    uint64_t GetReads()
+    {
+        std::lock_guard lock{m_lock};
+        return m_reads;
+    }
+
+private:
+    static std::wstring MakeName(const SettingsKeyDescriptor &Key, const wchar_t *ValueName)
+    {
+        return std::to_wstring((uint32_t)Key.Hive) + L"\\" + Key.Path + L"\\" + ValueName;
+    }
+
+    std::mutex m_lock;
+    std::map<std::wstring, uint32_t> m_values;
+    uint64_t m_reads = 0;
+};
+
+struct SettingChange
+{
+    SettingId Id;
+    uint32_t Value;
+};
+
+TEST_CASE(DefaultsStandInForMissingValues)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+
+    // Nothing read yet
+    CHECK_EQUAL(1u, cache.Get(SettingId::AutoRotationEnable));
+    CHECK_EQUAL(0u, cache.Get(SettingId::OOBEInProgress));
+    CHECK_EQUAL(SETTING_MISSING, cache.Get(SettingId::TabletPostureTaskbar));
+    CHECK_EQUAL(0u, store.GetReads());
+
+    cache.RefreshAll();
+
+    CHECK_EQUAL(1u, cache.Get(SettingId::AutoRotationEnable));
+    CHECK_EQUAL(SETTING_MISSING, cache.Get(SettingId::TabletPostureTaskbar));
+    CHECK_EQUAL((uint64_t)SettingId::Count, store.GetReads());
+    CHECK_EQUAL(0u, cache.GetStats().Changes);
+}
+
+TEST_CASE(LookupsNeverReachTheStore)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+    uint64_t sum = 0;
+
+    store.Write(SettingId::OOBEInProgress, 1);
+    cache.RefreshAll();
+
+    uint64_t reads = store.GetReads();
+
+    for (uint32_t i = 0; i < 1000000; i++)
+    {
+        sum += cache.Get((SettingId)(i % (uint32_t)SettingId::Count));
+    }
+
+    CHECK(sum > 0);
+    CHECK_EQUAL(reads, store.GetReads());
+    CHECK_EQUAL(reads, cache.GetStats().StoreReads);
+    CHECK_EQUAL(1000000u, cache.GetStats().Lookups);
+}
+
+TEST_CASE(RefreshRereadsOnlyTheKeyWhichChanged)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+    std::vector<SettingChange> changes;
+
+    cache.SetChangedCallback([&](SettingId Id, uint32_t Value) { changes.push_back({Id, Value}); });
+    cache.RefreshAll();
+
+    uint64_t reads = store.GetReads();
+
+    // The rotation lock turned on, and setup changed behind the cache's back
+    store.Write(SettingId::AutoRotationEnable, 0);
+    store.Write(SettingId::OOBEInProgress, 1);
+    cache.RefreshKey(SettingsKeyId::AutoRotation);
+
+    CHECK_EQUAL(reads + 1, store.GetReads());
+    CHECK_EQUAL(1u, changes.size());
+    CHECK(changes[0].Id == SettingId::AutoRotationEnable && changes[0].Value == 0);
+    CHECK_EQUAL(0u, cache.Get(SettingId::AutoRotationEnable));
+    CHECK_EQUAL(0u, cache.Get(SettingId::OOBEInProgress));
+
+    // Refreshing again without a change reports nothing
+    cache.RefreshKey(SettingsKeyId::AutoRotation);
+    CHECK_EQUAL(1u, changes.size());
+
+    // A deleted value goes back to its default
+    store.Delete(SettingId::AutoRotationEnable);
+    cache.RefreshKey(SettingsKeyId::AutoRotation);
+    CHECK_EQUAL(2u, changes.size());
+    CHECK_EQUAL(1u, cache.Get(SettingId::AutoRotationEnable));
+    CHECK_EQUAL(2u, cache.GetStats().Changes);
+    CHECK_EQUAL(3u + (uint64_t)SettingsKeyId::Count, cache.GetStats().Refreshes);
+}
+
+TEST_CASE(OwnWritesDoNotReportAChange)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+    uint32_t changes = 0;
+
+    cache.SetChangedCallback([&](SettingId, uint32_t) { changes++; });
+    cache.RefreshAll();
+
+    // The service writes the taskbar value, records it, then gets the notification for its own write
+    store.Write(SettingId::TabletPostureTaskbar, 1);
+    cache.Set(SettingId::TabletPostureTaskbar, 1);
+    CHECK_EQUAL(1u, cache.Get(SettingId::TabletPostureTaskbar));
+
+    cache.RefreshKey(SettingsKeyId::Explorer);
+    CHECK_EQUAL(0u, changes);
+    CHECK_EQUAL(1u, cache.Get(SettingId::TabletPostureTaskbar));
+}
+
+TEST_CASE(ReadersSeeOnlyWrittenValues)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> unexpected{0};
+    std::vector<std::thread> readers;
+
+    cache.RefreshAll();
+
+    for (uint32_t i = 0; i < 4; i++)
+    {
+        readers.emplace_back([&] {
+            while (!done.load())
+            {
+                uint32_t value = cache.Get(SettingId::OOBEInProgress);
+
+                if (value > 1)
+                {
+                    unexpected++;
+                }
+            }
+        });
+    }
+
+    for (uint32_t i = 0; i < 100000; i++)
+    {
+        store.Write(SettingId::OOBEInProgress, i & 1);
+        cache.RefreshKey(SettingsKeyId::Setup);
+    }
+
+    done = true;
+
+    for (std::thread &reader : readers)
+    {
+        reader.join();
+    }
+
+    CHECK_EQUAL(0u, unexpected.load());
+    CHECK_EQUAL(99999u, cache.GetStats().Changes);
+}
+
+BENCHMARK_CASE(SettingLookups)
+{
+    FakeSettingsStore store;
+    SettingsCache cache(store);
+    volatile uint32_t sink = 0;
+
+    store.Write(SettingId::OOBEInProgress, 0);
+    cache.RefreshAll();
+
+    double lookup =
+        MeasureNanoseconds(100000000, [&](uint64_t) { sink = sink + cache.Get(SettingId::OOBEInProgress); });
+    double storeRead = MeasureNanoseconds(1000000, [&](uint64_t) {
+        uint32_t value = 0;
+        store.ReadDword(SETTINGS_KEYS[(uint32_t)SettingsKeyId::Setup], L"OOBEInProgress", value);
+        sink = sink + value;
+    });
+    double refresh = MeasureNanoseconds(1000000, [&](uint64_t) { cache.RefreshKey(SettingsKeyId::Setup); });
+
+    ReportMeasurement("SettingsCache::Get", lookup, "ns");
+    ReportMeasurement("In-memory store read", storeRead, "ns");
+    ReportMeasurement("SettingsCache::RefreshKey", refresh, "ns");
+}
\ No newline at end of file
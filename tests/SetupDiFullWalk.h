@@ -0,0 +1,163 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The SetupDi walks the display code did before the device inventory existed, kept as the baseline the
+// inventory and the device state transactions are measured against
+//
+
+#include "pch.h"
+#include <SetupAPI.h>
+#include <Devpkey.h>
+#include "DeviceProperties.h"
+#include <cwchar>
+
+inline std::vector<BYTE>
+GetPropertyWithProbe(HDEVINFO devInfo, PSP_DEVINFO_DATA devData, CONST DEVPROPKEY *propertyKey)
+{
+    DEVPROPTYPE devProptype;
+    DWORD dwBuffersize = 0;
+    std::vector<BYTE> buffer;
+
+    SetupDiGetDeviceProperty(devInfo, devData, propertyKey, &devProptype, NULL, 0, &dwBuffersize, 0);
+    buffer.resize(dwBuffersize);
+
+    if (dwBuffersize == 0 ||
+        !SetupDiGetDeviceProperty(devInfo, devData, propertyKey, &devProptype, buffer.data(), dwBuffersize, NULL, 0))
+    {
+        buffer.clear();
+    }
+
+    return buffer;
+}
+
+//
+// What a lookup cost before the inventory existed: every devnode on the system is walked, with a size probe and
+// a fetch of its hardware ids, and the driver key and the panel id are read for the devnode which matches
+//
+inline BOOLEAN
+FullWalkIsDeviceBoundToPanelId(CONST WCHAR *DeviceId, CONST WCHAR *DevicePanelId)
+{
+    HDEVINFO devInfo;
+    SP_DEVINFO_DATA devData{};
+    BOOLEAN bound = FALSE;
+    std::wstring deviceId = DeviceId;
+
+    if ((devInfo = SetupDiGetClassDevs(NULL, NULL, NULL, DIGCF_ALLCLASSES)) == INVALID_HANDLE_VALUE)
+    {
+        return FALSE;
+    }
+
+    devData.cbSize = sizeof(SP_DEVINFO_DATA);
+
+    for (DWORD i = 0; SetupDiEnumDeviceInfo(devInfo, i, &devData); i++)
+    {
+        std::vector<BYTE> hardwareIds = GetPropertyWithProbe(devInfo, &devData, &DEVPKEY_Device_HardwareIds);
+        LPCWSTR matched = nullptr;
+
+        for (LPCWSTR hardwareId = (LPCWSTR)hardwareIds.data(); !hardwareIds.empty() && *hardwareId;
+             hardwareId += wcslen(hardwareId) + 1)
+        {
+            if (deviceId.compare(0, wcslen(hardwareId), hardwareId) == 0)
+            {
+                matched = hardwareId;
+                break;
+            }
+        }
+
+        if (matched == nullptr)
+        {
+            continue;
+        }
+
+        std::vector<BYTE> driverKey = GetPropertyWithProbe(devInfo, &devData, &DEVPKEY_Device_Driver);
+        if (driverKey.empty() || deviceId.substr(wcslen(matched) + 1) != (LPCWSTR)driverKey.data())
+        {
+            continue;
+        }
+
+        std::vector<BYTE> panelId = GetPropertyWithProbe(devInfo, &devData, &DEVPKEY_Device_PanelId);
+        bound = !panelId.empty() && lstrcmp((LPCWSTR)panelId.data(), DevicePanelId) == 0;
+        break;
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+    return bound;
+}
+
+//
+// What toggling one panel device cost before the transactions: every devnode is walked and its hardware ids
+// are fetched, the panel id is read for the devnodes which match, and the matches change state one by one
+//
+inline HRESULT
+FullWalkSetHardwareEnabledStateForPanel(CONST WCHAR *DevicePanelId, CONST WCHAR *DeviceHardwareId, BOOLEAN Enable)
+{
+    HDEVINFO devInfo;
+    SP_DEVINFO_DATA devData{};
+    SP_PROPCHANGE_PARAMS pcParams{};
+    HRESULT Status = ERROR_SUCCESS;
+
+    if ((devInfo = SetupDiGetClassDevs(NULL, NULL, NULL, DIGCF_ALLCLASSES)) == INVALID_HANDLE_VALUE)
+    {
+        return HRESULT_FROM_WIN32(GetLastError());
+    }
+
+    devData.cbSize = sizeof(SP_DEVINFO_DATA);
+    pcParams.ClassInstallHeader.cbSize = sizeof(SP_CLASSINSTALL_HEADER);
+    pcParams.ClassInstallHeader.InstallFunction = DIF_PROPERTYCHANGE;
+    pcParams.Scope = DICS_FLAG_GLOBAL;
+    pcParams.StateChange = Enable ? DICS_ENABLE : DICS_DISABLE;
+
+    for (DWORD i = 0; SetupDiEnumDeviceInfo(devInfo, i, &devData); i++)
+    {
+        std::vector<BYTE> hardwareIds = GetPropertyWithProbe(devInfo, &devData, &DEVPKEY_Device_HardwareIds);
+        BOOLEAN match = FALSE;
+
+        for (LPCWSTR hardwareId = (LPCWSTR)hardwareIds.data(); !hardwareIds.empty() && *hardwareId && !match;
+             hardwareId += wcslen(hardwareId) + 1)
+        {
+            match = lstrcmp(hardwareId, DeviceHardwareId) == 0;
+        }
+
+        if (!match)
+        {
+            continue;
+        }
+
+        std::vector<BYTE> panelId = GetPropertyWithProbe(devInfo, &devData, &DEVPKEY_Device_PanelId);
+        if (panelId.empty() || lstrcmp((LPCWSTR)panelId.data(), DevicePanelId) != 0)
+        {
+            continue;
+        }
+
+        if (!SetupDiSetClassInstallParams(
+                devInfo, &devData, (PSP_CLASSINSTALL_HEADER)&pcParams, sizeof(SP_PROPCHANGE_PARAMS)) ||
+            !SetupDiChangeState(devInfo, &devData))
+        {
+            Status = HRESULT_FROM_WIN32(GetLastError());
+        }
+    }
+
+    SetupDiDestroyDeviceInfoList(devInfo);
+    return Status;
+}
\ No newline at end of file
@@ -0,0 +1,204 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeFileSystem.h"
+#include "SpanTracer.h"
+#include "TestHarness.h"
+
+#define SPAN_TRACE_PATH L"C:\\Users\\Test\\AppData\\Local\\SurfaceDisplayConfiguratorService\\DisplayTransitions.json"
+
+constexpr uint32_t SPAN_WRITER_THREADS = 4;
+
+static size_t
+CountOccurrences(const std::string &Text, const std::string &Pattern)
+{
+    size_t count = 0;
+
+    for (size_t position = Text.find(Pattern); position != std::string::npos;
+         position = Text.find(Pattern, position + Pattern.size()))
+    {
+        count++;
+    }
+
+    return count;
+}
+
+static size_t
+CountSpans(const std::string &Json)
+{
+    return CountOccurrences(Json, "\"ph\":\"X\"");
+}
+
+static bool
+IsWellFormedTrace(const std::string &Json)
+{
+    const std::string prefix = "{\"traceEvents\":[";
+    const std::string suffix = "]}";
+
+    return Json.compare(0, prefix.size(), prefix) == 0 &&
+           Json.compare(Json.size() - suffix.size(), suffix.size(), suffix) == 0 &&
+           CountOccurrences(Json, "{") == CountOccurrences(Json, "}");
+}
+
+TEST_CASE(ExportListsTheRecordedSpans)
+{
+    std::unique_ptr<SpanTracer> tracer = std::make_unique<SpanTracer>();
+
+    CHECK_EQUAL(std::string("{\"traceEvents\":[]}"), tracer->ExportChromeTrace());
+
+    tracer->Record("Lookup", 100, 150);
+    uint64_t end = tracer->EndPhase("Plan", 150);
+
+    std::string json = tracer->ExportChromeTrace();
+
+    CHECK(IsWellFormedTrace(json));
+    CHECK_EQUAL(2u, CountSpans(json));
+    CHECK(json.find("{\"name\":\"Lookup\",\"ph\":\"X\",\"pid\":1,") != std::string::npos);
+    CHECK(json.find("\"ts\":100,\"dur\":50}") != std::string::npos);
+    CHECK(json.find("\"name\":\"Plan\"") > json.find("\"name\":\"Lookup\""));
+    CHECK(end >= 150);
+}
+
+TEST_CASE(RingKeepsTheNewestSpans)
+{
+    std::unique_ptr<SpanTracer> tracer = std::make_unique<SpanTracer>();
+
+    for (uint64_t i = 0; i < SPAN_TRACER_CAPACITY + 1000; i++)
+    {
+        tracer->Record("Span", i, i + 1);
+    }
+
+    std::string json = tracer->ExportChromeTrace();
+
+    CHECK_EQUAL((size_t)SPAN_TRACER_CAPACITY, CountSpans(json));
+    CHECK(json.find("\"ts\":999,") == std::string::npos);
+    CHECK(json.find("\"ts\":1000,") < json.find("\"ts\":1001,"));
+    CHECK(json.find("\"ts\":3047,") != std::string::npos);
+}
+
+TEST_CASE(ConcurrentWritersNeverTearASpan)
+{
+    std::unique_ptr<SpanTracer> tracer = std::make_unique<SpanTracer>();
+    std::atomic<bool> done{false};
+    std::vector<std::thread> writers;
+    size_t exports = 0;
+    size_t malformed = 0;
+    size_t torn = 0;
+
+    // Every span lasts 7us, a slot mixing two writes would show another duration
+    for (uint32_t thread = 0; thread < SPAN_WRITER_THREADS; thread++)
+    {
+        writers.emplace_back([&, thread]() {
+            for (uint64_t i = 0; i < 1000000; i++)
+            {
+                uint64_t start = i * SPAN_WRITER_THREADS + thread;
+                tracer->Record("Span", start, start + 7);
+            }
+        });
+    }
+
+    std::thread reader([&]() {
+        while (!done.load())
+        {
+            std::string json = tracer->ExportChromeTrace();
+            size_t spans = CountSpans(json);
+
+            exports++;
+            malformed += !IsWellFormedTrace(json) || spans > SPAN_TRACER_CAPACITY;
+            torn += spans - CountOccurrences(json, "\"dur\":7}");
+        }
+    });
+
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+
+    done = true;
+    reader.join();
+
+    std::string json = tracer->ExportChromeTrace();
+
+    std::printf("    %zu exports while writing\n", exports);
+    CHECK(exports > 0);
+    CHECK_EQUAL(0u, malformed);
+    CHECK_EQUAL(0u, torn);
+    CHECK_EQUAL((size_t)SPAN_TRACER_CAPACITY, CountSpans(json));
+    CHECK_EQUAL((size_t)SPAN_TRACER_CAPACITY, CountOccurrences(json, "\"dur\":7}"));
+}
+
+TEST_CASE(WriteSpanTraceStoresTheExport)
+{
+    FakeFileSystemReset();
+
+    SpanTracer::instance().Record("SetDisplayStates", 10, 40);
+
+    CHECK_EQUAL(ERROR_SUCCESS, WriteSpanTrace(L"DisplayTransitions.json"));
+    CHECK_EQUAL(1u, FakeFileSystemGetFiles().count(SPAN_TRACE_PATH));
+
+    const std::vector<BYTE> &bytes = FakeFileSystemGetFiles()[SPAN_TRACE_PATH];
+    std::string json(bytes.begin(), bytes.end());
+
+    CHECK_EQUAL(SpanTracer::instance().ExportChromeTrace(), json);
+    CHECK(json.find("\"name\":\"SetDisplayStates\"") != std::string::npos);
+}
+
+BENCHMARK_CASE(SpanOverhead)
+{
+    std::unique_ptr<SpanTracer> tracer = std::make_unique<SpanTracer>();
+    std::vector<std::thread> writers;
+    volatile uint64_t sink = 0;
+
+    double now = MeasureNanoseconds(10000000, [&](uint64_t) { sink = sink + SpanTracer::Now(); });
+    double record = MeasureNanoseconds(10000000, [&](uint64_t i) { tracer->Record("Span", i, i + 1); });
+    double endPhase = MeasureNanoseconds(10000000, [&](uint64_t i) { sink = sink + tracer->EndPhase("Span", i); });
+
+    // Writers on every thread share the ring index
+    auto start = std::chrono::steady_clock::now();
+    for (uint32_t thread = 0; thread < SPAN_WRITER_THREADS; thread++)
+    {
+        writers.emplace_back([&]() {
+            for (uint64_t i = 0; i < 2500000; i++)
+            {
+                tracer->Record("Span", i, i + 1);
+            }
+        });
+    }
+
+    for (std::thread &writer : writers)
+    {
+        writer.join();
+    }
+
+    double contended = (double)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           std::chrono::steady_clock::now() - start)
+                           .count() /
+                       (2500000.0 * SPAN_WRITER_THREADS);
+
+    double exportFull = MeasureNanoseconds(1000, [&](uint64_t) { sink = sink + tracer->ExportChromeTrace().size(); });
+
+    ReportMeasurement("SpanTracer::Now", now, "ns");
+    ReportMeasurement("Record", record, "ns");
+    ReportMeasurement("EndPhase", endPhase, "ns");
+    ReportMeasurement("Record, 4 threads, wall time per span", contended, "ns");
+    ReportMeasurement("ExportChromeTrace, full ring", exportFull / 1000.0, "us");
+}
\ No newline at end of file
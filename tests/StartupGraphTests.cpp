@@ -0,0 +1,195 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "StartupGraph.h"
+#include "TestHarness.h"
+
+//
+// A step which sleeps like a blocking startup call would
+//
+static std::function<bool()>
+SleepingStep(uint32_t Milliseconds, bool Succeeds = true)
+{
+    return [Milliseconds, Succeeds] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(Milliseconds));
+        return Succeeds;
+    };
+}
+
+static bool
+Overlap(const StartupStepTiming &First, const StartupStepTiming &Second)
+{
+    return First.StartMicroseconds < Second.EndMicroseconds && Second.StartMicroseconds < First.EndMicroseconds;
+}
+
+TEST_CASE(IndependentStepsOverlap)
+{
+    StartupGraph graph;
+
+    StartupGraph::StepId first = graph.Add("First", {}, SleepingStep(100));
+    StartupGraph::StepId second = graph.Add("Second", {}, SleepingStep(100));
+
+    uint64_t start = StartupGraph::SteadyNow();
+    CHECK(graph.Run(2));
+    uint64_t elapsed = StartupGraph::SteadyNow() - start;
+
+    std::vector<StartupStepTiming> timeline = graph.GetTimeline();
+
+    CHECK(Overlap(timeline[first], timeline[second]));
+    CHECK(timeline[first].Worker != timeline[second].Worker);
+    CHECK(elapsed < 180000);
+}
+
+TEST_CASE(StepsWaitForTheirDependencies)
+{
+    StartupGraph graph;
+    std::atomic<uint32_t> order{0};
+    uint32_t inventorySeen = 0;
+    uint32_t sensorsSeen = 0;
+
+    StartupGraph::StepId inventory = graph.Add("Inventory", {}, [&] {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        inventorySeen = ++order;
+        return true;
+    });
+    StartupGraph::StepId sensor = graph.Add("Sensor", {}, SleepingStep(5));
+    StartupGraph::StepId sensors = graph.Add("Sensors", {inventory, sensor}, [&] {
+        sensorsSeen = ++order;
+        return true;
+    });
+
+    CHECK(graph.Run(4));
+
+    std::vector<StartupStepTiming> timeline = graph.GetTimeline();
+
+    CHECK(inventorySeen < sensorsSeen);
+    CHECK(timeline[sensors].StartMicroseconds >= timeline[inventory].EndMicroseconds);
+    CHECK(timeline[sensors].StartMicroseconds >= timeline[sensor].EndMicroseconds);
+    CHECK(graph.GetStatus(sensors) == StartupStepStatus::Succeeded);
+}
+
+TEST_CASE(FailureSkipsEveryStepDependingOnIt)
+{
+    StartupGraph graph;
+    bool ranDependent = false;
+    bool ranIndependent = false;
+
+    StartupGraph::StepId sensor = graph.Add("Sensor", {}, SleepingStep(1, false));
+    StartupGraph::StepId throwing = graph.Add("Throwing", {}, []() -> bool { throw std::runtime_error("failed"); });
+    StartupGraph::StepId sensors = graph.Add("Sensors", {sensor}, [&] { return ranDependent = true; });
+    StartupGraph::StepId after = graph.Add("After", {sensors, throwing}, [&] { return ranDependent = true; });
+    StartupGraph::StepId independent = graph.Add("Independent", {}, [&] { return ranIndependent = true; });
+
+    CHECK(!graph.Run(3));
+
+    CHECK(graph.GetStatus(sensor) == StartupStepStatus::Failed);
+    CHECK(graph.GetStatus(throwing) == StartupStepStatus::Failed);
+    CHECK(graph.GetStatus(sensors) == StartupStepStatus::Skipped);
+    CHECK(graph.GetStatus(after) == StartupStepStatus::Skipped);
+    CHECK(graph.GetStatus(independent) == StartupStepStatus::Succeeded);
+    CHECK(!ranDependent);
+    CHECK(ranIndependent);
+}
+
+TEST_CASE(OneWorkerRunsInOrder)
+{
+    StartupGraph graph;
+    std::vector<uint32_t> order;
+
+    graph.Add("A", {}, [&] {
+        order.push_back(0);
+        return true;
+    });
+    StartupGraph::StepId b = graph.Add("B", {}, [&] {
+        order.push_back(1);
+        return true;
+    });
+    graph.Add("C", {b}, [&] {
+        order.push_back(2);
+        return true;
+    });
+
+    // A later step can only name earlier ones, a forward id is ignored rather than waited on forever
+    graph.Add("D", {7}, [&] {
+        order.push_back(3);
+        return true;
+    });
+
+    CHECK(graph.Run(1));
+    CHECK(order == (std::vector<uint32_t>{0, 1, 3, 2}));
+
+    for (const StartupStepTiming &step : graph.GetTimeline())
+    {
+        CHECK_EQUAL(0u, step.Worker);
+    }
+}
+
+TEST_CASE(EmptyGraphSucceeds)
+{
+    StartupGraph graph;
+
+    CHECK(graph.Run(4));
+    CHECK(graph.GetTimeline().empty());
+}
+
+BENCHMARK_CASE(ServiceStartupShape)
+{
+    // The shape of the service startup: four shell writes, the inventory, both sensor acquisitions and the
+    // bring-up once the sensors and the inventory are there. The step lengths are only plausible guesses.
+    auto build = [](StartupGraph &Graph) {
+        Graph.Add("StartupTabletPosture", {}, SleepingStep(8));
+        Graph.Add("StartupTabletPostureTaskbar", {}, SleepingStep(6));
+        Graph.Add("StartupWorkAreas", {}, SleepingStep(4));
+        Graph.Add("StartupWallpaperSpanStyle", {}, SleepingStep(10));
+
+        StartupGraph::StepId inventory = Graph.Add("StartupDeviceInventory", {}, SleepingStep(25));
+        StartupGraph::StepId posture = Graph.Add("StartupPostureSensor", {}, SleepingStep(40));
+        StartupGraph::StepId flip = Graph.Add("StartupFlipSensor", {}, SleepingStep(35));
+
+        Graph.Add("StartupSensors", {posture, flip, inventory}, SleepingStep(15));
+    };
+
+    StartupGraph sequential;
+    StartupGraph concurrent;
+    StartupGraph empty;
+
+    build(sequential);
+    build(concurrent);
+
+    double oneWorker = MeasureNanoseconds(1, [&](uint64_t) { sequential.Run(1); });
+    double fourWorkers = MeasureNanoseconds(1, [&](uint64_t) { concurrent.Run(4); });
+
+    double overhead = MeasureNanoseconds(1000, [&](uint64_t) {
+        StartupGraph graph;
+
+        for (uint32_t i = 0; i < 8; i++)
+        {
+            graph.Add("Step", {}, [] { return true; });
+        }
+
+        graph.Run(4);
+    });
+
+    ReportMeasurement("Startup, one worker", oneWorker / 1000000, "ms");
+    ReportMeasurement("Startup, four workers", fourWorkers / 1000000, "ms");
+    ReportMeasurement("Scheduling 8 empty steps on four workers", overhead / 1000, "us");
+}
\ No newline at end of file
@@ -0,0 +1,288 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "StateSnapshot.h"
+#include "TestHarness.h"
+
+constexpr uint64_t SNAPSHOT_POISON = 0xDEADDEADDEADDEADull;
+
+//
+// Counts the live copies, and poisons itself when freed so a reader still holding it can tell
+//
+struct TrackedState
+{
+    static inline std::atomic<int64_t> Live{0};
+
+    uint64_t Generation;
+    // Always Generation * 3, a torn or freed snapshot breaks it
+    uint64_t Check;
+
+    explicit TrackedState(uint64_t Value) : Generation(Value), Check(Value * 3)
+    {
+        Live++;
+    }
+
+    TrackedState(const TrackedState &Other) : Generation(Other.Generation), Check(Other.Check)
+    {
+        Live++;
+    }
+
+    ~TrackedState()
+    {
+        Generation = SNAPSHOT_POISON;
+        Check = SNAPSHOT_POISON;
+        Live--;
+    }
+
+    bool IsIntact() const
+    {
+        return Generation != SNAPSHOT_POISON && Check == Generation * 3;
+    }
+};
+
+static bool
+Advance(TrackedState &State)
+{
+    State.Generation++;
+    State.Check = State.Generation * 3;
+    return true;
+}
+
+TEST_CASE(GuardKeepsItsSnapshotAlive)
+{
+    {
+        SnapshotCell<TrackedState> cell(TrackedState(0));
+        SnapshotCell<TrackedState>::Guard pinned = cell.Read();
+
+        CHECK(cell.Update(Advance));
+        CHECK(cell.Update(Advance));
+
+        // Both replaced copies may still be seen by the pinned reader
+        CHECK_EQUAL(2u, cell.GetRetiredCount());
+        CHECK(pinned->IsIntact());
+        CHECK_EQUAL(0u, pinned->Generation);
+        CHECK_EQUAL(2u, cell.Load().Generation);
+
+        {
+            SnapshotCell<TrackedState>::Guard moved = std::move(pinned);
+            CHECK_EQUAL(0u, moved->Generation);
+        }
+
+        // Nothing pins an epoch any more, the next publication frees every replaced copy
+        CHECK(cell.Update(Advance));
+        CHECK_EQUAL(0u, cell.GetRetiredCount());
+        CHECK_EQUAL(3u, cell.GetPublishedCount());
+        CHECK_EQUAL(1, TrackedState::Live.load());
+    }
+
+    CHECK_EQUAL(0, TrackedState::Live.load());
+}
+
+TEST_CASE(DeclinedUpdatePublishesNothing)
+{
+    SnapshotCell<TrackedState> cell(TrackedState(7));
+
+    CHECK(!cell.Update([](TrackedState &State) {
+        State.Generation = 8;
+        return false;
+    }));
+
+    CHECK_EQUAL(7u, cell.Load().Generation);
+    CHECK_EQUAL(0u, cell.GetPublishedCount());
+    CHECK_EQUAL(0u, cell.GetRetiredCount());
+    CHECK_EQUAL(1, TrackedState::Live.load());
+}
+
+TEST_CASE(ReadersNeverSeeAFreedSnapshot)
+{
+    constexpr uint32_t readers = 6;
+    constexpr uint64_t updates = 200000;
+
+    {
+        SnapshotCell<TrackedState> cell(TrackedState(0));
+        std::atomic<bool> done{false};
+        std::atomic<uint64_t> broken{0};
+        std::atomic<uint64_t> reads{0};
+        std::vector<std::thread> threads;
+
+        for (uint32_t i = 0; i < readers; i++)
+        {
+            threads.emplace_back([&] {
+                uint64_t last = 0;
+                uint64_t count = 0;
+
+                while (!done.load())
+                {
+                    SnapshotCell<TrackedState>::Guard state = cell.Read();
+
+                    // Snapshots only move forward for a given reader
+                    if (!state->IsIntact() || state->Generation < last)
+                    {
+                        broken++;
+                    }
+
+                    last = state->Generation;
+                    count++;
+                }
+
+                reads += count;
+            });
+        }
+
+        for (uint64_t i = 0; i < updates; i++)
+        {
+            cell.Update(Advance);
+        }
+
+        done = true;
+
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK_EQUAL(0u, broken.load());
+        CHECK(reads.load() > 0);
+        CHECK_EQUAL(updates, cell.Load().Generation);
+        CHECK_EQUAL(updates, cell.GetPublishedCount());
+
+        // Once the readers are gone the next publication frees every replaced copy
+        CHECK(cell.Update(Advance));
+        CHECK_EQUAL(0u, cell.GetRetiredCount());
+        CHECK_EQUAL(1, TrackedState::Live.load());
+    }
+
+    CHECK_EQUAL(0, TrackedState::Live.load());
+}
+
+TEST_CASE(ReadersWaitForAFreeSlot)
+{
+    constexpr uint32_t readers = 8;
+
+    {
+        // Fewer slots than readers, every one of them still gets through
+        SnapshotCell<TrackedState, 2> cell(TrackedState(0));
+        std::atomic<uint64_t> broken{0};
+        std::vector<std::thread> threads;
+
+        for (uint32_t i = 0; i < readers; i++)
+        {
+            threads.emplace_back([&] {
+                for (uint32_t j = 0; j < 20000; j++)
+                {
+                    if (!cell.Read()->IsIntact())
+                    {
+                        broken++;
+                    }
+                }
+            });
+        }
+
+        for (uint32_t i = 0; i < 20000; i++)
+        {
+            cell.Update(Advance);
+        }
+
+        for (std::thread &thread : threads)
+        {
+            thread.join();
+        }
+
+        CHECK_EQUAL(0u, broken.load());
+    }
+
+    CHECK_EQUAL(0, TrackedState::Live.load());
+}
+
+template <typename Read>
+static double
+MeasureContendedRead(uint32_t Readers, Read &&ReadOnce, const std::function<void()> &Write)
+{
+    constexpr uint64_t iterations = 2000000;
+    std::atomic<bool> done{false};
+    std::atomic<uint64_t> totalNanoseconds{0};
+    std::vector<std::thread> threads;
+
+    for (uint32_t i = 0; i < Readers; i++)
+    {
+        threads.emplace_back([&] {
+            double nanoseconds = MeasureNanoseconds(iterations, [&](uint64_t) { ReadOnce(); });
+            totalNanoseconds += (uint64_t)(nanoseconds * 1000);
+        });
+    }
+
+    // The writer keeps publishing for as long as the readers run, a mode set every millisecond is far above
+    // what the service sees
+    std::thread writer([&] {
+        while (!done.load())
+        {
+            Write();
+            std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+    });
+
+    for (std::thread &thread : threads)
+    {
+        thread.join();
+    }
+
+    done = true;
+    writer.join();
+
+    return (double)totalNanoseconds.load() / 1000.0 / Readers;
+}
+
+BENCHMARK_CASE(SnapshotReads)
+{
+    SnapshotCell<TrackedState> cell(TrackedState(0));
+    std::shared_mutex lock;
+    TrackedState locked(0);
+    volatile uint64_t sink = 0;
+    uint32_t readers = (std::max)(2u, (std::min)(8u, std::thread::hardware_concurrency()));
+
+    double read = MeasureNanoseconds(10000000, [&](uint64_t) { sink = sink + cell.Read()->Generation; });
+    double sharedRead = MeasureNanoseconds(10000000, [&](uint64_t) {
+        std::shared_lock guard{lock};
+        sink = sink + locked.Generation;
+    });
+    double update = MeasureNanoseconds(1000000, [&](uint64_t) { cell.Update(Advance); });
+
+    double contended = MeasureContendedRead(
+        readers, [&] { sink = sink + cell.Read()->Generation; }, [&] { cell.Update(Advance); });
+    double sharedContended = MeasureContendedRead(
+        readers,
+        [&] {
+            std::shared_lock guard{lock};
+            sink = sink + locked.Generation;
+        },
+        [&] {
+            std::unique_lock guard{lock};
+            Advance(locked);
+        });
+
+    ReportMeasurement("SnapshotCell::Read, one reader", read, "ns");
+    ReportMeasurement("shared_mutex read, one reader", sharedRead, "ns");
+    ReportMeasurement("SnapshotCell::Update", update, "ns");
+    ReportMeasurement("SnapshotCell::Read, contended", contended, "ns");
+    ReportMeasurement("shared_mutex read, contended", sharedContended, "ns");
+    ReportMeasurement("Readers", readers, "threads");
+}
\ No newline at end of file
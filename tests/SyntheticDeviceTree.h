@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// Generates device trees shaped like the one of a two panel device, scaled to any number of devnodes. Every
+// panel brings a monitor and a digitizer devnode carrying its panel id, everything else is filler from the
+// usual buses. The same seed always gives the same tree.
+//
+
+#include "pch.h"
+#include "DeviceInventory.h"
+#include "FakeSetupApi.h"
+#include <cwchar>
+#include <functional>
+
+constexpr inline WCHAR SYNTHETIC_MONITOR_CLASS_KEY[] = L"{4d36e96e-e325-11ce-bfc1-08002be10318}";
+constexpr inline WCHAR SYNTHETIC_DIGITIZER_HARDWARE_ID[] = L"HID_DEVICE_UP:000D_U:000F";
+
+struct SyntheticPanel
+{
+    std::wstring PanelId;
+    std::wstring MonitorInstanceId;
+    // "<hardware id>\<driver key>", as EnumDisplayDevices reports it for the monitor
+    std::wstring MonitorDeviceId;
+    std::wstring DigitizerInstanceId;
+};
+
+struct SyntheticDeviceTree
+{
+    std::vector<FakeDeviceNode> Devices;
+    std::vector<SyntheticPanel> Panels;
+};
+
+class SyntheticRandom
+{
+public:
+    explicit SyntheticRandom(uint32_t Seed) : m_state(Seed ? Seed : 1)
+    {
+    }
+
+    uint32_t Next()
+    {
+        m_state ^= m_state << 13;
+        m_state ^= m_state >> 17;
+        m_state ^= m_state << 5;
+        return m_state;
+    }
+
+private:
+    uint32_t m_state;
+};
+
+inline std::wstring
+FormatSyntheticString(const WCHAR *Format, uint32_t First, uint32_t Second = 0)
+{
+    WCHAR buffer[128];
+
+    std::swprintf(buffer, ARRAYSIZE(buffer), Format, First, Second);
+    return buffer;
+}
+
+//
+// Subject: Generates a device tree
+//
+// Parameters:
+//
+//             DeviceCount: The number of devnodes, the panel ones included
+//
+//             PanelCount: The number of panels, each one taking two devnodes
+//
+//             Seed: Picks the filler devnodes and where the panel devnodes sit in the tree
+//
+// Returns: The devnodes in enumeration order, and the panels they hold
+//
+inline SyntheticDeviceTree
+GenerateSyntheticDeviceTree(size_t DeviceCount, size_t PanelCount, uint32_t Seed)
+{
+    static const WCHAR *fillerFormats[] = {
+        L"PCI\\VEN_%04X&DEV_%04X",
+        L"USB\\VID_%04X&PID_%04X",
+        L"ACPI\\QCOM%04X\\%u",
+        L"SWD\\MMDEVAPI\\%08X%04X",
+        L"HID\\VID_%04X&PID_%04X&Col01",
+        L"ROOT\\SYSTEM\\%04X%04X"};
+
+    SyntheticDeviceTree tree;
+    SyntheticRandom random(Seed);
+    size_t panelDevices = PanelCount * 2;
+    size_t fillerDevices = DeviceCount > panelDevices ? DeviceCount - panelDevices : 0;
+
+    tree.Devices.reserve(fillerDevices + panelDevices);
+
+    for (size_t i = 0; i < fillerDevices; i++)
+    {
+        const WCHAR *format = fillerFormats[random.Next() % ARRAYSIZE(fillerFormats)];
+        FakeDeviceNode device{};
+        std::wstring hardwareId = FormatSyntheticString(format, random.Next() & 0xFFFF, random.Next() & 0xFFFF);
+
+        device.InstanceId = hardwareId + FormatSyntheticString(L"\\%u&%08X", (uint32_t)i, random.Next());
+        device.DriverKey =
+            FormatSyntheticString(L"{%08X-0000-0000-0000-000000000000}\\%04u", random.Next(), (uint32_t)i);
+        device.HardwareIds = {hardwareId, hardwareId.substr(0, hardwareId.find(L'&'))};
+        device.Enabled = TRUE;
+        tree.Devices.push_back(std::move(device));
+    }
+
+    for (uint32_t panel = 0; panel < PanelCount; panel++)
+    {
+        SyntheticPanel info;
+        FakeDeviceNode monitor{};
+        FakeDeviceNode digitizer{};
+        std::wstring monitorHardwareId = FormatSyntheticString(L"MONITOR\\SYN%04X", panel);
+
+        info.PanelId = FormatSyntheticString(L"{%08X-97A9-4BFF-9BC6-%012X}", random.Next(), panel);
+
+        monitor.InstanceId = FormatSyntheticString(L"DISPLAY\\SYN%04X\\5&%08X&0&UID0", panel, random.Next());
+        monitor.DriverKey = std::wstring(SYNTHETIC_MONITOR_CLASS_KEY) + FormatSyntheticString(L"\\%04u", panel);
+        monitor.PanelId = info.PanelId;
+        monitor.HardwareIds = {monitorHardwareId};
+        monitor.Enabled = TRUE;
+
+        digitizer.InstanceId = FormatSyntheticString(L"HID\\SYNTOUCH&COL%02X\\7&%08X&0&0000", panel, random.Next());
+        digitizer.DriverKey = FormatSyntheticString(L"{745a17a0-74d3-11d0-b6fe-00a0c90f57da}\\%04u", panel);
+        digitizer.PanelId = info.PanelId;
+        digitizer.HardwareIds = {SYNTHETIC_DIGITIZER_HARDWARE_ID, L"HID_DEVICE_SYSTEM_DIGITIZER", L"HID_DEVICE"};
+        digitizer.Enabled = TRUE;
+
+        info.MonitorInstanceId = monitor.InstanceId;
+        info.MonitorDeviceId = monitorHardwareId + L"\\" + monitor.DriverKey;
+        info.DigitizerInstanceId = digitizer.InstanceId;
+
+        // Spread the panel devnodes over the tree rather than leaving them at the end of the enumeration
+        for (FakeDeviceNode *device : {&monitor, &digitizer})
+        {
+            size_t position = tree.Devices.empty() ? 0 : random.Next() % (tree.Devices.size() + 1);
+            tree.Devices.insert(tree.Devices.begin() + position, std::move(*device));
+        }
+
+        tree.Panels.push_back(std::move(info));
+    }
+
+    return tree;
+}
+
+//
+// Hands the panel devnodes of a synthetic tree to the device inventory without going through SetupDi
+//
+class SyntheticDeviceSource final : public DeviceSource
+{
+public:
+    explicit SyntheticDeviceSource(const SyntheticDeviceTree &Tree) : m_tree(Tree)
+    {
+    }
+
+    HRESULT EnumeratePanelDevices(const std::function<void(DeviceNodeRecord &&)> &callback) override
+    {
+        for (const FakeDeviceNode &device : m_tree.Devices)
+        {
+            if (!device.PanelId.empty())
+            {
+                callback(DeviceNodeRecord{device.InstanceId, device.DriverKey, device.PanelId, device.HardwareIds});
+            }
+        }
+
+        return ERROR_SUCCESS;
+    }
+
+private:
+    const SyntheticDeviceTree &m_tree;
+};
\ No newline at end of file
@@ -0,0 +1,100 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// A minimal test and benchmark runner, so that the off-device tests need nothing but a C++20 compiler.
+// Every test executable links TestMain.cpp. Test cases run by default, benchmark cases only with --bench.
+//
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+struct TestCase
+{
+    const char *Name;
+    void (*Body)();
+    bool Benchmark;
+};
+
+std::vector<TestCase> &
+GetTestCases();
+
+void
+ReportCheck(bool Passed, const char *Expression, const char *File, int Line);
+
+struct TestRegistration
+{
+    TestRegistration(const char *Name, void (*Body)(), bool Benchmark)
+    {
+        GetTestCases().push_back(TestCase{Name, Body, Benchmark});
+    }
+};
+
+#define TEST_CASE(Name) \
+    static void Name(); \
+    static TestRegistration Name##Registration(#Name, Name, false); \
+    static void Name()
+
+#define BENCHMARK_CASE(Name) \
+    static void Name(); \
+    static TestRegistration Name##Registration(#Name, Name, true); \
+    static void Name()
+
+#define CHECK(Expression) ReportCheck(static_cast<bool>(Expression), #Expression, __FILE__, __LINE__)
+
+#define CHECK_EQUAL(Expected, Actual) \
+    ReportCheck((Expected) == (Actual), #Expected " == " #Actual, __FILE__, __LINE__)
+
+//
+// Subject: Times a loop and returns the average cost of one iteration
+//
+// Parameters:
+//
+//             Iterations: How many times Body runs
+//
+//             Body: Called with the iteration index
+//
+// Returns: Nanoseconds per iteration
+//
+template <typename Body>
+double
+MeasureNanoseconds(uint64_t Iterations, Body &&Run)
+{
+    auto start = std::chrono::steady_clock::now();
+
+    for (uint64_t i = 0; i < Iterations; i++)
+    {
+        Run(i);
+    }
+
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return (double)std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count() / (double)Iterations;
+}
+
+inline void
+ReportMeasurement(const char *Name, double Value, const char *Unit)
+{
+    std::printf("    %-56s %12.1f %s\n", Name, Value, Unit);
+}
\ No newline at end of file
@@ -0,0 +1,94 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "TestHarness.h"
+#include <cstring>
+
+static uint32_t g_FailedChecks = 0;
+
+std::vector<TestCase> &
+GetTestCases()
+{
+    static std::vector<TestCase> cases;
+    return cases;
+}
+
+void
+ReportCheck(bool Passed, const char *Expression, const char *File, int Line)
+{
+    if (!Passed)
+    {
+        std::printf("    %s:%d: CHECK(%s) failed\n", File, Line, Expression);
+        g_FailedChecks++;
+    }
+}
+
+//
+// Runs the test cases, or the benchmark cases with --bench, optionally only those named on the command line
+//
+int
+main(int argc, char **argv)
+{
+    bool benchmark = false;
+    uint32_t failedCases = 0;
+    uint32_t ranCases = 0;
+    std::vector<const char *> names;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (std::strcmp(argv[i], "--bench") == 0)
+        {
+            benchmark = true;
+        }
+        else
+        {
+            names.push_back(argv[i]);
+        }
+    }
+
+    for (const TestCase &test : GetTestCases())
+    {
+        bool selected = names.empty();
+
+        for (const char *name : names)
+        {
+            selected = selected || std::strcmp(name, test.Name) == 0;
+        }
+
+        if (test.Benchmark != benchmark || !selected)
+        {
+            continue;
+        }
+
+        uint32_t failedBefore = g_FailedChecks;
+
+        std::printf("[ RUN  ] %s\n", test.Name);
+        test.Body();
+        std::printf("[ %s ] %s\n", g_FailedChecks == failedBefore ? " OK " : "FAIL", test.Name);
+
+        failedCases += g_FailedChecks != failedBefore ? 1 : 0;
+        ranCases++;
+    }
+
+    std::printf("%u of %u cases passed\n", ranCases - failedCases, ranCases);
+
+    return failedCases == 0 && ranCases != 0 ? 0 : 1;
+}
\ No newline at end of file
@@ -0,0 +1,162 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include <dbt.h>
+#include "DisplayChangeNotifier.h"
+#include "FakeDisplayChangeNotifier.h"
+#include <deque>
+
+#define WM_QUIT 0x0012
+
+struct FakeMessage
+{
+    UINT Message;
+    WPARAM wParam;
+};
+
+//
+// Stands in for the thread message queue of the hidden window
+//
+static std::mutex g_FakeMessageLock;
+static std::condition_variable g_FakeMessageQueued;
+static std::condition_variable g_FakeMessageProcessed;
+static std::deque<FakeMessage> g_FakeMessages;
+static ULONG64 g_FakeMessagesSent = 0;
+static ULONG64 g_FakeMessagesProcessed = 0;
+
+static VOID
+PostFakeMessage(UINT Message, WPARAM wParam)
+{
+    std::lock_guard lock{g_FakeMessageLock};
+
+    g_FakeMessages.push_back(FakeMessage{Message, wParam});
+    g_FakeMessagesSent++;
+    g_FakeMessageQueued.notify_all();
+}
+
+VOID
+FakeDisplayChangeNotifierSend(UINT Message, WPARAM wParam)
+{
+    // Make sure the notifier is listening
+    DisplayChangeNotifier::instance();
+
+    PostFakeMessage(Message, wParam);
+
+    std::unique_lock lock{g_FakeMessageLock};
+    ULONG64 sent = g_FakeMessagesSent;
+    g_FakeMessageProcessed.wait(lock, [&] { return g_FakeMessagesProcessed >= sent; });
+}
+
+DisplayChangeNotifier &
+DisplayChangeNotifier::instance()
+{
+    static DisplayChangeNotifier self;
+    return self;
+}
+
+DisplayChangeNotifier::DisplayChangeNotifier() : m_thread{[this] { MessageLoop(); }}
+{
+}
+
+DisplayChangeNotifier::~DisplayChangeNotifier()
+{
+    PostFakeMessage(WM_QUIT, 0);
+
+    if (m_thread.joinable())
+    {
+        m_thread.join();
+    }
+}
+
+ULONG
+DisplayChangeNotifier::GetDisplayGeneration() const
+{
+    return m_displayGeneration;
+}
+
+ULONG
+DisplayChangeNotifier::GetDeviceGeneration() const
+{
+    return m_deviceGeneration;
+}
+
+BOOLEAN
+DisplayChangeNotifier::WaitForDisplayChange(ULONG Generation, DWORD TimeoutMs)
+{
+    std::unique_lock lock{m_waitLock};
+
+    return m_displayChanged.wait_for(
+        lock, std::chrono::milliseconds(TimeoutMs), [&] { return m_displayGeneration != Generation; });
+}
+
+LRESULT CALLBACK
+DisplayChangeNotifier::WindowProc(HWND hwnd, UINT message, WPARAM wParam, LPARAM)
+{
+    DisplayChangeNotifier *self = reinterpret_cast<DisplayChangeNotifier *>(hwnd);
+
+    switch (message)
+    {
+    case WM_DISPLAYCHANGE:
+    {
+        std::lock_guard lock{self->m_waitLock};
+        self->m_displayGeneration++;
+        self->m_displayChanged.notify_all();
+        break;
+    }
+    case WM_DEVICECHANGE:
+        if (wParam == DBT_DEVNODES_CHANGED)
+        {
+            self->m_deviceGeneration++;
+        }
+        break;
+    }
+
+    return 0;
+}
+
+VOID
+DisplayChangeNotifier::MessageLoop()
+{
+    while (TRUE)
+    {
+        FakeMessage message;
+
+        {
+            std::unique_lock lock{g_FakeMessageLock};
+            g_FakeMessageQueued.wait(lock, [] { return !g_FakeMessages.empty(); });
+
+            message = g_FakeMessages.front();
+            g_FakeMessages.pop_front();
+        }
+
+        if (message.Message == WM_QUIT)
+        {
+            return;
+        }
+
+        WindowProc(reinterpret_cast<HWND>(this), message.Message, message.wParam, 0);
+
+        std::lock_guard lock{g_FakeMessageLock};
+        g_FakeMessagesProcessed++;
+        g_FakeMessageProcessed.notify_all();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The off-device DisplayChangeNotifier has no window, its message loop is fed the broadcasts the tests send
+// instead. Sending returns once the notifier has processed the message.
+//
+
+#include <windows.h>
+#include <dbt.h>
+
+VOID
+FakeDisplayChangeNotifierSend(UINT Message, WPARAM wParam);
+
+// The device tree changed, as DBT_DEVNODES_CHANGED tells it
+inline VOID
+FakeDisplayChangeNotifierSendDeviceChange()
+{
+    FakeDisplayChangeNotifierSend(WM_DEVICECHANGE, DBT_DEVNODES_CHANGED);
+}
+
+// A mode set went through, as WM_DISPLAYCHANGE tells it
+inline VOID
+FakeDisplayChangeNotifierSendDisplayChange()
+{
+    FakeDisplayChangeNotifierSend(WM_DISPLAYCHANGE, 0);
+}
\ No newline at end of file
@@ -0,0 +1,250 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeDisplayConfig.h"
+
+static std::mutex g_FakeDisplayConfigLock;
+static FakeDisplayConfig g_FakeDisplayConfig;
+static std::vector<FakeDisplayConfigApply> g_FakeDisplayConfigApplied;
+static FakeDisplayConfigStats g_FakeDisplayConfigStats{};
+
+static BOOLEAN
+IsSameLuid(CONST LUID &Left, CONST LUID &Right)
+{
+    return Left.LowPart == Right.LowPart && Left.HighPart == Right.HighPart;
+}
+
+static BOOLEAN
+IsSamePath(CONST DISPLAYCONFIG_PATH_INFO &Left, CONST DISPLAYCONFIG_PATH_INFO &Right)
+{
+    return IsSameLuid(Left.sourceInfo.adapterId, Right.sourceInfo.adapterId) &&
+           Left.sourceInfo.id == Right.sourceInfo.id &&
+           IsSameLuid(Left.targetInfo.adapterId, Right.targetInfo.adapterId) &&
+           Left.targetInfo.id == Right.targetInfo.id;
+}
+
+static CONST FakeDisplayConfigName *
+FindName(CONST std::vector<FakeDisplayConfigName> &Names, CONST DISPLAYCONFIG_DEVICE_INFO_HEADER &Header)
+{
+    for (CONST FakeDisplayConfigName &name : Names)
+    {
+        if (IsSameLuid(name.AdapterId, Header.adapterId) && name.Id == Header.id)
+        {
+            return &name;
+        }
+    }
+
+    return nullptr;
+}
+
+VOID
+FakeDisplayConfigSet(FakeDisplayConfig Config)
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+
+    g_FakeDisplayConfig = std::move(Config);
+    g_FakeDisplayConfigApplied.clear();
+    g_FakeDisplayConfigStats = {};
+}
+
+FakeDisplayConfig &
+FakeDisplayConfigGet()
+{
+    return g_FakeDisplayConfig;
+}
+
+FakeDisplayConfigStats
+FakeDisplayConfigGetStats()
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+    return g_FakeDisplayConfigStats;
+}
+
+VOID
+FakeDisplayConfigResetStats()
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+    g_FakeDisplayConfigStats = {};
+}
+
+const std::vector<FakeDisplayConfigApply> &
+FakeDisplayConfigGetApplied()
+{
+    return g_FakeDisplayConfigApplied;
+}
+
+static std::vector<DISPLAYCONFIG_PATH_INFO>
+SelectPaths(UINT32 Flags)
+{
+    std::vector<DISPLAYCONFIG_PATH_INFO> paths;
+
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : g_FakeDisplayConfig.Paths)
+    {
+        if ((Flags & QDC_ALL_PATHS) || (path.flags & DISPLAYCONFIG_PATH_ACTIVE))
+        {
+            paths.push_back(path);
+        }
+    }
+
+    return paths;
+}
+
+LONG
+GetDisplayConfigBufferSizes(UINT32 Flags, UINT32 *NumPathArrayElements, UINT32 *NumModeInfoArrayElements)
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+
+    g_FakeDisplayConfigStats.BufferSizeCalls++;
+
+    *NumPathArrayElements = (UINT32)SelectPaths(Flags).size();
+    *NumModeInfoArrayElements = (UINT32)g_FakeDisplayConfig.Modes.size();
+
+    return ERROR_SUCCESS;
+}
+
+LONG
+QueryDisplayConfig(
+    UINT32 Flags,
+    UINT32 *NumPathArrayElements,
+    DISPLAYCONFIG_PATH_INFO *PathArray,
+    UINT32 *NumModeInfoArrayElements,
+    DISPLAYCONFIG_MODE_INFO *ModeInfoArray,
+    DISPLAYCONFIG_TOPOLOGY_ID *)
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+    std::vector<DISPLAYCONFIG_PATH_INFO> paths = SelectPaths(Flags);
+
+    g_FakeDisplayConfigStats.QueryCalls++;
+
+    if (*NumPathArrayElements < paths.size() || *NumModeInfoArrayElements < g_FakeDisplayConfig.Modes.size())
+    {
+        return ERROR_INSUFFICIENT_BUFFER;
+    }
+
+    std::copy(paths.begin(), paths.end(), PathArray);
+    std::copy(g_FakeDisplayConfig.Modes.begin(), g_FakeDisplayConfig.Modes.end(), ModeInfoArray);
+
+    *NumPathArrayElements = (UINT32)paths.size();
+    *NumModeInfoArrayElements = (UINT32)g_FakeDisplayConfig.Modes.size();
+
+    return ERROR_SUCCESS;
+}
+
+LONG
+DisplayConfigGetDeviceInfo(DISPLAYCONFIG_DEVICE_INFO_HEADER *RequestPacket)
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+    CONST FakeDisplayConfigName *name = nullptr;
+
+    g_FakeDisplayConfigStats.DeviceInfoCalls++;
+
+    switch (RequestPacket->type)
+    {
+    case DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME:
+    {
+        DISPLAYCONFIG_SOURCE_DEVICE_NAME *sourceName = (DISPLAYCONFIG_SOURCE_DEVICE_NAME *)RequestPacket;
+
+        if ((name = FindName(g_FakeDisplayConfig.SourceNames, *RequestPacket)) == nullptr)
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        StringCchCopy(sourceName->viewGdiDeviceName, ARRAYSIZE(sourceName->viewGdiDeviceName), name->Name.c_str());
+        return ERROR_SUCCESS;
+    }
+    case DISPLAYCONFIG_DEVICE_INFO_GET_TARGET_NAME:
+    {
+        DISPLAYCONFIG_TARGET_DEVICE_NAME *targetName = (DISPLAYCONFIG_TARGET_DEVICE_NAME *)RequestPacket;
+
+        if ((name = FindName(g_FakeDisplayConfig.TargetNames, *RequestPacket)) == nullptr)
+        {
+            return ERROR_NOT_FOUND;
+        }
+
+        StringCchCopy(targetName->monitorDevicePath, ARRAYSIZE(targetName->monitorDevicePath), name->Name.c_str());
+        return ERROR_SUCCESS;
+    }
+    default:
+        return ERROR_INVALID_PARAMETER;
+    }
+}
+
+LONG
+SetDisplayConfig(
+    UINT32 NumPathArrayElements,
+    DISPLAYCONFIG_PATH_INFO *PathArray,
+    UINT32 NumModeInfoArrayElements,
+    DISPLAYCONFIG_MODE_INFO *ModeInfoArray,
+    UINT32 Flags)
+{
+    std::lock_guard lock{g_FakeDisplayConfigLock};
+    FakeDisplayConfigApply apply{
+        std::vector<DISPLAYCONFIG_PATH_INFO>(PathArray, PathArray + NumPathArrayElements),
+        std::vector<DISPLAYCONFIG_MODE_INFO>(ModeInfoArray, ModeInfoArray + NumModeInfoArrayElements),
+        Flags};
+
+    g_FakeDisplayConfigStats.SetCalls++;
+
+    if (!(Flags & SDC_APPLY))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    g_FakeDisplayConfigApplied.push_back(apply);
+
+    if (!(Flags & SDC_USE_SUPPLIED_DISPLAY_CONFIG))
+    {
+        return ERROR_SUCCESS;
+    }
+
+    for (CONST DISPLAYCONFIG_PATH_INFO &path : apply.Paths)
+    {
+        if ((path.sourceInfo.modeInfoIdx != DISPLAYCONFIG_PATH_MODE_IDX_INVALID &&
+             path.sourceInfo.modeInfoIdx >= apply.Modes.size()) ||
+            (path.targetInfo.modeInfoIdx != DISPLAYCONFIG_PATH_MODE_IDX_INVALID &&
+             path.targetInfo.modeInfoIdx >= apply.Modes.size()))
+        {
+            return ERROR_INVALID_PARAMETER;
+        }
+    }
+
+    // The supplied paths become the active ones, every other path stays listed as a possible one
+    std::vector<DISPLAYCONFIG_PATH_INFO> paths = apply.Paths;
+
+    for (DISPLAYCONFIG_PATH_INFO path : g_FakeDisplayConfig.Paths)
+    {
+        if (std::none_of(apply.Paths.begin(), apply.Paths.end(), [&](CONST DISPLAYCONFIG_PATH_INFO &applied) {
+                return IsSamePath(applied, path);
+            }))
+        {
+            path.flags &= ~DISPLAYCONFIG_PATH_ACTIVE;
+            path.sourceInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+            path.targetInfo.modeInfoIdx = DISPLAYCONFIG_PATH_MODE_IDX_INVALID;
+            paths.push_back(path);
+        }
+    }
+
+    g_FakeDisplayConfig.Paths = std::move(paths);
+    g_FakeDisplayConfig.Modes = apply.Modes;
+
+    return ERROR_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The display configuration behind QueryDisplayConfig, DisplayConfigGetDeviceInfo and SetDisplayConfig in the
+// off-device build. A supplied configuration which gets applied becomes the current one, the way the display
+// stack would report it back. Every call is counted.
+//
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+struct FakeDisplayConfigName
+{
+    LUID AdapterId;
+    UINT32 Id;
+    // The GDI device name of a source, the monitor device path of a target
+    std::wstring Name;
+};
+
+struct FakeDisplayConfig
+{
+    std::vector<DISPLAYCONFIG_PATH_INFO> Paths;
+    std::vector<DISPLAYCONFIG_MODE_INFO> Modes;
+    std::vector<FakeDisplayConfigName> SourceNames;
+    std::vector<FakeDisplayConfigName> TargetNames;
+};
+
+struct FakeDisplayConfigApply
+{
+    std::vector<DISPLAYCONFIG_PATH_INFO> Paths;
+    std::vector<DISPLAYCONFIG_MODE_INFO> Modes;
+    UINT32 Flags;
+};
+
+struct FakeDisplayConfigStats
+{
+    uint64_t BufferSizeCalls;
+    uint64_t QueryCalls;
+    uint64_t DeviceInfoCalls;
+    uint64_t SetCalls;
+};
+
+// Replaces the configuration and clears the statistics and the applied configurations
+VOID
+FakeDisplayConfigSet(FakeDisplayConfig Config);
+
+FakeDisplayConfig &
+FakeDisplayConfigGet();
+
+FakeDisplayConfigStats
+FakeDisplayConfigGetStats();
+
+VOID
+FakeDisplayConfigResetStats();
+
+// Every SetDisplayConfig call which went through, in order
+const std::vector<FakeDisplayConfigApply> &
+FakeDisplayConfigGetApplied();
\ No newline at end of file
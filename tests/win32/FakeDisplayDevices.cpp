@@ -0,0 +1,160 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeDisplayDevices.h"
+
+static std::mutex g_FakeDisplayDevicesLock;
+static std::vector<FakeDisplayAdapter> g_FakeDisplayAdapters;
+static FakeDisplayDevicesStats g_FakeDisplayDevicesStats{};
+
+static FakeDisplayAdapter *
+FindAdapter(LPCWSTR DeviceName)
+{
+    for (FakeDisplayAdapter &adapter : g_FakeDisplayAdapters)
+    {
+        if (lstrcmpi(adapter.DeviceName.c_str(), DeviceName) == 0)
+        {
+            return &adapter;
+        }
+    }
+
+    return nullptr;
+}
+
+VOID
+FakeDisplayDevicesSet(std::vector<FakeDisplayAdapter> Adapters)
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+
+    g_FakeDisplayAdapters = std::move(Adapters);
+    g_FakeDisplayDevicesStats = {};
+}
+
+std::vector<FakeDisplayAdapter> &
+FakeDisplayDevicesGet()
+{
+    return g_FakeDisplayAdapters;
+}
+
+FakeDisplayDevicesStats
+FakeDisplayDevicesGetStats()
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+    return g_FakeDisplayDevicesStats;
+}
+
+VOID
+FakeDisplayDevicesResetStats()
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+    g_FakeDisplayDevicesStats = {};
+}
+
+BOOL
+EnumDisplayDevices(LPCWSTR Device, DWORD DevNum, PDISPLAY_DEVICE DisplayDevice, DWORD)
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+
+    g_FakeDisplayDevicesStats.EnumDevicesCalls++;
+
+    // Adapters when no device is given, otherwise the single monitor of the adapter
+    if (Device == NULL)
+    {
+        if (DevNum >= g_FakeDisplayAdapters.size())
+        {
+            return FALSE;
+        }
+
+        const FakeDisplayAdapter &adapter = g_FakeDisplayAdapters[DevNum];
+
+        StringCchCopy(DisplayDevice->DeviceName, ARRAYSIZE(DisplayDevice->DeviceName), adapter.DeviceName.c_str());
+        DisplayDevice->StateFlags = (adapter.Attached ? DISPLAY_DEVICE_ATTACHED_TO_DESKTOP : 0) |
+                                    (adapter.Primary ? DISPLAY_DEVICE_PRIMARY_DEVICE : 0);
+        DisplayDevice->DeviceID[0] = L'\0';
+        return TRUE;
+    }
+
+    FakeDisplayAdapter *adapter = FindAdapter(Device);
+    if (adapter == nullptr || DevNum != 0 || adapter->MonitorDeviceId.empty())
+    {
+        return FALSE;
+    }
+
+    std::wstring monitorName = adapter->DeviceName + L"\\Monitor0";
+
+    StringCchCopy(DisplayDevice->DeviceName, ARRAYSIZE(DisplayDevice->DeviceName), monitorName.c_str());
+    StringCchCopy(DisplayDevice->DeviceID, ARRAYSIZE(DisplayDevice->DeviceID), adapter->MonitorDeviceId.c_str());
+    DisplayDevice->StateFlags = adapter->Attached ? DISPLAY_DEVICE_ATTACHED_TO_DESKTOP : 0;
+    return TRUE;
+}
+
+BOOL
+EnumDisplaySettings(LPCWSTR DeviceName, DWORD ModeNum, PDEVMODE DevMode)
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+
+    g_FakeDisplayDevicesStats.EnumSettingsCalls++;
+
+    FakeDisplayAdapter *adapter = FindAdapter(DeviceName);
+    if (adapter == nullptr)
+    {
+        return FALSE;
+    }
+
+    if (ModeNum == ENUM_CURRENT_SETTINGS || ModeNum == ENUM_REGISTRY_SETTINGS)
+    {
+        if (!adapter->Attached)
+        {
+            return FALSE;
+        }
+
+        *DevMode = adapter->CurrentMode;
+        return TRUE;
+    }
+
+    if (ModeNum >= adapter->Modes.size())
+    {
+        return FALSE;
+    }
+
+    *DevMode = adapter->Modes[ModeNum];
+    return TRUE;
+}
+
+INT
+GetSystemMetrics(INT Index)
+{
+    std::lock_guard lock{g_FakeDisplayDevicesLock};
+    INT monitors = 0;
+
+    if (Index != SM_CMONITORS)
+    {
+        return 0;
+    }
+
+    for (const FakeDisplayAdapter &adapter : g_FakeDisplayAdapters)
+    {
+        monitors += adapter.Attached ? 1 : 0;
+    }
+
+    return monitors;
+}
\ No newline at end of file
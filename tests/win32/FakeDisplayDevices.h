@@ -0,0 +1,62 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The display adapters and monitors behind EnumDisplayDevices and EnumDisplaySettings in the off-device
+// build. Every call is counted.
+//
+
+#include <windows.h>
+#include <string>
+#include <vector>
+
+struct FakeDisplayAdapter
+{
+    // "\\.\DISPLAYn"
+    std::wstring DeviceName;
+    // "<hardware id>\<driver key>" of the monitor on the adapter
+    std::wstring MonitorDeviceId;
+    BOOLEAN Attached;
+    BOOLEAN Primary;
+    DEVMODE CurrentMode;
+    std::vector<DEVMODE> Modes;
+};
+
+struct FakeDisplayDevicesStats
+{
+    uint64_t EnumDevicesCalls;
+    uint64_t EnumSettingsCalls;
+};
+
+// Replaces the adapters and clears the statistics
+VOID
+FakeDisplayDevicesSet(std::vector<FakeDisplayAdapter> Adapters);
+
+std::vector<FakeDisplayAdapter> &
+FakeDisplayDevicesGet();
+
+FakeDisplayDevicesStats
+FakeDisplayDevicesGetStats();
+
+VOID
+FakeDisplayDevicesResetStats();
\ No newline at end of file
@@ -0,0 +1,237 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeFileSystem.h"
+
+#define FAKE_LOCAL_APP_DATA L"C:\\Users\\Test\\AppData\\Local"
+
+//
+// An open file, written files are published on close
+//
+struct FakeFileHandle
+{
+    std::wstring Path;
+    std::vector<BYTE> Data;
+    size_t Position;
+    BOOLEAN Write;
+};
+
+static std::mutex g_FakeFileSystemLock;
+static std::map<std::wstring, std::vector<BYTE>> g_FakeFiles;
+static FakeFileSystemStats g_FakeFileSystemStats{};
+
+VOID
+FakeFileSystemReset()
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+
+    g_FakeFiles.clear();
+    g_FakeFileSystemStats = {};
+}
+
+FakeFileSystemStats
+FakeFileSystemGetStats()
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+    return g_FakeFileSystemStats;
+}
+
+VOID
+FakeFileSystemResetStats()
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+    g_FakeFileSystemStats = {};
+}
+
+std::map<std::wstring, std::vector<BYTE>> &
+FakeFileSystemGetFiles()
+{
+    return g_FakeFiles;
+}
+
+HANDLE
+CreateFile(
+    LPCWSTR FileName,
+    DWORD DesiredAccess,
+    DWORD,
+    LPSECURITY_ATTRIBUTES,
+    DWORD CreationDisposition,
+    DWORD,
+    HANDLE)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+
+    g_FakeFileSystemStats.OpenCalls++;
+
+    if (CreationDisposition == OPEN_EXISTING)
+    {
+        auto it = g_FakeFiles.find(FileName);
+        if (it == g_FakeFiles.end())
+        {
+            SetLastError(ERROR_FILE_NOT_FOUND);
+            return INVALID_HANDLE_VALUE;
+        }
+
+        return new FakeFileHandle{FileName, it->second, 0, (DesiredAccess & GENERIC_WRITE) != 0};
+    }
+
+    if (CreationDisposition != CREATE_ALWAYS)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return INVALID_HANDLE_VALUE;
+    }
+
+    return new FakeFileHandle{FileName, {}, 0, TRUE};
+}
+
+BOOL
+ReadFile(HANDLE File, LPVOID Buffer, DWORD NumberOfBytesToRead, LPDWORD NumberOfBytesRead, LPOVERLAPPED)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+    FakeFileHandle *file = (FakeFileHandle *)File;
+    size_t count = (std::min)((size_t)NumberOfBytesToRead, file->Data.size() - file->Position);
+
+    g_FakeFileSystemStats.ReadCalls++;
+    g_FakeFileSystemStats.BytesRead += count;
+
+    std::memcpy(Buffer, file->Data.data() + file->Position, count);
+    file->Position += count;
+    *NumberOfBytesRead = (DWORD)count;
+
+    return TRUE;
+}
+
+BOOL
+WriteFile(HANDLE File, LPCVOID Buffer, DWORD NumberOfBytesToWrite, LPDWORD NumberOfBytesWritten, LPOVERLAPPED)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+    FakeFileHandle *file = (FakeFileHandle *)File;
+
+    g_FakeFileSystemStats.WriteCalls++;
+
+    if (!file->Write)
+    {
+        SetLastError(ERROR_ACCESS_DENIED);
+        return FALSE;
+    }
+
+    g_FakeFileSystemStats.BytesWritten += NumberOfBytesToWrite;
+
+    file->Data.resize((std::max)(file->Data.size(), file->Position + NumberOfBytesToWrite));
+    std::memcpy(file->Data.data() + file->Position, Buffer, NumberOfBytesToWrite);
+    file->Position += NumberOfBytesToWrite;
+    *NumberOfBytesWritten = NumberOfBytesToWrite;
+
+    return TRUE;
+}
+
+BOOL
+CloseHandle(HANDLE Object)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+    FakeFileHandle *file = (FakeFileHandle *)Object;
+
+    if (file == NULL || file == INVALID_HANDLE_VALUE)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    if (file->Write)
+    {
+        g_FakeFiles[file->Path] = std::move(file->Data);
+    }
+
+    delete file;
+    return TRUE;
+}
+
+BOOL
+DeleteFile(LPCWSTR FileName)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+
+    g_FakeFileSystemStats.DeleteCalls++;
+
+    if (g_FakeFiles.erase(FileName) == 0)
+    {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+
+    return TRUE;
+}
+
+BOOL
+MoveFileEx(LPCWSTR ExistingFileName, LPCWSTR NewFileName, DWORD Flags)
+{
+    std::lock_guard lock{g_FakeFileSystemLock};
+
+    g_FakeFileSystemStats.MoveCalls++;
+
+    auto it = g_FakeFiles.find(ExistingFileName);
+    if (it == g_FakeFiles.end())
+    {
+        SetLastError(ERROR_FILE_NOT_FOUND);
+        return FALSE;
+    }
+
+    if (!(Flags & MOVEFILE_REPLACE_EXISTING) && g_FakeFiles.count(NewFileName) != 0)
+    {
+        SetLastError(ERROR_ALREADY_EXISTS);
+        return FALSE;
+    }
+
+    std::vector<BYTE> data = std::move(it->second);
+    g_FakeFiles.erase(it);
+    g_FakeFiles[NewFileName] = std::move(data);
+
+    return TRUE;
+}
+
+BOOL
+CreateDirectory(LPCWSTR, LPSECURITY_ATTRIBUTES)
+{
+    // Directories are implied by the file paths
+    SetLastError(ERROR_ALREADY_EXISTS);
+    return FALSE;
+}
+
+DWORD
+ExpandEnvironmentStrings(LPCWSTR Source, LPWSTR Destination, DWORD Size)
+{
+    std::wstring expanded = Source;
+    std::wstring variable = L"%LOCALAPPDATA%";
+
+    for (size_t position; (position = expanded.find(variable)) != std::wstring::npos;)
+    {
+        expanded.replace(position, variable.length(), FAKE_LOCAL_APP_DATA);
+    }
+
+    if (expanded.length() + 1 > Size)
+    {
+        return (DWORD)expanded.length() + 1;
+    }
+
+    std::wmemcpy(Destination, expanded.c_str(), expanded.length() + 1);
+    return (DWORD)expanded.length() + 1;
+}
\ No newline at end of file
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// An in-memory file system behind the file functions of the off-device build. Files only become visible to
+// readers once closed, the same as the cache files the service writes are only renamed into place once
+// complete. Every call is counted.
+//
+
+#include <windows.h>
+#include <map>
+#include <string>
+#include <vector>
+
+struct FakeFileSystemStats
+{
+    uint64_t OpenCalls;
+    uint64_t ReadCalls;
+    uint64_t WriteCalls;
+    uint64_t MoveCalls;
+    uint64_t DeleteCalls;
+    uint64_t BytesRead;
+    uint64_t BytesWritten;
+};
+
+// Drops every file and clears the statistics
+VOID
+FakeFileSystemReset();
+
+FakeFileSystemStats
+FakeFileSystemGetStats();
+
+VOID
+FakeFileSystemResetStats();
+
+// The files by full path, %LOCALAPPDATA% expands to L"C:\\Users\\Test\\AppData\\Local"
+std::map<std::wstring, std::vector<BYTE>> &
+FakeFileSystemGetFiles();
\ No newline at end of file
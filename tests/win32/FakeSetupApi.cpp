@@ -0,0 +1,380 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include <SetupAPI.h>
+#include <Devpkey.h>
+#include "DeviceProperties.h"
+#include "FakeSetupApi.h"
+#include <cstring>
+#include <mutex>
+
+//
+// A device information set, the devnodes it holds are indexes into the device tree
+//
+struct FakeDeviceInfoSet
+{
+    std::vector<size_t> Members;
+    std::vector<DWORD> StateChanges;
+};
+
+static std::mutex g_FakeSetupApiLock;
+static std::vector<FakeDeviceNode> g_FakeDevices;
+static std::unordered_map<std::wstring, size_t> g_FakeInstanceIdIndex;
+static std::vector<FakeDeviceStateChange> g_FakeStateChanges;
+static FakeSetupApiStats g_FakeSetupApiStats{};
+
+static BOOLEAN
+IsSameKey(CONST DEVPROPKEY *Left, CONST DEVPROPKEY &Right)
+{
+    return std::memcmp(&Left->fmtid, &Right.fmtid, sizeof(GUID)) == 0 && Left->pid == Right.pid;
+}
+
+static BOOL
+CopyProperty(CONST std::vector<WCHAR> &Value, PBYTE Buffer, DWORD BufferSize, PDWORD RequiredSize)
+{
+    DWORD size = (DWORD)(Value.size() * sizeof(WCHAR));
+
+    if (RequiredSize != NULL)
+    {
+        *RequiredSize = size;
+    }
+
+    if (BufferSize < size || Buffer == NULL)
+    {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+
+    std::memcpy(Buffer, Value.data(), size);
+    return TRUE;
+}
+
+static std::wstring
+NormalizeInstanceId(std::wstring InstanceId)
+{
+    CharUpperBuff(InstanceId.data(), (DWORD)InstanceId.length());
+    return InstanceId;
+}
+
+//
+// Opening a devnode by instance id is a hashed lookup in the PnP manager, not a walk of the tree. The index is
+// rebuilt whenever a test added devnodes through FakeSetupApiGetDevices.
+//
+static std::optional<size_t>
+FindByInstanceId(CONST std::wstring &InstanceId)
+{
+    if (g_FakeInstanceIdIndex.size() != g_FakeDevices.size())
+    {
+        g_FakeInstanceIdIndex.clear();
+
+        for (size_t i = 0; i < g_FakeDevices.size(); i++)
+        {
+            g_FakeInstanceIdIndex.emplace(NormalizeInstanceId(g_FakeDevices[i].InstanceId), i);
+        }
+    }
+
+    auto it = g_FakeInstanceIdIndex.find(NormalizeInstanceId(InstanceId));
+    if (it == g_FakeInstanceIdIndex.end())
+    {
+        return std::nullopt;
+    }
+
+    return it->second;
+}
+
+static FakeDeviceNode *
+GetMember(HDEVINFO DeviceInfoSet, PSP_DEVINFO_DATA DeviceInfoData)
+{
+    if (DeviceInfoSet == INVALID_HANDLE_VALUE || DeviceInfoSet == NULL || DeviceInfoData == NULL ||
+        DeviceInfoData->DevInst >= g_FakeDevices.size())
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return nullptr;
+    }
+
+    return &g_FakeDevices[DeviceInfoData->DevInst];
+}
+
+VOID
+FakeSetupApiSetDevices(std::vector<FakeDeviceNode> Devices)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+
+    g_FakeDevices = std::move(Devices);
+    g_FakeInstanceIdIndex.clear();
+
+    // Index the tree up front rather than within whatever the first open is part of
+    FindByInstanceId(std::wstring{});
+    g_FakeStateChanges.clear();
+    g_FakeSetupApiStats = {};
+}
+
+std::vector<FakeDeviceNode> &
+FakeSetupApiGetDevices()
+{
+    return g_FakeDevices;
+}
+
+FakeSetupApiStats
+FakeSetupApiGetStats()
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    return g_FakeSetupApiStats;
+}
+
+VOID
+FakeSetupApiResetStats()
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    g_FakeSetupApiStats = {};
+}
+
+const std::vector<FakeDeviceStateChange> &
+FakeSetupApiGetStateChanges()
+{
+    return g_FakeStateChanges;
+}
+
+HDEVINFO
+SetupDiGetClassDevs(CONST GUID *, PCWSTR, HWND, DWORD Flags)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    FakeDeviceInfoSet *set = new FakeDeviceInfoSet{};
+
+    g_FakeSetupApiStats.DeviceListCalls++;
+
+    if (Flags & DIGCF_ALLCLASSES)
+    {
+        for (size_t i = 0; i < g_FakeDevices.size(); i++)
+        {
+            set->Members.push_back(i);
+        }
+    }
+
+    set->StateChanges.resize(set->Members.size());
+    return set;
+}
+
+HDEVINFO
+SetupDiCreateDeviceInfoList(CONST GUID *, HWND)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+
+    g_FakeSetupApiStats.DeviceListCalls++;
+    return new FakeDeviceInfoSet{};
+}
+
+BOOL
+SetupDiDestroyDeviceInfoList(HDEVINFO DeviceInfoSet)
+{
+    if (DeviceInfoSet == INVALID_HANDLE_VALUE || DeviceInfoSet == NULL)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    delete (FakeDeviceInfoSet *)DeviceInfoSet;
+    return TRUE;
+}
+
+BOOL
+SetupDiEnumDeviceInfo(HDEVINFO DeviceInfoSet, DWORD MemberIndex, PSP_DEVINFO_DATA DeviceInfoData)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    FakeDeviceInfoSet *set = (FakeDeviceInfoSet *)DeviceInfoSet;
+
+    g_FakeSetupApiStats.EnumCalls++;
+
+    if (MemberIndex >= set->Members.size())
+    {
+        SetLastError(ERROR_NO_MORE_ITEMS);
+        return FALSE;
+    }
+
+    DeviceInfoData->DevInst = (DWORD)set->Members[MemberIndex];
+    return TRUE;
+}
+
+BOOL
+SetupDiOpenDeviceInfo(HDEVINFO DeviceInfoSet, PCWSTR DeviceInstanceId, HWND, DWORD, PSP_DEVINFO_DATA DeviceInfoData)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    FakeDeviceInfoSet *set = (FakeDeviceInfoSet *)DeviceInfoSet;
+
+    g_FakeSetupApiStats.OpenCalls++;
+
+    std::optional<size_t> device = FindByInstanceId(DeviceInstanceId);
+    if (device)
+    {
+        set->Members.push_back(*device);
+        set->StateChanges.push_back(0);
+        DeviceInfoData->DevInst = (DWORD)*device;
+        return TRUE;
+    }
+
+    SetLastError(ERROR_NOT_FOUND);
+    return FALSE;
+}
+
+BOOL
+SetupDiGetDeviceProperty(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    CONST DEVPROPKEY *PropertyKey,
+    DEVPROPTYPE *,
+    PBYTE PropertyBuffer,
+    DWORD PropertyBufferSize,
+    PDWORD RequiredSize,
+    DWORD)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    std::vector<WCHAR> value;
+
+    g_FakeSetupApiStats.PropertyCalls++;
+
+    FakeDeviceNode *device = GetMember(DeviceInfoSet, DeviceInfoData);
+    if (device == nullptr)
+    {
+        return FALSE;
+    }
+
+    auto append = [&](const std::wstring &String) {
+        value.insert(value.end(), String.c_str(), String.c_str() + String.size() + 1);
+    };
+
+    if (IsSameKey(PropertyKey, DEVPKEY_Device_PanelId) && !device->PanelId.empty())
+    {
+        append(device->PanelId);
+    }
+    else if (IsSameKey(PropertyKey, DEVPKEY_Device_Driver) && !device->DriverKey.empty())
+    {
+        append(device->DriverKey);
+    }
+    else if (IsSameKey(PropertyKey, DEVPKEY_Device_HardwareIds) && !device->HardwareIds.empty())
+    {
+        for (const std::wstring &hardwareId : device->HardwareIds)
+        {
+            append(hardwareId);
+        }
+
+        value.push_back(L'\0');
+    }
+    else
+    {
+        SetLastError(ERROR_NOT_FOUND);
+        return FALSE;
+    }
+
+    return CopyProperty(value, PropertyBuffer, PropertyBufferSize, RequiredSize);
+}
+
+BOOL
+SetupDiGetDeviceInstanceId(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    PWSTR DeviceInstanceId,
+    DWORD DeviceInstanceIdSize,
+    PDWORD RequiredSize)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+
+    g_FakeSetupApiStats.InstanceIdCalls++;
+
+    FakeDeviceNode *device = GetMember(DeviceInfoSet, DeviceInfoData);
+    if (device == nullptr)
+    {
+        return FALSE;
+    }
+
+    if (RequiredSize != NULL)
+    {
+        *RequiredSize = (DWORD)device->InstanceId.size() + 1;
+    }
+
+    if (DeviceInstanceIdSize < device->InstanceId.size() + 1)
+    {
+        SetLastError(ERROR_INSUFFICIENT_BUFFER);
+        return FALSE;
+    }
+
+    std::wcscpy(DeviceInstanceId, device->InstanceId.c_str());
+    return TRUE;
+}
+
+BOOL
+SetupDiSetClassInstallParams(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    PSP_CLASSINSTALL_HEADER ClassInstallParams,
+    DWORD ClassInstallParamsSize)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    FakeDeviceInfoSet *set = (FakeDeviceInfoSet *)DeviceInfoSet;
+
+    if (GetMember(DeviceInfoSet, DeviceInfoData) == nullptr ||
+        ClassInstallParamsSize != sizeof(SP_PROPCHANGE_PARAMS) ||
+        ClassInstallParams->InstallFunction != DIF_PROPERTYCHANGE)
+    {
+        SetLastError(ERROR_INVALID_PARAMETER);
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < set->Members.size(); i++)
+    {
+        if (set->Members[i] == DeviceInfoData->DevInst)
+        {
+            set->StateChanges[i] = ((PSP_PROPCHANGE_PARAMS)ClassInstallParams)->StateChange;
+            return TRUE;
+        }
+    }
+
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+}
+
+BOOL
+SetupDiChangeState(HDEVINFO DeviceInfoSet, PSP_DEVINFO_DATA DeviceInfoData)
+{
+    std::lock_guard lock{g_FakeSetupApiLock};
+    FakeDeviceInfoSet *set = (FakeDeviceInfoSet *)DeviceInfoSet;
+
+    g_FakeSetupApiStats.ChangeStateCalls++;
+
+    FakeDeviceNode *device = GetMember(DeviceInfoSet, DeviceInfoData);
+    if (device == nullptr)
+    {
+        return FALSE;
+    }
+
+    for (size_t i = 0; i < set->Members.size(); i++)
+    {
+        if (set->Members[i] == DeviceInfoData->DevInst && set->StateChanges[i] != 0)
+        {
+            device->Enabled = set->StateChanges[i] == DICS_ENABLE;
+            g_FakeStateChanges.push_back(FakeDeviceStateChange{device->InstanceId, device->Enabled});
+            return TRUE;
+        }
+    }
+
+    SetLastError(ERROR_INVALID_PARAMETER);
+    return FALSE;
+}
\ No newline at end of file
@@ -0,0 +1,74 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The in-memory device tree behind the SetupDi functions of the off-device build. Every call is counted, so
+// tests can tell how many round trips a lookup or a transaction costs.
+//
+
+#include <SetupAPI.h>
+#include <string>
+#include <vector>
+
+struct FakeDeviceNode
+{
+    std::wstring InstanceId;
+    std::wstring DriverKey;
+    // Empty for the devnodes which are not bound to a panel
+    std::wstring PanelId;
+    std::vector<std::wstring> HardwareIds;
+    BOOLEAN Enabled;
+};
+
+struct FakeSetupApiStats
+{
+    uint64_t DeviceListCalls;
+    uint64_t EnumCalls;
+    uint64_t PropertyCalls;
+    uint64_t InstanceIdCalls;
+    uint64_t OpenCalls;
+    uint64_t ChangeStateCalls;
+};
+
+struct FakeDeviceStateChange
+{
+    std::wstring InstanceId;
+    BOOLEAN Enable;
+};
+
+// Replaces the device tree and clears the statistics and the state change log
+VOID
+FakeSetupApiSetDevices(std::vector<FakeDeviceNode> Devices);
+
+std::vector<FakeDeviceNode> &
+FakeSetupApiGetDevices();
+
+FakeSetupApiStats
+FakeSetupApiGetStats();
+
+VOID
+FakeSetupApiResetStats();
+
+// Every SetupDiChangeState call which went through, in order
+const std::vector<FakeDeviceStateChange> &
+FakeSetupApiGetStateChanges();
\ No newline at end of file
@@ -0,0 +1,116 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The device installation functions the device inventory and the device state transactions use, implemented by
+// FakeSetupApi.cpp over an in-memory device tree.
+//
+
+#include <windows.h>
+
+typedef HANDLE HDEVINFO;
+typedef ULONG DEVPROPTYPE;
+typedef DWORD DI_FUNCTION;
+
+typedef struct _DEVPROPKEY
+{
+    GUID fmtid;
+    ULONG pid;
+} DEVPROPKEY;
+
+typedef struct _SP_DEVINFO_DATA
+{
+    DWORD cbSize;
+    GUID ClassGuid;
+    DWORD DevInst;
+    ULONG_PTR Reserved;
+} SP_DEVINFO_DATA, *PSP_DEVINFO_DATA;
+
+typedef struct _SP_CLASSINSTALL_HEADER
+{
+    DWORD cbSize;
+    DI_FUNCTION InstallFunction;
+} SP_CLASSINSTALL_HEADER, *PSP_CLASSINSTALL_HEADER;
+
+typedef struct _SP_PROPCHANGE_PARAMS
+{
+    SP_CLASSINSTALL_HEADER ClassInstallHeader;
+    DWORD StateChange;
+    DWORD Scope;
+    DWORD HwProfile;
+} SP_PROPCHANGE_PARAMS, *PSP_PROPCHANGE_PARAMS;
+
+#define DIGCF_ALLCLASSES 0x00000004
+#define DIF_PROPERTYCHANGE 0x00000012
+#define DICS_ENABLE 0x00000001
+#define DICS_DISABLE 0x00000002
+#define DICS_FLAG_GLOBAL 0x00000001
+
+HDEVINFO
+SetupDiGetClassDevs(CONST GUID *ClassGuid, PCWSTR Enumerator, HWND Parent, DWORD Flags);
+
+HDEVINFO
+SetupDiCreateDeviceInfoList(CONST GUID *ClassGuid, HWND Parent);
+
+BOOL
+SetupDiDestroyDeviceInfoList(HDEVINFO DeviceInfoSet);
+
+BOOL
+SetupDiEnumDeviceInfo(HDEVINFO DeviceInfoSet, DWORD MemberIndex, PSP_DEVINFO_DATA DeviceInfoData);
+
+BOOL
+SetupDiOpenDeviceInfo(
+    HDEVINFO DeviceInfoSet,
+    PCWSTR DeviceInstanceId,
+    HWND Parent,
+    DWORD OpenFlags,
+    PSP_DEVINFO_DATA DeviceInfoData);
+
+BOOL
+SetupDiGetDeviceProperty(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    CONST DEVPROPKEY *PropertyKey,
+    DEVPROPTYPE *PropertyType,
+    PBYTE PropertyBuffer,
+    DWORD PropertyBufferSize,
+    PDWORD RequiredSize,
+    DWORD Flags);
+
+BOOL
+SetupDiGetDeviceInstanceId(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    PWSTR DeviceInstanceId,
+    DWORD DeviceInstanceIdSize,
+    PDWORD RequiredSize);
+
+BOOL
+SetupDiSetClassInstallParams(
+    HDEVINFO DeviceInfoSet,
+    PSP_DEVINFO_DATA DeviceInfoData,
+    PSP_CLASSINSTALL_HEADER ClassInstallParams,
+    DWORD ClassInstallParamsSize);
+
+BOOL
+SetupDiChangeState(HDEVINFO DeviceInfoSet, PSP_DEVINFO_DATA DeviceInfoData);
\ No newline at end of file
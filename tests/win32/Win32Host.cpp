@@ -0,0 +1,102 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#include "pch.h"
+#include "FakeTickCount.h"
+#include <chrono>
+#include <cwctype>
+
+static thread_local DWORD g_LastError = ERROR_SUCCESS;
+static std::atomic<ULONGLONG> g_TickCountOffset{0};
+
+DWORD
+GetLastError()
+{
+    return g_LastError;
+}
+
+VOID
+SetLastError(DWORD Error)
+{
+    g_LastError = Error;
+}
+
+DWORD
+CharUpperBuff(LPWSTR String, DWORD Length)
+{
+    for (DWORD i = 0; i < Length; i++)
+    {
+        String[i] = (WCHAR)std::towupper(String[i]);
+    }
+
+    return Length;
+}
+
+INT
+lstrcmp(LPCWSTR Left, LPCWSTR Right)
+{
+    return std::wcscmp(Left, Right);
+}
+
+INT
+lstrcmpi(LPCWSTR Left, LPCWSTR Right)
+{
+    for (;; Left++, Right++)
+    {
+        wint_t left = std::towupper(*Left);
+        wint_t right = std::towupper(*Right);
+
+        if (left != right || left == L'\0')
+        {
+            return left < right ? -1 : left > right ? 1 : 0;
+        }
+    }
+}
+
+BOOL
+QueryPerformanceCounter(LARGE_INTEGER *PerformanceCount)
+{
+    PerformanceCount->QuadPart = std::chrono::steady_clock::now().time_since_epoch().count();
+    return TRUE;
+}
+
+BOOL
+QueryPerformanceFrequency(LARGE_INTEGER *Frequency)
+{
+    Frequency->QuadPart = std::chrono::steady_clock::period::den / std::chrono::steady_clock::period::num;
+    return TRUE;
+}
+
+ULONGLONG
+GetTickCount64()
+{
+    ULONGLONG now = std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count();
+
+    return now + g_TickCountOffset.load();
+}
+
+VOID
+FakeTickCountAdvance(ULONGLONG Milliseconds)
+{
+    g_TickCountOffset += Milliseconds;
+}
\ No newline at end of file
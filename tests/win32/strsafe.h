@@ -0,0 +1,47 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+#include <windows.h>
+
+#define STRSAFE_E_INSUFFICIENT_BUFFER ((HRESULT)0x8007007AL)
+
+inline HRESULT
+StringCchCopy(LPWSTR Destination, size_t DestinationSize, LPCWSTR Source)
+{
+    size_t length = std::wcslen(Source);
+
+    if (DestinationSize == 0)
+    {
+        return ERROR_INVALID_PARAMETER;
+    }
+
+    if (length >= DestinationSize)
+    {
+        std::wmemcpy(Destination, Source, DestinationSize - 1);
+        Destination[DestinationSize - 1] = L'\0';
+        return STRSAFE_E_INSUFFICIENT_BUFFER;
+    }
+
+    std::wmemcpy(Destination, Source, length + 1);
+    return ERROR_SUCCESS;
+}
\ No newline at end of file
@@ -0,0 +1,469 @@
+/*
+ * Copyright (c) 2022-2023 The DuoWOA authors
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#pragma once
+
+//
+// The part of the Win32 API the service cores are written against, so that they build off-device. Types keep
+// their Windows sizes. The functions are implemented by Win32Host.cpp and the fakes next to it.
+//
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <cwchar>
+
+#define CONST const
+#define VOID void
+#define WINAPI
+#define CALLBACK
+#define EXTERN_C extern "C"
+#define DECLSPEC_SELECTANY __attribute__((weak))
+#define UNREFERENCED_PARAMETER(P) (void)(P)
+
+#define TRUE 1
+#define FALSE 0
+
+typedef uint8_t BYTE, *PBYTE;
+typedef uint8_t BOOLEAN;
+typedef int32_t BOOL;
+typedef uint16_t WORD, USHORT;
+typedef uint32_t DWORD, *PDWORD, *LPDWORD;
+typedef int32_t INT, LONG;
+typedef uint32_t UINT, UINT32, ULONG;
+typedef uint64_t ULONG64, ULONGLONG, UINT64;
+typedef uint16_t UINT16;
+typedef uintptr_t ULONG_PTR;
+typedef int32_t HRESULT;
+typedef wchar_t WCHAR, *PWSTR, *LPWSTR;
+typedef const wchar_t *PCWSTR, *LPCWSTR;
+typedef void *HANDLE, *HWND, *PVOID, *LPVOID;
+typedef intptr_t LONG_PTR, LRESULT, LPARAM;
+typedef uintptr_t WPARAM;
+typedef const void *LPCVOID;
+typedef int16_t SHORT;
+
+#define INVALID_HANDLE_VALUE ((HANDLE)(intptr_t)-1)
+
+#define MAXDWORD 0xffffffff
+#define INFINITE 0xFFFFFFFF
+
+#define ARRAYSIZE(A) (sizeof(A) / sizeof((A)[0]))
+#define MAX_PATH 260
+
+#ifndef min
+#define min(a, b) (((a) < (b)) ? (a) : (b))
+#endif
+
+#ifndef max
+#define max(a, b) (((a) > (b)) ? (a) : (b))
+#endif
+
+#define RtlZeroMemory(Destination, Length) std::memset((Destination), 0, (Length))
+
+typedef struct _GUID
+{
+    uint32_t Data1;
+    uint16_t Data2;
+    uint16_t Data3;
+    uint8_t Data4[8];
+} GUID;
+
+#define ERROR_SUCCESS 0L
+#define ERROR_FILE_NOT_FOUND 2L
+#define ERROR_ACCESS_DENIED 5L
+#define ERROR_INVALID_DATA 13L
+#define ERROR_SHARING_VIOLATION 32L
+#define ERROR_HANDLE_EOF 38L
+#define ERROR_ALREADY_EXISTS 183L
+#define ERROR_INVALID_PARAMETER 87L
+#define ERROR_INSUFFICIENT_BUFFER 122L
+#define ERROR_NO_MORE_ITEMS 259L
+#define ERROR_NOT_FOUND 1168L
+#define ERROR_GEN_FAILURE 31L
+#define ERROR_CANCELLED 1223L
+#define ERROR_TIMEOUT 1460L
+
+#define SUCCEEDED(Status) (((HRESULT)(Status)) >= 0)
+#define FAILED(Status) (((HRESULT)(Status)) < 0)
+
+inline HRESULT
+HRESULT_FROM_WIN32(DWORD Error)
+{
+    return (HRESULT)Error <= 0 ? (HRESULT)Error : (HRESULT)((Error & 0x0000FFFF) | (7 << 16) | 0x80000000);
+}
+
+typedef union _LARGE_INTEGER
+{
+    int64_t QuadPart;
+} LARGE_INTEGER;
+
+typedef struct _POINTL
+{
+    LONG x;
+    LONG y;
+} POINTL;
+
+typedef struct _devicemodeW
+{
+    WCHAR dmDeviceName[32];
+    WORD dmSpecVersion;
+    WORD dmDriverVersion;
+    WORD dmSize;
+    WORD dmDriverExtra;
+    DWORD dmFields;
+    POINTL dmPosition;
+    DWORD dmDisplayOrientation;
+    DWORD dmDisplayFixedOutput;
+    SHORT dmColor;
+    SHORT dmDuplex;
+    SHORT dmYResolution;
+    SHORT dmTTOption;
+    SHORT dmCollate;
+    WCHAR dmFormName[32];
+    WORD dmLogPixels;
+    DWORD dmBitsPerPel;
+    DWORD dmPelsWidth;
+    DWORD dmPelsHeight;
+    DWORD dmDisplayFlags;
+    DWORD dmDisplayFrequency;
+    DWORD dmICMMethod;
+    DWORD dmICMIntent;
+    DWORD dmMediaType;
+    DWORD dmDitherType;
+    DWORD dmReserved1;
+    DWORD dmReserved2;
+    DWORD dmPanningWidth;
+    DWORD dmPanningHeight;
+} DEVMODE, *PDEVMODE;
+
+#define DM_POSITION 0x00000020L
+#define DM_DISPLAYORIENTATION 0x00000080L
+#define DM_BITSPERPEL 0x00040000L
+#define DM_PELSWIDTH 0x00080000L
+#define DM_PELSHEIGHT 0x00100000L
+#define DM_DISPLAYFREQUENCY 0x00400000L
+
+#define DMDO_DEFAULT 0
+#define DMDO_90 1
+#define DMDO_180 2
+#define DMDO_270 3
+
+typedef struct _DISPLAY_DEVICEW
+{
+    DWORD cb;
+    WCHAR DeviceName[32];
+    WCHAR DeviceString[128];
+    DWORD StateFlags;
+    WCHAR DeviceID[128];
+    WCHAR DeviceKey[128];
+} DISPLAY_DEVICE, *PDISPLAY_DEVICE;
+
+#define DISPLAY_DEVICE_ATTACHED_TO_DESKTOP 0x00000001
+#define DISPLAY_DEVICE_PRIMARY_DEVICE 0x00000004
+
+#define ENUM_CURRENT_SETTINGS ((DWORD)-1)
+#define ENUM_REGISTRY_SETTINGS ((DWORD)-2)
+
+#define SM_CMONITORS 80
+
+#define WM_DISPLAYCHANGE 0x007E
+#define WM_DEVICECHANGE 0x0219
+
+typedef struct _LUID
+{
+    DWORD LowPart;
+    LONG HighPart;
+} LUID;
+
+typedef struct DISPLAYCONFIG_RATIONAL
+{
+    UINT32 Numerator;
+    UINT32 Denominator;
+} DISPLAYCONFIG_RATIONAL;
+
+typedef enum
+{
+    DISPLAYCONFIG_OUTPUT_TECHNOLOGY_HDMI = 5,
+    DISPLAYCONFIG_OUTPUT_TECHNOLOGY_INTERNAL = (int)0x80000000
+} DISPLAYCONFIG_VIDEO_OUTPUT_TECHNOLOGY;
+
+typedef enum
+{
+    DISPLAYCONFIG_SCANLINE_ORDERING_UNSPECIFIED = 0,
+    DISPLAYCONFIG_SCANLINE_ORDERING_PROGRESSIVE = 1
+} DISPLAYCONFIG_SCANLINE_ORDERING;
+
+typedef enum
+{
+    DISPLAYCONFIG_SCALING_IDENTITY = 1,
+    DISPLAYCONFIG_SCALING_PREFERRED = 128
+} DISPLAYCONFIG_SCALING;
+
+typedef enum
+{
+    DISPLAYCONFIG_ROTATION_IDENTITY = 1,
+    DISPLAYCONFIG_ROTATION_ROTATE90 = 2,
+    DISPLAYCONFIG_ROTATION_ROTATE180 = 3,
+    DISPLAYCONFIG_ROTATION_ROTATE270 = 4
+} DISPLAYCONFIG_ROTATION;
+
+typedef enum
+{
+    DISPLAYCONFIG_MODE_INFO_TYPE_SOURCE = 1,
+    DISPLAYCONFIG_MODE_INFO_TYPE_TARGET = 2
+} DISPLAYCONFIG_MODE_INFO_TYPE;
+
+typedef enum
+{
+    DISPLAYCONFIG_PIXELFORMAT_32BPP = 4
+} DISPLAYCONFIG_PIXELFORMAT;
+
+typedef struct DISPLAYCONFIG_2DREGION
+{
+    UINT32 cx;
+    UINT32 cy;
+} DISPLAYCONFIG_2DREGION;
+
+typedef struct DISPLAYCONFIG_VIDEO_SIGNAL_INFO
+{
+    UINT64 pixelRate;
+    DISPLAYCONFIG_RATIONAL hSyncFreq;
+    DISPLAYCONFIG_RATIONAL vSyncFreq;
+    DISPLAYCONFIG_2DREGION activeSize;
+    DISPLAYCONFIG_2DREGION totalSize;
+    UINT32 videoStandard;
+    DISPLAYCONFIG_SCANLINE_ORDERING scanLineOrdering;
+} DISPLAYCONFIG_VIDEO_SIGNAL_INFO;
+
+typedef struct DISPLAYCONFIG_TARGET_MODE
+{
+    DISPLAYCONFIG_VIDEO_SIGNAL_INFO targetVideoSignalInfo;
+} DISPLAYCONFIG_TARGET_MODE;
+
+typedef struct DISPLAYCONFIG_SOURCE_MODE
+{
+    UINT32 width;
+    UINT32 height;
+    DISPLAYCONFIG_PIXELFORMAT pixelFormat;
+    POINTL position;
+} DISPLAYCONFIG_SOURCE_MODE;
+
+typedef struct DISPLAYCONFIG_MODE_INFO
+{
+    DISPLAYCONFIG_MODE_INFO_TYPE infoType;
+    UINT32 id;
+    LUID adapterId;
+    union
+    {
+        DISPLAYCONFIG_TARGET_MODE targetMode;
+        DISPLAYCONFIG_SOURCE_MODE sourceMode;
+    };
+} DISPLAYCONFIG_MODE_INFO;
+
+typedef struct DISPLAYCONFIG_PATH_SOURCE_INFO
+{
+    LUID adapterId;
+    UINT32 id;
+    UINT32 modeInfoIdx;
+    UINT32 statusFlags;
+} DISPLAYCONFIG_PATH_SOURCE_INFO;
+
+typedef struct DISPLAYCONFIG_PATH_TARGET_INFO
+{
+    LUID adapterId;
+    UINT32 id;
+    UINT32 modeInfoIdx;
+    DISPLAYCONFIG_VIDEO_OUTPUT_TECHNOLOGY outputTechnology;
+    DISPLAYCONFIG_ROTATION rotation;
+    DISPLAYCONFIG_SCALING scaling;
+    DISPLAYCONFIG_RATIONAL refreshRate;
+    DISPLAYCONFIG_SCANLINE_ORDERING scanLineOrdering;
+    BOOL targetAvailable;
+    UINT32 statusFlags;
+} DISPLAYCONFIG_PATH_TARGET_INFO;
+
+typedef struct DISPLAYCONFIG_PATH_INFO
+{
+    DISPLAYCONFIG_PATH_SOURCE_INFO sourceInfo;
+    DISPLAYCONFIG_PATH_TARGET_INFO targetInfo;
+    UINT32 flags;
+} DISPLAYCONFIG_PATH_INFO;
+
+typedef enum
+{
+    DISPLAYCONFIG_DEVICE_INFO_GET_SOURCE_NAME = 1,
+    DISPLAYCONFIG_DEVICE_INFO_GET_TARGET_NAME = 2
+} DISPLAYCONFIG_DEVICE_INFO_TYPE;
+
+typedef struct DISPLAYCONFIG_DEVICE_INFO_HEADER
+{
+    DISPLAYCONFIG_DEVICE_INFO_TYPE type;
+    UINT32 size;
+    LUID adapterId;
+    UINT32 id;
+} DISPLAYCONFIG_DEVICE_INFO_HEADER;
+
+typedef struct DISPLAYCONFIG_SOURCE_DEVICE_NAME
+{
+    DISPLAYCONFIG_DEVICE_INFO_HEADER header;
+    WCHAR viewGdiDeviceName[32];
+} DISPLAYCONFIG_SOURCE_DEVICE_NAME;
+
+typedef struct DISPLAYCONFIG_TARGET_DEVICE_NAME
+{
+    DISPLAYCONFIG_DEVICE_INFO_HEADER header;
+    UINT32 flags;
+    DISPLAYCONFIG_VIDEO_OUTPUT_TECHNOLOGY outputTechnology;
+    UINT16 edidManufactureId;
+    UINT16 edidProductCodeId;
+    UINT32 connectorInstance;
+    WCHAR monitorFriendlyDeviceName[64];
+    WCHAR monitorDevicePath[128];
+} DISPLAYCONFIG_TARGET_DEVICE_NAME;
+
+typedef enum
+{
+    DISPLAYCONFIG_TOPOLOGY_INTERNAL = 1,
+    DISPLAYCONFIG_TOPOLOGY_EXTEND = 4
+} DISPLAYCONFIG_TOPOLOGY_ID;
+
+#define DISPLAYCONFIG_PATH_ACTIVE 0x00000001
+#define DISPLAYCONFIG_PATH_MODE_IDX_INVALID 0xffffffff
+
+#define QDC_ALL_PATHS 0x00000001
+#define QDC_ONLY_ACTIVE_PATHS 0x00000002
+
+#define SDC_TOPOLOGY_EXTEND 0x00000004
+#define SDC_USE_SUPPLIED_DISPLAY_CONFIG 0x00000020
+#define SDC_VALIDATE 0x00000040
+#define SDC_APPLY 0x00000080
+#define SDC_SAVE_TO_DATABASE 0x00000200
+#define SDC_ALLOW_CHANGES 0x00000400
+#define SDC_PATH_PERSIST_IF_REQUIRED 0x00000800
+
+#define GENERIC_READ 0x80000000L
+#define GENERIC_WRITE 0x40000000L
+#define FILE_SHARE_READ 0x00000001
+#define CREATE_ALWAYS 2
+#define OPEN_EXISTING 3
+#define FILE_ATTRIBUTE_NORMAL 0x00000080
+#define MOVEFILE_REPLACE_EXISTING 0x00000001
+
+typedef struct _SECURITY_ATTRIBUTES *LPSECURITY_ATTRIBUTES;
+typedef struct _OVERLAPPED *LPOVERLAPPED;
+
+DWORD
+GetLastError();
+
+VOID
+SetLastError(DWORD Error);
+
+DWORD
+CharUpperBuff(LPWSTR String, DWORD Length);
+
+INT
+lstrcmp(LPCWSTR Left, LPCWSTR Right);
+
+INT
+lstrcmpi(LPCWSTR Left, LPCWSTR Right);
+
+BOOL
+CloseHandle(HANDLE Object);
+
+BOOL
+QueryPerformanceCounter(LARGE_INTEGER *PerformanceCount);
+
+BOOL
+QueryPerformanceFrequency(LARGE_INTEGER *Frequency);
+
+// Moves with the steady clock, FakeTickCount.h can move it further
+ULONGLONG
+GetTickCount64();
+
+// The file functions are provided by FakeFileSystem.cpp
+HANDLE
+CreateFile(
+    LPCWSTR FileName,
+    DWORD DesiredAccess,
+    DWORD ShareMode,
+    LPSECURITY_ATTRIBUTES SecurityAttributes,
+    DWORD CreationDisposition,
+    DWORD FlagsAndAttributes,
+    HANDLE TemplateFile);
+
+BOOL
+ReadFile(HANDLE File, LPVOID Buffer, DWORD NumberOfBytesToRead, LPDWORD NumberOfBytesRead, LPOVERLAPPED Overlapped);
+
+BOOL
+WriteFile(
+    HANDLE File,
+    LPCVOID Buffer,
+    DWORD NumberOfBytesToWrite,
+    LPDWORD NumberOfBytesWritten,
+    LPOVERLAPPED Overlapped);
+
+BOOL
+DeleteFile(LPCWSTR FileName);
+
+BOOL
+MoveFileEx(LPCWSTR ExistingFileName, LPCWSTR NewFileName, DWORD Flags);
+
+BOOL
+CreateDirectory(LPCWSTR PathName, LPSECURITY_ATTRIBUTES SecurityAttributes);
+
+DWORD
+ExpandEnvironmentStrings(LPCWSTR Source, LPWSTR Destination, DWORD Size);
+
+// The display functions are provided by FakeDisplayDevices.cpp
+BOOL
+EnumDisplayDevices(LPCWSTR Device, DWORD DevNum, PDISPLAY_DEVICE DisplayDevice, DWORD Flags);
+
+BOOL
+EnumDisplaySettings(LPCWSTR DeviceName, DWORD ModeNum, PDEVMODE DevMode);
+
+// Only SM_CMONITORS is known, the attached adapters
+INT
+GetSystemMetrics(INT Index);
+
+// The display configuration functions are provided by FakeDisplayConfig.cpp
+LONG
+GetDisplayConfigBufferSizes(UINT32 Flags, UINT32 *NumPathArrayElements, UINT32 *NumModeInfoArrayElements);
+
+LONG
+QueryDisplayConfig(
+    UINT32 Flags,
+    UINT32 *NumPathArrayElements,
+    DISPLAYCONFIG_PATH_INFO *PathArray,
+    UINT32 *NumModeInfoArrayElements,
+    DISPLAYCONFIG_MODE_INFO *ModeInfoArray,
+    DISPLAYCONFIG_TOPOLOGY_ID *CurrentTopologyId);
+
+LONG
+DisplayConfigGetDeviceInfo(DISPLAYCONFIG_DEVICE_INFO_HEADER *RequestPacket);
+
+LONG
+SetDisplayConfig(
+    UINT32 NumPathArrayElements,
+    DISPLAYCONFIG_PATH_INFO *PathArray,
+    UINT32 NumModeInfoArrayElements,
+    DISPLAYCONFIG_MODE_INFO *ModeInfoArray,
+    UINT32 Flags);
\ No newline at end of file